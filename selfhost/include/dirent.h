@@ -0,0 +1,29 @@
+#ifndef LLVM7_DIRENT_H
+#define LLVM7_DIRENT_H
+
+typedef struct DIR DIR;
+
+#ifdef __APPLE__
+struct dirent {
+    unsigned long d_ino;
+    unsigned long d_seekoff;
+    unsigned short d_reclen;
+    unsigned short d_namlen;
+    unsigned char d_type;
+    char d_name[1024];
+};
+#else
+struct dirent {
+    unsigned long d_ino;
+    long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[256];
+};
+#endif
+
+DIR* opendir(const char* name);
+struct dirent* readdir(DIR* dirp);
+int closedir(DIR* dirp);
+
+#endif /* LLVM7_DIRENT_H */
@@ -0,0 +1,8 @@
+#ifndef _FCNTL_H_
+#define _FCNTL_H_
+
+#define O_RDONLY 0
+
+int open(const char* path, int flags, ...);
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef LLVM7_PTHREAD_H
+#define LLVM7_PTHREAD_H
+
+#include <stddef.h>
+
+// Opaque handle; an unsigned long (Linux) or pointer (macOS), both 64-bit
+typedef unsigned long pthread_t;
+
+// start_routine is declared as void* because function pointer parameter
+// types are not supported; pass the function name directly.
+int pthread_create(pthread_t* thread, const void* attr, void* start_routine,
+                   void* arg);
+int pthread_join(pthread_t thread, void** retval);
+
+#endif /* LLVM7_PTHREAD_H */
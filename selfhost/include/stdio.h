@@ -1,4 +1,7 @@
 /* Minimal stdio.h for selfhost */
+#ifndef LLVM7_STDIO_H
+#define LLVM7_STDIO_H
+
 typedef struct {
     int fd;
 } FILE;
@@ -30,3 +33,5 @@ int fseek(FILE* file, long offset, int whence);
 long ftell(FILE* file);
 size_t fread(void* ptr, size_t size, size_t count, FILE* stream);
 int fflush(FILE* stream);
+
+#endif
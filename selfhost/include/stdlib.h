@@ -5,6 +5,8 @@ void free(void* ptr);
 void exit(int status);
 long strtol(char* str, char** endptr, int base);
 double strtod(const char *nptr, char **endptr);
+float strtof(const char *nptr, char **endptr);
 unsigned long long strtoull(const char *nptr, char **endptr, int base);
 char *getenv(const char *name);
 void *realloc(void *ptr, size_t size);
+char *realpath(const char *path, char *resolved_path);
@@ -9,3 +9,7 @@ size_t strlen(char* s);
 char* strdup(char* s);
 char* strstr(char* haystack, char* needle);
 char* strchr(char* s, int c);
+void* memchr(void* s, int c, size_t n);
+size_t strspn(char* s, char* accept);
+size_t strcspn(char* s, char* reject);
+char* strrchr(char* s, int c);
@@ -0,0 +1,55 @@
+#ifndef LLVM7_SYS_STAT_H
+#define LLVM7_SYS_STAT_H
+
+#include <sys/types.h>
+#include <time.h>
+
+#ifdef __APPLE__
+struct stat {
+    int st_dev;
+    unsigned short st_mode;
+    unsigned short st_nlink;
+    unsigned long st_ino;
+    unsigned int st_uid;
+    unsigned int st_gid;
+    int st_rdev;
+    struct timespec st_atimespec;
+    struct timespec st_mtimespec;
+    struct timespec st_ctimespec;
+    struct timespec st_birthtimespec;
+    off_t st_size;
+    long st_blocks;
+    int st_blksize;
+    unsigned int st_flags;
+    unsigned int st_gen;
+    int st_lspare;
+    long st_qspare0;
+    long st_qspare1;
+};
+#define st_mtime st_mtimespec.tv_sec
+#else
+struct stat {
+    unsigned long st_dev;
+    unsigned long st_ino;
+    unsigned long st_nlink;
+    unsigned int st_mode;
+    unsigned int st_uid;
+    unsigned int st_gid;
+    int st_pad0;
+    unsigned long st_rdev;
+    off_t st_size;
+    long st_blksize;
+    long st_blocks;
+    struct timespec st_atim;
+    struct timespec st_mtim;
+    struct timespec st_ctim;
+    long st_reserved0;
+    long st_reserved1;
+    long st_reserved2;
+};
+#define st_mtime st_mtim.tv_sec
+#endif
+
+int stat(const char* path, struct stat* buf);
+
+#endif /* LLVM7_SYS_STAT_H */
@@ -2,5 +2,6 @@
 #define LLVM7_SYS_TYPES_H
 
 typedef long ssize_t;
+typedef long off_t;
 
 #endif /* LLVM7_SYS_TYPES_H */
@@ -2,6 +2,20 @@
 #define _TIME_H_
 
 typedef long time_t;
+typedef long clock_t;
+
+#define CLOCKS_PER_SEC 1000000
+
+#ifdef __APPLE__
+#define CLOCK_MONOTONIC 6
+#else
+#define CLOCK_MONOTONIC 1
+#endif
+
+struct timespec {
+    time_t tv_sec;
+    long tv_nsec;
+};
 
 struct tm {
     int tm_sec;
@@ -23,5 +37,7 @@ size_t strftime(char *restrict s, size_t maxsize,
                 const char *restrict format,
                 const struct tm *restrict timeptr);
 char *ctime(const time_t *timer);
+clock_t clock(void);
+int clock_gettime(int clock_id, struct timespec *tp);
 
 #endif
@@ -0,0 +1,26 @@
+#ifndef _UNISTD_H_
+#define _UNISTD_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifndef SEEK_SET
+#define SEEK_SET 0
+#endif
+#ifndef SEEK_END
+#define SEEK_END 2
+#endif
+
+#ifdef __APPLE__
+#define _SC_NPROCESSORS_ONLN 58
+#else
+#define _SC_NPROCESSORS_ONLN 84
+#endif
+
+ssize_t read(int fd, void* buf, size_t count);
+int close(int fd);
+off_t lseek(int fd, off_t offset, int whence);
+int getpagesize(void);
+long sysconf(int name);
+
+#endif
@@ -0,0 +1,136 @@
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_CHUNK_SIZE 65536
+
+// Arena used by ast_alloc(); selected by the compilation driver
+static Arena* active_arena = NULL;
+// Used when no arena has been selected (e.g. unit tests)
+static Arena* fallback_arena = NULL;
+
+static ArenaChunk* new_chunk(size_t size) {
+    ArenaChunk* chunk = malloc(sizeof(ArenaChunk) + size);
+    if (!chunk) {
+        perror("malloc");
+        exit(1);
+    }
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+/**
+ * Allocate zero-initialized memory from an arena
+ *
+ * @param[in] arena Arena to allocate from
+ * @param[in] size Number of bytes
+ * @return Pointer to 8-byte aligned memory valid until arena_free()
+ */
+void* arena_alloc(Arena* arena, size_t size) {
+    size = (size + 7) & ~(size_t)7;
+    ArenaChunk* chunk = arena->chunks;
+    if (!chunk || chunk->used + size > chunk->size) {
+        if (size > ARENA_CHUNK_SIZE / 4) {
+            // Large request: give it its own chunk behind the current one so
+            // the space left in the current chunk is not wasted
+            ArenaChunk* big = new_chunk(size);
+            big->used = size;
+            if (chunk) {
+                big->next = chunk->next;
+                chunk->next = big;
+            } else {
+                arena->chunks = big;
+            }
+            char* mem = (char*)(big + 1);
+            memset(mem, 0, size);
+            return mem;
+        }
+        chunk = new_chunk(ARENA_CHUNK_SIZE);
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+    char* mem = (char*)(chunk + 1) + chunk->used;
+    chunk->used += size;
+    memset(mem, 0, size);
+    return mem;
+}
+
+/**
+ * Release every allocation made from an arena
+ *
+ * The arena is left empty and can be reused.
+ *
+ * @param[in] arena Arena to release
+ */
+void arena_free(Arena* arena) {
+    ArenaChunk* chunk = arena->chunks;
+    while (chunk) {
+        ArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->chunks = NULL;
+}
+
+/**
+ * Select the arena used by ast_alloc()
+ *
+ * @param[in] arena Arena owning the current compilation, or NULL
+ */
+void arena_use(Arena* arena) { active_arena = arena; }
+
+static Arena* current_arena(void) {
+    if (active_arena) {
+        return active_arena;
+    }
+    if (!fallback_arena) {
+        fallback_arena = calloc(1, sizeof(Arena));
+        if (!fallback_arena) {
+            perror("calloc");
+            exit(1);
+        }
+    }
+    return fallback_arena;
+}
+
+/**
+ * Move every allocation of an arena into the one used by ast_alloc()
+ *
+ * Lets storage built in a private arena (e.g. by a worker thread) live as
+ * long as the current compilation. The chunks go behind the current chunk
+ * so that its free space is still used.
+ *
+ * @param[in] arena Arena to empty; left reusable
+ */
+void ast_adopt(Arena* arena) {
+    ArenaChunk* first = arena->chunks;
+    if (!first) {
+        return;
+    }
+    ArenaChunk* last = first;
+    while (last->next) {
+        last = last->next;
+    }
+    Arena* dst = current_arena();
+    if (dst->chunks) {
+        last->next = dst->chunks->next;
+        dst->chunks->next = first;
+    } else {
+        dst->chunks = first;
+    }
+    arena->chunks = NULL;
+}
+
+/**
+ * Allocate zero-initialized front-end storage (nodes, types, symbols)
+ *
+ * @param[in] size Number of bytes
+ * @return Pointer to memory owned by the active arena
+ */
+void* ast_alloc(size_t size) {
+    return arena_alloc(current_arena(), size);
+}
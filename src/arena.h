@@ -0,0 +1,12 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include "common.h"
+
+extern void* arena_alloc(Arena* arena, size_t size);
+extern void arena_free(Arena* arena);
+extern void arena_use(Arena* arena);
+extern void* ast_alloc(size_t size);
+extern void ast_adopt(Arena* arena);
+
+#endif
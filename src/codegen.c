@@ -1,5 +1,9 @@
 #include "codegen.h"
+#include "arena.h"
+#include "intern.h"
 #include "parse.h"
+#include "type.h"
+#include "variable.h"
 #include <llvm-c/Analysis.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -24,14 +28,16 @@ struct LabelEntry {
     LabelEntry* next;
     const char* name;
     int len;
+    int sym;
     LLVMBasicBlockRef bb;
 };
 
 static LLVMBasicBlockRef get_or_create_label_bb(Context* ctx, LLVMValueRef func,
                                                 Token* tok) {
     LabelEntry* head = (LabelEntry*)ctx->current_label_map;
+    int sym = tok_sym(tok);
     for (LabelEntry* e = head; e; e = e->next) {
-        if (e->len == tok->len && strncmp(e->name, tok->str, tok->len) == 0) {
+        if (e->sym == sym) {
             return e->bb;
         }
     }
@@ -42,6 +48,7 @@ static LLVMBasicBlockRef get_or_create_label_bb(Context* ctx, LLVMValueRef func,
     }
     e->name = tok->str;
     e->len = tok->len;
+    e->sym = sym;
     e->bb = LLVMAppendBasicBlockInContext(get_llvm_context(), func, "label");
     e->next = head;
     ctx->current_label_map = e;
@@ -97,45 +104,6 @@ static LLVMTypeRef ty_void(void) {
     return LLVMVoidTypeInContext(get_llvm_context());
 }
 
-static int codegen_type_size(Type* ty) {
-    if (!ty)
-        return 4;
-    if (ty->array_size > 0)
-        return codegen_type_size(ty->ptr_to) * (int)ty->array_size;
-    switch (ty->ty) {
-    case CHAR:
-    case BOOL:
-        return 1;
-    case SHORT:
-        return 2;
-    case INT:
-    case FLOAT:
-        return 4;
-    case LONG:
-    case LONGLONG:
-    case DOUBLE:
-    case PTR:
-        return 8;
-    case STRUCT: {
-        int size = 0;
-        for (Member* m = ty->members; m; m = m->next)
-            size += codegen_type_size(m->type);
-        return size > 0 ? size : 1;
-    }
-    case UNION: {
-        int max_size = 1;
-        for (Member* m = ty->members; m; m = m->next) {
-            int s = codegen_type_size(m->type);
-            if (s > max_size)
-                max_size = s;
-        }
-        return max_size;
-    }
-    default:
-        return 4;
-    }
-}
-
 /**
  * Converts Type to LLVMTypeRef
  */
@@ -205,13 +173,15 @@ static LLVMTypeRef to_llvm_type(Type* ty) {
         Type* largest = NULL;
         int max_size = 0;
         for (Member* m = ty->members; m; m = m->next) {
-            int s = codegen_type_size(m->type);
+            int s = type_size(m->type);
             if (s > max_size) {
                 max_size = s;
                 largest = m->type;
             }
         }
-        LLVMTypeRef elem = largest ? to_llvm_type(largest) : ty_i32();
+        LLVMTypeRef elem = ty_i32();
+        if (largest)
+            elem = to_llvm_type(largest);
         LLVMStructSetBody(named_union, &elem, 1, false);
         return named_union;
     }
@@ -367,6 +337,12 @@ static LLVMValueRef cast_value(LLVMBuilderRef builder, LLVMValueRef val,
     return val;
 }
 
+// Whether an ND_NUM node's value lives in uval rather than val
+static bool num_uses_uval(Node* node) {
+    return node->type && (node->type->is_unsigned || node->type->ty == LONG ||
+                          node->type->ty == LONGLONG);
+}
+
 static bool eval_const_int(Node* node, long long* out) {
     if (!node) {
         return false;
@@ -376,11 +352,9 @@ static bool eval_const_int(Node* node, long long* out) {
     long long rhs = 0;
     switch (node->kind) {
     case ND_NUM:
-        // Honor the literal's signedness: an unsigned literal such as
-        // 0xFFFFFFFFU keeps its bit pattern in node->uval, while node->val
-        // is a clamped signed int and would lose the high bit.
-        *out = (node->type && node->type->is_unsigned) ? (long long)node->uval
-                                                       : node->val;
+        // Unsigned and 64-bit literals keep their full bit pattern in
+        // node->u.uval; node->val only holds the low 32 bits.
+        *out = num_uses_uval(node) ? (long long)node->u.uval : node->val;
         return true;
     case ND_CAST:
         return eval_const_int(node->lhs, out);
@@ -534,8 +508,8 @@ static LLVMValueRef codegen_constant(Node* node, LLVMModuleRef module) {
     }
 
     if (node->kind == ND_NUM) {
-        if (node->type && node->type->is_unsigned) {
-            return LLVMConstInt(to_llvm_type(node->type), node->uval, 0);
+        if (num_uses_uval(node)) {
+            return LLVMConstInt(to_llvm_type(node->type), node->u.uval, 0);
         }
         return LLVMConstInt(to_llvm_type(node->type), node->val, 1);
     }
@@ -584,7 +558,51 @@ static LLVMValueRef codegen_constant(Node* node, LLVMModuleRef module) {
     return LLVMConstNull(to_llvm_type(node->type));
 }
 
+/**
+ * Find a function already added to the module
+ *
+ * Results are kept in ctx->functions, next to the parser's entry for the
+ * name, so a call site costs one lookup by symbol id.
+ *
+ * @param[in,out] ctx Compilation context
+ * @param[in] module Module being generated
+ * @param[in] tok Name of the function
+ * @param[in] func_name Name of the function in the module
+ * @return The function, or NULL if it has not been added
+ */
+static LLVMValueRef module_function(Context* ctx, LLVMModuleRef module,
+                                    Token* tok, const char* func_name) {
+    int sym = tok_sym(tok);
+    FuncEntry* entry = find_function(ctx, sym);
+    if (entry && entry->llvm_func)
+        return entry->llvm_func;
+    // Built-in declarations are only known to the module
+    LLVMValueRef func = LLVMGetNamedFunction(module, func_name);
+    if (func) {
+        entry = add_function(ctx, sym);
+        entry->llvm_func = func;
+    }
+    return func;
+}
+
+// Add a function to the module and remember it for module_function()
+static LLVMValueRef add_module_function(Context* ctx, LLVMModuleRef module,
+                                        Token* tok, const char* func_name,
+                                        LLVMTypeRef func_type) {
+    LLVMValueRef func = LLVMAddFunction(module, func_name, func_type);
+    FuncEntry* entry = add_function(ctx, tok_sym(tok));
+    entry->llvm_func = func;
+    return func;
+}
+
 LLVMModuleRef generate_module(Context* ctx) {
+    // Functions of a module generated earlier from this context are gone
+    for (int i = 0; i < ctx->functions.cap; i++) {
+        FuncEntry* entry = ctx->functions.slots[i].value;
+        if (entry)
+            entry->llvm_func = NULL;
+    }
+
     // Create a new LLVM module with specified name
     LLVMModuleRef module =
         LLVMModuleCreateWithNameInContext(MODULE_NAME, get_llvm_context());
@@ -775,9 +793,11 @@ LLVMModuleRef generate_module(Context* ctx) {
         LLVMTypeRef func_type = LLVMFunctionType(
             ret_type, param_types, param_count, is_variadic ? 1 : 0);
 
-        LLVMValueRef func = LLVMGetNamedFunction(module, func_name);
+        LLVMValueRef func =
+            module_function(ctx, module, func_node->tok, func_name);
         if (!func) {
-            func = LLVMAddFunction(module, func_name, func_type);
+            func = add_module_function(ctx, module, func_node->tok, func_name,
+                                       func_type);
         }
 
         // Apply inline semantics
@@ -822,9 +842,19 @@ LLVMModuleRef generate_module(Context* ctx) {
         LLVMPositionBuilderAtEnd(builder, entry);
         ctx->current_label_map = NULL;
 
-        // Local variable space per function
-        LLVMValueRef local_allocas[MAX_LOCALS];
-        memset(local_allocas, 0, sizeof(local_allocas));
+        // Local variable space per function, one slot per local
+        int local_count = 0;
+        for (LVar* var = func_node->u.locals; var; var = var->next) {
+            if (var->offset >= local_count)
+                local_count = var->offset + 1;
+        }
+        ctx->current_local_count = local_count;
+        LLVMValueRef* local_allocas =
+            calloc((size_t)local_count + 1, sizeof(LLVMValueRef));
+        if (!local_allocas) {
+            perror("calloc");
+            exit(1);
+        }
 
         // Create __func__ string constant for this function
         char func_name_var[64];
@@ -851,17 +881,15 @@ LLVMModuleRef generate_module(Context* ctx) {
             free(func_name_data);
         }
 
-        LVar* var = func_node->locals;
+        LVar* var = func_node->u.locals;
         while (var) {
-            if (var->offset < MAX_LOCALS) {
-                char var_name[64];
-                int len = var->len < 63 ? var->len : 63;
-                strncpy(var_name, var->name, len);
-                var_name[len] = '\0';
-                LLVMTypeRef var_type = to_llvm_type(var->type);
-                local_allocas[var->offset] =
-                    LLVMBuildAlloca(builder, var_type, var_name);
-            }
+            char var_name[64];
+            int len = var->len < 63 ? var->len : 63;
+            strncpy(var_name, var->name, len);
+            var_name[len] = '\0';
+            LLVMTypeRef var_type = to_llvm_type(var->type);
+            local_allocas[var->offset] =
+                LLVMBuildAlloca(builder, var_type, var_name);
             var = var->next;
         }
 
@@ -869,7 +897,7 @@ LLVMModuleRef generate_module(Context* ctx) {
         param = func_node->rhs;
         for (int i = 0; i < param_count; i++) {
             LLVMValueRef arg = LLVMGetParam(func, i);
-            if (param->val < MAX_LOCALS && local_allocas[param->val]) {
+            if (param->val < local_count && local_allocas[param->val]) {
                 LLVMBuildStore(builder, arg, local_allocas[param->val]);
             }
             param = param->next;
@@ -907,12 +935,15 @@ LLVMModuleRef generate_module(Context* ctx) {
             }
         }
         free_label_map(ctx);
+        free(local_allocas);
     }
 
     // Verify generated module
     char* error = NULL;
     if (LLVMVerifyModule(module, LLVMReturnStatusAction, &error)) {
         fprintf(stderr, "LLVM IR verification failed: %s\n", error);
+    }
+    if (error) {
         LLVMDisposeMessage(error);
     }
 
@@ -956,16 +987,16 @@ static LLVMValueRef codegen(Context* ctx, Node* node, LLVMBuilderRef builder,
 
     switch (node->kind) {
     case ND_NUM: {
-        if (node->type && node->type->is_unsigned) {
-            return LLVMConstInt(to_llvm_type(node->type), node->uval, 0);
+        if (num_uses_uval(node)) {
+            return LLVMConstInt(to_llvm_type(node->type), node->u.uval, 0);
         }
         return LLVMConstInt(to_llvm_type(node->type), node->val, 0);
     }
     case ND_FNUM: {
-        return LLVMConstReal(to_llvm_type(node->type), node->fval);
+        return LLVMConstReal(to_llvm_type(node->type), node->u.fval);
     }
     case ND_LVAR: {
-        if (node->val < MAX_LOCALS && local_allocas[node->val]) {
+        if (node->val < ctx->current_local_count && local_allocas[node->val]) {
             LLVMValueRef alloca_ptr = local_allocas[node->val];
             if (node->type && node->type->array_size > 0) {
                 return alloca_ptr;
@@ -1024,7 +1055,7 @@ static LLVMValueRef codegen(Context* ctx, Node* node, LLVMBuilderRef builder,
         strncpy(func_name, node->tok->str, len);
         func_name[len] = '\0';
 
-        LLVMValueRef func = LLVMGetNamedFunction(module, func_name);
+        LLVMValueRef func = module_function(ctx, module, node->tok, func_name);
         if (!func) {
             fprintf(stderr, "Function not found: %s\n", func_name);
             exit(1);
@@ -1053,12 +1084,12 @@ static LLVMValueRef codegen(Context* ctx, Node* node, LLVMBuilderRef builder,
             addr_node->type = new_type_ptr(node->lhs->type);
             LLVMValueRef ptr = codegen(ctx, addr_node, builder, local_allocas,
                                        has_return, module);
-            free(addr_node);
 
             build_volatile_store(builder, store_val, ptr, lhs_volatile);
         } else if (node->lhs->kind == ND_LVAR) {
             // Regular variable assignment
-            if (node->lhs->val < MAX_LOCALS && local_allocas[node->lhs->val]) {
+            if (node->lhs->val < ctx->current_local_count &&
+                local_allocas[node->lhs->val]) {
                 LLVMValueRef alloca_ptr = local_allocas[node->lhs->val];
                 build_volatile_store(builder, store_val, alloca_ptr,
                                      lhs_volatile);
@@ -1411,7 +1442,7 @@ static LLVMValueRef codegen(Context* ctx, Node* node, LLVMBuilderRef builder,
             }
         }
 
-        LLVMValueRef func = LLVMGetNamedFunction(module, func_name);
+        LLVMValueRef func = module_function(ctx, module, node->tok, func_name);
         LLVMTypeRef func_type;
         LLVMTypeRef* dest_param_types = NULL;
         int dest_param_count = 0;
@@ -1422,38 +1453,11 @@ static LLVMValueRef codegen(Context* ctx, Node* node, LLVMBuilderRef builder,
             // undeclared functions
             func_type = LLVMFunctionType(i32_type, param_types, arg_count,
                                          1); // Variadic=true
-            func = LLVMAddFunction(module, func_name, func_type);
-
-            // Register function type for calls
-            FuncType* ft = calloc(1, sizeof(FuncType));
-            ft->name = strdup(func_name);
-            ft->len = strlen(func_name);
-            ft->llvm_type = func_type;
-            ft->next = ctx->func_types;
-            ctx->func_types = ft;
+            func = add_module_function(ctx, module, node->tok, func_name,
+                                       func_type);
         } else {
-            // Lookup function type in our context
-            func_type = NULL;
-            for (FuncType* ft = ctx->func_types; ft; ft = ft->next) {
-                if (strlen(func_name) == (size_t)ft->len &&
-                    strncmp(func_name, ft->name, ft->len) == 0) {
-                    func_type = ft->llvm_type;
-                    break;
-                }
-            }
-
-            if (!func_type) {
-                // Fallback for external functions not seen yet?
-                // Or try global value type (might start working if not opaque)
-                func_type = LLVMGlobalGetValueType(func);
-                // Maybe it returns PointerType, let's try to handle it if so
-                if (LLVMGetTypeKind(func_type) == LLVMPointerTypeKind) {
-                    // Try GetElementType if reachable
-                    // func_type = LLVMGetElementType(func_type);
-                    // If opaque, we are stuck without declaration.
-                    // But printf should be declared in main.i
-                }
-            }
+            // The function's own type; pointers are opaque
+            func_type = LLVMGlobalGetValueType(func);
 
             dest_param_count = LLVMCountParamTypes(func_type);
             if (dest_param_count > 0) {
@@ -1512,7 +1516,6 @@ static LLVMValueRef codegen(Context* ctx, Node* node, LLVMBuilderRef builder,
         addr_node->type = new_type_ptr(node->lhs->type);
         LLVMValueRef ptr =
             codegen(ctx, addr_node, builder, local_allocas, has_return, module);
-        free(addr_node);
 
         if (!ptr) {
             fprintf(stderr, "incdec: pointer is NULL\n");
@@ -1750,7 +1753,7 @@ static LLVMValueRef codegen(Context* ctx, Node* node, LLVMBuilderRef builder,
 
         // Count cases
         int case_count = 0;
-        for (Node* c = node->cases; c; c = c->next_case)
+        for (Node* c = node->u.cases; c; c = c->u.next_case)
             case_count++;
 
         LLVMValueRef sw_inst =
@@ -1806,12 +1809,8 @@ static LLVMValueRef codegen(Context* ctx, Node* node, LLVMBuilderRef builder,
             LLVMSetOperand((LLVMValueRef)ctx->current_switch_inst, 1,
                            LLVMBasicBlockAsValue(case_bb));
         } else {
-            int case_value = node->case_val;
-            if (case_value == 0 && node->val != 0) {
-                case_value = node->val;
-            }
             LLVMAddCase((LLVMValueRef)ctx->current_switch_inst,
-                        LLVMConstInt(ty_i32(), case_value, 0), case_bb);
+                        LLVMConstInt(ty_i32(), node->val, 0), case_bb);
         }
 
         LLVMPositionBuilderAtEnd(builder, case_bb);
@@ -1906,7 +1905,6 @@ static LLVMValueRef codegen(Context* ctx, Node* node, LLVMBuilderRef builder,
         addr_node->type = new_type_ptr(node->type);
         LLVMValueRef ptr =
             codegen(ctx, addr_node, builder, local_allocas, has_return, module);
-        free(addr_node);
 
         LLVMTypeRef member_type = to_llvm_type(node->type);
         LLVMValueRef loaded =
@@ -1923,7 +1921,6 @@ static LLVMValueRef codegen(Context* ctx, Node* node, LLVMBuilderRef builder,
         addr_node->type = new_type_ptr(node->type);
         LLVMValueRef ptr =
             codegen(ctx, addr_node, builder, local_allocas, has_return, module);
-        free(addr_node);
         LLVMTypeRef lit_type = to_llvm_type(node->type);
         return build_volatile_load(builder, lit_type, ptr, "compound_load",
                                    node->type ? node->type->is_volatile
@@ -1933,7 +1930,8 @@ static LLVMValueRef codegen(Context* ctx, Node* node, LLVMBuilderRef builder,
     case ND_ADDR: {
         // &expr - get address of variable
         if (node->lhs->kind == ND_LVAR) {
-            if (node->lhs->val < MAX_LOCALS && local_allocas[node->lhs->val]) {
+            if (node->lhs->val < ctx->current_local_count &&
+                local_allocas[node->lhs->val]) {
                 LLVMValueRef ptr = local_allocas[node->lhs->val];
                 if (node->lhs->type->array_size > 0) {
                     // Implicit conversion or &a
@@ -2029,13 +2027,11 @@ static LLVMValueRef codegen(Context* ctx, Node* node, LLVMBuilderRef builder,
                 nested_addr->type = new_type_ptr(node->lhs->lhs->type);
                 base_addr = codegen(ctx, nested_addr, builder, local_allocas,
                                     has_return, module);
-                free(nested_addr);
             } else if (node->lhs->lhs->kind == ND_COMPOUND) {
                 Node* nested_addr = new_node(ND_ADDR, node->lhs->lhs, NULL);
                 nested_addr->type = new_type_ptr(node->lhs->lhs->type);
                 base_addr = codegen(ctx, nested_addr, builder, local_allocas,
                                     has_return, module);
-                free(nested_addr);
             } else if (node->lhs->lhs->kind == ND_DEREF) {
                 // p->m: base is (*p), we need p's value as address
                 base_addr = codegen(ctx, node->lhs->lhs->lhs, builder,
@@ -2047,14 +2043,14 @@ static LLVMValueRef codegen(Context* ctx, Node* node, LLVMBuilderRef builder,
 
             if (node->lhs->lhs->type && node->lhs->lhs->type->ty == UNION) {
                 LLVMTypeRef member_ptr_ty =
-                    LLVMPointerType(to_llvm_type(node->lhs->member->type), 0);
+                    LLVMPointerType(to_llvm_type(node->lhs->u.member->type), 0);
                 return LLVMBuildBitCast(builder, base_addr, member_ptr_ty,
                                         "union_member_ptr");
             }
 
             LLVMTypeRef struct_type = to_llvm_type(node->lhs->lhs->type);
             return LLVMBuildStructGEP2(builder, struct_type, base_addr,
-                                       node->lhs->member->index, "mgep");
+                                       node->lhs->u.member->index, "mgep");
         } else if (node->lhs->kind == ND_GVAR) {
             char var_name[64];
             int len = node->lhs->tok->len < 63 ? node->lhs->tok->len : 63;
@@ -2086,7 +2082,7 @@ static LLVMValueRef codegen(Context* ctx, Node* node, LLVMBuilderRef builder,
     }
     case ND_DECL: {
         if (node->is_vla) {
-            if (node->val < 0 || node->val >= MAX_LOCALS) {
+            if (node->val < 0 || node->val >= ctx->current_local_count) {
                 fprintf(stderr, "ND_DECL(VLA): node->val %d out of bounds\n",
                         node->val);
                 exit(1);
@@ -2114,7 +2110,7 @@ static LLVMValueRef codegen(Context* ctx, Node* node, LLVMBuilderRef builder,
         }
 
         if (node->init) {
-            if (node->val < 0 || node->val >= MAX_LOCALS) {
+            if (node->val < 0 || node->val >= ctx->current_local_count) {
                 fprintf(stderr, "ND_DECL: node->val %d out of bounds\n",
                         node->val);
                 fflush(stderr);
@@ -4,9 +4,6 @@
 #include <stdbool.h>
 #include <stddef.h>
 
-#define MAX_NODES 1024
-#define MAX_LOCALS 1024
-
 typedef enum {
     TK_RESERVED,
     TK_IDENT,
@@ -22,23 +19,44 @@ struct Member {
     Type* type;
     const char* name;
     int len;
+    int sym; // Interned symbol id of name
     int index; // Member index for GEP
     bool is_bitfield;
     int bit_width;
     int bit_offset;
+    int offset; // Byte offset, set with the layout of the struct
+};
+
+// C type of a numeric literal. long and long long are both 64 bits wide.
+typedef enum {
+    NUM_INT,
+    NUM_UINT,
+    NUM_LONG,
+    NUM_ULONG,
+    NUM_LLONG,
+    NUM_ULLONG,
+    NUM_FLOAT,
+    NUM_DOUBLE,
+} NumType;
+
+// Numeric payload of a TK_NUM token, kept out of Token so that punctuation
+// and identifiers do not pay for it
+typedef struct TokenNum TokenNum;
+struct TokenNum {
+    unsigned long long uval; // Integer value (two's complement bit pattern)
+    double fval;             // Value of NUM_FLOAT/NUM_DOUBLE literals
+    NumType type;
 };
 
+// Tokens produced by tokenize() are stored contiguously in a single
+// allocation and terminated by TK_EOF; use next_token() to advance.
 typedef struct Token Token;
 struct Token {
     TokenKind kind;
-    Token* next;
-    int val;
-    unsigned long long uval;
-    double fval;
-    bool is_float;
-    bool is_unsigned;
-    const char* str;
     int len;
+    int sym; // Interned symbol id (identifiers), 0 until resolved
+    const char* str;
+    TokenNum* num; // Non-NULL only for TK_NUM
     int line;
     int col;
 };
@@ -65,6 +83,13 @@ struct Type {
     size_t array_size;
     struct Member* members; // For STRUCT
     void* llvm_type;        // Cache for LLVMTypeRef
+    bool is_permanent;      // Shared by all compilations (see type.c)
+    bool has_layout;        // For STRUCT/UNION: size and align are valid
+    int size;
+    int align;
+    struct Type* pointer_type; // Canonical pointer to this type
+    struct Type* array_types;  // Canonical sized arrays of this type
+    struct Type* next_array;   // Next array of the same element type
 };
 
 typedef enum {
@@ -134,15 +159,30 @@ struct LVar {
     LVar* next;
     const char* name;
     int len;
+    int sym; // Interned symbol id of name
     int offset;
-    Type* type; // Type of the variable
+    Type* type;     // Type of the variable
+    LVar* shadowed; // Binding of the same name this one hides
 };
 
+typedef struct {
+    int sym;     // Interned symbol id; 0 = empty
+    void* value; // Entry stored under the name
+} SymSlot;
+
+// Entries by name; open addressing with linear probing
+typedef struct {
+    SymSlot* slots;
+    int cap; // Power of two
+    int count;
+} SymTable;
+
 typedef struct Typedef Typedef;
 struct Typedef {
     Typedef* next;
     const char* name;
     int len;
+    int sym; // Interned symbol id of name
     Type* type;
 };
 
@@ -151,35 +191,38 @@ struct EnumConst {
     EnumConst* next;
     const char* name;
     int len;
+    int sym; // Interned symbol id of name
     int val;
 };
 
 typedef struct Node Node;
+// Fields used by every kind of node come first; the ones a single kind
+// needs share the union u, so a node costs 80 bytes on LP64 hosts.
 struct Node {
     NodeKind kind;
+    int val;
+    Type* type; // Type of the node (for ND_DECL, ND_LVAR, etc.)
+    Token* tok; // Function name or token for the node
     Node* next;
     Node* lhs;  // General left operand, or then branch for if/while/for
     Node* rhs;  // General right operand, or else branch for if, or inc for for
     Node* cond; // Condition for if/while/for
     Node* init; // Initialization for for loop
-    Token* tok; // Function name or token for the node
-    int val;
-    unsigned long long uval;
-    double fval;
-    Type* type;       // Type of the node (for ND_DECL, ND_LVAR, etc.)
-    LVar* locals;     // Local variables (for ND_FUNCTION)
-    Member* member;   // for ND_MEMBER
-    Node* cases;      // for ND_SWITCH
-    Node* next_case;  // for case/default list in ND_SWITCH
-    int case_val;     // for ND_CASE
-    bool is_default;  // for ND_DEFAULT
+    union {
+        unsigned long long uval; // ND_NUM: value with all 64 bits
+        double fval;             // ND_FNUM
+        LVar* locals;            // ND_FUNCTION: local variables
+        Member* member;          // ND_MEMBER
+        Node* cases;             // ND_SWITCH: case/default list
+        Node* next_case;         // ND_CASE: next in the switch's list
+    } u;
+    bool is_default;  // for ND_CASE: default label
     bool is_do_while; // for ND_WHILE: distinguish do-while from while
     bool is_extern;   // for extern global var
     bool is_vla;      // for ND_DECL: variable-length array declaration
     bool is_inline;   // for ND_FUNCTION: inline function
     bool is_static;   // for ND_FUNCTION: static function
     bool is_vararg;   // for ND_FUNCTION: variadic function (...)
-    void* llvm_label; // LLVMBasicBlockRef for ND_CASE/ND_BREAK/etc.
 };
 
 typedef struct StructTag StructTag;
@@ -187,21 +230,38 @@ struct StructTag {
     StructTag* next;
     const char* name;
     int len;
+    int sym; // Interned symbol id of name
     Type* type;
 };
 
-typedef struct FuncType FuncType;
-struct FuncType {
-    FuncType* next;
-    const char* name;
-    int len;
-    void* llvm_type; // LLVMTypeRef
+// Function known by name, shared by the parser and codegen
+typedef struct {
+    Node* decl;      // First ND_FUNCTION declaring it, or NULL if only called
+    void* llvm_func; // LLVMValueRef in the module being generated, or NULL
+} FuncEntry;
+
+// Bump allocator; memory is carved out of chunks and released all at once
+typedef struct ArenaChunk ArenaChunk;
+struct ArenaChunk {
+    ArenaChunk* next;
+    size_t size; // usable bytes following this header
+    size_t used;
 };
 
+typedef struct Arena Arena;
+struct Arena {
+    ArenaChunk* chunks; // most recent chunk first
+};
+
+// Pull-mode token source (see lexer_new())
+typedef struct Lexer Lexer;
+
 typedef struct Context Context;
 struct Context {
     Token* current_token;           // Current token being processed
-    Node* code[MAX_NODES];          // Generated AST nodes (statements)
+    Lexer* lexer; // Supplies tokens on demand; NULL for a tokenize() array
+    Node** code;                    // Top-level declarations, then NULL
+    int code_cap;                   // Entries code has room for
     LVar* locals;                   // local variables
     LVar* globals;                  // global variables
     Typedef* typedefs;              // typedefs
@@ -213,15 +273,25 @@ struct Context {
     void* current_continue_label;   // Current jump target for continue
     void* current_label_map;        // Function-scope label map for goto/label
     int node_count;                 // Number of statements
-    const char* strings[MAX_NODES]; // string literal data
-    int string_lens[MAX_NODES];     // string literal lengths
+    const char** strings;           // string literal data
+    int* string_lens;               // string literal lengths
     int string_count;               // number of string literals
+    int string_cap;                 // Entries strings has room for
     Type* current_func_type; // Return type of current function being generated
-    FuncType* func_types;    // Function types for opaque pointers support
-    int scope_depth; // lexical scope depth for local variable visibility
-    Node* vla_size_exprs[MAX_LOCALS]; // local slot -> VLA element count expr
-    const char* current_func_name;   // Name of current function being generated
-    int current_func_name_len;       // Length of current function name
+    SymTable functions;    // FuncEntry of declared and called functions
+    SymTable local_table;  // LVar visible at the current point; the value
+                           // is NULL once its scope has closed
+    SymTable global_table; // LVar of globals
+    LVar** scope_starts;   // ctx->locals when each open scope was entered
+    int scope_depth;       // Number of open block scopes
+    int scope_cap;
+    int local_count;               // Slots handed out in the current function
+    Node** vla_size_exprs;         // local slot -> VLA element count expr
+    int vla_cap;                   // Entries vla_size_exprs has room for
+    int current_local_count;       // Slots of the function being generated
+    const char* current_func_name; // Name of current function being generated
+    int current_func_name_len;     // Length of current function name
+    Arena arena; // Owns AST nodes, types and symbols of this compilation
 };
 
 #endif
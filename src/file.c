@@ -1,8 +1,15 @@
+#include "file.h"
+#include "intern.h"
+
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-
-char* read_file(const char* filename);
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 char* read_file(const char* filename) {
     FILE* file = fopen(filename, "r");
@@ -41,3 +48,439 @@ char* read_file(const char* filename) {
 
     return source;
 }
+
+// Read everything from fd into a NUL-terminated heap buffer
+static char* read_fd(int fd, size_t* out_len) {
+    size_t cap = 65536;
+    size_t len = 0;
+    char* buf = malloc(cap + 1);
+    if (!buf) {
+        perror("malloc");
+        exit(1);
+    }
+    while (1) {
+        if (len == cap) {
+            cap *= 2;
+            char* p = realloc(buf, cap + 1);
+            if (!p) {
+                perror("realloc");
+                exit(1);
+            }
+            buf = p;
+        }
+        ssize_t n = read(fd, buf + len, cap - len);
+        if (n < 0) {
+            free(buf);
+            return NULL;
+        }
+        if (n == 0) {
+            break;
+        }
+        len += (size_t)n;
+    }
+    buf[len] = '\0';
+    *out_len = len;
+    return buf;
+}
+
+/**
+ * Open a source file as a read-only, NUL-terminated view
+ *
+ * Regular files are mapped without copying when the kernel guarantees a
+ * zero byte after the contents, i.e. when the size is not a multiple of the
+ * page size (the rest of the last page reads as zeros). Otherwise, and for
+ * pipes or stdin ("-"), the contents are read into a heap buffer.
+ *
+ * @param[in] filename Path to the file, or "-" for stdin
+ * @param[out] view Receives the contents; release with close_file_view()
+ * @return true on success, false if the file could not be read
+ */
+bool open_file_view(const char* filename, FileView* view) {
+    view->data = NULL;
+    view->len = 0;
+    view->mapped = false;
+
+    bool is_stdin = strcmp(filename, "-") == 0;
+    int fd = is_stdin ? 0 : open(filename, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size > 0 && size % getpagesize() != 0) {
+        void* p = mmap(NULL, (size_t)size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            if (!is_stdin) {
+                close(fd);
+            }
+            view->data = p;
+            view->len = (size_t)size;
+            view->mapped = true;
+            return true;
+        }
+    }
+    if (size >= 0) {
+        lseek(fd, 0, SEEK_SET);
+    }
+
+    size_t len = 0;
+    char* buf = read_fd(fd, &len);
+    if (!is_stdin) {
+        close(fd);
+    }
+    if (!buf) {
+        return false;
+    }
+    view->data = buf;
+    view->len = len;
+    return true;
+}
+
+/**
+ * Release a view returned by open_file_view()
+ *
+ * @param[in] view View to release; its data pointer is cleared
+ */
+void close_file_view(FileView* view) {
+    if (!view->data) {
+        return;
+    }
+    if (view->mapped) {
+        munmap((void*)view->data, view->len);
+    } else {
+        free((void*)view->data);
+    }
+    view->data = NULL;
+    view->len = 0;
+    view->mapped = false;
+}
+
+// Process-wide cache of path lookups and file contents, shared by every
+// translation unit. An entry is trusted for the rest of the current epoch
+// once checked; in a later epoch it is checked again with stat(), so
+// long-running users see edits without paying for syscalls on every
+// #include. Not thread-safe.
+typedef struct {
+    bool exists;
+    time_t mtime;
+    off_t size;
+    time_t checked; // Wall clock time of the stat() call
+} FileStamp;
+
+typedef struct CachedFile CachedFile;
+struct CachedFile {
+    char* path; // As looked up
+    unsigned int hash;
+    bool resolved_set;   // cached_realpath() has resolved path
+    char* resolved;      // realpath() of path, or NULL if it does not exist
+    FileStamp dir_stamp; // Directory holding path, when resolved was set
+    int resolved_epoch;  // Epoch in which resolved was last checked
+    bool loaded;         // view holds the contents
+    FileView view;
+    FileStamp stamp; // path itself, when view was loaded
+    int view_epoch;  // Epoch in which view was last checked
+    bool listed;     // entries holds the directory listing of path
+    char** entries;  // Open addressing set of entry names; NULL = empty
+    int entry_cap;   // Power of two
+    FileStamp list_stamp; // path itself, when it was listed
+    int list_epoch;       // Epoch in which the listing was last checked
+};
+
+static CachedFile** cache_slots = NULL; // open addressing; NULL = empty
+static int cache_cap = 0;
+static int cache_count = 0;
+static int cache_epoch = 1;
+
+static FileStamp stamp_path(const char* path) {
+    FileStamp stamp;
+    memset(&stamp, 0, sizeof(stamp));
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        stamp.exists = true;
+        stamp.mtime = st.st_mtime;
+        stamp.size = st.st_size;
+    }
+    stamp.checked = time(NULL);
+    return stamp;
+}
+
+// A change within the second of the previous check would leave mtime
+// unchanged, so such a stamp never proves the file is unmodified
+static bool stamp_unchanged(FileStamp* old, FileStamp* now) {
+    return old->exists == now->exists && old->mtime == now->mtime &&
+           old->size == now->size && old->mtime < old->checked;
+}
+
+static FileStamp stamp_parent_dir(const char* path) {
+    const char* slash = strrchr(path, '/');
+    if (!slash) {
+        return stamp_path(".");
+    }
+    if (slash == path) {
+        return stamp_path("/");
+    }
+    size_t len = (size_t)(slash - path);
+    char* dir = malloc(len + 1);
+    if (!dir) {
+        perror("malloc");
+        exit(1);
+    }
+    memcpy(dir, path, len);
+    dir[len] = '\0';
+    FileStamp stamp = stamp_path(dir);
+    free(dir);
+    return stamp;
+}
+
+static int cache_slot(const char* path, unsigned int hash) {
+    int i = (int)(hash & (unsigned int)(cache_cap - 1));
+    while (cache_slots[i]) {
+        CachedFile* f = cache_slots[i];
+        if (f->hash == hash && strcmp(f->path, path) == 0) {
+            return i;
+        }
+        i = (i + 1) & (cache_cap - 1);
+    }
+    return i;
+}
+
+static void grow_cache(void) {
+    int old_cap = cache_cap;
+    CachedFile** old_slots = cache_slots;
+    cache_cap = old_cap ? old_cap * 2 : 256;
+    cache_slots = calloc((size_t)cache_cap, sizeof(CachedFile*));
+    if (!cache_slots) {
+        perror("calloc");
+        exit(1);
+    }
+    for (int i = 0; i < old_cap; i++) {
+        CachedFile* f = old_slots[i];
+        if (f) {
+            cache_slots[cache_slot(f->path, f->hash)] = f;
+        }
+    }
+    free(old_slots);
+}
+
+// Find or create the entry for path
+static CachedFile* cache_entry(const char* path) {
+    if ((cache_count + 1) * 2 > cache_cap) {
+        grow_cache();
+    }
+    unsigned int hash = hash_name(path, (int)strlen(path));
+    int i = cache_slot(path, hash);
+    if (cache_slots[i]) {
+        return cache_slots[i];
+    }
+    CachedFile* f = calloc(1, sizeof(CachedFile));
+    if (!f) {
+        perror("calloc");
+        exit(1);
+    }
+    f->path = strdup(path);
+    if (!f->path) {
+        perror("strdup");
+        exit(1);
+    }
+    f->hash = hash;
+    cache_slots[i] = f;
+    cache_count++;
+    return f;
+}
+
+/**
+ * Resolve a path to its canonical form, remembering the answer
+ *
+ * Missing files are remembered too. In a new epoch the answer is checked
+ * against the modification time of the containing directory.
+ *
+ * @param[in] path Path to resolve
+ * @return Canonical path owned by the cache, or NULL if it does not exist
+ */
+const char* cached_realpath(const char* path) {
+    CachedFile* f = cache_entry(path);
+    if (f->resolved_set && f->resolved_epoch == cache_epoch) {
+        return f->resolved;
+    }
+    FileStamp now = stamp_parent_dir(path);
+    if (!f->resolved_set || !stamp_unchanged(&f->dir_stamp, &now)) {
+        free(f->resolved);
+        f->resolved = realpath(path, NULL);
+        f->dir_stamp = now;
+        f->resolved_set = true;
+    }
+    f->resolved_epoch = cache_epoch;
+    return f->resolved;
+}
+
+/**
+ * Get the contents of a file through the cache
+ *
+ * The file is read once and kept open; in a new epoch it is read again if
+ * its modification time or size changed.
+ *
+ * @param[in] path Canonical path, e.g. from cached_realpath()
+ * @return View owned by the cache, or NULL if the file cannot be read
+ */
+const FileView* cached_file_view(const char* path) {
+    CachedFile* f = cache_entry(path);
+    if (f->loaded && f->view_epoch == cache_epoch) {
+        return &f->view;
+    }
+    FileStamp now = stamp_path(path);
+    if (f->loaded && !stamp_unchanged(&f->stamp, &now)) {
+        close_file_view(&f->view);
+        f->loaded = false;
+    }
+    if (!f->loaded) {
+        if (!open_file_view(path, &f->view)) {
+            return NULL;
+        }
+        f->stamp = now;
+        f->loaded = true;
+    }
+    f->view_epoch = cache_epoch;
+    return &f->view;
+}
+
+static int entry_slot(char** entries, int cap, const char* name) {
+    unsigned int hash = hash_name(name, (int)strlen(name));
+    int i = (int)(hash & (unsigned int)(cap - 1));
+    while (entries[i] && strcmp(entries[i], name) != 0) {
+        i = (i + 1) & (cap - 1);
+    }
+    return i;
+}
+
+static void free_listing(CachedFile* f) {
+    for (int i = 0; i < f->entry_cap; i++) {
+        free(f->entries[i]);
+    }
+    free(f->entries);
+    f->entries = NULL;
+    f->entry_cap = 0;
+    f->listed = false;
+}
+
+// Read the directory into the entry set; a missing directory lists as empty
+static void list_dir(CachedFile* f) {
+    char** names = NULL;
+    int count = 0;
+    int cap = 0;
+    DIR* dir = opendir(f->path);
+    if (dir) {
+        struct dirent* ent;
+        while ((ent = readdir(dir)) != NULL) {
+            if (count == cap) {
+                cap = cap ? cap * 2 : 64;
+                names = realloc(names, sizeof(char*) * (size_t)cap);
+                if (!names) {
+                    perror("realloc");
+                    exit(1);
+                }
+            }
+            names[count] = strdup(ent->d_name);
+            if (!names[count]) {
+                perror("strdup");
+                exit(1);
+            }
+            count++;
+        }
+        closedir(dir);
+    }
+
+    // Keep the load factor at or below 1/2
+    f->entry_cap = 16;
+    while (f->entry_cap < count * 2) {
+        f->entry_cap *= 2;
+    }
+    f->entries = calloc((size_t)f->entry_cap, sizeof(char*));
+    if (!f->entries) {
+        perror("calloc");
+        exit(1);
+    }
+    for (int i = 0; i < count; i++) {
+        f->entries[entry_slot(f->entries, f->entry_cap, names[i])] = names[i];
+    }
+    free(names);
+    f->listed = true;
+}
+
+/**
+ * Check whether a directory has an entry, using a cached listing
+ *
+ * Each directory is listed once and kept as a hash set, so a miss costs no
+ * syscalls. In a new epoch the listing is read again if the directory's
+ * modification time changed. A name with slashes is looked up in the
+ * listing of its subdirectory.
+ *
+ * @param[in] dir Directory to look in; "." is the working directory
+ * @param[in] name Entry name, possibly with a relative directory part
+ * @return true if dir/name exists
+ */
+bool cached_dir_has(const char* dir, const char* name) {
+    const char* leaf = strrchr(name, '/');
+    const char* list_path = dir;
+    char* joined = NULL;
+    if (leaf) {
+        // Look up the last component in the listing of dir/<prefix>
+        size_t dir_len = strlen(dir);
+        size_t prefix_len = (size_t)(leaf - name);
+        joined = malloc(dir_len + prefix_len + 2);
+        if (!joined) {
+            perror("malloc");
+            exit(1);
+        }
+        memcpy(joined, dir, dir_len);
+        joined[dir_len] = '/';
+        memcpy(joined + dir_len + 1, name, prefix_len);
+        joined[dir_len + 1 + prefix_len] = '\0';
+        list_path = joined;
+        leaf++;
+    } else {
+        leaf = name;
+    }
+
+    CachedFile* f = cache_entry(list_path);
+    free(joined);
+    if (!f->listed || f->list_epoch != cache_epoch) {
+        FileStamp now = stamp_path(f->path);
+        if (f->listed && !stamp_unchanged(&f->list_stamp, &now)) {
+            free_listing(f);
+        }
+        if (!f->listed) {
+            list_dir(f);
+            f->list_stamp = now;
+        }
+        f->list_epoch = cache_epoch;
+    }
+    return f->entries[entry_slot(f->entries, f->entry_cap, leaf)] != NULL;
+}
+
+/**
+ * Start a new cache epoch
+ *
+ * Cached entries are checked against the file system again on their next
+ * use. Called once per translation unit.
+ */
+void file_cache_revalidate(void) { cache_epoch++; }
+
+/**
+ * Drop every cached path and file
+ */
+void file_cache_clear(void) {
+    for (int i = 0; i < cache_cap; i++) {
+        CachedFile* f = cache_slots[i];
+        if (f) {
+            close_file_view(&f->view);
+            free_listing(f);
+            free(f->resolved);
+            free(f->path);
+            free(f);
+        }
+    }
+    free(cache_slots);
+    cache_slots = NULL;
+    cache_cap = 0;
+    cache_count = 0;
+}
@@ -1,6 +1,25 @@
 #ifndef __FILE_H__
 #define __FILE_H__
 
+#include <stdbool.h>
+#include <stddef.h>
+
+// Read-only, NUL-terminated contents of a source file. Regular files are
+// memory-mapped; pipes and stdin are read into a heap buffer.
+typedef struct FileView FileView;
+struct FileView {
+    const char* data;
+    size_t len;
+    bool mapped;
+};
+
 extern char* read_file(const char* filename);
+extern bool open_file_view(const char* filename, FileView* view);
+extern void close_file_view(FileView* view);
+extern const char* cached_realpath(const char* path);
+extern const FileView* cached_file_view(const char* path);
+extern bool cached_dir_has(const char* dir, const char* name);
+extern void file_cache_revalidate(void);
+extern void file_cache_clear(void);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,131 @@
+#include "intern.h"
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Process-wide identifier table. Each distinct spelling gets a symbol id
+// starting at 1, so names can be compared by id instead of by text. Symbol
+// text is copied into the table's own arena and outlives the source buffers.
+static int* slots = NULL; // open addressing; 0 = empty, else symbol id
+static int slot_cap = 0;
+static const char** names = NULL; // indexed by symbol id
+static int* lens = NULL;
+static unsigned int* hashes = NULL;
+static int sym_count = 0;
+static int sym_cap = 0;
+static Arena* text_arena = NULL;
+
+/**
+ * Hash a name with 32-bit FNV-1a
+ *
+ * @param[in] str Name text (not necessarily NUL-terminated)
+ * @param[in] len Length of the name
+ * @return Hash value
+ */
+unsigned int hash_name(const char* str, int len) {
+    unsigned int h = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        h = h ^ (unsigned char)str[i];
+        h = h * 16777619;
+    }
+    return h;
+}
+
+static void grow_slots(void) {
+    int new_cap = slot_cap ? slot_cap * 2 : 1024;
+    int* new_slots = calloc((size_t)new_cap, sizeof(int));
+    if (!new_slots) {
+        perror("calloc");
+        exit(1);
+    }
+    for (int i = 0; i < slot_cap; i++) {
+        int id = slots[i];
+        if (id == 0)
+            continue;
+        int j = (int)(hashes[id] & (unsigned int)(new_cap - 1));
+        while (new_slots[j] != 0)
+            j = (j + 1) & (new_cap - 1);
+        new_slots[j] = id;
+    }
+    free(slots);
+    slots = new_slots;
+    slot_cap = new_cap;
+}
+
+static void grow_syms(void) {
+    sym_cap = sym_cap ? sym_cap * 2 : 1024;
+    names = realloc(names, sizeof(char*) * (size_t)sym_cap);
+    lens = realloc(lens, sizeof(int) * (size_t)sym_cap);
+    hashes = realloc(hashes, sizeof(unsigned int) * (size_t)sym_cap);
+    if (!names || !lens || !hashes) {
+        perror("realloc");
+        exit(1);
+    }
+}
+
+/**
+ * Intern a name
+ *
+ * @param[in] str Name text (not necessarily NUL-terminated)
+ * @param[in] len Length of the name
+ * @return Symbol id (>= 1), equal for equal spellings
+ */
+int intern(const char* str, int len) {
+    // Keep the load factor at or below 1/2
+    if ((sym_count + 1) * 2 > slot_cap) {
+        grow_slots();
+    }
+    unsigned int h = hash_name(str, len);
+    int i = (int)(h & (unsigned int)(slot_cap - 1));
+    while (slots[i] != 0) {
+        int id = slots[i];
+        if (hashes[id] == h && lens[id] == len &&
+            memcmp(names[id], str, (size_t)len) == 0) {
+            return id;
+        }
+        i = (i + 1) & (slot_cap - 1);
+    }
+
+    int id = ++sym_count;
+    if (id >= sym_cap) {
+        grow_syms();
+    }
+    if (!text_arena) {
+        text_arena = calloc(1, sizeof(Arena));
+        if (!text_arena) {
+            perror("calloc");
+            exit(1);
+        }
+    }
+    char* text = arena_alloc(text_arena, (size_t)len + 1);
+    memcpy(text, str, (size_t)len);
+    names[id] = text;
+    lens[id] = len;
+    hashes[id] = h;
+    slots[i] = id;
+    return id;
+}
+
+const char* sym_name(int sym) { return names[sym]; }
+
+int sym_len(int sym) { return lens[sym]; }
+
+unsigned int sym_hash(int sym) { return hashes[sym]; }
+
+/**
+ * Get the symbol id of a token, interning it on first use
+ *
+ * Identifiers are interned by the lexer; this also covers keywords and
+ * tokens synthesized by the parser.
+ *
+ * @param[in] tok Token to resolve
+ * @return Symbol id of the token's spelling
+ */
+int tok_sym(Token* tok) {
+    if (tok->sym == 0) {
+        tok->sym = intern(tok->str, tok->len);
+    }
+    return tok->sym;
+}
@@ -0,0 +1,13 @@
+#ifndef __INTERN_H__
+#define __INTERN_H__
+
+#include "common.h"
+
+extern unsigned int hash_name(const char* str, int len);
+extern int intern(const char* str, int len);
+extern const char* sym_name(int sym);
+extern int sym_len(int sym);
+extern unsigned int sym_hash(int sym);
+extern int tok_sym(Token* tok);
+
+#endif
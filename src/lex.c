@@ -1,10 +1,17 @@
 #include "lex.h"
+#include "arena.h"
+#include "intern.h"
+#include "literal.h"
 #include "parse.h"
+#include "preprocess.h"
+#include "scan.h"
 
 #include <ctype.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #define LLVM7_INT_MAX 2147483647
 
@@ -13,101 +20,146 @@ static int is_alnum(char c) {
            ('0' <= c && c <= '9') || c == '_';
 }
 
-static char decode_escape_char(const char** pp) {
-    const char* p = *pp;
-    if (*p == 'n') {
-        *pp = p + 1;
-        return '\n';
-    }
-    if (*p == 'r') {
-        *pp = p + 1;
-        return '\r';
-    }
-    if (*p == 't') {
-        *pp = p + 1;
-        return '\t';
-    }
-    if (*p == 'a') {
-        *pp = p + 1;
-        return '\a';
-    }
-    if (*p == 'b') {
-        *pp = p + 1;
-        return '\b';
-    }
-    if (*p == 'f') {
-        *pp = p + 1;
-        return '\f';
-    }
-    if (*p == 'v') {
-        *pp = p + 1;
-        return '\v';
-    }
-    if (*p == '\\' || *p == '"' || *p == '\'') {
-        *pp = p + 1;
-        return *p;
-    }
-    if (*p == 'x') {
-        // Hex escape: \xHH (1-2 hex digits)
-        p++;
-        int val = 0;
-        int count = 0;
-        while (count < 2 && isxdigit((unsigned char)*p)) {
-            int d;
-            if ('0' <= *p && *p <= '9')
-                d = *p - '0';
-            else if ('a' <= *p && *p <= 'f')
-                d = *p - 'a' + 10;
-            else
-                d = *p - 'A' + 10;
-            val = val * 16 + d;
-            p++;
-            count++;
+static bool kw_eq(const char* s, const char* kw, int len) {
+    return memcmp(s, kw, len) == 0;
+}
+
+/**
+ * Classify a complete identifier as a keyword
+ *
+ * Dispatches on length and first character so that at most a couple of
+ * memcmp calls are needed per identifier.
+ *
+ * @param[in] s Start of the identifier
+ * @param[in] len Length of the identifier
+ * @return true if the identifier is a reserved keyword
+ */
+static bool is_keyword(const char* s, int len) {
+    switch (len) {
+    case 2:
+        return kw_eq(s, "if", 2) || kw_eq(s, "do", 2);
+    case 3:
+        return kw_eq(s, "int", 3) || kw_eq(s, "for", 3);
+    case 4:
+        switch (s[0]) {
+        case 'b':
+            return kw_eq(s, "bool", 4);
+        case 'c':
+            return kw_eq(s, "char", 4) || kw_eq(s, "case", 4);
+        case 'e':
+            return kw_eq(s, "else", 4) || kw_eq(s, "enum", 4);
+        case 'g':
+            return kw_eq(s, "goto", 4);
+        case 'l':
+            return kw_eq(s, "long", 4);
+        case 't':
+            return kw_eq(s, "true", 4);
+        case 'v':
+            return kw_eq(s, "void", 4);
+        case 'N':
+            return kw_eq(s, "NULL", 4);
         }
-        *pp = p;
-        return (char)(val & 0xFF);
-    }
-    if ('0' <= *p && *p <= '7') {
-        // Octal escape: \OOO (1-3 octal digits)
-        int val = 0;
-        int count = 0;
-        while (count < 3 && '0' <= *p && *p <= '7') {
-            val = val * 8 + (*p - '0');
-            p++;
-            count++;
+        return false;
+    case 5:
+        switch (s[0]) {
+        case 'b':
+            return kw_eq(s, "break", 5);
+        case 'c':
+            return kw_eq(s, "const", 5);
+        case 'f':
+            return kw_eq(s, "false", 5) || kw_eq(s, "float", 5);
+        case 's':
+            return kw_eq(s, "short", 5);
+        case 'u':
+            return kw_eq(s, "union", 5);
+        case 'w':
+            return kw_eq(s, "while", 5);
+        case '_':
+            return kw_eq(s, "_Bool", 5);
         }
-        *pp = p;
-        return (char)(val & 0xFF);
-    }
-    if (*p == '\0') {
-        return '\0';
+        return false;
+    case 6:
+        switch (s[0]) {
+        case 'd':
+            return kw_eq(s, "double", 6);
+        case 'e':
+            return kw_eq(s, "extern", 6);
+        case 'i':
+            return kw_eq(s, "inline", 6);
+        case 'r':
+            return kw_eq(s, "return", 6);
+        case 's':
+            return kw_eq(s, "sizeof", 6) || kw_eq(s, "struct", 6) ||
+                   kw_eq(s, "static", 6) || kw_eq(s, "size_t", 6) ||
+                   kw_eq(s, "switch", 6) || kw_eq(s, "signed", 6);
+        }
+        return false;
+    case 7:
+        return kw_eq(s, "typedef", 7) || kw_eq(s, "default", 7) ||
+               kw_eq(s, "_Pragma", 7);
+    case 8:
+        switch (s[0]) {
+        case 'c':
+            return kw_eq(s, "continue", 8);
+        case 'r':
+            return kw_eq(s, "restrict", 8) || kw_eq(s, "register", 8);
+        case 'u':
+            return kw_eq(s, "unsigned", 8);
+        case 'v':
+            return kw_eq(s, "volatile", 8);
+        case '_':
+            return kw_eq(s, "_Complex", 8) || kw_eq(s, "__func__", 8);
+        }
+        return false;
     }
-    *pp = p + 1;
-    return *p;
+    return false;
 }
 
-// Keyword table (selfhost-compatible: no anonymous struct)
-char* kw_str[42] = {
-    "return",   "if",       "else",     "while",    "for",      "int",
-    "char",     "void",     "sizeof",   "struct",   "typedef",  "enum",
-    "static",   "extern",   "const",    "long",     "bool",     "size_t",
-    "NULL",     "true",     "false",    "switch",   "case",     "default",
-    "break",    "continue", "unsigned", "signed",   "double",   "float",
-    "do",       "goto",     "union",    "inline",   "restrict", "volatile",
-    "register", "_Bool",    "_Complex", "__func__", "_Pragma",  "short"};
-int kw_len[42] = {6, 2, 4, 5, 3, 3, 4, 4, 6, 6, 7, 4, 6, 6,
-                  5, 4, 4, 6, 4, 4, 5, 6, 4, 7, 5, 8, 8, 6,
-                  6, 5, 2, 4, 5, 6, 8, 8, 8, 5, 8, 8, 7, 5};
-int NUM_KEYWORDS = 42;
-
-char* three_char_ops[3] = {"...", "<<=", ">>="};
-int NUM_THREE_CHAR_OPS = 3;
-
-static char* two_char_ops[] = {
-    "==", "!=", "<=", ">=", "&&", "||", "->", "++", "--",
-    "+=", "-=", "*=", "/=", "<<", ">>", "&=", "|=", "^="};
-
-static int NUM_TWO_CHAR_OPS = sizeof(two_char_ops) / sizeof(two_char_ops[0]);
+/**
+ * Match an operator or delimiter by dispatching on its first character
+ *
+ * @param[in] p Current position in the source
+ * @return Length of the punctuator at p (1-3), or 0 if there is none
+ */
+static int punct_len(const char* p) {
+    switch (p[0]) {
+    case '.':
+        if (p[1] == '.' && p[2] == '.')
+            return 3;
+        return 1;
+    case '<':
+    case '>':
+        if (p[1] == p[0])
+            return p[2] == '=' ? 3 : 2;
+        return p[1] == '=' ? 2 : 1;
+    case '=':
+    case '!':
+    case '*':
+    case '/':
+    case '^':
+        return p[1] == '=' ? 2 : 1;
+    case '&':
+    case '|':
+    case '+':
+        return (p[1] == p[0] || p[1] == '=') ? 2 : 1;
+    case '-':
+        return (p[1] == '-' || p[1] == '=' || p[1] == '>') ? 2 : 1;
+    case '(':
+    case ')':
+    case ';':
+    case '{':
+    case '}':
+    case ',':
+    case '[':
+    case ']':
+    case ':':
+    case '?':
+    case '%':
+    case '~':
+        return 1;
+    }
+    return 0;
+}
 
 static bool lex_debug = false;
 
@@ -150,358 +202,848 @@ static void print_token(TokenKind kind, const char* str, int len, int val) {
             len, str, val);
 }
 
-Token* new_token(TokenKind kind, Token* cur, const char* str, int len) {
-    Token* tok = calloc(1, sizeof(Token));
-    if (!tok) {
-        perror("calloc");
+// Growable token storage used while lexing. Numeric payloads are collected
+// in a separate array and attached to their tokens by finish_tokens().
+typedef struct TokenBuf TokenBuf;
+struct TokenBuf {
+    Token* toks;
+    int len;
+    int cap;
+    TokenNum* nums;
+    int num_len;
+    int num_cap;
+};
+
+static Token* push_token(TokenBuf* tb) {
+    if (tb->len == tb->cap) {
+        tb->cap = tb->cap ? tb->cap * 2 : 256;
+        tb->toks = realloc(tb->toks, sizeof(Token) * tb->cap);
+        if (!tb->toks) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    return &tb->toks[tb->len++];
+}
+
+static TokenNum* push_num(TokenBuf* tb) {
+    if (tb->num_len == tb->num_cap) {
+        tb->num_cap = tb->num_cap ? tb->num_cap * 2 : 64;
+        tb->nums = realloc(tb->nums, sizeof(TokenNum) * tb->num_cap);
+        if (!tb->nums) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    return &tb->nums[tb->num_len++];
+}
+
+static void discard_tokens(TokenBuf* tb) {
+    free(tb->toks);
+    free(tb->nums);
+}
+
+// Stored right after the EOF token of a tokenize() array so free_tokens()
+// can find the start of the allocation from any token
+typedef struct {
+    Token* base;
+} TokenArrayEnd;
+
+/**
+ * Move tokens and numeric payloads into a single allocation
+ *
+ * The token array is followed by a TokenArrayEnd and then the payloads.
+ */
+static Token* finish_tokens(TokenBuf* tb) {
+    Token* toks = realloc(tb->toks, sizeof(Token) * tb->len +
+                                        sizeof(TokenArrayEnd) +
+                                        sizeof(TokenNum) * tb->num_len);
+    if (!toks) {
+        perror("realloc");
         exit(1);
     }
+    TokenArrayEnd* end = (TokenArrayEnd*)(toks + tb->len);
+    end->base = toks;
+    TokenNum* nums = (TokenNum*)(end + 1);
+    if (tb->num_len > 0) {
+        memcpy(nums, tb->nums, sizeof(TokenNum) * tb->num_len);
+    }
+    free(tb->nums);
+
+    int k = 0;
+    for (int i = 0; i < tb->len; i++) {
+        if (toks[i].kind == TK_NUM) {
+            toks[i].num = &nums[k++];
+        }
+    }
+    return toks;
+}
+
+// Running line/column cursor. Token positions only move forward, so each
+// lookup scans just the bytes consumed since the previous one instead of
+// rescanning from the start of the buffer.
+typedef struct LineCursor LineCursor;
+struct LineCursor {
+    const char* pos;
+    const char* line_start;
+    int line;
+};
+
+static void cursor_init(LineCursor* lc, const char* source) {
+    lc->pos = source;
+    lc->line_start = source;
+    lc->line = 1;
+}
+
+static void cursor_get_line_col(LineCursor* lc, const char* pos, int* line,
+                                int* col) {
+    const char* p = lc->pos;
+    while (p < pos) {
+        const char* nl = scan_line_end(p, pos);
+        if (nl == pos) {
+            break;
+        }
+        lc->line++;
+        lc->line_start = nl + 1;
+        p = nl + 1;
+    }
+    if (pos > lc->pos) {
+        lc->pos = pos;
+    }
+    *line = lc->line;
+    *col = (int)(lc->pos - lc->line_start) + 1;
+}
+
+// Read position of a lexer: the rest of the input and its line cursor
+typedef struct LexState LexState;
+struct LexState {
+    const char* p;
+    const char* end;
+    LineCursor lc;
+    Arena* arena;  // Owns decoded string literals; NULL for ast_alloc()
+    bool detached; // On a worker thread: no interning, no error output
+};
+
+static void lex_init(LexState* ls, const char* p, const char* end) {
+    memset(ls, 0, sizeof(LexState));
+    ls->p = p;
+    ls->end = end;
+    cursor_init(&ls->lc, p);
+}
+
+static void lex_error(LexState* ls, const char* pos, const char* msg) {
+    if (ls->detached) {
+        return;
+    }
+    int line = 0;
+    int col = 0;
+    cursor_get_line_col(&ls->lc, pos, &line, &col);
+    fprintf(stderr, "lex error:%d:%d: %s\n", line, col, msg);
+}
+
+static void set_token(Token* tok, TokenKind kind, const char* str, int len,
+                      LineCursor* lc, const char* pos) {
     tok->kind = kind;
-    tok->val = 0;
-    tok->uval = 0;
-    tok->fval = 0;
-    tok->str = str;
     tok->len = len;
-    tok->line = 0;
-    tok->col = 0;
-    cur->next = tok;
-    if (lex_debug) {
-        print_token(kind, str, len, tok->val);
-    }
-    return tok;
+    tok->sym = 0;
+    tok->str = str;
+    tok->num = NULL;
+    cursor_get_line_col(lc, pos, &tok->line, &tok->col);
 }
 
-static Token* new_token_at(TokenKind kind, Token* cur, const char* str, int len,
-                           const char* source, const char* pos) {
-    Token* tok = new_token(kind, cur, str, len);
-    lex_get_line_col(source, pos, &tok->line, &tok->col);
-    return tok;
+static TokenNum* set_num(Token* tok, TokenNum* num) {
+    memset(num, 0, sizeof(TokenNum));
+    tok->num = num;
+    return num;
 }
 
 /**
- * Tokenize a string into a linked list of tokens
+ * Lex the next token of the input
  *
- * @param[in] p The input string to be tokenized
- * @return Pointer to the head of the token linked list
+ * Skips whitespace and comments, then fills in one token. At the end of the
+ * input a TK_EOF token is produced, and again on every further call. The
+ * input may stop short of its NUL terminator as long as it ends right after
+ * a newline that is outside any comment or literal.
+ *
+ * @param[in,out] ls Read position, advanced past the token
+ * @param[out] tok Token to fill in
+ * @param[out] num Storage for the numeric payload; tok->num points here
+ * when the token is TK_NUM
+ * @return true on success, false on a lex error (already reported)
  */
-Token* tokenize(const char* p) {
-    const char* source = p;
-    // Initialize head and tail pointers for the token linked list
-    Token head;
-    head.next = NULL;
-    Token* cur = &head;
-    lex_debug = getenv("DEBUG_TOKENS") != NULL;
+static bool lex_token(LexState* ls, Token* tok, TokenNum* num) {
+    const char* p = ls->p;
+    const char* end = ls->end;
+    LineCursor* lc = &ls->lc;
 
-    // Iterate through the input string until null terminator
-    while (*p) {
+    while (p < end) {
         if (isspace(*p)) {
-            p++;
+            p = scan_skip_space(p);
             continue;
         }
 
         // Skip line comments
-        if (strncmp(p, "//", 2) == 0) {
-            p += 2;
-            while (*p && *p != '\n')
-                p++;
+        if (p[0] == '/' && p[1] == '/') {
+            p = scan_line_end(p + 2, end);
             continue;
         }
 
         // Skip block comments
-        if (strncmp(p, "/*", 2) == 0) {
-            const char* q = strstr(p + 2, "*/");
+        if (p[0] == '/' && p[1] == '*') {
+            const char* q = scan_comment_end(p + 2, end);
             if (!q) {
-                int line = 0;
-                int col = 0;
-                lex_get_line_col(source, p, &line, &col);
-                fprintf(stderr, "lex error:%d:%d: unterminated block comment\n",
-                        line, col);
-                return NULL;
+                lex_error(ls, p, "unterminated block comment");
+                return false;
             }
             p = q + 2;
             continue;
         }
+        break;
+    }
 
-        // Check for keywords
-        bool keyword_matched = false;
-        for (int i = 0; i < NUM_KEYWORDS; i++) {
-            if (strncmp(p, kw_str[i], kw_len[i]) == 0 &&
-                !is_alnum(p[kw_len[i]])) {
-                cur = new_token_at(TK_RESERVED, cur, p, kw_len[i], source, p);
-                p += kw_len[i];
-                keyword_matched = true;
-                break;
-            }
+    if (p >= end) {
+        // Whitespace skipping may run past the end of a chunk
+        p = end;
+        set_token(tok, TK_EOF, p, 0, lc, p);
+        ls->p = p;
+        return true;
+    }
+
+    // Identifier or keyword
+    if (('a' <= *p && *p <= 'z') || ('A' <= *p && *p <= 'Z') || *p == '_') {
+        const char* start = p;
+        while (is_alnum(*p)) {
+            p++;
         }
-        if (keyword_matched) {
-            continue;
+        int len = (int)(p - start);
+        if (is_keyword(start, len)) {
+            set_token(tok, TK_RESERVED, start, len, lc, start);
+        } else {
+            set_token(tok, TK_IDENT, start, len, lc, start);
+            if (!ls->detached) {
+                tok->sym = intern(start, len);
+            }
         }
+        ls->p = p;
+        return true;
+    }
 
-        // Check for three-character operators (ellipsis)
-        bool three_char_matched = false;
-        for (int i = 0; i < NUM_THREE_CHAR_OPS; i++) {
-            if (strncmp(p, three_char_ops[i], 3) == 0) {
-                cur = new_token_at(TK_RESERVED, cur, p, 3, source, p);
-                p += 3;
-                three_char_matched = true;
-                break;
+    // Operators and delimiters
+    int plen = punct_len(p);
+    if (plen > 0) {
+        set_token(tok, TK_RESERVED, p, plen, lc, p);
+        ls->p = p + plen;
+        return true;
+    }
+
+    // String literal
+    if (*p == '"') {
+        p++; // skip opening quote
+        // Decoded text is never longer than the raw literal body
+        const char* q = p;
+        while (*q && *q != '"') {
+            q = scan_string_stop(q, '"');
+            if (*q == '\\' && q[1])
+                q += 2;
+            else if (*q == '\\' || *q == '\n')
+                q++;
+        }
+        size_t cap = (size_t)(q - p) + 1;
+        char* decoded;
+        if (ls->arena)
+            decoded = arena_alloc(ls->arena, cap);
+        else
+            decoded = ast_alloc(cap);
+        size_t len = 0;
+        while (*p && *p != '"') {
+            const char* stop = scan_string_stop(p, '"');
+            memcpy(decoded + len, p, (size_t)(stop - p));
+            len += (size_t)(stop - p);
+            p = stop;
+            if (*p == '\\') {
+                p++;
+                decoded[len++] = decode_escape_char(&p);
+            } else if (*p == '\n') {
+                decoded[len++] = *p;
+                p++;
             }
         }
-        if (three_char_matched) {
-            continue;
+        if (*p != '"') {
+            lex_error(ls, p, "unterminated string literal");
+            return false;
         }
+        set_token(tok, TK_STR, decoded, (int)len, lc, p);
+        ls->p = p + 1; // skip closing quote
+        return true;
+    }
 
-        // Check for two-character operators
-        bool two_char_matched = false;
-        for (int i = 0; i < NUM_TWO_CHAR_OPS; i++) {
-            if (strncmp(p, two_char_ops[i], 2) == 0) {
-                cur = new_token_at(TK_RESERVED, cur, p, 2, source, p);
-                p += 2;
-                two_char_matched = true;
-                break;
-            }
+    // Character literal
+    if (*p == '\'') {
+        p++; // skip '
+        int val;
+        if (*p == '\\') {
+            p++;
+            val = decode_escape_char(&p);
+        } else {
+            val = *p++;
         }
-        if (two_char_matched) {
-            continue;
+
+        if (*p != '\'') {
+            lex_error(ls, p, "unterminated character literal");
+            return false;
         }
+        p++; // skip closing '
+        set_token(tok, TK_NUM, p - 2, 1, lc, p - 2);
+        set_num(tok, num);
+        num->uval = (unsigned long long)(long long)val;
+        num->type = NUM_INT;
+        // Length 0 keeps consume() from matching the literal as punctuation;
+        // expect_number() reads num->uval
+        tok->len = 0;
+        ls->p = p;
+        return true;
+    }
 
-        // Check for single-character operators and delimiters
-        char* single_char_ops = "+-*/()<>;={},&|[].!:=?%^~\0";
-        if (strchr(single_char_ops, *p)) {
-            cur = new_token_at(TK_RESERVED, cur, p, 1, source, p);
-            p++;
-            continue;
+    // Numeric constant
+    if (isdigit(*p) || (*p == '.' && isdigit(p[1]))) {
+        const char* start = p;
+        const char* err = NULL;
+        p = read_number(start, num, &err);
+        if (!p) {
+            lex_error(ls, start, err);
+            return false;
         }
+        set_token(tok, TK_NUM, start, (int)(p - start), lc, start);
+        tok->num = num;
+        ls->p = p;
+        return true;
+    }
+
+    // Error
+    char msg[32];
+    snprintf(msg, sizeof(msg), "invalid character '%c'", *p);
+    lex_error(ls, p, msg);
+    return false;
+}
+
+/**
+ * Lex everything from a read position into a token buffer
+ *
+ * @param[in,out] ls Read position
+ * @param[in,out] tb Buffer receiving the tokens, ending with TK_EOF
+ * @param[in] debug Print each token as it is lexed
+ * @return true on success, false on a lex error
+ */
+static bool lex_all(LexState* ls, TokenBuf* tb, bool debug) {
+    for (;;) {
+        Token* tok = push_token(tb);
+        TokenNum num;
+        if (!lex_token(ls, tok, &num)) {
+            return false;
+        }
+        if (debug) {
+            print_token(tok->kind, tok->str, tok->len, 0);
+        }
+        if (tok->kind == TK_NUM) {
+            *push_num(tb) = num;
+        }
+        if (tok->kind == TK_EOF) {
+            return true;
+        }
+    }
+}
 
-        // String literal
-        if (*p == '"') {
-            p++; // skip opening quote
-            size_t cap = strlen(p) + 1;
-            char* decoded = calloc(cap, 1);
-            if (!decoded) {
-                perror("calloc");
-                return NULL;
+static Token* tokenize_serial(const char* p, const char* end) {
+    LexState ls;
+    lex_init(&ls, p, end);
+    TokenBuf tb;
+    memset(&tb, 0, sizeof(tb));
+    if (!lex_all(&ls, &tb, lex_debug)) {
+        discard_tokens(&tb);
+        return NULL;
+    }
+    return finish_tokens(&tb);
+}
+
+// Smallest chunk worth handing to a worker thread
+#define LEX_CHUNK_MIN (256 * 1024)
+#define LEX_MAX_THREADS 64
+
+/**
+ * Find the next position where the input can be split for lexing
+ *
+ * Follows the same comment and literal rules as lex_token() so that a
+ * split never falls inside a token, comment or literal.
+ *
+ * @param[in] p Safe split position to scan from
+ * @param[in] target Earliest acceptable split position
+ * @param[in] end End of the input
+ * @return Position just after the first newline at or after target that is
+ * outside comments and literals, or end if there is none
+ */
+static const char* next_split(const char* p, const char* target,
+                              const char* end) {
+    while (p < end) {
+        p += strcspn(p, "\n/\"'");
+        if (p >= end) {
+            break;
+        }
+        if (*p == '\n') {
+            if (p >= target) {
+                return p + 1;
+            }
+            p++;
+        } else if (p[0] == '/' && p[1] == '/') {
+            p = scan_line_end(p + 2, end);
+        } else if (p[0] == '/' && p[1] == '*') {
+            const char* q = scan_comment_end(p + 2, end);
+            if (!q) {
+                break;
             }
-            size_t len = 0;
+            p = q + 2;
+        } else if (*p == '/') {
+            p++;
+        } else if (*p == '"') {
+            p++;
             while (*p && *p != '"') {
-                if (*p == '\\') {
+                p = scan_string_stop(p, '"');
+                if (*p == '\\' && p[1])
+                    p += 2;
+                else if (*p == '\\' || *p == '\n')
                     p++;
-                    decoded[len++] = decode_escape_char(&p);
-                    continue;
-                }
-                decoded[len++] = *p;
-                p++;
             }
-            if (*p != '"') {
-                int line = 0;
-                int col = 0;
-                lex_get_line_col(source, p, &line, &col);
-                fprintf(stderr,
-                        "lex error:%d:%d: unterminated string literal\n", line,
-                        col);
-                return NULL;
+            if (*p) {
+                p++;
             }
-            cur = new_token_at(TK_STR, cur, decoded, (int)len, source, p);
-            p++; // skip closing quote
-            continue;
-        }
-
-        // Character literal
-        if (*p == '\'') {
-            p++; // skip '
-            int val;
+        } else {
+            // Character literal
+            p++;
             if (*p == '\\') {
                 p++;
-                val = decode_escape_char(&p);
-            } else {
-                val = *p++;
+                decode_escape_char(&p);
+            } else if (*p) {
+                p++;
             }
-
-            if (*p != '\'') {
-                int line = 0;
-                int col = 0;
-                lex_get_line_col(source, p, &line, &col);
-                fprintf(stderr,
-                        "lex error:%d:%d: unterminated character literal\n",
-                        line, col);
-                return NULL;
+            if (*p == '\'') {
+                p++;
             }
-            p++; // skip closing '
-            cur = new_token_at(TK_NUM, cur, p - 2, 1, source, p - 2);
-            cur->val = val;
-            cur->uval = (unsigned long long)(unsigned int)val;
-            cur->len =
-                0; // Still use 0 to avoid consume() matching, but wait...
-            // Let's use actual length 1 and pointed at the char but it's
-            // complex. Actually, the best way is to not use len=0 if it's a
-            // valid token. For TK_NUM, expect_number() uses cur->val. So
-            // kind=TK_NUM, len=0 is fine IF nobody uses len to match it. Wait,
-            // the previous logic was creating a SECOND token!
-            continue;
         }
+    }
+    return end;
+}
 
-        // Hexadecimal floating-point or integer constant (C99)
-        if (strncmp(p, "0x", 2) == 0 || strncmp(p, "0X", 2) == 0) {
-            const char* start = p;
-            p += 2;
+// One slice of the input lexed by a worker thread
+typedef struct LexChunk LexChunk;
+struct LexChunk {
+    const char* start;
+    const char* end;
+    TokenBuf tb;
+    Arena arena; // Decoded string literals of this chunk
+    bool ok;
+};
 
-            bool has_dot = false;
-            while (isxdigit(*p))
-                p++;
-            if (*p == '.') {
-                has_dot = true;
-                p++;
-                while (isxdigit(*p))
-                    p++;
-            }
-
-            // Hex float must have exponent 'p' or 'P'
-            if (*p == 'p' || *p == 'P') {
-                p++;
-                if (*p == '+' || *p == '-')
-                    p++;
-                while (isdigit(*p))
-                    p++;
+static void* lex_chunk(void* arg) {
+    LexChunk* c = arg;
+    LexState ls;
+    lex_init(&ls, c->start, c->end);
+    ls.arena = &c->arena;
+    ls.detached = true;
+    c->ok = lex_all(&ls, &c->tb, false);
+    return NULL;
+}
 
-                // Optional suffix
-                if (*p == 'l' || *p == 'L' || *p == 'f' || *p == 'F') {
-                    p++;
-                }
+/**
+ * Concatenate the chunk token buffers into one
+ *
+ * Drops the EOF token of every chunk but the last, shifts line numbers by
+ * the lines of the preceding chunks, and interns identifiers, which the
+ * workers leave to this single-threaded pass.
+ */
+static Token* merge_chunks(LexChunk* chunks, int n) {
+    TokenBuf tb;
+    memset(&tb, 0, sizeof(tb));
+    for (int i = 0; i < n; i++) {
+        tb.cap += chunks[i].tb.len - 1;
+        tb.num_cap += chunks[i].tb.num_len;
+    }
+    tb.cap++;
+    tb.toks = malloc(sizeof(Token) * tb.cap);
+    tb.nums = malloc(sizeof(TokenNum) * (tb.num_cap + 1));
+    if (!tb.toks || !tb.nums) {
+        perror("malloc");
+        exit(1);
+    }
 
-                cur =
-                    new_token_at(TK_NUM, cur, start, p - start, source, start);
-                cur->is_float = true;
-                cur->fval = strtod(start, NULL);
-                continue;
+    int line_base = 0;
+    for (int i = 0; i < n; i++) {
+        TokenBuf* src = &chunks[i].tb;
+        int count = i == n - 1 ? src->len : src->len - 1;
+        for (int k = 0; k < count; k++) {
+            Token* tok = &tb.toks[tb.len++];
+            *tok = src->toks[k];
+            tok->line += line_base;
+            if (tok->kind == TK_IDENT) {
+                tok->sym = intern(tok->str, tok->len);
             }
-
-            // Not a hex float. If it had a dot, we backtrack to before the dot
-            // to treat it as a hex integer followed by a dot.
-            if (has_dot) {
-                p = start + 2;
-                while (isxdigit(*p))
-                    p++;
+            if (lex_debug) {
+                print_token(tok->kind, tok->str, tok->len, 0);
             }
+        }
+        memcpy(tb.nums + tb.num_len, src->nums,
+               sizeof(TokenNum) * src->num_len);
+        tb.num_len += src->num_len;
+        // The chunk's EOF sits after its last newline
+        line_base += src->toks[src->len - 1].line - 1;
+        discard_tokens(src);
+        ast_adopt(&chunks[i].arena);
+    }
+    return finish_tokens(&tb);
+}
 
-            // Hex integer
-            cur = new_token_at(TK_NUM, cur, start, p - start, source, start);
-            cur->is_float = false;
-            cur->uval = strtoull(start, NULL, 16);
-            cur->fval = (double)cur->uval;
-            if (cur->uval <= (unsigned long long)LLVM7_INT_MAX) {
-                cur->val = (int)cur->uval;
-            } else {
-                cur->val = LLVM7_INT_MAX;
-            }
+/**
+ * Tokenize a string by lexing slices of it on several threads
+ *
+ * The result is identical to single-threaded lexing. If any slice fails to
+ * lex, the whole input is lexed again on the calling thread so that the
+ * error is reported exactly as tokenize() would.
+ *
+ * @param[in] p The input string to be tokenized
+ * @param[in] nthreads Maximum number of threads to use
+ * @return Pointer to the first token of a TK_EOF-terminated token array, or
+ * NULL on error
+ */
+Token* tokenize_parallel(const char* p, int nthreads) {
+    const char* end = p + strlen(p);
+    lex_debug = getenv("DEBUG_TOKENS") != NULL;
+    if (nthreads > LEX_MAX_THREADS) {
+        nthreads = LEX_MAX_THREADS;
+    }
+    if (nthreads < 2) {
+        return tokenize_serial(p, end);
+    }
 
-            // Optional integer suffixes
-            while (*p == 'u' || *p == 'U' || *p == 'l' || *p == 'L') {
-                if (*p == 'u' || *p == 'U')
-                    cur->is_unsigned = true;
-                p++;
-            }
-            cur->len = (int)(p - start);
-            continue;
+    LexChunk* chunks = calloc((size_t)nthreads, sizeof(LexChunk));
+    if (!chunks) {
+        perror("calloc");
+        exit(1);
+    }
+    size_t step = (size_t)(end - p) / (size_t)nthreads;
+    int n = 0;
+    const char* start = p;
+    while (start < end) {
+        const char* stop = end;
+        if (n < nthreads - 1) {
+            stop = next_split(start, start + step, end);
         }
+        chunks[n].start = start;
+        chunks[n].end = stop;
+        n++;
+        start = stop;
+    }
+    if (n < 2) {
+        free(chunks);
+        return tokenize_serial(p, end);
+    }
 
-        // Number
-        if (isdigit(*p) || (*p == '.' && isdigit(p[1]))) {
-            const char* start = p;
-            bool is_float = false;
-            if (*p == '.') {
-                is_float = true;
-                p++;
-                while (isdigit(*p)) {
-                    p++;
-                }
-            } else {
-                while (isdigit(*p)) {
-                    p++;
-                }
-                if (*p == '.') {
-                    is_float = true;
-                    p++;
-                    while (isdigit(*p)) {
-                        p++;
-                    }
-                }
-            }
-            if (*p == 'e' || *p == 'E') {
-                is_float = true;
-                p++;
-                if (*p == '+' || *p == '-') {
-                    p++;
-                }
-                while (isdigit(*p)) {
-                    p++;
-                }
-            }
-            if (*p == 'f' || *p == 'F') {
-                is_float = true;
-                p++;
-            }
-            cur = new_token_at(TK_NUM, cur, start, p - start, source, start);
-            cur->is_float = is_float;
-            if (is_float) {
-                cur->fval = strtod(start, NULL);
-            } else {
-                cur->uval = strtoull(start, NULL, 10);
-                cur->fval = (double)cur->uval;
-                if (cur->uval <= (unsigned long long)LLVM7_INT_MAX) {
-                    cur->val = (int)cur->uval;
-                } else {
-                    cur->val = LLVM7_INT_MAX;
-                }
-            }
-            if (!is_float && (*p == 'u' || *p == 'U')) {
-                cur->is_unsigned = true;
-                p++;
-            }
-            if (!is_float) {
-                while (*p == 'l' || *p == 'L') {
-                    p++;
-                }
-            }
-            cur->len = (int)(p - start);
-            continue;
+    pthread_t threads[LEX_MAX_THREADS];
+    for (int i = 1; i < n; i++) {
+        if (pthread_create(&threads[i], NULL, lex_chunk, &chunks[i]) != 0) {
+            perror("pthread_create");
+            exit(1);
         }
+    }
+    lex_chunk(&chunks[0]);
+    bool ok = chunks[0].ok;
+    for (int i = 1; i < n; i++) {
+        pthread_join(threads[i], NULL);
+        ok = ok && chunks[i].ok;
+    }
 
-        // Identifier
-        if (('a' <= *p && *p <= 'z') || ('A' <= *p && *p <= 'Z') || *p == '_') {
-            const char* start = p;
-            while (('a' <= *p && *p <= 'z') || ('A' <= *p && *p <= 'Z') ||
-                   ('0' <= *p && *p <= '9') || *p == '_') {
-                p++;
-            }
-            cur = new_token_at(TK_IDENT, cur, start, p - start, source, start);
-            continue;
+    if (!ok) {
+        for (int i = 0; i < n; i++) {
+            discard_tokens(&chunks[i].tb);
+            arena_free(&chunks[i].arena);
         }
+        free(chunks);
+        return tokenize_serial(p, end);
+    }
+    Token* toks = merge_chunks(chunks, n);
+    free(chunks);
+    return toks;
+}
+
+// Processors available to lex on, at most LEX_MAX_THREADS
+static int lex_cpu_count(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
+        return 1;
+    if (cpus > LEX_MAX_THREADS)
+        return LEX_MAX_THREADS;
+    return (int)cpus;
+}
+
+/**
+ * Check whether tokenize() can split any input across threads here
+ *
+ * @return false if only one processor is available
+ */
+bool lex_can_split(void) { return lex_cpu_count() > 1; }
+
+/**
+ * Get the number of threads tokenize() uses for an input
+ *
+ * @param[in] len Length of the input in bytes
+ * @return Number of threads; 1 if the input is lexed on the calling thread
+ */
+int lex_thread_count(size_t len) {
+    if (len < LEX_PARALLEL_MIN)
+        return 1;
+    int nthreads = lex_cpu_count();
+    if ((size_t)nthreads > len / LEX_CHUNK_MIN) {
+        nthreads = (int)(len / LEX_CHUNK_MIN);
+    }
+    return nthreads;
+}
+
+/**
+ * Tokenize a whole string up front
+ *
+ * Large inputs are split across the available processors.
+ *
+ * @param[in] p The input string to be tokenized
+ * @return Pointer to the first token of a TK_EOF-terminated token array, or
+ * NULL on error
+ */
+Token* tokenize(const char* p) {
+    return tokenize_parallel(p, lex_thread_count(strlen(p)));
+}
 
-        // Error
-        int line = 0;
-        int col = 0;
-        lex_get_line_col(source, p, &line, &col);
-        fprintf(stderr, "lex error:%d:%d: invalid character '%c'\n", line, col,
-                *p);
+// Number of tokens held by a Lexer. This bounds how far the parser can peek
+// ahead, and a consumed token stays valid until LEX_WINDOW - 1 more tokens
+// have been lexed; use keep_token() for tokens that must live longer.
+#define LEX_WINDOW 64
+
+// Pull-mode lexer: tokens are lexed on demand into a ring of LEX_WINDOW
+// slots, so only the lookahead window is resident instead of the whole
+// token array
+struct Lexer {
+    LexState state;
+    Preprocessor* pp; // Source of the tokens, or NULL to lex state
+    Token* toks;      // Ring of LEX_WINDOW tokens
+    TokenNum* nums;   // Numeric values of toks, slot for slot
+    int head;         // Slot of the current token
+    int ahead;        // Tokens already lexed, starting at head
+};
+
+// The ring is allocated on its own: the self-hosted compiler cannot yet
+// index arrays that are struct members
+static Lexer* alloc_lexer(void) {
+    Lexer* lx = calloc(1, sizeof(Lexer));
+    Token* toks = calloc(LEX_WINDOW, sizeof(Token));
+    TokenNum* nums = calloc(LEX_WINDOW, sizeof(TokenNum));
+    if (!lx || !toks || !nums) {
+        perror("calloc");
+        exit(1);
+    }
+    lx->toks = toks;
+    lx->nums = nums;
+    return lx;
+}
+
+/**
+ * Create a pull-mode lexer over a string
+ *
+ * @param[in] p The input string; must outlive the lexer and its tokens
+ * @return New lexer positioned before the first token
+ */
+Lexer* lexer_new(const char* p) {
+    Lexer* lx = alloc_lexer();
+    lex_init(&lx->state, p, p + strlen(p));
+    lex_debug = getenv("DEBUG_TOKENS") != NULL;
+    return lx;
+}
+
+/**
+ * Create a pull-mode lexer over the tokens of a preprocessor
+ *
+ * Each preprocessing token is turned into a token as the parser asks for
+ * it, so the translation unit is never held as text.
+ *
+ * @param[in] pp Preprocessor; must outlive the lexer and its tokens
+ * @return New lexer positioned before the first token
+ */
+Lexer* lexer_new_preprocessed(Preprocessor* pp) {
+    Lexer* lx = alloc_lexer();
+    lx->pp = pp;
+    lex_debug = getenv("DEBUG_TOKENS") != NULL;
+    return lx;
+}
+
+void lexer_free(Lexer* lx) {
+    if (!lx)
+        return;
+    free(lx->toks);
+    free(lx->nums);
+    free(lx);
+}
+
+// Lex the next token of a preprocessor; its spelling must make exactly one
+// token
+static bool lex_pp_token(Preprocessor* pp, Token* tok, TokenNum* num) {
+    PPSpelling sp;
+    if (!preprocessor_next(pp, &sp)) {
+        memset(tok, 0, sizeof(Token));
+        tok->kind = TK_EOF;
+        tok->str = "";
+        return true;
+    }
+    LexState ls;
+    lex_init(&ls, sp.str, sp.str + sp.len);
+    ls.lc.line = sp.line;
+    if (!lex_token(&ls, tok, num)) {
+        return false;
+    }
+    if (tok->kind == TK_EOF || ls.p != ls.end) {
+        fprintf(stderr, "lex error:%d:%d: invalid token '%.*s'\n", sp.line,
+                sp.col, sp.len, sp.str);
+        return false;
+    }
+    tok->line = sp.line;
+    tok->col = sp.col;
+    return true;
+}
+
+static void lexer_fill(Lexer* lx) {
+    int slot = (lx->head + lx->ahead) % LEX_WINDOW;
+    Token* tok = &lx->toks[slot];
+    bool ok;
+    if (lx->pp) {
+        ok = lex_pp_token(lx->pp, tok, &lx->nums[slot]);
+    } else {
+        ok = lex_token(&lx->state, tok, &lx->nums[slot]);
+    }
+    if (!ok) {
+        exit(1);
+    }
+    if (lex_debug) {
+        print_token(tok->kind, tok->str, tok->len, 0);
+    }
+    lx->ahead++;
+}
+
+/**
+ * Get a token at or after the current one, lexing as needed
+ *
+ * @param[in] lx Lexer
+ * @param[in] n Distance from the current token (0 <= n < LEX_WINDOW)
+ * @return The token; TK_EOF repeats once the input is exhausted
+ */
+Token* lexer_peek(Lexer* lx, int n) {
+    if (n >= LEX_WINDOW) {
+        fprintf(stderr, "lex error: lookahead %d exceeds window\n", n);
+        exit(1);
+    }
+    while (lx->ahead <= n) {
+        lexer_fill(lx);
+    }
+    return &lx->toks[(lx->head + n) % LEX_WINDOW];
+}
+
+/**
+ * Step to the next token
+ *
+ * @param[in] lx Lexer
+ * @return The new current token
+ */
+Token* lexer_advance(Lexer* lx) {
+    lexer_peek(lx, 1);
+    lx->head = (lx->head + 1) % LEX_WINDOW;
+    lx->ahead--;
+    return &lx->toks[lx->head];
+}
+
+/**
+ * Get the token following tok
+ *
+ * @param[in] tok Token in an array returned by tokenize()
+ * @return The next token, or NULL if tok is the EOF token
+ */
+Token* next_token(Token* tok) {
+    if (tok->kind == TK_EOF) {
         return NULL;
     }
+    return tok + 1;
+}
 
-    new_token_at(TK_EOF, cur, p, 0, source, p);
-    return head.next;
+/**
+ * Advance the parser to the next token
+ *
+ * @param[in] ctx Context whose current token is replaced by its successor,
+ * pulled from ctx->lexer when one is attached
+ */
+void advance_token(Context* ctx) {
+    if (ctx->lexer) {
+        ctx->current_token = lexer_advance(ctx->lexer);
+    } else {
+        ctx->current_token = ctx->current_token + 1;
+    }
+}
+
+/**
+ * Look ahead of the current token
+ *
+ * @param[in] ctx Context containing current token
+ * @param[in] n Distance from the current token
+ * @return The token n positions ahead, or NULL if EOF comes first
+ */
+Token* peek_token(Context* ctx, int n) {
+    Token* tok = ctx->current_token;
+    for (int i = 0; i < n; i++) {
+        if (tok->kind == TK_EOF) {
+            return NULL;
+        }
+        if (ctx->lexer)
+            tok = lexer_peek(ctx->lexer, i + 1);
+        else
+            tok++;
+    }
+    return tok;
 }
 
 /**
- * Free a linked list of tokens
+ * Make a token outlive the lexer window
  *
- * @param[in] head Pointer to the head of the token linked list to free
+ * @param[in] ctx Context the token came from
+ * @param[in] tok Token to keep
+ * @return tok itself for tokenize() arrays, otherwise an arena copy
  */
-void free_tokens(Token* head) {
-    Token* curr = head;
-    while (curr != NULL) {
-        Token* next = curr->next;
-        free(curr);
-        curr = next;
+Token* keep_token(Context* ctx, Token* tok) {
+    if (!ctx->lexer) {
+        return tok;
+    }
+    Token* kept = ast_alloc(sizeof(Token));
+    *kept = *tok;
+    if (tok->num) {
+        kept->num = ast_alloc(sizeof(TokenNum));
+        *kept->num = *tok->num;
+    }
+    return kept;
+}
+
+/**
+ * Free a token array returned by tokenize()
+ *
+ * @param[in] tok Any token in the array; the whole array is released
+ */
+void free_tokens(Token* tok) {
+    if (tok == NULL) {
+        return;
+    }
+    while (tok->kind != TK_EOF) {
+        tok++;
     }
+    TokenArrayEnd* end = (TokenArrayEnd*)(tok + 1);
+    free(end->base);
 }
 
 /**
@@ -517,7 +1059,7 @@ bool consume(Context* ctx, char* op) {
         memcmp(ctx->current_token->str, op, ctx->current_token->len)) {
         return false;
     }
-    ctx->current_token = ctx->current_token->next;
+    advance_token(ctx);
     return true;
 }
 
@@ -533,9 +1075,10 @@ Token* consume_ident(Context* ctx) {
     if (ctx->current_token->kind != TK_IDENT) {
         return NULL;
     }
-    // Store current token and advance to the next token
-    Token* t = ctx->current_token;
-    ctx->current_token = ctx->current_token->next;
+    // Keep the token beyond the lexer window, since callers store
+    // identifiers in the AST, and advance to the next token
+    Token* t = keep_token(ctx, ctx->current_token);
+    advance_token(ctx);
     return t;
 }
 
@@ -564,15 +1107,20 @@ int expect_number(Context* ctx) {
         // Exit the program with an error status
         exit(1);
     }
-    if (ctx->current_token->uval > (unsigned long long)LLVM7_INT_MAX) {
+    // Callers need an int. Literals of type int always fit, including
+    // negative character constants such as '\xff'.
+    TokenNum* num = ctx->current_token->num;
+    bool is_integer = num->type != NUM_FLOAT && num->type != NUM_DOUBLE;
+    if (!is_integer || (num->type != NUM_INT &&
+                        num->uval > (unsigned long long)LLVM7_INT_MAX)) {
         fprintf(stderr,
                 "lex error:%d:%d: integer literal out of range for int\n",
                 ctx->current_token->line, ctx->current_token->col);
         exit(1);
     }
     // Return the value of the number token
-    int val = ctx->current_token->val;
-    ctx->current_token = ctx->current_token->next;
+    int val = (int)num->uval;
+    advance_token(ctx);
     return val;
 }
 
@@ -2,12 +2,27 @@
 #define __LEX_H__
 
 #include "common.h"
+#include "preprocess.h"
+
+// Inputs shorter than this are lexed on the calling thread
+#define LEX_PARALLEL_MIN (1 << 20)
 
-extern Token* new_token(TokenKind kind, Token* cur, const char* str, int len);
 extern Token* tokenize(const char* p);
+extern Token* tokenize_parallel(const char* p, int nthreads);
+extern bool lex_can_split(void);
+extern int lex_thread_count(size_t len);
+extern Token* next_token(Token* tok);
+extern Lexer* lexer_new(const char* p);
+extern Lexer* lexer_new_preprocessed(Preprocessor* pp);
+extern Token* lexer_peek(Lexer* lx, int n);
+extern Token* lexer_advance(Lexer* lx);
+extern void lexer_free(Lexer* lx);
 extern void lex_get_line_col(const char* source, const char* pos, int* line,
                              int* col);
-extern void free_tokens(Token* head);
+extern void free_tokens(Token* tok);
+extern void advance_token(Context* ctx);
+extern Token* peek_token(Context* ctx, int n);
+extern Token* keep_token(Context* ctx, Token* tok);
 extern bool consume(Context* ctx, char* op);
 extern Token* consume_ident(Context* ctx);
 extern void expect(Context* ctx, char* op);
@@ -0,0 +1,347 @@
+#include "literal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define LITERAL_INT_MAX 2147483647ULL
+#define LITERAL_UINT_MAX 4294967295ULL
+#define LITERAL_LLONG_MAX 9223372036854775807ULL
+#define LITERAL_ULLONG_MAX 18446744073709551615ULL
+
+// Largest mantissa a double represents exactly (2^53)
+#define EXACT_DOUBLE_MAX 9007199254740992ULL
+// Largest mantissa a float represents exactly (2^24)
+#define EXACT_FLOAT_MAX 16777216ULL
+
+// 10^n for 0 <= n <= 22. Every intermediate product is exact in a double,
+// so this is exact as well.
+static double exact_pow10(int n) {
+    double d = 1.0;
+    for (int i = 0; i < n; i++) {
+        d = d * 10.0;
+    }
+    return d;
+}
+
+static int digit_value(char c) {
+    if ('0' <= c && c <= '9')
+        return c - '0';
+    if ('a' <= c && c <= 'f')
+        return c - 'a' + 10;
+    if ('A' <= c && c <= 'F')
+        return c - 'A' + 10;
+    return 99;
+}
+
+/**
+ * Decode the escape sequence after a backslash
+ *
+ * @param[in,out] pp Character after the backslash; advanced past the
+ *                sequence
+ * @return Value of the escaped character
+ */
+char decode_escape_char(const char** pp) {
+    const char* p = *pp;
+    if (*p == 'n') {
+        *pp = p + 1;
+        return '\n';
+    }
+    if (*p == 'r') {
+        *pp = p + 1;
+        return '\r';
+    }
+    if (*p == 't') {
+        *pp = p + 1;
+        return '\t';
+    }
+    if (*p == 'a') {
+        *pp = p + 1;
+        return '\a';
+    }
+    if (*p == 'b') {
+        *pp = p + 1;
+        return '\b';
+    }
+    if (*p == 'f') {
+        *pp = p + 1;
+        return '\f';
+    }
+    if (*p == 'v') {
+        *pp = p + 1;
+        return '\v';
+    }
+    if (*p == '\\' || *p == '"' || *p == '\'') {
+        *pp = p + 1;
+        return *p;
+    }
+    if (*p == 'x') {
+        // Hex escape: \xHH (1-2 hex digits)
+        p++;
+        int val = 0;
+        int count = 0;
+        while (count < 2 && digit_value(*p) < 16) {
+            val = val * 16 + digit_value(*p);
+            p++;
+            count++;
+        }
+        *pp = p;
+        return (char)(val & 0xFF);
+    }
+    if ('0' <= *p && *p <= '7') {
+        // Octal escape: \OOO (1-3 octal digits)
+        int val = 0;
+        int count = 0;
+        while (count < 3 && '0' <= *p && *p <= '7') {
+            val = val * 8 + (*p - '0');
+            p++;
+            count++;
+        }
+        *pp = p;
+        return (char)(val & 0xFF);
+    }
+    if (*p == '\0') {
+        return '\0';
+    }
+    *pp = p + 1;
+    return *p;
+}
+
+/**
+ * Pick the C type of an integer constant (C99 6.4.4.1)
+ *
+ * long and long long are both 64 bits, so a value that does not fit int
+ * (or unsigned int) moves straight to a 64-bit type. A decimal constant
+ * without u that does not fit long long becomes unsigned long long, as GCC
+ * and Clang do.
+ */
+static NumType integer_type(unsigned long long v, bool decimal, bool u,
+                            int longs) {
+    if (longs == 0) {
+        if (!u && v <= LITERAL_INT_MAX)
+            return NUM_INT;
+        if ((u || !decimal) && v <= LITERAL_UINT_MAX)
+            return NUM_UINT;
+    }
+    if (!u && v <= LITERAL_LLONG_MAX)
+        return longs == 2 ? NUM_LLONG : NUM_LONG;
+    return longs == 2 ? NUM_ULLONG : NUM_ULONG;
+}
+
+/**
+ * Convert a decimal floating constant
+ *
+ * Uses Clinger's fast path when the decimal mantissa and the power of ten
+ * are both exact in the target format: a single correctly rounded multiply
+ * or divide then gives the correctly rounded result. Everything else goes
+ * through strtod()/strtof().
+ */
+static double decimal_float(const char* start, unsigned long long mant,
+                            int digits, int exp10, bool is_single) {
+    if (digits <= 19) {
+        if (is_single && mant <= EXACT_FLOAT_MAX && exp10 >= -10 &&
+            exp10 <= 10) {
+            float f = (float)mant;
+            float scale = (float)exact_pow10(exp10 < 0 ? -exp10 : exp10);
+            return exp10 < 0 ? (double)(f / scale) : (double)(f * scale);
+        }
+        if (!is_single && mant <= EXACT_DOUBLE_MAX && exp10 >= -22 &&
+            exp10 <= 22) {
+            double d = (double)mant;
+            return exp10 < 0 ? d / exact_pow10(-exp10) : d * exact_pow10(exp10);
+        }
+    }
+    if (is_single) {
+        return (double)strtof(start, NULL);
+    }
+    return strtod(start, NULL);
+}
+
+static const char* read_float_suffix(const char* p, TokenNum* num) {
+    if (*p == 'f' || *p == 'F') {
+        num->type = NUM_FLOAT;
+        return p + 1;
+    }
+    if (*p == 'l' || *p == 'L') {
+        // No long double; treated as double
+        p++;
+    }
+    num->type = NUM_DOUBLE;
+    return p;
+}
+
+// Hexadecimal floating constant; p is just past the "0x" prefix
+static const char* read_hex_float(const char* start, const char* p,
+                                  TokenNum* num, const char** err) {
+    while (digit_value(*p) < 16)
+        p++;
+    if (*p == '.') {
+        p++;
+        while (digit_value(*p) < 16)
+            p++;
+    }
+    // *p is the binary exponent marker
+    p++;
+    if (*p == '+' || *p == '-')
+        p++;
+    if (!('0' <= *p && *p <= '9')) {
+        *err = "exponent has no digits";
+        return NULL;
+    }
+    while ('0' <= *p && *p <= '9')
+        p++;
+    p = read_float_suffix(p, num);
+    if (num->type == NUM_FLOAT) {
+        num->fval = (double)strtof(start, NULL);
+    } else {
+        num->fval = strtod(start, NULL);
+    }
+    return p;
+}
+
+// Decimal floating constant; digits and an optional exponent
+static const char* read_decimal_float(const char* start, TokenNum* num,
+                                      const char** err) {
+    const char* p = start;
+    unsigned long long mant = 0;
+    int digits = 0; // Significant digits accumulated into mant
+    int exp10 = 0;
+    bool seen_dot = false;
+    for (;; p++) {
+        if (*p == '.' && !seen_dot) {
+            seen_dot = true;
+            continue;
+        }
+        if (!('0' <= *p && *p <= '9'))
+            break;
+        if (mant == 0 && *p == '0') {
+            // Leading zeros are not significant
+            if (seen_dot)
+                exp10--;
+            continue;
+        }
+        if (digits < 19) {
+            mant = mant * 10 + (unsigned long long)(*p - '0');
+            if (seen_dot)
+                exp10--;
+        } else if (!seen_dot) {
+            exp10++;
+        }
+        digits++;
+    }
+    if (*p == 'e' || *p == 'E') {
+        p++;
+        int sign = 1;
+        if (*p == '+' || *p == '-') {
+            sign = *p == '-' ? -1 : 1;
+            p++;
+        }
+        if (!('0' <= *p && *p <= '9')) {
+            *err = "exponent has no digits";
+            return NULL;
+        }
+        int e = 0;
+        while ('0' <= *p && *p <= '9') {
+            if (e < 100000)
+                e = e * 10 + (*p - '0');
+            p++;
+        }
+        exp10 += sign * e;
+    }
+    p = read_float_suffix(p, num);
+    num->fval =
+        decimal_float(start, mant, digits, exp10, num->type == NUM_FLOAT);
+    return p;
+}
+
+/**
+ * Parse a numeric constant
+ *
+ * Handles decimal, octal, hexadecimal and binary (0b) integers with any
+ * combination of u/U and l/L/ll/LL suffixes, and decimal and hexadecimal
+ * floating constants with f/F/l/L suffixes. Integers keep their exact
+ * 64-bit value in num->uval; floating constants are stored in num->fval.
+ *
+ * @param[in] p Start of the constant (a digit, or '.' followed by a digit)
+ * @param[out] num Value and C type of the constant
+ * @param[out] err Reason for failure when NULL is returned
+ * @return Pointer just past the constant, or NULL on error
+ */
+const char* read_number(const char* p, TokenNum* num, const char** err) {
+    const char* start = p;
+    memset(num, 0, sizeof(TokenNum));
+
+    int base = 10;
+    if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        // A hex float needs a binary exponent; "0x1." without one is the
+        // integer 0x1 followed by '.'
+        const char* q = p + 2;
+        while (digit_value(*q) < 16)
+            q++;
+        if (*q == '.') {
+            q++;
+            while (digit_value(*q) < 16)
+                q++;
+        }
+        if (*q == 'p' || *q == 'P') {
+            return read_hex_float(start, p + 2, num, err);
+        }
+        base = 16;
+        p += 2;
+    } else if (p[0] == '0' && (p[1] == 'b' || p[1] == 'B') &&
+               (p[2] == '0' || p[2] == '1')) {
+        base = 2;
+        p += 2;
+    } else {
+        const char* q = p;
+        while ('0' <= *q && *q <= '9')
+            q++;
+        // An 'f' directly after the digits is accepted as a float suffix
+        if (*q == '.' || *q == 'e' || *q == 'E' || *q == 'f' || *q == 'F') {
+            return read_decimal_float(start, num, err);
+        }
+        if (p[0] == '0') {
+            base = 8;
+        }
+    }
+
+    const char* digits = p;
+    unsigned long long v = 0;
+    for (; digit_value(*p) < base; p++) {
+        unsigned long long d = (unsigned long long)digit_value(*p);
+        if (v > (LITERAL_ULLONG_MAX - d) / (unsigned long long)base) {
+            *err = "integer constant is too large";
+            return NULL;
+        }
+        v = v * (unsigned long long)base + d;
+    }
+    if (p == digits) {
+        *err = "missing digits in integer constant";
+        return NULL;
+    }
+    if (base == 8 && '0' <= *p && *p <= '9') {
+        *err = "invalid digit in octal constant";
+        return NULL;
+    }
+
+    bool u = false;
+    int longs = 0;
+    for (;;) {
+        if ((*p == 'u' || *p == 'U') && !u) {
+            u = true;
+            p++;
+        } else if (((p[0] == 'l' && p[1] == 'l') ||
+                    (p[0] == 'L' && p[1] == 'L')) &&
+                   longs == 0) {
+            longs = 2;
+            p += 2;
+        } else if ((*p == 'l' || *p == 'L') && longs == 0) {
+            longs = 1;
+            p++;
+        } else {
+            break;
+        }
+    }
+    num->uval = v;
+    num->type = integer_type(v, base == 10, u, longs);
+    return p;
+}
@@ -0,0 +1,9 @@
+#ifndef __LITERAL_H__
+#define __LITERAL_H__
+
+#include "common.h"
+
+extern const char* read_number(const char* p, TokenNum* num, const char** err);
+extern char decode_escape_char(const char** pp);
+
+#endif
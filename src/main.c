@@ -1,22 +1,115 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include "arena.h"
 #include "codegen.h"
 #include "file.h"
 #include "lex.h"
 #include "parse.h"
+#include "pch.h"
 #include "preprocess.h"
 
+/**
+ * Tokenize the preprocessed source without parsing and report throughput
+ *
+ * Uses tokenize(), which lexes large inputs on several threads.
+ *
+ * @param[in] preprocessed Preprocessed source text
+ * @return 0 on success, 1 on lex error
+ */
+static int lex_benchmark(const char* preprocessed) {
+    Arena arena;
+    memset(&arena, 0, sizeof(arena));
+    arena_use(&arena);
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Token* head = tokenize(preprocessed);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (head == NULL) {
+        arena_use(NULL);
+        arena_free(&arena);
+        return 1;
+    }
+
+    int count = 0;
+    for (Token* t = head; t->kind != TK_EOF; t = t + 1) {
+        count++;
+    }
+    double secs = (double)(end.tv_sec - start.tv_sec) +
+                  (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Tokens: %d\n", count);
+    printf("Lex time: %.3f s\n", secs);
+    if (secs > 0) {
+        printf("Tokens/sec: %.0f\n", count / secs);
+    }
+    free_tokens(head);
+    arena_use(NULL);
+    arena_free(&arena);
+    return 0;
+}
+
+/**
+ * Replace the extension of a file name
+ *
+ * @param[in] path File name
+ * @param[in] ext New extension including the dot
+ * @return New file name (caller frees)
+ */
+static char* replace_extension(const char* path, const char* ext) {
+    size_t len = strlen(path);
+    for (size_t i = len; i > 0 && path[i - 1] != '/'; i--) {
+        if (path[i - 1] == '.') {
+            len = i - 1;
+            break;
+        }
+    }
+    char* out = malloc(len + strlen(ext) + 1);
+    if (!out) {
+        perror("malloc");
+        exit(1);
+    }
+    memcpy(out, path, len);
+    strcpy(out + len, ext);
+    return out;
+}
+
 int main(int argc, const char** argv) {
     if (argc < 2) {
-        fprintf(stderr, "Usage: %s <input_file> [-o <output_file>]\n", argv[0]);
+        fprintf(stderr,
+                "Usage: %s <input_file|-> [-o <output_file>] [-E] [-lex-only] "
+                "[-I <dir>] [-isystem <dir>] [-emit-pch] "
+                "[-include-pch <file>] [-MD] [-MF <file>]\n",
+                argv[0]);
+        fprintf(stderr, "  Use - to read the source from stdin\n");
         fprintf(stderr, "  Default output: tmp.ll\n");
+        fprintf(stderr, "  -E: preprocess only (default output: stdout)\n");
+        fprintf(stderr, "  -lex-only: tokenize only and report tokens/sec\n");
+        fprintf(stderr, "  -I <dir>: add a directory to the include path\n");
+        fprintf(stderr,
+                "  -isystem <dir>: add a directory searched after -I\n");
+        fprintf(stderr, "  -emit-pch: precompile the input header "
+                        "(default output: <input>.pch)\n");
+        fprintf(stderr, "  -include-pch <file>: start from a header "
+                        "precompiled with -emit-pch\n");
+        fprintf(stderr, "  -MD: also write a Make dependency rule for the "
+                        "output to <output>.d\n");
+        fprintf(stderr, "  -MF <file>: write the dependency rule to <file> "
+                        "(implies -MD)\n");
         return 1;
     }
 
     const char* input_file = argv[1];
-    const char* output_file = "tmp.ll"; // default
+    const char* output_file = NULL;
+    bool lex_only = false;
+    bool preprocess_only = false;
+    bool emit_pch = false;
+    const char* pch_file = NULL;
+    bool gen_deps = false;
+    const char* deps_file = NULL;
 
     // Parse -o option
     for (int i = 2; i < argc; i++) {
@@ -28,50 +121,216 @@ int main(int argc, const char** argv) {
                 fprintf(stderr, "Error: -o requires a filename argument\n");
                 return 1;
             }
+        } else if (strcmp(argv[i], "-E") == 0) {
+            preprocess_only = true;
+        } else if (strcmp(argv[i], "-lex-only") == 0) {
+            lex_only = true;
+        } else if (strcmp(argv[i], "-emit-pch") == 0) {
+            emit_pch = true;
+        } else if (strcmp(argv[i], "-include-pch") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr,
+                        "Error: -include-pch requires a filename argument\n");
+                return 1;
+            }
+            pch_file = argv[++i];
+        } else if (strcmp(argv[i], "-MD") == 0) {
+            gen_deps = true;
+        } else if (strcmp(argv[i], "-MF") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: -MF requires a filename argument\n");
+                return 1;
+            }
+            gen_deps = true;
+            deps_file = argv[++i];
+        } else if (strncmp(argv[i], "-isystem", 8) == 0 ||
+                   strncmp(argv[i], "-I", 2) == 0) {
+            // Accept both "-Idir" and "-I dir"
+            bool is_system = argv[i][1] == 'i';
+            const char* dir = argv[i] + (is_system ? 8 : 2);
+            if (*dir == '\0') {
+                if (i + 1 >= argc) {
+                    fprintf(stderr, "Error: %s requires a directory argument\n",
+                            argv[i]);
+                    return 1;
+                }
+                dir = argv[++i];
+            }
+            add_include_dir(dir, is_system);
+        }
+    }
+
+    char* pch_output = NULL;
+    if (!output_file && !preprocess_only) {
+        if (emit_pch) {
+            pch_output = malloc(strlen(input_file) + 5);
+            if (!pch_output) {
+                perror("malloc");
+                return 1;
+            }
+            sprintf(pch_output, "%s.pch", input_file);
+            output_file = pch_output;
+        } else {
+            output_file = "tmp.ll"; // default
+        }
+    }
+
+    // The rule is for the file this run produces. As in other compilers,
+    // -E names it after the input: the .ll a compile would write.
+    char* deps_target = NULL;
+    char* deps_output = NULL;
+    if (gen_deps) {
+        if (preprocess_only) {
+            deps_target = replace_extension(input_file, ".ll");
+        } else {
+            deps_target = strdup(output_file);
+            if (!deps_target) {
+                perror("strdup");
+                return 1;
+            }
         }
+        if (!deps_file) {
+            deps_output = replace_extension(deps_target, ".d");
+            deps_file = deps_output;
+        }
+        preprocess_save_deps(deps_file, deps_target);
     }
 
-    const char* source = read_file(input_file);
-    if (source == NULL) {
+    if (pch_file && !load_pch(pch_file)) {
+        fprintf(stderr,
+                "Error: %s is not a valid precompiled header or is out of "
+                "date\n",
+                pch_file);
+        return 1;
+    }
+
+    FileView source;
+    if (!open_file_view(input_file, &source)) {
         printf("Error: could not read file %s\n", input_file);
         return 1;
     }
 
+    if (preprocess_only) {
+        FILE* fp = stdout;
+        if (output_file) {
+            fp = fopen(output_file, "w");
+            if (!fp) {
+                perror(output_file);
+                return 1;
+            }
+        }
+        preprocess_to_file(source.data, input_file, fp);
+        close_file_view(&source);
+        free(deps_target);
+        free(deps_output);
+        close_pch();
+        int rc = output_file ? fclose(fp) : fflush(fp);
+        if (rc != 0) {
+            perror(output_file ? output_file : "stdout");
+            return 1;
+        }
+        return 0;
+    }
+
+    PchBuf pch_state;
+    memset(&pch_state, 0, sizeof(pch_state));
+    if (emit_pch)
+        preprocess_save_pch(&pch_state);
+
+    char* preprocessed = NULL;
+    if (lex_only) {
+        preprocessed = preprocess(source.data, input_file);
+        close_file_view(&source);
+        free(deps_target);
+        free(deps_output);
+        int rc = lex_benchmark(preprocessed);
+        free(preprocessed);
+        return rc;
+    }
+
     // printf("Compiling: %s\n", source);
     printf("Output: %s\n\n", output_file);
 
-    // Preprocess
-    char* preprocessed = preprocess(source, input_file);
-
-    // Create context and tokenize
+    // Create context. The parser pulls tokens from the lexer on demand,
+    // which pulls them from the preprocessor: no preprocessed text is built
+    // and only a small window of tokens is resident. Where the lexer can run
+    // on several threads, the whole preprocessed text is built instead, since
+    // only its size tells whether splitting it pays off. A text that
+    // tokenize() will split is then held as a full token array as well;
+    // any other is lexed from the text through the same small window. Tokens
+    // point into the source view, macro bodies, the preprocessor or the
+    // text, so all of them are kept until the end.
+    Token* tokens = NULL;
+    Preprocessor* pp = NULL;
+    if (lex_can_split())
+        preprocessed = preprocess(source.data, input_file);
+    else
+        pp = preprocessor_new(source.data, input_file);
     Context ctx;
     memset(&ctx, 0, sizeof(ctx));
-    ctx.current_token = tokenize(preprocessed);
+    arena_use(&ctx.arena);
+    restore_pch(&ctx);
+    close_pch();
+    if (preprocessed && lex_thread_count(strlen(preprocessed)) > 1) {
+        tokens = tokenize(preprocessed);
+        if (!tokens) {
+            free(preprocessed);
+            return 1;
+        }
+        ctx.current_token = tokens;
+    } else if (preprocessed) {
+        ctx.lexer = lexer_new(preprocessed);
+        ctx.current_token = lexer_peek(ctx.lexer, 0);
+    } else {
+        ctx.lexer = lexer_new_preprocessed(pp);
+        ctx.current_token = lexer_peek(ctx.lexer, 0);
+    }
 
     // Parse AST
     parse_program(&ctx);
 
+    if (emit_pch) {
+        write_pch(&ctx, &pch_state, output_file);
+        printf("Generated: %s\n", output_file);
+        free(pch_state.data);
+        free(pch_output);
+        free(preprocessed);
+        lexer_free(ctx.lexer);
+        free_tokens(tokens);
+        preprocessor_free(pp);
+        close_file_view(&source);
+        free(deps_target);
+        free(deps_output);
+        arena_use(NULL);
+        arena_free(&ctx.arena);
+        return 0;
+    }
+
     // Generate LLVM IR to file
     if (generate_code_to_file(&ctx, output_file) != 0) {
         fprintf(stderr, "Error: failed to generate LLVM IR\n");
-        free((void*)source);
-        if (ctx.current_token) {
-            free_tokens(ctx.current_token);
-        }
+        free(preprocessed);
+        lexer_free(ctx.lexer);
+        free_tokens(tokens);
+        preprocessor_free(pp);
+        close_file_view(&source);
+        free(deps_target);
+        free(deps_output);
         return 1;
     }
 
     printf("Generated: %s\n", output_file);
 
     // Clean up
-    free((void*)source);
     free(preprocessed);
-    for (int i = 0; i < ctx.node_count; i++) {
-        free_ast(ctx.code[i]);
-    }
-    if (ctx.current_token) {
-        free_tokens(ctx.current_token);
-    }
+    lexer_free(ctx.lexer);
+    free_tokens(tokens);
+    preprocessor_free(pp);
+    close_file_view(&source);
+    free(deps_target);
+    free(deps_output);
+    arena_use(NULL);
+    arena_free(&ctx.arena);
 
     return 0;
 }
@@ -1,5 +1,8 @@
 #include "parse.h"
+#include "arena.h"
+#include "intern.h"
 #include "lex.h"
+#include "type.h"
 #include "variable.h"
 #include <stdlib.h>
 #include <string.h>
@@ -25,15 +28,9 @@ static EnumConst* find_enum_const(Context* ctx, Token* tok);
 static Typedef* find_typedef(Context* ctx, Token* tok);
 static Node* clone_ast(Node* node);
 static Node* parse_sizeof_expr_node(Context* ctx, Node* node);
-static int type_size(Type* ty);
-static Node* find_defined_function(Context* ctx, Token* tok);
 
 Node* new_node(NodeKind kind, Node* lhs, Node* rhs) {
-    Node* node = calloc(1, sizeof(Node));
-    if (!node) {
-        perror("calloc");
-        exit(1);
-    }
+    Node* node = ast_alloc(sizeof(Node));
     node->kind = kind;
     node->next = NULL;
     node->lhs = lhs;
@@ -46,14 +43,10 @@ Node* new_node(NodeKind kind, Node* lhs, Node* rhs) {
 }
 
 Node* new_node_num(int val) {
-    Node* node = calloc(1, sizeof(Node));
-    if (!node) {
-        perror("calloc");
-        exit(1);
-    }
+    Node* node = ast_alloc(sizeof(Node));
     node->kind = ND_NUM;
     node->val = val;
-    node->uval = (unsigned long long)(unsigned int)val;
+    node->u.uval = (unsigned long long)(unsigned int)val;
     node->type = new_type_int();
     return node;
 }
@@ -64,11 +57,7 @@ Node* new_node_ident(Context* ctx, Token* tok) {
         return new_node_num(ec->val);
     }
 
-    Node* node = calloc(1, sizeof(Node));
-    if (!node) {
-        perror("calloc");
-        exit(1);
-    }
+    Node* node = ast_alloc(sizeof(Node));
     LVar* lvar = find_lvar(ctx, tok);
     if (lvar) {
         node->kind = ND_LVAR;
@@ -85,11 +74,12 @@ Node* new_node_ident(Context* ctx, Token* tok) {
         return node;
     }
 
-    Node* fn = find_defined_function(ctx, tok);
-    if (fn) {
+    FuncEntry* fn = find_function(ctx, tok_sym(tok));
+    if (fn && fn->decl) {
         node->kind = ND_FUNCNAME;
         node->tok = tok;
-        node->type = new_type_ptr(fn->type ? fn->type : new_type_int());
+        node->type =
+            new_type_ptr(fn->decl->type ? fn->decl->type : new_type_int());
         return node;
     }
 
@@ -97,43 +87,15 @@ Node* new_node_ident(Context* ctx, Token* tok) {
     fprintf(stderr, "Error: undeclared variable '");
     fwrite(tok->str, 1, tok->len, stderr);
     fprintf(stderr, "'\n");
-    free(node);
     exit(1);
 }
 
-static Node* find_defined_function(Context* ctx, Token* tok) {
-    for (int i = 0; i < MAX_NODES; i++) {
-        Node* n = ctx->code[i];
-        if (!n || n->kind != ND_FUNCTION || !n->tok)
-            continue;
-        if (n->tok->len == tok->len &&
-            strncmp(n->tok->str, tok->str, tok->len) == 0)
-            return n;
-    }
-    return NULL;
-}
-
-void free_ast(Node* ast) {
-    if (ast == NULL)
-        return;
-    free_ast(ast->lhs);
-    free_ast(ast->rhs);
-    free_ast(ast->next);
-    free_ast(ast->cond);
-    free_ast(ast->init);
-    free(ast);
-}
-
 static Node* clone_ast(Node* node) {
     if (node == NULL) {
         return NULL;
     }
 
-    Node* cloned = calloc(1, sizeof(Node));
-    if (!cloned) {
-        perror("calloc");
-        exit(1);
-    }
+    Node* cloned = ast_alloc(sizeof(Node));
     *cloned = *node;
     cloned->lhs = clone_ast(node->lhs);
     cloned->rhs = clone_ast(node->rhs);
@@ -143,6 +105,46 @@ static Node* clone_ast(Node* node) {
     return cloned;
 }
 
+// Record the element count of a VLA; the table covers the current
+// function only (see reset_scope())
+static void set_vla_size(Context* ctx, int slot, Node* count) {
+    if (slot >= ctx->vla_cap) {
+        int cap = ctx->vla_cap ? ctx->vla_cap : 16;
+        while (cap <= slot)
+            cap *= 2;
+        Node** exprs = ast_alloc(sizeof(Node*) * (size_t)cap);
+        if (ctx->vla_cap > 0)
+            memcpy(exprs, ctx->vla_size_exprs,
+                   sizeof(Node*) * (size_t)ctx->vla_cap);
+        ctx->vla_size_exprs = exprs;
+        ctx->vla_cap = cap;
+    }
+    ctx->vla_size_exprs[slot] = count;
+}
+
+// Add a string literal to the module's strings; returns its index
+static int add_string(Context* ctx, const char* str, int len) {
+    if (ctx->string_count == ctx->string_cap) {
+        int cap = ctx->string_cap ? ctx->string_cap * 2 : 64;
+        const char** strings = ast_alloc(sizeof(char*) * (size_t)cap);
+        int* lens = ast_alloc(sizeof(int) * (size_t)cap);
+        if (ctx->string_count > 0) {
+            memcpy(strings, ctx->strings,
+                   sizeof(char*) * (size_t)ctx->string_count);
+            memcpy(lens, ctx->string_lens,
+                   sizeof(int) * (size_t)ctx->string_count);
+        }
+        ctx->strings = strings;
+        ctx->string_lens = lens;
+        ctx->string_cap = cap;
+    }
+    int idx = ctx->string_count;
+    ctx->strings[idx] = str;
+    ctx->string_lens[idx] = len;
+    ctx->string_count++;
+    return idx;
+}
+
 static Node* parse_sizeof_expr_node(Context* ctx, Node* node) {
     if (!node) {
         return new_node_num(0);
@@ -153,7 +155,7 @@ static Node* parse_sizeof_expr_node(Context* ctx, Node* node) {
 
     if (node->kind == ND_LVAR && node->type && node->type->ty == PTR &&
         node->type->array_size == 0 && node->type->ptr_to && node->val >= 0 &&
-        node->val < MAX_LOCALS && ctx->vla_size_exprs[node->val]) {
+        node->val < ctx->vla_cap && ctx->vla_size_exprs[node->val]) {
         Node* count = clone_ast(ctx->vla_size_exprs[node->val]);
         Node* elem_size = new_node_num(type_size(node->type->ptr_to));
         Node* mul = new_node(ND_MUL, count, elem_size);
@@ -170,111 +172,32 @@ static Node* parse_sizeof_expr_node(Context* ctx, Node* node) {
 // parse_type = "int" | "void" | type "*"
 Type* parse_type(Context* ctx);
 
-// Helper to create a new char type
-Type* new_type_char(void) {
-    Type* t = calloc(1, sizeof(Type));
-    if (!t) {
-        perror("calloc");
-        exit(1);
-    }
-    t->ty = CHAR;
-    t->ptr_to = NULL;
-    return t;
-}
-
-// Helper to create a new short type
-Type* new_type_short(void) {
-    Type* t = calloc(1, sizeof(Type));
-    if (!t) {
-        perror("calloc");
-        exit(1);
-    }
-    t->ty = SHORT;
-    t->ptr_to = NULL;
-    return t;
-}
-
-// Helper to create a new bool type
-Type* new_type_bool(void) {
-    Type* t = calloc(1, sizeof(Type));
-    if (!t) {
-        perror("calloc");
-        exit(1);
-    }
-    t->ty = BOOL;
-    t->ptr_to = NULL;
-    return t;
-}
-
-// Helper to create a new int type
-Type* new_type_int(void) {
-    Type* t = calloc(1, sizeof(Type));
-    if (!t) {
-        perror("calloc");
-        exit(1);
-    }
-    t->ty = INT;
-    t->ptr_to = NULL;
-    return t;
-}
-
-// Helper to create a pointer type
-Type* new_type_ptr(Type* base) {
-    Type* t = calloc(1, sizeof(Type));
-    if (!t) {
-        perror("calloc");
-        exit(1);
-    }
-    t->ty = PTR;
-    t->ptr_to = base;
-    return t;
-}
-
-// Helper to create an array type
-Type* new_type_array(Type* base, size_t size) {
-    Type* t = calloc(1, sizeof(Type));
-    if (!t) {
-        perror("calloc");
-        exit(1);
-    }
-    t->ty = PTR;
-    t->ptr_to = base;
-    t->array_size = size;
-    return t;
-}
-
-// Helper to create a new double type
-Type* new_type_double(void) {
-    Type* t = calloc(1, sizeof(Type));
-    if (!t) {
-        perror("calloc");
-        exit(1);
-    }
-    t->ty = DOUBLE;
-    t->ptr_to = NULL;
-    return t;
-}
-
-// Helper to create a new float type
-Type* new_type_float(void) {
-    Type* t = calloc(1, sizeof(Type));
-    if (!t) {
-        perror("calloc");
-        exit(1);
+// Integer constant node typed after the literal's suffix and value
+static Node* new_node_literal(TokenNum* num) {
+    Node* node = new_node_num((int)num->uval);
+    node->u.uval = num->uval;
+    switch (num->type) {
+    case NUM_UINT:
+        node->type = builtin_type(INT, true, false);
+        break;
+    case NUM_LONG:
+    case NUM_ULONG:
+        node->type = builtin_type(LONG, num->type == NUM_ULONG, false);
+        break;
+    case NUM_LLONG:
+    case NUM_ULLONG:
+        node->type = builtin_type(LONGLONG, num->type == NUM_ULLONG, false);
+        break;
+    default:
+        break;
     }
-    t->ty = FLOAT;
-    t->ptr_to = NULL;
-    return t;
+    return node;
 }
 
 Node* new_node_fnum(double fval, Type* ty) {
-    Node* node = calloc(1, sizeof(Node));
-    if (!node) {
-        perror("calloc");
-        exit(1);
-    }
+    Node* node = ast_alloc(sizeof(Node));
     node->kind = ND_FNUM;
-    node->fval = fval;
+    node->u.fval = fval;
     node->type = ty;
     return node;
 }
@@ -314,27 +237,25 @@ Type* get_common_type(Type* ty1, Type* ty2) {
         return ty2;
 
     // Ranks are equal (same base type), check signedness
-    if (ty1->is_unsigned || ty2->is_unsigned) {
-        Type* res = calloc(1, sizeof(Type));
-        *res = *ty1; // Copy type
-        res->is_unsigned = true;
-        return res;
-    }
+    if (ty1->is_unsigned || ty2->is_unsigned)
+        return qualify_type(ty1, true, false, false);
 
     return ty1;
 }
 
 static EnumConst* find_enum_const(Context* ctx, Token* tok) {
+    int sym = tok_sym(tok);
     for (EnumConst* ec = ctx->enum_consts; ec; ec = ec->next) {
-        if (ec->len == tok->len && strncmp(ec->name, tok->str, ec->len) == 0)
+        if (ec->sym == sym)
             return ec;
     }
     return NULL;
 }
 
 static Typedef* find_typedef(Context* ctx, Token* tok) {
+    int sym = tok_sym(tok);
     for (Typedef* td = ctx->typedefs; td; td = td->next) {
-        if (td->len == tok->len && strncmp(td->name, tok->str, td->len) == 0)
+        if (td->sym == sym)
             return td;
     }
     return NULL;
@@ -361,8 +282,9 @@ static int expect_const_int(Context* ctx) {
 }
 
 static StructTag* find_tag(Context* ctx, Token* tok) {
+    int sym = tok_sym(tok);
     for (StructTag* tag = ctx->struct_tags; tag; tag = tag->next) {
-        if (tag->len == tok->len && strncmp(tag->name, tok->str, tag->len) == 0)
+        if (tag->sym == sym)
             return tag;
     }
     return NULL;
@@ -416,8 +338,7 @@ Type* try_parse_type(Context* ctx) {
         consume(ctx, "_Complex");
         base = new_type_double();
     } else if (consume(ctx, "void")) {
-        base = calloc(1, sizeof(Type));
-        base->ty = VOID;
+        base = new_type_void();
     } else if (consume(ctx, "long")) {
         if (consume(ctx, "double")) {
             consume(ctx, "_Complex");
@@ -425,11 +346,9 @@ Type* try_parse_type(Context* ctx) {
             base = new_type_double();
         } else if (consume(ctx, "long")) {
             // 'long long' is a distinct type from 'long'
-            base = calloc(1, sizeof(Type));
-            base->ty = LONGLONG;
+            base = builtin_type(LONGLONG, false, false);
         } else {
-            base = calloc(1, sizeof(Type));
-            base->ty = LONG;
+            base = new_type_long();
         }
     } else if (consume(ctx, "_Complex")) {
         if (consume(ctx, "float")) {
@@ -446,9 +365,7 @@ Type* try_parse_type(Context* ctx) {
         consume(ctx, "bool");
         base = new_type_bool();
     } else if (consume(ctx, "size_t")) {
-        base = calloc(1, sizeof(Type));
-        base->ty = LONG;
-        base->is_unsigned = true;
+        base = builtin_type(LONG, true, false);
     } else if (consume(ctx, "enum")) {
         // ... (keep rest of enum logic)
         consume_ident(ctx); // Ignore tag
@@ -461,9 +378,10 @@ Type* try_parse_type(Context* ctx) {
                 if (consume(ctx, "=")) {
                     val = expect_const_int(ctx);
                 }
-                EnumConst* ec = calloc(1, sizeof(EnumConst));
+                EnumConst* ec = ast_alloc(sizeof(EnumConst));
                 ec->name = tok->str;
                 ec->len = tok->len;
+                ec->sym = tok_sym(tok);
                 ec->val = val++;
                 ec->next = ctx->enum_consts;
                 ctx->enum_consts = ec;
@@ -478,7 +396,7 @@ Type* try_parse_type(Context* ctx) {
                  strncmp(ctx->current_token->str, "union", 5) == 0))) {
         bool is_union = (ctx->current_token->len == 5 &&
                          strncmp(ctx->current_token->str, "union", 5) == 0);
-        ctx->current_token = ctx->current_token->next;
+        advance_token(ctx);
         Token* tag = consume_ident(ctx);
         Type* str_type = NULL;
 
@@ -487,18 +405,19 @@ Type* try_parse_type(Context* ctx) {
             if (st) {
                 str_type = st->type;
             } else {
-                str_type = calloc(1, sizeof(Type));
+                str_type = ast_alloc(sizeof(Type));
                 str_type->ty = is_union ? UNION : STRUCT;
-                StructTag* nst = calloc(1, sizeof(StructTag));
+                StructTag* nst = ast_alloc(sizeof(StructTag));
                 nst->name = tag->str;
                 nst->len = tag->len;
+                nst->sym = tok_sym(tag);
                 nst->type = str_type;
                 nst->next = ctx->struct_tags;
                 ctx->struct_tags = nst;
             }
         } else {
             // Anonymous struct
-            str_type = calloc(1, sizeof(Type));
+            str_type = ast_alloc(sizeof(Type));
             str_type->ty = is_union ? UNION : STRUCT;
         }
 
@@ -524,10 +443,11 @@ Type* try_parse_type(Context* ctx) {
                     }
                     mty = new_type_array(mty, (size_t)size);
                 }
-                Member* m = calloc(1, sizeof(Member));
+                Member* m = ast_alloc(sizeof(Member));
                 m->type = mty;
                 m->name = mtok->str;
                 m->len = mtok->len;
+                m->sym = tok_sym(mtok);
                 m->index = index++;
                 if (consume(ctx, ":")) {
                     int bw = expect_const_int(ctx);
@@ -551,7 +471,7 @@ Type* try_parse_type(Context* ctx) {
                 cur->next = m;
                 cur = m;
             }
-            str_type->members = head.next;
+            set_members(str_type, head.next);
         } else if (!tag) {
             fprintf(stderr, "Expected '{' after struct\\n");
             exit(1);
@@ -561,7 +481,7 @@ Type* try_parse_type(Context* ctx) {
     } else if (ctx->current_token->kind == TK_IDENT) {
         Typedef* td = find_typedef(ctx, ctx->current_token);
         if (td) {
-            ctx->current_token = ctx->current_token->next;
+            advance_token(ctx);
             base = td->type;
         }
     }
@@ -574,12 +494,7 @@ Type* try_parse_type(Context* ctx) {
         return NULL;
     }
 
-    if (is_unsigned) {
-        base->is_unsigned = true;
-    }
-    if (is_volatile) {
-        base->is_volatile = true;
-    }
+    base = qualify_type(base, is_unsigned, false, is_volatile);
 
     // Parse pointers
     while (consume(ctx, "*")) {
@@ -595,12 +510,7 @@ Type* try_parse_type(Context* ctx) {
         is_volatile = true;
     }
 
-    if (is_restrict && base->ty == PTR) {
-        base->is_restrict = true;
-    }
-    if (is_volatile) {
-        base->is_volatile = true;
-    }
+    base = qualify_type(base, false, is_restrict, is_volatile);
 
     return base;
 }
@@ -632,7 +542,7 @@ Node* parse_params(Context* ctx, bool* is_vararg) {
             }
         }
         // Arguments without name (prototype)
-        tok = calloc(1, sizeof(Token));
+        tok = ast_alloc(sizeof(Token));
         tok->kind = TK_IDENT;
         tok->str = "";
         tok->len = 0;
@@ -664,7 +574,7 @@ Node* parse_params(Context* ctx, bool* is_vararg) {
         tok = consume_ident(ctx);
         if (!tok) {
             // Arguments without name
-            tok = calloc(1, sizeof(Token));
+            tok = ast_alloc(sizeof(Token));
             tok->kind = TK_IDENT;
             tok->str = "";
             tok->len = 0;
@@ -719,7 +629,7 @@ static Node* build_function_definition(Context* ctx, Type* return_ty,
         }
     }
     node->lhs = head;
-    node->locals = ctx->locals;
+    node->u.locals = ctx->locals;
     return node;
 }
 
@@ -767,13 +677,7 @@ Node* parse_global_var(Context* ctx) {
 
     expect(ctx, ";");
 
-    // Add to globals
-    LVar* lvar = calloc(1, sizeof(LVar));
-    lvar->name = tok->str;
-    lvar->len = tok->len;
-    lvar->type = ty;
-    lvar->next = ctx->globals;
-    ctx->globals = lvar;
+    add_gvar(ctx, tok, ty);
 
     // Create global variable node
     Node* node = new_node(ND_GVAR, NULL, NULL);
@@ -793,8 +697,9 @@ static int count_members(Type* ty) {
 }
 
 static Member* find_member_by_tok(Type* ty, Token* tok) {
+    int sym = tok_sym(tok);
     for (Member* m = ty ? ty->members : NULL; m; m = m->next) {
-        if (m->len == tok->len && strncmp(m->name, tok->str, tok->len) == 0)
+        if (m->sym == sym)
             return m;
     }
     return NULL;
@@ -934,7 +839,9 @@ static Node* parse_initializer(Context* ctx, Type* target_type) {
 
 static Node* parse_block_stmt(Context* ctx) {
     enter_scope(ctx);
-    Node head = {0};
+    // Not "= {0}": the selfhost build cannot zero-initialize Node's union
+    Node head;
+    head.next = NULL;
     Node* cur = &head;
     while (!consume(ctx, "}")) {
         if (at_eof(ctx)) {
@@ -968,8 +875,31 @@ static StorageSpecifiers parse_storage_specifiers(Context* ctx) {
     return spec;
 }
 
+/**
+ * Append a top-level declaration to ctx->code
+ *
+ * ctx->code lives in the compilation arena and always has a NULL entry
+ * after the last declaration. Declarations restored from a precompiled
+ * header are added before the translation unit is parsed, so they come
+ * first.
+ *
+ * @param[in,out] ctx Parser context
+ * @param[in] node ND_FUNCTION or ND_GVAR node
+ */
+void add_code(Context* ctx, Node* node) {
+    if (ctx->node_count + 1 >= ctx->code_cap) {
+        int cap = ctx->code_cap ? ctx->code_cap * 2 : 64;
+        Node** code = ast_alloc(sizeof(Node*) * (size_t)cap);
+        if (ctx->node_count > 0)
+            memcpy(code, ctx->code, sizeof(Node*) * (size_t)ctx->node_count);
+        ctx->code = code;
+        ctx->code_cap = cap;
+    }
+    ctx->code[ctx->node_count] = node;
+    ctx->node_count++;
+}
+
 void parse_program(Context* ctx) {
-    int i = 0;
     while (!at_eof(ctx)) {
         StorageSpecifiers spec = parse_storage_specifiers(ctx);
 
@@ -981,13 +911,10 @@ void parse_program(Context* ctx) {
                 exit(1);
             }
             expect(ctx, ";");
-            Typedef* td = calloc(1, sizeof(Typedef));
-            if (!td) {
-                perror("calloc");
-                exit(1);
-            }
+            Typedef* td = ast_alloc(sizeof(Typedef));
             td->name = tok->str;
             td->len = tok->len;
+            td->sym = tok_sym(tok);
             td->type = ty;
             td->next = ctx->typedefs;
             ctx->typedefs = td;
@@ -1035,7 +962,8 @@ void parse_program(Context* ctx) {
                 proto_node->is_vararg = is_vararg;
                 proto_node->is_inline = spec.is_inline;
                 proto_node->is_static = spec.is_static;
-                ctx->code[i++] = proto_node;
+                declare_function(ctx, proto_node);
+                add_code(ctx, proto_node);
                 continue;
             }
 
@@ -1045,14 +973,18 @@ void parse_program(Context* ctx) {
                 exit(1);
             }
 
-            ctx->code[i++] = build_function_definition(ctx, ty, tok, func_params,
-                                                       is_vararg, spec.is_inline,
-                                                       spec.is_static);
+            Node* fn = build_function_definition(ctx, ty, tok, func_params,
+                                                 is_vararg, spec.is_inline,
+                                                 spec.is_static);
+            declare_function(ctx, fn);
+            add_code(ctx, fn);
         } else {
             // This is a global variable
             // Put back the "[" or ";" token
             // Since we've already consumed the ident, we need to check for "["
             // or ";"
+            // An array of unknown size takes its size from the initializer
+            bool open_array = false;
             if (consume(ctx, "[")) {
                 int size = 0;
                 if (!consume(ctx, "]")) {
@@ -1060,19 +992,10 @@ void parse_program(Context* ctx) {
                     expect(ctx, "]");
                 }
                 ty = new_type_array(ty, size);
+                open_array = size == 0;
             }
 
-            // Add to globals
-            LVar* lvar = calloc(1, sizeof(LVar));
-            if (!lvar) {
-                perror("calloc");
-                exit(1);
-            }
-            lvar->name = tok->str;
-            lvar->len = tok->len;
-            lvar->type = ty;
-            lvar->next = ctx->globals;
-            ctx->globals = lvar;
+            add_gvar(ctx, tok, ty);
 
             // Create global variable node
             Node* gvar_node = new_node(ND_GVAR, NULL, NULL);
@@ -1082,7 +1005,6 @@ void parse_program(Context* ctx) {
 
             // extern declarations cannot have initializers
             if (!spec.is_extern && consume(ctx, "=")) {
-                int array_size_before = gvar_node->type->array_size;
                 // Check if next token is '{'
                 Token* t = ctx->current_token;
                 if (t->kind == TK_RESERVED && t->len == 1 && t->str[0] == '{') {
@@ -1092,8 +1014,8 @@ void parse_program(Context* ctx) {
                     gvar_node->init = parse_expr(ctx);
                 }
 
-                if (array_size_before == 0 && gvar_node->type->ty == PTR &&
-                    gvar_node->init && gvar_node->init->kind == ND_INIT &&
+                if (open_array && gvar_node->init &&
+                    gvar_node->init->kind == ND_INIT &&
                     gvar_node->init->lhs) {
                     int count = 0;
                     for (Node* init_node = gvar_node->init->lhs; init_node;
@@ -1105,11 +1027,10 @@ void parse_program(Context* ctx) {
             }
             expect(ctx, ";");
 
-            ctx->code[i++] = gvar_node;
+            add_code(ctx, gvar_node);
             continue; // Ensure we move to next token!
         }
     }
-    ctx->node_count = i;
 }
 
 Node* parse_declaration(Context* ctx, Type* ty) {
@@ -1151,6 +1072,7 @@ Node* parse_declaration(Context* ctx, Type* ty) {
     }
 
     Node* vla_size = NULL;
+    bool open_array = false;
     // Check for array definitions (e.g., int a[10], char x[3], int y[], int
     // vla[n])
     if (!is_func_ptr_decl && consume(ctx, "[")) {
@@ -1167,6 +1089,7 @@ Node* parse_declaration(Context* ctx, Type* ty) {
             }
         } else {
             ty = new_type_array(ty, 0);
+            open_array = true;
         }
     }
 
@@ -1179,9 +1102,7 @@ Node* parse_declaration(Context* ctx, Type* ty) {
     if (vla_size) {
         node->is_vla = true;
         node->rhs = vla_size;
-        if (lvar->offset >= 0 && lvar->offset < MAX_LOCALS) {
-            ctx->vla_size_exprs[lvar->offset] = clone_ast(vla_size);
-        }
+        set_vla_size(ctx, lvar->offset, clone_ast(vla_size));
     }
 
     if (consume(ctx, "=")) {
@@ -1193,7 +1114,7 @@ Node* parse_declaration(Context* ctx, Type* ty) {
             ctx->current_token->len == 1 && ctx->current_token->str[0] == '{') {
             node->init = parse_initializer(ctx, ty);
             // If array size was 0, count elements
-            if (node->type->ty == PTR && node->type->array_size == 0) {
+            if (open_array) {
                 int count = 0;
                 for (Node* init_node = node->init->lhs; init_node;
                      init_node = init_node->next)
@@ -1213,12 +1134,12 @@ Node* parse_stmt(Context* ctx) {
     Node* stmt_node;
 
     // label: statement
-    if (ctx->current_token->kind == TK_IDENT && ctx->current_token->next &&
-        ctx->current_token->next->kind == TK_RESERVED &&
-        ctx->current_token->next->len == 1 &&
-        ctx->current_token->next->str[0] == ':') {
-        Token* label_tok = ctx->current_token;
-        ctx->current_token = ctx->current_token->next->next; // consume ident:
+    Token* after = peek_token(ctx, 1);
+    if (ctx->current_token->kind == TK_IDENT && after &&
+        after->kind == TK_RESERVED && after->len == 1 && after->str[0] == ':') {
+        Token* label_tok = keep_token(ctx, ctx->current_token);
+        advance_token(ctx); // consume ident
+        advance_token(ctx); // consume ':'
         Node* body = parse_stmt(ctx);
         Node* label_node = new_node(ND_LABEL, body, NULL);
         label_node->tok = label_tok;
@@ -1326,9 +1247,8 @@ Node* parse_stmt(Context* ctx) {
 
         Node* case_node = new_node(ND_CASE, NULL, NULL);
         case_node->val = val;
-        case_node->case_val = val;
-        case_node->next_case = ctx->current_switch->cases;
-        ctx->current_switch->cases = case_node;
+        case_node->u.next_case = ctx->current_switch->u.cases;
+        ctx->current_switch->u.cases = case_node;
         return case_node;
     } else if (consume(ctx, "default")) {
         if (!ctx->current_switch) {
@@ -1338,8 +1258,8 @@ Node* parse_stmt(Context* ctx) {
         expect(ctx, ":");
         Node* default_node = new_node(ND_CASE, NULL, NULL);
         default_node->is_default = true;
-        default_node->next_case = ctx->current_switch->cases;
-        ctx->current_switch->cases = default_node;
+        default_node->u.next_case = ctx->current_switch->u.cases;
+        ctx->current_switch->u.cases = default_node;
         return default_node;
     } else if (consume(ctx, "break")) {
         expect(ctx, ";");
@@ -1630,105 +1550,10 @@ Node* parse_mul(Context* ctx) {
     }
 }
 
-static int type_align(Type* ty) {
-    if (ty == NULL)
-        return 4;
-    if (ty->ty == CHAR)
-        return 1;
-    if (ty->ty == BOOL)
-        return 1;
-    if (ty->ty == INT)
-        return 4;
-    if (ty->ty == FLOAT)
-        return 4;
-    if (ty->ty == DOUBLE)
-        return 8;
-    if (ty->ty == LONG)
-        return 8;
-    if (ty->ty == LONGLONG)
-        return 8;
-    if (ty->ty == PTR)
-        return 8;
-    if (ty->ty == STRUCT) {
-        int max_align = 1;
-        for (Member* m = ty->members; m; m = m->next) {
-            int a = type_align(m->type);
-            if (a > max_align)
-                max_align = a;
-        }
-        return max_align;
-    }
-    if (ty->ty == UNION) {
-        int max_align = 1;
-        for (Member* m = ty->members; m; m = m->next) {
-            int a = type_align(m->type);
-            if (a > max_align)
-                max_align = a;
-        }
-        return max_align;
-    }
-    if (ty->array_size > 0)
-        return type_align(ty->ptr_to);
-    return 4;
-}
-
-static int type_size(Type* ty) {
-    if (ty == NULL)
-        return 4;
-    if (ty->array_size > 0)
-        return type_size(ty->ptr_to) * ty->array_size;
-
-    if (ty->ty == CHAR)
-        return 1;
-    if (ty->ty == BOOL)
-        return 1;
-    if (ty->ty == INT)
-        return 4;
-    if (ty->ty == FLOAT)
-        return 4;
-    if (ty->ty == DOUBLE)
-        return 8;
-    if (ty->ty == LONG)
-        return 8;
-    if (ty->ty == LONGLONG)
-        return 8;
-    if (ty->ty == PTR)
-        return 8;
-    if (ty->ty == STRUCT) {
-        int size = 0;
-        int max_align = 1;
-        for (Member* m = ty->members; m; m = m->next) {
-            int a = type_align(m->type);
-            if (a > max_align)
-                max_align = a;
-            // Align current size to member alignment
-            size = ((size + a - 1) / a) * a;
-            size += type_size(m->type);
-        }
-        // Final size is multiple of max_align
-        size = ((size + max_align - 1) / max_align) * max_align;
-        return size;
-    }
-    if (ty->ty == UNION) {
-        int max_size = 0;
-        int max_align = 1;
-        for (Member* m = ty->members; m; m = m->next) {
-            int s = type_size(m->type);
-            int a = type_align(m->type);
-            if (s > max_size)
-                max_size = s;
-            if (a > max_align)
-                max_align = a;
-        }
-        max_size = ((max_size + max_align - 1) / max_align) * max_align;
-        return max_size;
-    }
-    return 4;
-}
-
 static Member* find_member(Type* ty, Token* tok) {
+    int sym = tok_sym(tok);
     for (Member* m = ty->members; m; m = m->next) {
-        if (m->len == tok->len && memcmp(m->name, tok->str, tok->len) == 0) {
+        if (m->sym == sym) {
             return m;
         }
     }
@@ -1791,7 +1616,7 @@ static Node* parse_postfix(Context* ctx) {
             }
             Node* n = new_node(ND_MEMBER, node, NULL);
             n->type = m->type;
-            n->member = m;
+            n->u.member = m;
             node = n;
             continue;
         }
@@ -1821,7 +1646,7 @@ static Node* parse_postfix(Context* ctx) {
             }
             Node* n = new_node(ND_MEMBER, deref, NULL);
             n->type = m->type;
-            n->member = m;
+            n->u.member = m;
             node = n;
             continue;
         }
@@ -1877,7 +1702,7 @@ static bool is_type(Context* ctx) {
 Node* parse_unary(Context* ctx) {
     if (ctx->current_token->kind == TK_RESERVED &&
         ctx->current_token->len == 1 && ctx->current_token->str[0] == '(') {
-        Token* next = ctx->current_token->next;
+        Token* next = peek_token(ctx, 1);
         // Peek if it's a type
         Token* old_tok = ctx->current_token;
         ctx->current_token = next;
@@ -1887,6 +1712,7 @@ Node* parse_unary(Context* ctx) {
         if (it) {
             consume(ctx, "(");
             Type* ty = parse_type(ctx);
+            bool open_array = false;
             while (consume(ctx, "[")) {
                 int size = 0;
                 if (!consume(ctx, "]")) {
@@ -1894,14 +1720,14 @@ Node* parse_unary(Context* ctx) {
                     expect(ctx, "]");
                 }
                 ty = new_type_array(ty, (size_t)size);
+                open_array = size == 0;
             }
             expect(ctx, ")");
             if (ctx->current_token->kind == TK_RESERVED &&
                 ctx->current_token->len == 1 &&
                 ctx->current_token->str[0] == '{') {
                 Node* init = parse_initializer(ctx, ty);
-                if (ty->ty == PTR && ty->array_size == 0 && init &&
-                    init->kind == ND_INIT) {
+                if (open_array && init && init->kind == ND_INIT) {
                     int cnt = 0;
                     for (Node* n = init->lhs; n; n = n->next)
                         cnt++;
@@ -2053,7 +1879,7 @@ Node* parse_primary(Context* ctx) {
 
     // __func__ - predefined identifier for function name
     if (consume(ctx, "__func__")) {
-        Node* node = calloc(1, sizeof(Node));
+        Node* node = ast_alloc(sizeof(Node));
         node->kind = ND_FUNCSTR;
         node->type = new_type_ptr(new_type_char()); // char* type
         return node;
@@ -2064,7 +1890,7 @@ Node* parse_primary(Context* ctx) {
         expect(ctx, "(");
         // Consume the string literal
         if (ctx->current_token->kind == TK_STR) {
-            ctx->current_token = ctx->current_token->next;
+            advance_token(ctx);
         } else {
             // _Pragma requires a string literal
             fprintf(stderr, "_Pragma requires a string literal\n");
@@ -2085,32 +1911,29 @@ Node* parse_primary(Context* ctx) {
 
     // String literal
     if (ctx->current_token->kind == TK_STR) {
+        // Adjacent literals are concatenated as they are consumed, since
+        // the lexer window may not hold all of them at once
+        char* buf = NULL;
         int total_len = 0;
-        Token* t = ctx->current_token;
-        while (t && t->kind == TK_STR) {
-            total_len += t->len;
-            t = t->next;
-        }
-
-        char* merged = calloc((size_t)total_len + 1, 1);
-        if (!merged) {
-            perror("calloc");
-            exit(1);
-        }
-        int off = 0;
         while (ctx->current_token->kind == TK_STR) {
             Token* tok = ctx->current_token;
-            memcpy(merged + off, tok->str, (size_t)tok->len);
-            off += tok->len;
-            ctx->current_token = ctx->current_token->next;
+            buf = realloc(buf, (size_t)total_len + (size_t)tok->len + 1);
+            if (!buf) {
+                perror("realloc");
+                exit(1);
+            }
+            memcpy(buf + total_len, tok->str, (size_t)tok->len);
+            total_len += tok->len;
+            advance_token(ctx);
         }
 
-        // Add string to context's string vector
-        int idx = ctx->string_count++;
-        ctx->strings[idx] = merged;
-        ctx->string_lens[idx] = total_len;
+        char* merged = ast_alloc((size_t)total_len + 1);
+        memcpy(merged, buf, (size_t)total_len);
+        free(buf);
+
+        int idx = add_string(ctx, merged, total_len);
         // Create ND_STR node
-        Node* node = calloc(1, sizeof(Node));
+        Node* node = ast_alloc(sizeof(Node));
         node->kind = ND_STR;
         node->val = idx; // index into strings vector
         // Type is char* (pointer to char)
@@ -2177,31 +2000,14 @@ Node* parse_primary(Context* ctx) {
     if (ctx->current_token->kind == TK_NUM) {
         Token* num_tok = ctx->current_token;
         Node* num_node;
-        if (num_tok->is_float) {
-            bool is_single = false;
-            if (num_tok->len > 0 && (num_tok->str[num_tok->len - 1] == 'f' ||
-                                     num_tok->str[num_tok->len - 1] == 'F')) {
-                is_single = true;
-            }
-            Type* fty;
-            if (is_single) {
-                fty = new_type_float();
-            } else {
-                fty = new_type_double();
-            }
-            num_node = new_node_fnum(num_tok->fval, fty);
-            ctx->current_token = ctx->current_token->next;
+        if (num_tok->num->type == NUM_FLOAT) {
+            num_node = new_node_fnum(num_tok->num->fval, new_type_float());
+        } else if (num_tok->num->type == NUM_DOUBLE) {
+            num_node = new_node_fnum(num_tok->num->fval, new_type_double());
         } else {
-            int ival = (num_tok->uval <= (unsigned long long)LLVM7_INT_MAX)
-                           ? (int)num_tok->uval
-                           : LLVM7_INT_MAX;
-            num_node = new_node_num(ival);
-            num_node->uval = num_tok->uval;
-            if (num_tok->is_unsigned) {
-                num_node->type->is_unsigned = true;
-            }
-            ctx->current_token = ctx->current_token->next;
+            num_node = new_node_literal(num_tok->num);
         }
+        advance_token(ctx);
 
         // Check for [ after number
         if (consume(ctx, "[")) {
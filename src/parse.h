@@ -2,6 +2,7 @@
 #define __PARSE_H__
 
 #include "common.h"
+#include "type.h"
 
 // program      = (extern? (typedef | function | global_decl))*
 // typedef      = "typedef" type ident ";"
@@ -52,7 +53,7 @@
 extern Node* new_node(NodeKind kind, Node* lhs, Node* rhs);
 extern Node* new_node_num(int val);
 extern Node* new_node_ident(Context* ctx, Token* tok);
-extern void free_ast(Node* ast);
+extern void add_code(Context* ctx, Node* node);
 extern void parse_program(Context* ctx);
 extern Node* parse_stmt(Context* ctx);
 Node* parse_declaration(Context* ctx, Type* ty);
@@ -69,12 +70,6 @@ extern Node* parse_function(Context* ctx);
 extern Node* parse_params(Context* ctx, bool* is_vararg);
 extern Type* parse_type(Context* ctx);
 extern Type* try_parse_type(Context* ctx);
-extern Type* new_type_int(void);
-extern Type* new_type_bool(void);
-extern Type* new_type_char(void);
-extern Type* new_type_double(void);
-extern Type* new_type_float(void);
-extern Type* new_type_ptr(Type* base);
 extern Node* new_node_fnum(double fval, Type* ty);
 extern Type* get_common_type(Type* ty1, Type* ty2);
 
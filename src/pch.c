@@ -0,0 +1,535 @@
+#include "pch.h"
+#include "arena.h"
+#include "file.h"
+#include "intern.h"
+#include "parse.h"
+#include "preprocess.h"
+#include "variable.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A precompiled header is
+//   magic, version
+//   preprocessor state: input files with their sizes and hashes, macros,
+//                       include guards (see preprocess_save_pch())
+//   parser state: types, typedefs, enum constants, struct tags, globals and
+//                 top-level declarations
+// Integers are little-endian; a string is its length, its bytes and a NUL.
+// Types refer to each other by 1-based index, 0 being NULL.
+
+#define PCH_MAGIC 0x4843504cu // "LPCH"
+// Bump whenever the layout changes
+#define PCH_VERSION 1
+#define PCH_NULL_STR 0xffffffffu
+
+// Loaded header; mapped until close_pch()
+static FileView pch_view;
+static bool pch_loaded = false;
+static PchReader pch_parser; // Start of the parser state
+
+static void pch_reserve(PchBuf* buf, size_t n) {
+    if (buf->len + n <= buf->cap)
+        return;
+    size_t cap = buf->cap ? buf->cap * 2 : 4096;
+    while (cap < buf->len + n)
+        cap *= 2;
+    char* data = realloc(buf->data, cap);
+    if (!data) {
+        perror("realloc");
+        exit(1);
+    }
+    buf->data = data;
+    buf->cap = cap;
+}
+
+void pch_put_u32(PchBuf* buf, unsigned int v) {
+    pch_reserve(buf, 4);
+    for (int i = 0; i < 4; i++) {
+        buf->data[buf->len++] = (char)((v >> (8 * i)) & 0xff);
+    }
+}
+
+void pch_put_u64(PchBuf* buf, unsigned long long v) {
+    pch_put_u32(buf, (unsigned int)(v & 0xffffffffu));
+    pch_put_u32(buf, (unsigned int)(v >> 32));
+}
+
+/**
+ * Append a string
+ *
+ * @param[in,out] buf Buffer
+ * @param[in] s Bytes to write, or NULL
+ * @param[in] len Number of bytes
+ */
+void pch_put_str(PchBuf* buf, const char* s, int len) {
+    if (!s) {
+        pch_put_u32(buf, PCH_NULL_STR);
+        return;
+    }
+    pch_put_u32(buf, (unsigned int)len);
+    pch_reserve(buf, (size_t)len + 1);
+    memcpy(buf->data + buf->len, s, (size_t)len);
+    buf->len += (size_t)len;
+    buf->data[buf->len++] = '\0';
+}
+
+unsigned int pch_get_u32(PchReader* r) {
+    if (r->end - r->p < 4) {
+        r->error = true;
+        r->p = r->end;
+        return 0;
+    }
+    unsigned int v = 0;
+    for (int i = 0; i < 4; i++) {
+        v |= (unsigned int)(unsigned char)r->p[i] << (8 * i);
+    }
+    r->p += 4;
+    return v;
+}
+
+unsigned long long pch_get_u64(PchReader* r) {
+    unsigned long long lo = pch_get_u32(r);
+    unsigned long long hi = pch_get_u32(r);
+    return lo | (hi << 32);
+}
+
+/**
+ * Read a string written by pch_put_str()
+ *
+ * @param[in,out] r Reader
+ * @param[out] len Length of the string
+ * @return NUL-terminated string inside the loaded file, or NULL
+ */
+const char* pch_get_str(PchReader* r, int* len) {
+    *len = 0;
+    unsigned int n = pch_get_u32(r);
+    if (n == PCH_NULL_STR || r->error)
+        return NULL;
+    if ((size_t)(r->end - r->p) < (size_t)n + 1 || r->p[n] != '\0') {
+        r->error = true;
+        r->p = r->end;
+        return NULL;
+    }
+    const char* s = r->p;
+    r->p += n + 1;
+    *len = (int)n;
+    return s;
+}
+
+// Types reachable from the saved declarations, numbered from 1
+typedef struct {
+    Type** keys; // Open addressing on the address
+    int* ids;
+    int cap;
+    Type** list; // Type of each id - 1
+    int count;
+    int list_cap;
+} TypeTable;
+
+static int type_slot(TypeTable* table, Type* ty) {
+    size_t addr = (size_t)ty;
+    unsigned int h = (unsigned int)(addr >> 4) * 2654435761u;
+    int i = (int)(h & (unsigned int)(table->cap - 1));
+    while (table->keys[i] && table->keys[i] != ty)
+        i = (i + 1) & (table->cap - 1);
+    return i;
+}
+
+static void grow_type_table(TypeTable* table) {
+    int old_cap = table->cap;
+    Type** old_keys = table->keys;
+    int* old_ids = table->ids;
+    table->cap = old_cap ? old_cap * 2 : 256;
+    table->keys = calloc((size_t)table->cap, sizeof(Type*));
+    table->ids = calloc((size_t)table->cap, sizeof(int));
+    if (!table->keys || !table->ids) {
+        perror("calloc");
+        exit(1);
+    }
+    for (int i = 0; i < old_cap; i++) {
+        if (old_keys[i]) {
+            int slot = type_slot(table, old_keys[i]);
+            table->keys[slot] = old_keys[i];
+            table->ids[slot] = old_ids[i];
+        }
+    }
+    free(old_keys);
+    free(old_ids);
+}
+
+// Number a type on first sight; 0 for NULL
+static int type_ref(TypeTable* table, Type* ty) {
+    if (!ty)
+        return 0;
+    if ((table->count + 1) * 2 > table->cap)
+        grow_type_table(table);
+    int slot = type_slot(table, ty);
+    if (table->keys[slot])
+        return table->ids[slot];
+    if (table->count == table->list_cap) {
+        table->list_cap = table->list_cap ? table->list_cap * 2 : 256;
+        table->list = realloc(table->list, sizeof(Type*) * table->list_cap);
+        if (!table->list) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    table->list[table->count++] = ty;
+    table->keys[slot] = ty;
+    table->ids[slot] = table->count;
+    return table->count;
+}
+
+static void put_type_ref(PchBuf* buf, TypeTable* table, Type* ty) {
+    pch_put_u32(buf, (unsigned int)type_ref(table, ty));
+}
+
+// Prototype parameters: kind, slot and type of each
+static void put_params(PchBuf* buf, TypeTable* table, Node* params) {
+    int count = 0;
+    for (Node* p = params; p; p = p->next)
+        count++;
+    pch_put_u32(buf, (unsigned int)count);
+    for (Node* p = params; p; p = p->next) {
+        pch_put_u32(buf, (unsigned int)p->kind);
+        pch_put_u32(buf, (unsigned int)p->val);
+        put_type_ref(buf, table, p->type);
+    }
+}
+
+static void put_types(PchBuf* buf, TypeTable* table) {
+    // Number everything reachable first; records may refer forward
+    for (int i = 0; i < table->count; i++) {
+        Type* ty = table->list[i];
+        type_ref(table, ty->ptr_to);
+        for (Member* m = ty->members; m; m = m->next)
+            type_ref(table, m->type);
+    }
+
+    pch_put_u32(buf, (unsigned int)table->count);
+    for (int i = 0; i < table->count; i++) {
+        Type* ty = table->list[i];
+        pch_put_u32(buf, (unsigned int)ty->ty);
+        pch_put_u32(buf, (ty->is_unsigned ? 1u : 0u) |
+                             (ty->is_restrict ? 2u : 0u) |
+                             (ty->is_volatile ? 4u : 0u));
+        put_type_ref(buf, table, ty->ptr_to);
+        pch_put_u64(buf, (unsigned long long)ty->array_size);
+        int count = 0;
+        for (Member* m = ty->members; m; m = m->next)
+            count++;
+        pch_put_u32(buf, (unsigned int)count);
+        for (Member* m = ty->members; m; m = m->next) {
+            pch_put_str(buf, m->name, m->len);
+            put_type_ref(buf, table, m->type);
+            pch_put_u32(buf, (unsigned int)m->index);
+            pch_put_u32(buf, m->is_bitfield ? 1u : 0u);
+            pch_put_u32(buf, (unsigned int)m->bit_width);
+            pch_put_u32(buf, (unsigned int)m->bit_offset);
+        }
+    }
+}
+
+/**
+ * Write a precompiled header
+ *
+ * Only declarations can be saved: a function body or an initialized global
+ * in the header is an error.
+ *
+ * @param[in] ctx Parser state after parsing the header
+ * @param[in] pp_state Preprocessor state recorded by preprocess_save_pch()
+ * @param[in] path File to create
+ */
+void write_pch(Context* ctx, PchBuf* pp_state, const char* path) {
+    for (int i = 0; i < ctx->node_count; i++) {
+        Node* node = ctx->code[i];
+        if ((node->kind == ND_FUNCTION && node->lhs) ||
+            (node->kind == ND_GVAR && node->init)) {
+            fprintf(stderr,
+                    "Error: cannot precompile the definition of '%.*s'\n",
+                    node->tok->len, node->tok->str);
+            exit(1);
+        }
+    }
+
+    // Declarations go to a second buffer so that the type table, which they
+    // fill in, can be written ahead of them
+    TypeTable table;
+    memset(&table, 0, sizeof(table));
+    PchBuf decls;
+    memset(&decls, 0, sizeof(decls));
+
+    int count = 0;
+    for (Typedef* td = ctx->typedefs; td; td = td->next)
+        count++;
+    pch_put_u32(&decls, (unsigned int)count);
+    for (Typedef* td = ctx->typedefs; td; td = td->next) {
+        pch_put_str(&decls, td->name, td->len);
+        put_type_ref(&decls, &table, td->type);
+    }
+
+    count = 0;
+    for (EnumConst* ec = ctx->enum_consts; ec; ec = ec->next)
+        count++;
+    pch_put_u32(&decls, (unsigned int)count);
+    for (EnumConst* ec = ctx->enum_consts; ec; ec = ec->next) {
+        pch_put_str(&decls, ec->name, ec->len);
+        pch_put_u32(&decls, (unsigned int)ec->val);
+    }
+
+    count = 0;
+    for (StructTag* tag = ctx->struct_tags; tag; tag = tag->next)
+        count++;
+    pch_put_u32(&decls, (unsigned int)count);
+    for (StructTag* tag = ctx->struct_tags; tag; tag = tag->next) {
+        pch_put_str(&decls, tag->name, tag->len);
+        put_type_ref(&decls, &table, tag->type);
+    }
+
+    count = 0;
+    for (LVar* var = ctx->globals; var; var = var->next)
+        count++;
+    pch_put_u32(&decls, (unsigned int)count);
+    for (LVar* var = ctx->globals; var; var = var->next) {
+        pch_put_str(&decls, var->name, var->len);
+        put_type_ref(&decls, &table, var->type);
+    }
+
+    pch_put_u32(&decls, (unsigned int)ctx->node_count);
+    for (int i = 0; i < ctx->node_count; i++) {
+        Node* node = ctx->code[i];
+        pch_put_u32(&decls, (unsigned int)node->kind);
+        pch_put_str(&decls, node->tok->str, node->tok->len);
+        put_type_ref(&decls, &table, node->type);
+        pch_put_u32(&decls, (node->is_extern ? 1u : 0u) |
+                                (node->is_vararg ? 2u : 0u) |
+                                (node->is_inline ? 4u : 0u) |
+                                (node->is_static ? 8u : 0u));
+        put_params(&decls, &table, node->rhs);
+    }
+
+    PchBuf types;
+    memset(&types, 0, sizeof(types));
+    put_types(&types, &table);
+
+    FILE* fp = fopen(path, "wb");
+    if (!fp) {
+        perror(path);
+        exit(1);
+    }
+    PchBuf head;
+    memset(&head, 0, sizeof(head));
+    pch_put_u32(&head, PCH_MAGIC);
+    pch_put_u32(&head, PCH_VERSION);
+    if (fwrite(head.data, 1, head.len, fp) != head.len ||
+        fwrite(pp_state->data, 1, pp_state->len, fp) != pp_state->len ||
+        fwrite(types.data, 1, types.len, fp) != types.len ||
+        fwrite(decls.data, 1, decls.len, fp) != decls.len) {
+        perror(path);
+        exit(1);
+    }
+    if (fclose(fp) != 0) {
+        perror(path);
+        exit(1);
+    }
+
+    free(head.data);
+    free(types.data);
+    free(decls.data);
+    free(table.keys);
+    free(table.ids);
+    free(table.list);
+}
+
+/**
+ * Open a precompiled header for the next compilation
+ *
+ * The preprocessor picks up the saved macros in its next preprocess() call;
+ * restore_pch() brings back the declarations.
+ *
+ * @param[in] path File written by write_pch()
+ * @return false if the file is not a precompiled header of this version or
+ *         one of the headers it was built from has changed
+ */
+bool load_pch(const char* path) {
+    close_pch();
+    if (!open_file_view(path, &pch_view))
+        return false;
+    pch_loaded = true;
+
+    PchReader r;
+    r.p = pch_view.data;
+    r.end = pch_view.data + pch_view.len;
+    r.error = false;
+    unsigned int magic = pch_get_u32(&r);
+    unsigned int version = pch_get_u32(&r);
+    if (r.error || magic != PCH_MAGIC || version != PCH_VERSION ||
+        !preprocess_load_pch(&r, path)) {
+        close_pch();
+        return false;
+    }
+    pch_parser = r;
+    return true;
+}
+
+static void corrupt_pch(void) {
+    fprintf(stderr, "Error: corrupt precompiled header\n");
+    exit(1);
+}
+
+// Name as an interned symbol; the text outlives the loaded file
+static int get_name(PchReader* r, const char** name, int* len) {
+    const char* s = pch_get_str(r, len);
+    if (!s) {
+        *name = NULL;
+        return 0;
+    }
+    int sym = intern(s, *len);
+    *name = sym_name(sym);
+    return sym;
+}
+
+static Type* get_type_ref(PchReader* r, Type** types, int count) {
+    unsigned int ref = pch_get_u32(r);
+    if (ref == 0)
+        return NULL;
+    if (ref > (unsigned int)count)
+        corrupt_pch();
+    return types[ref - 1];
+}
+
+/**
+ * Restore the declarations of the loaded precompiled header
+ *
+ * Must run before the rest of the translation unit is parsed. Everything
+ * is allocated from the active arena.
+ *
+ * @param[in,out] ctx Fresh parser state
+ */
+void restore_pch(Context* ctx) {
+    if (!pch_loaded)
+        return;
+    PchReader r = pch_parser;
+
+    int type_count = (int)pch_get_u32(&r);
+    if (r.error || (size_t)type_count > (size_t)(r.end - r.p))
+        corrupt_pch();
+    Type** types = calloc((size_t)type_count + 1, sizeof(Type*));
+    if (!types) {
+        perror("calloc");
+        exit(1);
+    }
+    for (int i = 0; i < type_count; i++)
+        types[i] = ast_alloc(sizeof(Type));
+    for (int i = 0; i < type_count; i++) {
+        Type* ty = types[i];
+        ty->ty = pch_get_u32(&r);
+        unsigned int flags = pch_get_u32(&r);
+        ty->is_unsigned = (flags & 1u) != 0;
+        ty->is_restrict = (flags & 2u) != 0;
+        ty->is_volatile = (flags & 4u) != 0;
+        ty->ptr_to = get_type_ref(&r, types, type_count);
+        ty->array_size = (size_t)pch_get_u64(&r);
+        int member_count = (int)pch_get_u32(&r);
+        Member** link = &ty->members;
+        for (int j = 0; j < member_count && !r.error; j++) {
+            Member* m = ast_alloc(sizeof(Member));
+            m->sym = get_name(&r, &m->name, &m->len);
+            m->type = get_type_ref(&r, types, type_count);
+            m->index = (int)pch_get_u32(&r);
+            m->is_bitfield = pch_get_u32(&r) != 0;
+            m->bit_width = (int)pch_get_u32(&r);
+            m->bit_offset = (int)pch_get_u32(&r);
+            *link = m;
+            link = &m->next;
+        }
+    }
+
+    // Lists are rebuilt in their saved order
+    int count = (int)pch_get_u32(&r);
+    Typedef** td_link = &ctx->typedefs;
+    for (int i = 0; i < count && !r.error; i++) {
+        Typedef* td = ast_alloc(sizeof(Typedef));
+        td->sym = get_name(&r, &td->name, &td->len);
+        td->type = get_type_ref(&r, types, type_count);
+        *td_link = td;
+        td_link = &td->next;
+    }
+
+    count = (int)pch_get_u32(&r);
+    EnumConst** ec_link = &ctx->enum_consts;
+    for (int i = 0; i < count && !r.error; i++) {
+        EnumConst* ec = ast_alloc(sizeof(EnumConst));
+        ec->sym = get_name(&r, &ec->name, &ec->len);
+        ec->val = (int)pch_get_u32(&r);
+        *ec_link = ec;
+        ec_link = &ec->next;
+    }
+
+    count = (int)pch_get_u32(&r);
+    StructTag** tag_link = &ctx->struct_tags;
+    for (int i = 0; i < count && !r.error; i++) {
+        StructTag* tag = ast_alloc(sizeof(StructTag));
+        tag->sym = get_name(&r, &tag->name, &tag->len);
+        tag->type = get_type_ref(&r, types, type_count);
+        *tag_link = tag;
+        tag_link = &tag->next;
+    }
+
+    count = (int)pch_get_u32(&r);
+    LVar** var_link = &ctx->globals;
+    for (int i = 0; i < count && !r.error; i++) {
+        LVar* var = ast_alloc(sizeof(LVar));
+        var->sym = get_name(&r, &var->name, &var->len);
+        var->type = get_type_ref(&r, types, type_count);
+        *var_link = var;
+        var_link = &var->next;
+    }
+    index_gvars(ctx);
+
+    count = (int)pch_get_u32(&r);
+    if (count < 0 || count > r.end - r.p)
+        corrupt_pch();
+    for (int i = 0; i < count && !r.error; i++) {
+        NodeKind kind = (NodeKind)pch_get_u32(&r);
+        if (kind != ND_FUNCTION && kind != ND_GVAR)
+            corrupt_pch();
+        Node* node = new_node(kind, NULL, NULL);
+        Token* tok = ast_alloc(sizeof(Token));
+        tok->kind = TK_IDENT;
+        tok->sym = get_name(&r, &tok->str, &tok->len);
+        node->tok = tok;
+        node->type = get_type_ref(&r, types, type_count);
+        unsigned int flags = pch_get_u32(&r);
+        node->is_extern = (flags & 1u) != 0;
+        node->is_vararg = (flags & 2u) != 0;
+        node->is_inline = (flags & 4u) != 0;
+        node->is_static = (flags & 8u) != 0;
+        int param_count = (int)pch_get_u32(&r);
+        Node** param_link = &node->rhs;
+        for (int j = 0; j < param_count && !r.error; j++) {
+            Node* param = new_node((NodeKind)pch_get_u32(&r), NULL, NULL);
+            param->val = (int)pch_get_u32(&r);
+            param->type = get_type_ref(&r, types, type_count);
+            *param_link = param;
+            param_link = &param->next;
+        }
+        if (kind == ND_FUNCTION)
+            declare_function(ctx, node);
+        add_code(ctx, node);
+    }
+    free(types);
+    if (r.error)
+        corrupt_pch();
+}
+
+// Release the loaded precompiled header
+void close_pch(void) {
+    preprocess_load_pch(NULL, NULL);
+    if (pch_loaded) {
+        close_file_view(&pch_view);
+        pch_loaded = false;
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef __PCH_H__
+#define __PCH_H__
+
+#include "common.h"
+
+// Growable byte buffer a precompiled header is built in
+typedef struct PchBuf PchBuf;
+struct PchBuf {
+    char* data;
+    size_t len;
+    size_t cap;
+};
+
+// Read position in a loaded precompiled header; error is set instead of
+// reading past end
+typedef struct PchReader PchReader;
+struct PchReader {
+    const char* p;
+    const char* end;
+    bool error;
+};
+
+extern void pch_put_u32(PchBuf* buf, unsigned int v);
+extern void pch_put_u64(PchBuf* buf, unsigned long long v);
+extern void pch_put_str(PchBuf* buf, const char* s, int len);
+extern unsigned int pch_get_u32(PchReader* r);
+extern unsigned long long pch_get_u64(PchReader* r);
+extern const char* pch_get_str(PchReader* r, int* len);
+extern void write_pch(Context* ctx, PchBuf* pp_state, const char* path);
+extern bool load_pch(const char* path);
+extern void restore_pch(Context* ctx);
+extern void close_pch(void);
+
+#endif
@@ -1,5 +1,9 @@
 #include "preprocess.h"
+#include "arena.h"
 #include "file.h"
+#include "intern.h"
+#include "literal.h"
+#include "scan.h"
 
 #include <ctype.h>
 #include <stdbool.h>
@@ -9,20 +13,86 @@
 #include <time.h>
 
 typedef struct Macro Macro;
+
+typedef enum {
+    PP_IDENT,
+    PP_NUMBER,
+    PP_LITERAL, // String or character literal
+    PP_PUNCT,
+    PP_EOL, // End of the line; its gap holds trailing blanks and comments
+} PPKind;
+
+// Macros a token must not be expanded by again (Prosser's algorithm)
+typedef struct HideSet HideSet;
+struct HideSet {
+    Macro* macro;
+    HideSet* next;
+};
+
+// Preprocessing token
+typedef struct PPToken PPToken;
+struct PPToken {
+    PPKind kind;
+    const char* str;
+    int len;
+    unsigned int hash; // PP_IDENT: hash_name() of the spelling
+    bool space;        // Whitespace or a comment comes before the token
+    const char* gap;   // Source text before the token, copied to the output
+                       // as is; NULL for tokens built by an expansion
+    int gap_len;
+    int param; // In a macro body: parameter index, or -1
+    int line;  // Source position for diagnostics; 0 in a macro body
+    int col;   // Column from the start of the tokenized text
+    HideSet* hs;
+    PPToken* next;
+};
+
 struct Macro {
     char* name;
+    size_t name_len;
+    unsigned int hash; // hash_name() of name
     char* value;
+    PPToken* body; // Tokens of value; their spellings point into value
+    int body_len;
     bool is_function;
-    bool is_variadic;
+    bool is_variadic; // __VA_ARGS__ is parameter number param_count
     char** params;
     int param_count;
-    Macro* next;
 };
 
+// Macros keyed by name; open addressing with linear probing
 typedef struct {
-    Macro* macros;
-    int current_line;
-} PreprocessContext;
+    Macro** slots; // NULL = empty
+    int cap;       // Power of two
+    int count;
+} MacroTable;
+
+// What is known about a header after its first inclusion
+typedef struct IncludeFile IncludeFile;
+struct IncludeFile {
+    char* path; // Canonical path from realpath()
+    unsigned int hash;
+    char* guard; // Macro of an #ifndef guard around the whole file, or NULL
+    size_t guard_len;
+    unsigned int guard_hash;
+    bool pragma_once;
+    bool listed; // Already in the dependency list
+};
+
+// Headers keyed by canonical path; open addressing with linear probing
+typedef struct {
+    IncludeFile** slots; // NULL = empty
+    int cap;             // Power of two
+    int count;
+} IncludeTable;
+
+// Progress of include guard detection through a header
+typedef enum {
+    GUARD_BEFORE,  // Only blank lines and comments so far
+    GUARD_INSIDE,  // Inside the #ifndef group
+    GUARD_AFTER,   // Group closed; only blank lines and comments may follow
+    GUARD_INVALID, // Not a guarded header
+} GuardState;
 
 typedef struct CondStack CondStack;
 struct CondStack {
@@ -31,12 +101,71 @@ struct CondStack {
     CondStack* next;
 };
 
+// Output buffer; with fp set it is written out whenever it fills up, so
+// memory stays bounded however much text passes through
 typedef struct {
     char* data;
     size_t len;
     size_t cap;
+    FILE* fp;
 } StrBuf;
 
+// A file being read; an included header is stacked on the file including
+// it
+typedef struct PPFile PPFile;
+struct PPFile {
+    const char* p;        // Start of the next line
+    const char* end;      // End of the input
+    const char* line_end; // End of the line handed out last
+    bool pending;         // The line at line_end is still to be stepped over
+    const char* filename; // Name used to resolve quoted includes
+    const char* display;  // Name of this file in line markers
+    IncludeFile* file;    // Header entry, or NULL for the main file
+    CondStack* cond_stack;
+    bool in_block_comment;
+    int out_line;    // Source line the next output line belongs to
+    int parent_line; // Line of the #include in the including file
+    // The file is guarded if it is a single #ifndef group with only blank
+    // lines and comments outside it
+    GuardState guard_state;
+    bool in_guard_comment;
+    const char* guard_name;
+    size_t guard_len;
+    PPFile* parent;
+};
+
+typedef struct {
+    MacroTable macros;
+    IncludeTable includes;
+    Arena expand_arena; // Tokens of the line being expanded
+    Arena text_arena;   // Spellings made by expansions; kept to the end
+    // Last hs_union() result; consecutive tokens mostly share hide sets
+    HideSet* union_a;
+    HideSet* union_b;
+    HideSet* union_result;
+    int current_line;
+    PPFile* file;         // File being read
+    StrBuf* out;          // Receives the text, or NULL when tokens are pulled
+    PPToken* line_eol;    // PP_EOL ending the line being expanded, or NULL
+    bool joining;         // Reading on for a macro invocation spanning lines
+    const char* filename; // Source file of the translation unit
+    bool line_markers;    // Emit "# line" markers (-E output)
+    bool record_deps;     // Collect the headers included into deps
+    // Dependency rule output and its target (see write_deps())
+    const char* deps_path;
+    const char* deps_target;
+    char* pch_path;     // Precompiled header the state was read from
+    PchBuf* pch_out;    // Receives the state at the end, or NULL
+    IncludeFile** deps; // Headers in the order they were first included
+    int dep_count;
+    int dep_cap;
+    // Values of replaced or undefined macros; tokens already handed out
+    // may still point into them
+    char** retired;
+    int retired_count;
+    int retired_cap;
+} PreprocessContext;
+
 static char* dup_range(const char* begin, size_t len) {
     char* s = malloc(len + 1);
     if (!s) {
@@ -51,6 +180,7 @@ static char* dup_range(const char* begin, size_t len) {
 static void sb_init(StrBuf* sb) {
     sb->cap = 4096;
     sb->len = 0;
+    sb->fp = NULL;
     sb->data = malloc(sb->cap);
     if (!sb->data) {
         perror("malloc");
@@ -59,10 +189,25 @@ static void sb_init(StrBuf* sb) {
     sb->data[0] = '\0';
 }
 
+static void sb_flush(StrBuf* sb) {
+    if (fwrite(sb->data, 1, sb->len, sb->fp) != sb->len) {
+        perror("fwrite");
+        exit(1);
+    }
+    sb->len = 0;
+    sb->data[0] = '\0';
+}
+
 static void sb_ensure(StrBuf* sb, size_t add_len) {
     size_t needed = sb->len + add_len + 1;
     if (needed <= sb->cap)
         return;
+    if (sb->fp) {
+        sb_flush(sb);
+        needed = add_len + 1;
+        if (needed <= sb->cap)
+            return;
+    }
     while (sb->cap < needed)
         sb->cap *= 2;
     char* p = realloc(sb->data, sb->cap);
@@ -100,17 +245,271 @@ static const char* skip_spaces(const char* p, const char* end) {
     return p;
 }
 
-static Macro* find_macro(PreprocessContext* ctx, const char* name, size_t len) {
-    for (Macro* m = ctx->macros; m; m = m->next) {
-        if (strncmp(m->name, name, len) == 0 && m->name[len] == '\0')
-            return m;
+/**
+ * Scan an identifier and hash it on the way
+ *
+ * Produces the same value as hash_name() over the scanned range, so the
+ * macro table can be probed without touching the text again.
+ *
+ * @param[in] p First character of the identifier
+ * @param[in] end End of the text, or NULL if it is NUL-terminated
+ * @param[out] hash Hash of the identifier
+ * @return Pointer just past the identifier
+ */
+static const char* scan_ident(const char* p, const char* end,
+                              unsigned int* hash) {
+    unsigned int h = 2166136261u;
+    while ((!end || p < end) && is_ident_char(*p)) {
+        h = h ^ (unsigned char)*p;
+        h = h * 16777619;
+        p++;
+    }
+    *hash = h;
+    return p;
+}
+
+// Skip whitespace and comments up to end
+static const char* pp_skip_gap(const char* p, const char* end,
+                               bool* in_comment) {
+    for (;;) {
+        if (*in_comment) {
+            const char* close = scan_comment_end(p, end);
+            if (!close)
+                return end;
+            p = close + 2;
+            *in_comment = false;
+        }
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' ||
+                           *p == '\f' || *p == '\v'))
+            p++;
+        if (p + 1 < end && p[0] == '/' && p[1] == '/')
+            return end;
+        if (p + 1 < end && p[0] == '/' && p[1] == '*') {
+            p += 2;
+            *in_comment = true;
+            continue;
+        }
+        return p;
+    }
+}
+
+// Preprocessing number: a digit (or '.' digit) followed by identifier
+// characters, dots and exponent signs
+static const char* pp_skip_number(const char* p, const char* end) {
+    p++;
+    while (p < end) {
+        if ((*p == '+' || *p == '-') && (p[-1] == 'e' || p[-1] == 'E' ||
+                                         p[-1] == 'p' || p[-1] == 'P'))
+            p++;
+        else if (is_ident_char(*p) || *p == '.')
+            p++;
+        else
+            break;
+    }
+    return p;
+}
+
+static const char* pp_skip_literal(const char* p, const char* end) {
+    char quote = *p++;
+    while (p < end && *p != quote) {
+        if (*p == '\\' && p + 1 < end)
+            p++;
+        p++;
+    }
+    return p < end ? p + 1 : end;
+}
+
+// Length of the punctuator at p; any other character stands alone
+static int pp_punct_len(const char* p, const char* end) {
+    char c = p[0];
+    char c1 = end - p > 1 ? p[1] : '\0';
+    char c2 = end - p > 2 ? p[2] : '\0';
+    switch (c) {
+    case '#':
+        return c1 == '#' ? 2 : 1;
+    case '.':
+        return (c1 == '.' && c2 == '.') ? 3 : 1;
+    case '<':
+    case '>':
+        if (c1 == c)
+            return c2 == '=' ? 3 : 2;
+        return c1 == '=' ? 2 : 1;
+    case '-':
+        return (c1 == '-' || c1 == '=' || c1 == '>') ? 2 : 1;
+    case '+':
+    case '&':
+    case '|':
+        return (c1 == c || c1 == '=') ? 2 : 1;
+    case '=':
+    case '!':
+    case '*':
+    case '/':
+    case '%':
+    case '^':
+        return c1 == '=' ? 2 : 1;
+    }
+    return 1;
+}
+
+/**
+ * Lex one preprocessing token
+ *
+ * @param[in] p Position to lex from
+ * @param[in] end End of the line
+ * @param[in,out] in_comment Whether a block comment is open at p; updated
+ * @param[out] tok Token; PP_EOL once only blanks and comments are left
+ * @return Position just past the token
+ */
+static const char* pp_next(const char* p, const char* end, bool* in_comment,
+                           PPToken* tok) {
+    const char* gap = p;
+    p = pp_skip_gap(p, end, in_comment);
+    memset(tok, 0, sizeof(PPToken));
+    tok->gap = gap;
+    tok->gap_len = (int)(p - gap);
+    tok->space = p > gap;
+    tok->param = -1;
+    tok->str = p;
+    if (p >= end) {
+        tok->kind = PP_EOL;
+        return end;
+    }
+
+    const char* q;
+    if (is_ident_start(*p)) {
+        tok->kind = PP_IDENT;
+        q = scan_ident(p, end, &tok->hash);
+    } else if (isdigit((unsigned char)*p) ||
+               (*p == '.' && p + 1 < end && isdigit((unsigned char)p[1]))) {
+        tok->kind = PP_NUMBER;
+        q = pp_skip_number(p, end);
+    } else if (*p == '"' || *p == '\'') {
+        tok->kind = PP_LITERAL;
+        q = pp_skip_literal(p, end);
+    } else {
+        tok->kind = PP_PUNCT;
+        q = p + pp_punct_len(p, end);
+    }
+    tok->len = (int)(q - p);
+    return q;
+}
+
+static bool is_punct(PPToken* tok, const char* op) {
+    return tok->kind == PP_PUNCT && tok->str[0] == op[0] &&
+           (size_t)tok->len == strlen(op) &&
+           strncmp(tok->str, op, (size_t)tok->len) == 0;
+}
+
+static int macro_slot(MacroTable* table, const char* name, size_t len,
+                      unsigned int hash) {
+    int i = (int)(hash & (unsigned int)(table->cap - 1));
+    while (table->slots[i]) {
+        Macro* m = table->slots[i];
+        if (m->hash == hash && m->name_len == len &&
+            memcmp(m->name, name, len) == 0)
+            return i;
+        i = (i + 1) & (table->cap - 1);
+    }
+    return i;
+}
+
+static Macro* find_macro(PreprocessContext* ctx, const char* name, size_t len,
+                         unsigned int hash) {
+    if (ctx->macros.count == 0)
+        return NULL;
+    return ctx->macros.slots[macro_slot(&ctx->macros, name, len, hash)];
+}
+
+static void grow_macro_table(MacroTable* table) {
+    int old_cap = table->cap;
+    Macro** old_slots = table->slots;
+    table->cap = old_cap ? old_cap * 2 : 256;
+    table->slots = calloc((size_t)table->cap, sizeof(Macro*));
+    if (!table->slots) {
+        perror("calloc");
+        exit(1);
+    }
+    for (int i = 0; i < old_cap; i++) {
+        Macro* m = old_slots[i];
+        if (m)
+            table->slots[macro_slot(table, m->name, m->name_len, m->hash)] = m;
+    }
+    free(old_slots);
+}
+
+/**
+ * Split a macro's replacement text into tokens
+ *
+ * Parameter names (and __VA_ARGS__) are resolved here once, so expansion
+ * only compares indices.
+ *
+ * @param[in,out] m Macro whose value, parameters and body are set
+ */
+static void set_macro_body(Macro* m) {
+    free(m->body);
+    int cap = 8;
+    int n = 0;
+    PPToken* body = malloc(sizeof(PPToken) * (size_t)cap);
+    if (!body) {
+        perror("malloc");
+        exit(1);
+    }
+    const char* p = m->value;
+    const char* end = p + strlen(p);
+    bool in_comment = false;
+    for (;;) {
+        PPToken tok;
+        p = pp_next(p, end, &in_comment, &tok);
+        if (tok.kind == PP_EOL)
+            break;
+        tok.gap = NULL;
+        tok.gap_len = 0;
+        if (tok.kind == PP_IDENT && m->is_function) {
+            for (int i = 0; i < m->param_count; i++) {
+                if (strlen(m->params[i]) == (size_t)tok.len &&
+                    strncmp(m->params[i], tok.str, (size_t)tok.len) == 0) {
+                    tok.param = i;
+                    break;
+                }
+            }
+            if (m->is_variadic && tok.len == 11 &&
+                strncmp(tok.str, "__VA_ARGS__", 11) == 0)
+                tok.param = m->param_count;
+        }
+        if (n == cap) {
+            cap *= 2;
+            body = realloc(body, sizeof(PPToken) * (size_t)cap);
+            if (!body) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        body[n++] = tok;
+    }
+    m->body = body;
+    m->body_len = n;
+}
+
+// Keep the value of a macro that is replaced or undefined until the end
+static void retire_value(PreprocessContext* ctx, char* value) {
+    if (ctx->retired_count == ctx->retired_cap) {
+        int cap = ctx->retired_cap ? ctx->retired_cap * 2 : 16;
+        char** retired = realloc(ctx->retired, sizeof(char*) * (size_t)cap);
+        if (!retired) {
+            perror("realloc");
+            exit(1);
+        }
+        ctx->retired = retired;
+        ctx->retired_cap = cap;
     }
-    return NULL;
+    ctx->retired[ctx->retired_count] = value;
+    ctx->retired_count++;
 }
 
 static void free_macro_fields(Macro* m) {
     free(m->name);
     free(m->value);
+    free(m->body);
     if (m->params) {
         for (int i = 0; i < m->param_count; i++) {
             free(m->params[i]);
@@ -124,9 +523,10 @@ static void add_or_replace_macro(PreprocessContext* ctx, const char* name,
                                  bool is_variadic, char** params,
                                  int param_count) {
     size_t name_len = strlen(name);
-    Macro* old = find_macro(ctx, name, name_len);
+    unsigned int hash = hash_name(name, (int)name_len);
+    Macro* old = find_macro(ctx, name, name_len, hash);
     if (old) {
-        free(old->value);
+        retire_value(ctx, old->value);
         if (old->params) {
             for (int i = 0; i < old->param_count; i++)
                 free(old->params[i]);
@@ -141,6 +541,7 @@ static void add_or_replace_macro(PreprocessContext* ctx, const char* name,
         old->is_variadic = is_variadic;
         old->params = params;
         old->param_count = param_count;
+        set_macro_body(old);
         return;
     }
 
@@ -155,35 +556,61 @@ static void add_or_replace_macro(PreprocessContext* ctx, const char* name,
         perror("strdup");
         exit(1);
     }
+    m->name_len = name_len;
+    m->hash = hash;
     m->is_function = is_function;
     m->is_variadic = is_variadic;
     m->params = params;
     m->param_count = param_count;
-    m->next = ctx->macros;
-    ctx->macros = m;
+    set_macro_body(m);
+
+    // Keep the load factor at or below 1/2
+    MacroTable* table = &ctx->macros;
+    if ((table->count + 1) * 2 > table->cap)
+        grow_macro_table(table);
+    table->slots[macro_slot(table, name, name_len, hash)] = m;
+    table->count++;
 }
 
-static void undef_macro(PreprocessContext* ctx, const char* name, size_t len) {
-    Macro** pp = &ctx->macros;
-    while (*pp) {
-        Macro* m = *pp;
-        if (strncmp(m->name, name, len) == 0 && m->name[len] == '\0') {
-            *pp = m->next;
-            free_macro_fields(m);
-            free(m);
-            return;
+static void undef_macro(PreprocessContext* ctx, const char* name, size_t len,
+                        unsigned int hash) {
+    MacroTable* table = &ctx->macros;
+    if (table->count == 0)
+        return;
+    int i = macro_slot(table, name, len, hash);
+    Macro* m = table->slots[i];
+    if (!m)
+        return;
+    retire_value(ctx, m->value);
+    m->value = NULL;
+    free_macro_fields(m);
+    free(m);
+    table->slots[i] = NULL;
+    table->count--;
+
+    // Backward-shift deletion: move later entries of the probe run into the
+    // hole when their home slot does not lie between the hole and them.
+    int mask = table->cap - 1;
+    int hole = i;
+    for (int j = (i + 1) & mask; table->slots[j]; j = (j + 1) & mask) {
+        int home = (int)(table->slots[j]->hash & (unsigned int)mask);
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            table->slots[hole] = table->slots[j];
+            table->slots[j] = NULL;
+            hole = j;
         }
-        pp = &m->next;
     }
 }
 
-static void free_macros(Macro* m) {
-    while (m) {
-        Macro* next = m->next;
-        free_macro_fields(m);
-        free(m);
-        m = next;
+static void free_macros(MacroTable* table) {
+    for (int i = 0; i < table->cap; i++) {
+        Macro* m = table->slots[i];
+        if (m) {
+            free_macro_fields(m);
+            free(m);
+        }
     }
+    free(table->slots);
 }
 
 static char* get_dirname(const char* path) {
@@ -200,7 +627,72 @@ static char* get_dirname(const char* path) {
     return dup_range(path, slash_pos);
 }
 
-static char* try_read_include(const char* dir, const char* inc_name) {
+// Directories added with -I and -isystem. The -I directories come first,
+// followed by the -isystem ones.
+static char** include_dirs = NULL;
+static int include_dir_count = 0;
+static int user_dir_count = 0;
+
+/**
+ * Add a directory to the include search path
+ *
+ * Directories are searched in the order they were added, -I directories
+ * before -isystem ones, after the includer's directory for "..." includes
+ * and before the built-in selfhost/include and working directory.
+ *
+ * @param[in] dir Directory to search
+ * @param[in] is_system Whether it was given with -isystem
+ */
+void add_include_dir(const char* dir, bool is_system) {
+    char** dirs =
+        realloc(include_dirs, sizeof(char*) * (size_t)(include_dir_count + 1));
+    if (!dirs) {
+        perror("realloc");
+        exit(1);
+    }
+    include_dirs = dirs;
+    int pos = is_system ? include_dir_count : user_dir_count;
+    for (int i = include_dir_count; i > pos; i--)
+        include_dirs[i] = include_dirs[i - 1];
+    // Drop trailing slashes so "dir/" and "dir" share cache entries
+    size_t len = strlen(dir);
+    while (len > 1 && dir[len - 1] == '/')
+        len--;
+    include_dirs[pos] = dup_range(dir, len);
+    include_dir_count++;
+    if (!is_system)
+        user_dir_count++;
+}
+
+/**
+ * Remove every directory added with add_include_dir()
+ */
+void clear_include_dirs(void) {
+    for (int i = 0; i < include_dir_count; i++)
+        free(include_dirs[i]);
+    free(include_dirs);
+    include_dirs = NULL;
+    include_dir_count = 0;
+    user_dir_count = 0;
+}
+
+/**
+ * Resolve an include candidate to a canonical path
+ *
+ * The directory listing is checked first, so a directory without the file
+ * is ruled out by a hash probe instead of a failing open. A listed name
+ * that cannot be read, such as a subdirectory, is not a match either, so
+ * the search goes on with the next directory.
+ *
+ * @param[in] dir Directory to look in
+ * @param[in] inc_name Name from the #include directive
+ * @return Canonical path owned by the file cache, or NULL if there is no
+ *         readable file of that name
+ */
+static const char* resolve_include(const char* dir, const char* inc_name) {
+    if (!cached_dir_has(dir, inc_name))
+        return NULL;
+
     StrBuf path;
     sb_init(&path);
     if (strcmp(dir, ".") == 0) {
@@ -211,9 +703,226 @@ static char* try_read_include(const char* dir, const char* inc_name) {
         sb_append_n(&path, inc_name, strlen(inc_name));
     }
 
-    char* content = read_file(path.data);
+    const char* resolved = cached_realpath(path.data);
     free(path.data);
-    return content;
+    if (!resolved || !cached_file_view(resolved))
+        return NULL;
+    return resolved;
+}
+
+static int include_slot(IncludeTable* table, const char* path,
+                        unsigned int hash) {
+    int i = (int)(hash & (unsigned int)(table->cap - 1));
+    while (table->slots[i]) {
+        IncludeFile* f = table->slots[i];
+        if (f->hash == hash && strcmp(f->path, path) == 0)
+            return i;
+        i = (i + 1) & (table->cap - 1);
+    }
+    return i;
+}
+
+static void grow_include_table(IncludeTable* table) {
+    int old_cap = table->cap;
+    IncludeFile** old_slots = table->slots;
+    table->cap = old_cap ? old_cap * 2 : 64;
+    table->slots = calloc((size_t)table->cap, sizeof(IncludeFile*));
+    if (!table->slots) {
+        perror("calloc");
+        exit(1);
+    }
+    for (int i = 0; i < old_cap; i++) {
+        IncludeFile* f = old_slots[i];
+        if (f)
+            table->slots[include_slot(table, f->path, f->hash)] = f;
+    }
+    free(old_slots);
+}
+
+/**
+ * Get the entry for a header, creating it on first use
+ *
+ * @param[in] ctx Preprocessor state
+ * @param[in] path Canonical path
+ * @return Entry for the header
+ */
+static IncludeFile* include_file(PreprocessContext* ctx, const char* path) {
+    IncludeTable* table = &ctx->includes;
+    size_t len = strlen(path);
+    unsigned int hash = hash_name(path, (int)len);
+    if ((table->count + 1) * 2 > table->cap)
+        grow_include_table(table);
+    int i = include_slot(table, path, hash);
+    if (table->slots[i])
+        return table->slots[i];
+    IncludeFile* f = calloc(1, sizeof(IncludeFile));
+    if (!f) {
+        perror("calloc");
+        exit(1);
+    }
+    f->path = strdup(path);
+    if (!f->path) {
+        perror("strdup");
+        exit(1);
+    }
+    f->hash = hash;
+    table->slots[i] = f;
+    table->count++;
+    return f;
+}
+
+// Add a header to the dependency list unless it is already there
+static void add_dep(PreprocessContext* ctx, IncludeFile* f) {
+    if (f->listed)
+        return;
+    if (ctx->dep_count == ctx->dep_cap) {
+        int cap = ctx->dep_cap ? ctx->dep_cap * 2 : 16;
+        IncludeFile** deps =
+            realloc(ctx->deps, sizeof(IncludeFile*) * (size_t)cap);
+        if (!deps) {
+            perror("realloc");
+            exit(1);
+        }
+        ctx->deps = deps;
+        ctx->dep_cap = cap;
+    }
+    ctx->deps[ctx->dep_count] = f;
+    ctx->dep_count++;
+    f->listed = true;
+}
+
+// Whether including the header again would produce nothing
+static bool include_is_redundant(PreprocessContext* ctx, IncludeFile* f) {
+    if (f->pragma_once)
+        return true;
+    return f->guard &&
+           find_macro(ctx, f->guard, f->guard_len, f->guard_hash) != NULL;
+}
+
+static void free_includes(IncludeTable* table) {
+    for (int i = 0; i < table->cap; i++) {
+        IncludeFile* f = table->slots[i];
+        if (f) {
+            free(f->path);
+            free(f->guard);
+            free(f);
+        }
+    }
+    free(table->slots);
+}
+
+/**
+ * Check that a line holds only whitespace and comments
+ *
+ * @param[in] p Start of the line
+ * @param[in] end End of the line
+ * @param[in,out] in_comment Whether a block comment is open at p; updated
+ *                to the state at end
+ * @return true if nothing else is on the line
+ */
+static bool is_blank_line(const char* p, const char* end, bool* in_comment) {
+    while (p < end) {
+        if (*in_comment) {
+            const char* close = scan_comment_end(p, end);
+            if (!close)
+                return true;
+            p = close + 2;
+            *in_comment = false;
+            continue;
+        }
+        if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\f' ||
+            *p == '\v') {
+            p++;
+            continue;
+        }
+        if (*p == '/' && p + 1 < end && p[1] == '/')
+            return true;
+        if (*p == '/' && p + 1 < end && p[1] == '*') {
+            p += 2;
+            *in_comment = true;
+            continue;
+        }
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Get the macro tested by a guard-style condition
+ *
+ * Accepts "#ifndef X" and "#if !defined X" / "#if !defined(X)".
+ *
+ * @param[in] kw Directive keyword
+ * @param[in] kw_len Length of the keyword
+ * @param[in] d Text after the keyword
+ * @param[in] end End of the line
+ * @param[out] len Length of the macro name
+ * @return Start of the macro name, or NULL if the condition has another form
+ */
+static const char* guard_condition(const char* kw, size_t kw_len,
+                                   const char* d, const char* end,
+                                   size_t* len) {
+    d = skip_spaces(d, end);
+    bool paren = false;
+    if (kw_len == 2 && strncmp(kw, "if", 2) == 0) {
+        if (d >= end || *d != '!')
+            return NULL;
+        d = skip_spaces(d + 1, end);
+        if (end - d < 7 || strncmp(d, "defined", 7) != 0)
+            return NULL;
+        d = skip_spaces(d + 7, end);
+        if (d < end && *d == '(') {
+            paren = true;
+            d = skip_spaces(d + 1, end);
+        }
+    } else if (!(kw_len == 6 && strncmp(kw, "ifndef", 6) == 0)) {
+        return NULL;
+    }
+    const char* name = d;
+    while (d < end && is_ident_char(*d))
+        d++;
+    if (d == name || !is_ident_start(*name))
+        return NULL;
+    *len = (size_t)(d - name);
+    d = skip_spaces(d, end);
+    if (paren) {
+        if (d >= end || *d != ')')
+            return NULL;
+        d = skip_spaces(d + 1, end);
+    }
+    // Anything else must be a comment
+    bool in_comment = false;
+    if (!is_blank_line(d, end, &in_comment) || in_comment)
+        return NULL;
+    return name;
+}
+
+/**
+ * Find a header on the search path
+ *
+ * @param[in] filename File containing the #include
+ * @param[in] inc_name Name from the #include directive
+ * @param[in] quoted Whether the name was in quotes rather than <>
+ * @return Canonical path owned by the file cache, or NULL if not found
+ */
+static const char* find_include(const char* filename, const char* inc_name,
+                                bool quoted) {
+    if (inc_name[0] == '/')
+        return cached_realpath(inc_name);
+
+    const char* path = NULL;
+    if (quoted) {
+        char* dir = get_dirname(filename);
+        path = resolve_include(dir, inc_name);
+        free(dir);
+    }
+    for (int i = 0; !path && i < include_dir_count; i++)
+        path = resolve_include(include_dirs[i], inc_name);
+    if (!path)
+        path = resolve_include("selfhost/include", inc_name);
+    if (!path)
+        path = resolve_include(".", inc_name);
+    return path;
 }
 
 static char* trim_copy(const char* s, size_t len) {
@@ -226,19 +935,6 @@ static char* trim_copy(const char* s, size_t len) {
     return dup_range(b, (size_t)(e - b));
 }
 
-static int find_param_index(Macro* m, const char* name, size_t len) {
-    for (int i = 0; i < m->param_count; i++) {
-        if (strlen(m->params[i]) == len &&
-            strncmp(m->params[i], name, len) == 0) {
-            return i;
-        }
-    }
-    return -1;
-}
-
-static char* expand_macros_in_text(PreprocessContext* ctx, const char* text,
-                                   int depth);
-
 static void sb_append_escaped_quoted(StrBuf* out, const char* s) {
     sb_append_c(out, '"');
     for (const char* p = s; *p; p++) {
@@ -249,512 +945,1233 @@ static void sb_append_escaped_quoted(StrBuf* out, const char* s) {
     sb_append_c(out, '"');
 }
 
-static void trim_trailing_space(StrBuf* out) {
-    while (out->len > 0) {
-        char c = out->data[out->len - 1];
-        if (c == ' ' || c == '\t') {
-            out->len--;
-            out->data[out->len] = '\0';
-            continue;
-        }
-        break;
+/**
+ * Emit a line marker: the next output line is line `line` of `name`
+ *
+ * @param[in] flag 1 when entering an included file, 2 when returning to the
+ *            includer, 0 otherwise
+ */
+static void pp_line_marker(StrBuf* out, int line, const char* name, int flag) {
+    char num[16];
+    snprintf(num, sizeof(num), "# %d ", line);
+    sb_append_n(out, num, strlen(num));
+    sb_append_escaped_quoted(out, name);
+    if (flag) {
+        sb_append_c(out, ' ');
+        sb_append_c(out, (char)('0' + flag));
     }
+    sb_append_c(out, '\n');
 }
 
-static char* expand_function_macro(Macro* m, char** args, int argc) {
-    StrBuf out;
-    sb_init(&out);
-    const char* p = m->value;
-    while (*p) {
-        if (*p == '#' && p[1] == '#') {
-            // Token pasting: remove previous trailing spaces and suppress
-            // following spaces.
-            trim_trailing_space(&out);
-            p += 2;
-            while (*p == ' ' || *p == '\t')
-                p++;
-            continue;
-        }
-        if (*p == '#') {
-            const char* q = p + 1;
-            while (*q == ' ' || *q == '\t')
-                q++;
-            if (is_ident_start(*q)) {
-                const char* start = q;
-                while (is_ident_char(*q))
-                    q++;
-                size_t len = (size_t)(q - start);
-                int idx = find_param_index(m, start, len);
-                if (idx >= 0 && idx < argc) {
-                    sb_append_escaped_quoted(&out, args[idx]);
-                    p = q;
-                    continue;
-                }
-                // #__VA_ARGS__ stringification
-                if (m->is_variadic && len == 11 &&
-                    strncmp(start, "__VA_ARGS__", 11) == 0) {
-                    StrBuf joined;
-                    sb_init(&joined);
-                    int fixed_count = m->param_count;
-                    for (int i = fixed_count; i < argc; i++) {
-                        if (i > fixed_count)
-                            sb_append_c(&joined, ',');
-                        sb_append_n(&joined, args[i], strlen(args[i]));
-                    }
-                    sb_append_escaped_quoted(&out, joined.data);
-                    free(joined.data);
-                    p = q;
-                    continue;
-                }
-            }
+// Tokens of one macro argument
+typedef struct {
+    PPToken* first; // As written in the invocation
+    int count;
+    PPToken* expanded; // Fully macro-expanded; built on first use
+    int expanded_count;
+    bool is_expanded;
+} PPArg;
+
+static bool hs_contains(HideSet* hs, Macro* m) {
+    for (; hs; hs = hs->next) {
+        if (hs->macro == m)
+            return true;
+    }
+    return false;
+}
+
+static HideSet* hs_add(PreprocessContext* ctx, HideSet* hs, Macro* m) {
+    HideSet* h = arena_alloc(&ctx->expand_arena, sizeof(HideSet));
+    h->macro = m;
+    h->next = hs;
+    return h;
+}
+
+static HideSet* hs_union(PreprocessContext* ctx, HideSet* a, HideSet* b) {
+    if (!a)
+        return b;
+    if (!b)
+        return a;
+    if (a == ctx->union_a && b == ctx->union_b)
+        return ctx->union_result;
+    ctx->union_a = a;
+    ctx->union_b = b;
+    // Lists share tails, so everything from b onwards is already in b
+    for (; a && a != b; a = a->next) {
+        if (!hs_contains(b, a->macro))
+            b = hs_add(ctx, b, a->macro);
+    }
+    ctx->union_result = b;
+    return b;
+}
+
+static HideSet* hs_intersect(PreprocessContext* ctx, HideSet* a, HideSet* b) {
+    HideSet* r = NULL;
+    for (; a; a = a->next) {
+        if (hs_contains(b, a->macro))
+            r = hs_add(ctx, r, a->macro);
+    }
+    return r;
+}
+
+// Copy of src without source gap, carrying the union of both hide sets
+static PPToken* copy_token(PreprocessContext* ctx, PPToken* src,
+                           HideSet* hs) {
+    PPToken* t = arena_alloc(&ctx->expand_arena, sizeof(PPToken));
+    *t = *src;
+    t->gap = NULL;
+    t->gap_len = 0;
+    t->param = -1;
+    t->hs = hs_union(ctx, src->hs, hs);
+    t->next = NULL;
+    return t;
+}
+
+// Spelling made by an expansion; it outlives the tokens of the line
+static char* arena_strndup(PreprocessContext* ctx, const char* s,
+                           size_t len) {
+    char* r = arena_alloc(&ctx->text_arena, len + 1);
+    memcpy(r, s, len);
+    r[len] = '\0';
+    return r;
+}
+
+/**
+ * Split text into preprocessing tokens
+ *
+ * @param[in] p Start of the text
+ * @param[in] end End of the line
+ * @param[in,out] in_comment Whether a block comment is open at p; updated
+ * @param[out] eol Receives the PP_EOL token, or NULL
+ * @return Token list terminated by a PP_EOL token
+ */
+static PPToken* pp_tokenize(PreprocessContext* ctx, const char* p,
+                            const char* end, bool* in_comment,
+                            PPToken** eol) {
+    const char* start = p;
+    PPToken head;
+    PPToken* cur = &head;
+    for (;;) {
+        PPToken* t = arena_alloc(&ctx->expand_arena, sizeof(PPToken));
+        p = pp_next(p, end, in_comment, t);
+        t->line = ctx->current_line;
+        t->col = (int)(t->str - start) + 1;
+        cur = cur->next = t;
+        if (t->kind == PP_EOL) {
+            if (eol)
+                *eol = t;
+            return head.next;
         }
-        // , ##__VA_ARGS__ GCC extension: suppress preceding comma when empty
-        if (*p == ',' && m->is_variadic) {
-            const char* q = p + 1;
-            while (*q == ' ' || *q == '\t')
-                q++;
-            if (q[0] == '#' && q[1] == '#') {
-                const char* r = q + 2;
-                while (*r == ' ' || *r == '\t')
-                    r++;
-                if (strncmp(r, "__VA_ARGS__", 11) == 0 &&
-                    !is_ident_char(r[11])) {
-                    if (argc <= m->param_count) {
-                        // No variadic args: suppress comma
-                        p = r + 11;
-                        continue;
-                    }
-                    // Has variadic args: emit ", args..."
-                    sb_append_c(&out, ',');
-                    int fixed_count = m->param_count;
-                    for (int i = fixed_count; i < argc; i++) {
-                        if (i > fixed_count)
-                            sb_append_c(&out, ',');
-                        sb_append_n(&out, args[i], strlen(args[i]));
-                    }
-                    p = r + 11;
-                    continue;
-                }
-            }
+    }
+}
+
+static bool pp_read_line(PreprocessContext* ctx, const char** start,
+                         const char** end);
+
+/**
+ * Continue the line being expanded with the next line of the file
+ *
+ * Lets a macro invocation span lines. The tokens of the next line take the
+ * place of eol, which is left as PP_EOL only if that line is blank.
+ *
+ * @param[in,out] eol PP_EOL ending the line being expanded
+ * @return false if eol ends something else or the file has no more lines
+ */
+static bool pp_join_line(PreprocessContext* ctx, PPToken* eol) {
+    if (eol != ctx->line_eol)
+        return false;
+    const char* start;
+    const char* end;
+    ctx->joining = true;
+    bool found = pp_read_line(ctx, &start, &end);
+    ctx->joining = false;
+    if (!found)
+        return false;
+    PPToken* next_eol;
+    PPToken* list = pp_tokenize(ctx, start, end,
+                                &ctx->file->in_block_comment, &next_eol);
+    *eol = *list;
+    // The newline separates the tokens like a space
+    eol->space = true;
+    ctx->line_eol = list == next_eol ? eol : next_eol;
+    return true;
+}
+
+/**
+ * Collect the arguments of a function-like macro invocation
+ *
+ * The variadic part, commas included, becomes argument param_count.
+ *
+ * @param[in] m Macro being invoked
+ * @param[in] lparen The '(' after the macro name; the tokens after it may
+ *            be followed by the next lines of the file
+ * @param[out] args Arguments; room for param_count + 1 entries
+ * @return The closing ')', or NULL if the invocation does not match m
+ */
+static PPToken* read_args(PreprocessContext* ctx, Macro* m, PPToken* lparen,
+                          PPArg* args) {
+    int nargs = m->param_count + (m->is_variadic ? 1 : 0);
+    int idx = 0;
+    int depth = 0;
+    args[0].first = lparen->next;
+    PPToken* t = lparen->next;
+    for (;; t = t->next) {
+        // The arguments may go on over the following lines
+        while (t->kind == PP_EOL) {
+            if (!pp_join_line(ctx, t))
+                return NULL;
         }
-        if (is_ident_start(*p)) {
-            const char* start = p;
-            while (is_ident_char(*p))
-                p++;
-            size_t len = (size_t)(p - start);
-            // Check for __VA_ARGS__
-            if (m->is_variadic && len == 11 &&
-                strncmp(start, "__VA_ARGS__", 11) == 0) {
-                // Append variadic args (all args after fixed params)
-                int fixed_count = m->param_count;
-                for (int i = fixed_count; i < argc; i++) {
-                    if (i > fixed_count)
-                        sb_append_c(&out, ',');
-                    sb_append_n(&out, args[i], strlen(args[i]));
-                }
-                continue;
-            }
-            int idx = find_param_index(m, start, len);
-            if (idx >= 0 && idx < argc) {
-                sb_append_n(&out, args[idx], strlen(args[idx]));
-            } else {
-                sb_append_n(&out, start, len);
-            }
+        if (is_punct(t, "(")) {
+            depth++;
+        } else if (is_punct(t, ")")) {
+            if (depth == 0)
+                break;
+            depth--;
+        } else if (is_punct(t, ",") && depth == 0 &&
+                   !(m->is_variadic && idx == m->param_count)) {
+            if (++idx >= nargs)
+                return NULL;
+            args[idx].first = t->next;
             continue;
         }
-        sb_append_c(&out, *p++);
+        args[idx].count++;
     }
-    return out.data;
+    if (nargs == 0 && args[0].count > 0)
+        return NULL;
+    // Only the variadic part may be left out
+    if (idx + 1 < m->param_count)
+        return NULL;
+    if (idx + 1 < nargs)
+        args[nargs - 1].first = t;
+    return t;
 }
 
-static char* expand_macros_in_text(PreprocessContext* ctx, const char* text,
-                                   int depth) {
-    if (depth > 16) {
-        return strdup(text);
+static PPToken* expand_tokens(PreprocessContext* ctx, PPToken* list);
+
+// Macro-expand an argument on its own; the result is kept for later uses
+static void expand_arg(PreprocessContext* ctx, PPArg* arg) {
+    if (arg->is_expanded)
+        return;
+    PPToken head;
+    PPToken* cur = &head;
+    PPToken* t = arg->first;
+    for (int i = 0; i < arg->count; i++) {
+        cur = cur->next = copy_token(ctx, t, NULL);
+        t = t->next;
     }
+    PPToken* eol = arena_alloc(&ctx->expand_arena, sizeof(PPToken));
+    eol->kind = PP_EOL;
+    cur->next = eol;
+
+    arg->expanded = expand_tokens(ctx, head.next);
+    arg->expanded_count = 0;
+    for (t = arg->expanded; t->kind != PP_EOL; t = t->next)
+        arg->expanded_count++;
+    arg->is_expanded = true;
+}
 
-    StrBuf out;
-    sb_init(&out);
-    const char* p = text;
-    while (*p) {
-        if (*p == '"' || *p == '\'') {
-            char q = *p;
-            sb_append_c(&out, *p++);
-            bool escaped = false;
-            while (*p) {
-                sb_append_c(&out, *p);
-                if (escaped) {
-                    escaped = false;
-                } else if (*p == '\\') {
-                    escaped = true;
-                } else if (*p == q) {
-                    p++;
-                    break;
+// Spell an argument as a string literal (the # operator)
+static PPToken* stringize(PreprocessContext* ctx, PPArg* arg, HideSet* hs) {
+    StrBuf sb;
+    sb_init(&sb);
+    sb_append_c(&sb, '"');
+    PPToken* t = arg->first;
+    for (int i = 0; i < arg->count; i++) {
+        if (i > 0 && t->space)
+            sb_append_c(&sb, ' ');
+        for (int j = 0; j < t->len; j++) {
+            char c = t->str[j];
+            if (t->kind == PP_LITERAL && (c == '"' || c == '\\'))
+                sb_append_c(&sb, '\\');
+            sb_append_c(&sb, c);
+        }
+        t = t->next;
+    }
+    sb_append_c(&sb, '"');
+
+    PPToken* r = arena_alloc(&ctx->expand_arena, sizeof(PPToken));
+    r->kind = PP_LITERAL;
+    r->str = arena_strndup(ctx, sb.data, sb.len);
+    r->len = (int)sb.len;
+    r->param = -1;
+    r->hs = hs;
+    free(sb.data);
+    return r;
+}
+
+/**
+ * Join two tokens into one (the ## operator)
+ *
+ * @return The pasted token, or NULL when the spelling is not one token
+ */
+static PPToken* paste(PreprocessContext* ctx, PPToken* lhs, PPToken* rhs) {
+    size_t len = (size_t)lhs->len + (size_t)rhs->len;
+    char* buf = arena_alloc(&ctx->text_arena, len + 1);
+    memcpy(buf, lhs->str, (size_t)lhs->len);
+    memcpy(buf + lhs->len, rhs->str, (size_t)rhs->len);
+
+    bool in_comment = false;
+    PPToken* t = arena_alloc(&ctx->expand_arena, sizeof(PPToken));
+    const char* q = pp_next(buf, buf + len, &in_comment, t);
+    if (q != buf + len || t->kind == PP_EOL || t->space)
+        return NULL;
+    t->gap = NULL;
+    t->gap_len = 0;
+    t->space = lhs->space;
+    t->hs = lhs->hs;
+    return t;
+}
+
+/**
+ * Substitute arguments into a macro body
+ *
+ * @param[in] m Macro being expanded
+ * @param[in] args Arguments of a function-like macro, else NULL
+ * @param[in] hs Hide set added to every resulting token
+ * @param[out] tail Last resulting token
+ * @return Resulting tokens, or NULL if there are none
+ */
+static PPToken* subst(PreprocessContext* ctx, Macro* m, PPArg* args,
+                      HideSet* hs, PPToken** tail) {
+    PPToken head;
+    PPToken* cur = &head;
+    head.next = NULL;
+    // The last operand appended was an empty argument (a placemarker)
+    bool placemarker = false;
+    PPToken* body = m->body;
+    int n = m->body_len;
+
+    for (int i = 0; i < n; i++) {
+        PPToken* bt = &body[i];
+
+        if (m->is_function && is_punct(bt, "#") && i + 1 < n &&
+            body[i + 1].param >= 0) {
+            PPToken* s = stringize(ctx, &args[body[i + 1].param], hs);
+            s->space = bt->space;
+            cur = cur->next = s;
+            placemarker = false;
+            i++;
+            continue;
+        }
+
+        // GNU extension: , ## __VA_ARGS__ drops the comma when there are no
+        // variadic arguments
+        if (m->is_variadic && is_punct(bt, ",") && i + 2 < n &&
+            is_punct(&body[i + 1], "##") &&
+            body[i + 2].param == m->param_count) {
+            PPArg* va = &args[m->param_count];
+            if (va->count > 0) {
+                cur = cur->next = copy_token(ctx, bt, hs);
+                PPToken* t = va->first;
+                for (int j = 0; j < va->count; j++) {
+                    cur = cur->next = copy_token(ctx, t, hs);
+                    if (j == 0)
+                        cur->space = false;
+                    t = t->next;
                 }
-                p++;
             }
+            placemarker = false;
+            i += 2;
             continue;
         }
 
-        if (is_ident_start(*p)) {
-            const char* id_start = p;
-            while (is_ident_char(*p))
-                p++;
-            size_t id_len = (size_t)(p - id_start);
-            if (id_len == 8 && strncmp(id_start, "__LINE__", 8) == 0) {
-                char line_buf[32];
-                snprintf(line_buf, sizeof(line_buf), "%d", ctx->current_line);
-                sb_append_n(&out, line_buf, strlen(line_buf));
+        if (is_punct(bt, "##") && i + 1 < n) {
+            PPToken* rbt = &body[++i];
+            PPToken* rhs = rbt;
+            int rcount = 1;
+            if (m->is_function && rbt->param >= 0) {
+                rhs = args[rbt->param].first;
+                rcount = args[rbt->param].count;
+            }
+            if (rcount == 0)
                 continue;
+            PPToken* pasted = NULL;
+            if (!placemarker && cur != &head)
+                pasted = paste(ctx, cur, rhs);
+            if (pasted) {
+                // Replace the left operand with the joined token
+                PPToken* prev = &head;
+                while (prev->next != cur)
+                    prev = prev->next;
+                cur = prev->next = pasted;
+                pasted->hs = hs;
+                rhs = rhs->next;
+                rcount--;
             }
-            Macro* m = find_macro(ctx, id_start, id_len);
-            if (m && !m->is_function) {
-                char* ex = expand_macros_in_text(ctx, m->value, depth + 1);
-                sb_append_n(&out, ex, strlen(ex));
-                free(ex);
+            for (int j = 0; j < rcount; j++) {
+                cur = cur->next = copy_token(ctx, rhs, hs);
+                rhs = rhs->next;
+            }
+            placemarker = false;
+            continue;
+        }
+
+        if (m->is_function && bt->param >= 0) {
+            PPArg* arg = &args[bt->param];
+            PPToken* t;
+            int count;
+            if (i + 1 < n && is_punct(&body[i + 1], "##")) {
+                // Operand of ## is not macro-expanded
+                t = arg->first;
+                count = arg->count;
             } else {
-                sb_append_n(&out, id_start, id_len);
+                expand_arg(ctx, arg);
+                t = arg->expanded;
+                count = arg->expanded_count;
             }
+            for (int j = 0; j < count; j++) {
+                PPToken* c = copy_token(ctx, t, hs);
+                if (j == 0)
+                    c->space = bt->space;
+                cur = cur->next = c;
+                t = t->next;
+            }
+            placemarker = count == 0;
             continue;
         }
 
-        sb_append_c(&out, *p++);
+        cur = cur->next = copy_token(ctx, bt, hs);
+        placemarker = false;
     }
-    return out.data;
+    *tail = NULL;
+    if (head.next)
+        *tail = cur;
+    return head.next;
 }
 
-static char** parse_macro_args(const char** sp, const char* end,
-                               int* out_argc) {
-    const char* p = *sp;
-    if (p >= end || *p != '(') {
-        *out_argc = 0;
-        return NULL;
+/**
+ * Expand the macro invocation starting at an identifier
+ *
+ * @param[in] t Identifier token
+ * @return Replacement tokens followed by the tokens after the invocation,
+ *         or NULL when t is not expanded
+ */
+static PPToken* expand_macro(PreprocessContext* ctx, PPToken* t) {
+    if (t->len == 8 && strncmp(t->str, "__LINE__", 8) == 0) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%d", ctx->current_line);
+        PPToken* num = copy_token(ctx, t, NULL);
+        num->kind = PP_NUMBER;
+        num->str = arena_strndup(ctx, buf, strlen(buf));
+        num->len = (int)strlen(buf);
+        num->gap = t->gap;
+        num->gap_len = t->gap_len;
+        num->next = t->next;
+        return num;
     }
-    p++; // skip '('
 
-    int cap = 4;
-    int argc = 0;
-    char** args = malloc(sizeof(char*) * cap);
-    if (!args) {
-        perror("malloc");
-        exit(1);
-    }
+    Macro* m = find_macro(ctx, t->str, (size_t)t->len, t->hash);
+    if (!m || hs_contains(t->hs, m))
+        return NULL;
 
-    while (1) {
-        p = skip_spaces(p, end);
-        if (p >= end) {
-            break;
+    PPArg* args = NULL;
+    PPToken* rest;
+    HideSet* hs;
+    if (m->is_function) {
+        PPToken* lparen = t->next;
+        // The '(' may be on a following line
+        while (lparen->kind == PP_EOL) {
+            if (!pp_join_line(ctx, lparen))
+                return NULL;
         }
-        if (*p == ')') {
-            p++;
-            break;
+        if (!is_punct(lparen, "("))
+            return NULL;
+        args = arena_alloc(&ctx->expand_arena,
+                           sizeof(PPArg) * (size_t)(m->param_count + 1));
+        PPToken* rparen = read_args(ctx, m, lparen, args);
+        if (!rparen)
+            return NULL;
+        hs = hs_add(ctx, hs_intersect(ctx, t->hs, rparen->hs), m);
+        rest = rparen->next;
+    } else {
+        hs = hs_add(ctx, t->hs, m);
+        rest = t->next;
+    }
+
+    PPToken* tail;
+    PPToken* ex = subst(ctx, m, args, hs, &tail);
+    if (!ex) {
+        rest->space = rest->space || t->space;
+        return rest;
+    }
+    // The expansion takes the place of the name in the output
+    ex->gap = t->gap;
+    ex->gap_len = t->gap_len;
+    ex->space = t->space;
+    tail->next = rest;
+    for (PPToken* e = ex; e != rest; e = e->next) {
+        if (e->line == 0) {
+            e->line = t->line;
+            e->col = t->col;
         }
+    }
+    return ex;
+}
 
-        const char* arg_start = p;
-        int depth = 0;
-        while (p < end) {
-            if (*p == '(') {
-                depth++;
-                p++;
-                continue;
-            }
-            if (*p == ')') {
-                if (depth == 0)
-                    break;
-                depth--;
-                p++;
-                continue;
-            }
-            if (*p == ',' && depth == 0)
-                break;
-            p++;
-        }
+// Expand every macro in a token list, rescanning each replacement together
+// with the rest of the list
+static PPToken* expand_tokens(PreprocessContext* ctx, PPToken* list) {
+    PPToken** link = &list;
+    while ((*link)->kind != PP_EOL) {
+        PPToken* t = *link;
+        PPToken* ex = NULL;
+        if (t->kind == PP_IDENT)
+            ex = expand_macro(ctx, t);
+        if (ex)
+            *link = ex;
+        else
+            link = &t->next;
+    }
+    return list;
+}
 
-        if (argc == cap) {
-            cap *= 2;
-            char** np = realloc(args, sizeof(char*) * cap);
-            if (!np) {
-                perror("realloc");
-                exit(1);
-            }
-            args = np;
+// Whether printing b right after a would lex differently
+static bool pp_needs_space(PPToken* a, PPToken* b) {
+    bool a_word = a->kind == PP_IDENT || a->kind == PP_NUMBER;
+    bool b_word = b->kind == PP_IDENT || b->kind == PP_NUMBER;
+    if (a_word && b_word)
+        return true;
+    if (a->kind == PP_NUMBER && b->kind == PP_PUNCT) {
+        char last = a->str[a->len - 1];
+        if (b->str[0] == '.')
+            return true;
+        if ((b->str[0] == '+' || b->str[0] == '-') &&
+            (last == 'e' || last == 'E' || last == 'p' || last == 'P'))
+            return true;
+    }
+    if (a->kind == PP_PUNCT && b->kind == PP_NUMBER && is_punct(a, "."))
+        return true;
+    if (a->kind == PP_PUNCT && b->kind == PP_PUNCT) {
+        if (is_punct(a, "/") && (b->str[0] == '/' || b->str[0] == '*'))
+            return true;
+        char buf[4];
+        int n = a->len < 3 ? a->len : 3;
+        memcpy(buf, a->str + a->len - n, (size_t)n);
+        buf[n] = b->str[0];
+        // A longer punctuator would swallow the first character of b
+        return pp_punct_len(buf, buf + n + 1) > n;
+    }
+    return false;
+}
+
+/**
+ * Append a token list to the output
+ *
+ * Source text between tokens, comments included, is copied as it was.
+ * Tokens built by an expansion are separated by one space where the
+ * source had whitespace, or where they would otherwise run together.
+ */
+static void pp_emit(StrBuf* out, PPToken* list) {
+    PPToken* prev = NULL;
+    for (PPToken* t = list;; t = t->next) {
+        if (t->gap_len > 0) {
+            sb_append_n(out, t->gap, (size_t)t->gap_len);
+        } else if (t->kind != PP_EOL &&
+                   (t->space || (prev && pp_needs_space(prev, t)))) {
+            sb_append_c(out, ' ');
         }
-        args[argc++] = trim_copy(arg_start, (size_t)(p - arg_start));
+        if (t->kind == PP_EOL)
+            return;
+        sb_append_n(out, t->str, (size_t)t->len);
+        prev = t;
+    }
+}
 
-        p = skip_spaces(p, end);
-        if (p < end && *p == ',') {
-            p++;
-            continue;
+// Release the tokens of an expansion
+static void end_expansion(PreprocessContext* ctx) {
+    arena_free(&ctx->expand_arena);
+    ctx->union_a = NULL;
+    ctx->union_b = NULL;
+}
+
+/**
+ * Macro-expand the rest of a line into ctx->out
+ *
+ * An invocation that is not closed on the line takes in the following
+ * lines of the file.
+ *
+ * @param[in] start First identifier to expand
+ * @param[in] line_end End of the line
+ */
+static void expand_line(PreprocessContext* ctx, const char* start,
+                        const char* line_end) {
+    PPToken* list = pp_tokenize(ctx, start, line_end,
+                                &ctx->file->in_block_comment, &ctx->line_eol);
+    pp_emit(ctx->out, expand_tokens(ctx, list));
+    ctx->line_eol = NULL;
+    end_expansion(ctx);
+}
+
+// Value of a #if operand: every integer is intmax_t or uintmax_t, which are
+// both 64 bits (C99 6.10.1p4)
+typedef struct {
+    unsigned long long v; // Two's complement bit pattern
+    bool is_unsigned;
+} PPValue;
+
+typedef struct {
+    PreprocessContext* ctx;
+    PPToken* tok; // Next token
+    const char* file;
+} PPExpr;
+
+static void pp_expr_error(PPExpr* e, const char* msg) {
+    fprintf(stderr, "Error: %s:%d: %s in #if\n", e->file, e->ctx->current_line,
+            msg);
+    exit(1);
+}
+
+static PPValue pp_int(long long v) {
+    PPValue r;
+    r.v = (unsigned long long)v;
+    r.is_unsigned = false;
+    return r;
+}
+
+static bool pp_is_true(PPValue a) { return a.v != 0; }
+
+// Replacement for `defined X` or `defined ( X )` at t, or NULL if t does not
+// start one
+static PPToken* pp_defined(PPExpr* e, PPToken* t) {
+    if (t->kind != PP_IDENT || t->len != 7 ||
+        strncmp(t->str, "defined", 7) != 0)
+        return NULL;
+    PPToken* name = t->next;
+    bool paren = is_punct(name, "(");
+    if (paren)
+        name = name->next;
+    if (name->kind != PP_IDENT)
+        pp_expr_error(e, "'defined' without a macro name");
+    PPToken* last = name;
+    if (paren) {
+        last = name->next;
+        if (!is_punct(last, ")"))
+            pp_expr_error(e, "missing ')' after 'defined'");
+    }
+    bool found = find_macro(e->ctx, name->str, (size_t)name->len, name->hash) ||
+                 (name->len == 8 && strncmp(name->str, "__LINE__", 8) == 0);
+    PPToken* num = copy_token(e->ctx, t, NULL);
+    num->kind = PP_NUMBER;
+    num->str = "0";
+    if (found)
+        num->str = "1";
+    num->len = 1;
+    num->next = last->next;
+    return num;
+}
+
+static PPValue pp_number(PPExpr* e, PPToken* t) {
+    TokenNum num;
+    const char* err = NULL;
+    const char* end = read_number(t->str, &num, &err);
+    if (!end || end != t->str + t->len)
+        pp_expr_error(e, err ? err : "invalid integer constant");
+    if (num.type == NUM_FLOAT || num.type == NUM_DOUBLE)
+        pp_expr_error(e, "floating constant");
+    // Unsigned with a u suffix or when too large for intmax_t; no hex digit
+    // is a 'u'
+    PPValue r;
+    r.v = num.uval;
+    r.is_unsigned = num.uval > 9223372036854775807ULL ||
+                    memchr(t->str, 'u', (size_t)t->len) ||
+                    memchr(t->str, 'U', (size_t)t->len);
+    return r;
+}
+
+// Character constant such as 'a' or L'\n'; as in the lexer, its value is a
+// single char
+static PPValue pp_char(PPExpr* e, PPToken* t) {
+    const char* p = t->str;
+    while (*p != '\'' && *p != '"')
+        p++;
+    if (*p != '\'')
+        pp_expr_error(e, "string literal");
+    p++;
+    char c = *p++;
+    if (c == '\\')
+        c = decode_escape_char(&p);
+    if (*p != '\'')
+        pp_expr_error(e, "invalid character constant");
+    return pp_int((long long)c);
+}
+
+static PPValue pp_cond_expr(PPExpr* e, bool live);
+
+/**
+ * Unary expression: a constant, a parenthesized expression, or an operator
+ * applied to a unary expression
+ *
+ * @param[in] live Whether the value is used; errors such as division by zero
+ *            are only reported in live operands
+ */
+static PPValue pp_unary(PPExpr* e, bool live) {
+    PPToken* t = e->tok;
+    if (t->kind == PP_EOL)
+        pp_expr_error(e, "missing operand");
+    e->tok = t->next;
+    if (t->kind == PP_NUMBER)
+        return pp_number(e, t);
+    if (t->kind == PP_LITERAL)
+        return pp_char(e, t);
+    if (t->kind == PP_IDENT) {
+        // `defined` coming out of a macro expansion
+        PPToken* d = pp_defined(e, t);
+        if (d) {
+            e->tok = d->next;
+            return pp_number(e, d);
         }
-        if (p < end && *p == ')') {
-            p++;
-            break;
+        // Identifiers left after expansion are 0
+        return pp_int(0);
+    }
+    if (is_punct(t, "(")) {
+        PPValue r = pp_cond_expr(e, live);
+        if (!is_punct(e->tok, ")"))
+            pp_expr_error(e, "missing ')'");
+        e->tok = e->tok->next;
+        return r;
+    }
+    if (t->len == 1) {
+        char op = t->str[0];
+        if (op == '+' || op == '-' || op == '~' || op == '!') {
+            PPValue r = pp_unary(e, live);
+            if (op == '-')
+                r.v = 0 - r.v;
+            else if (op == '~')
+                r.v = ~r.v;
+            else if (op == '!')
+                r = pp_int(!pp_is_true(r));
+            return r;
         }
     }
+    pp_expr_error(e, "invalid token");
+    return pp_int(0);
+}
 
-    *sp = p;
-    *out_argc = argc;
-    return args;
+// Binding strength of a binary operator, or 0 when t is not one
+static int pp_binary_prec(PPToken* t) {
+    if (t->kind != PP_PUNCT)
+        return 0;
+    char c = t->str[0];
+    char c2 = t->len == 2 ? t->str[1] : '\0';
+    if (t->len == 2 && c == c2) {
+        if (c == '|')
+            return 1;
+        if (c == '&')
+            return 2;
+        if (c == '=')
+            return 6;
+        if (c == '<' || c == '>')
+            return 8;
+        return 0;
+    }
+    if (t->len == 2 && c2 == '=') {
+        if (c == '!')
+            return 6;
+        if (c == '<' || c == '>')
+            return 7;
+        return 0;
+    }
+    if (t->len != 1)
+        return 0;
+    switch (c) {
+    case '|':
+        return 3;
+    case '^':
+        return 4;
+    case '&':
+        return 5;
+    case '<':
+    case '>':
+        return 7;
+    case '+':
+    case '-':
+        return 9;
+    case '*':
+    case '/':
+    case '%':
+        return 10;
+    }
+    return 0;
 }
 
-static char* preprocess_internal(const char* input, const char* filename,
-                                 PreprocessContext* ctx) {
-    StrBuf out;
-    sb_init(&out);
+static PPValue pp_shift(PPValue a, PPValue b, bool left) {
+    long long n = (long long)b.v;
+    if (b.is_unsigned && b.v > 63)
+        n = 64;
+    if (n < 0) {
+        n = -n;
+        left = !left;
+    }
+    if (left) {
+        a.v = n >= 64 ? 0 : a.v << n;
+    } else if (a.is_unsigned) {
+        a.v = n >= 64 ? 0 : a.v >> n;
+    } else {
+        long long v = (long long)a.v;
+        a.v = (unsigned long long)(v >> (n >= 64 ? 63 : n));
+    }
+    return a;
+}
+
+// Apply the binary operator op to a and b
+static PPValue pp_apply(PPExpr* e, PPToken* op, PPValue a, PPValue b,
+                        bool live) {
+    char c = op->str[0];
+    if (op->len == 2 && (c == '|' || c == '&')) {
+        return pp_int(c == '|' ? pp_is_true(a) || pp_is_true(b)
+                               : pp_is_true(a) && pp_is_true(b));
+    }
+    if (op->len == 2 && (c == '<' || c == '>') && op->str[1] == c)
+        return pp_shift(a, b, c == '<');
+
+    // Usual arithmetic conversions
+    bool u = a.is_unsigned || b.is_unsigned;
+    long long x = (long long)a.v;
+    long long y = (long long)b.v;
+    if (op->len == 2) {
+        bool eq = a.v == b.v;
+        if (c == '=')
+            return pp_int(eq);
+        if (c == '!')
+            return pp_int(!eq);
+        bool lt = u ? a.v < b.v : x < y;
+        return pp_int(c == '<' ? lt || eq : !lt);
+    }
+
+    PPValue r;
+    r.is_unsigned = u;
+    switch (c) {
+    case '<':
+        return pp_int(u ? a.v < b.v : x < y);
+    case '>':
+        return pp_int(u ? a.v > b.v : x > y);
+    case '|':
+        r.v = a.v | b.v;
+        return r;
+    case '^':
+        r.v = a.v ^ b.v;
+        return r;
+    case '&':
+        r.v = a.v & b.v;
+        return r;
+    case '+':
+        r.v = a.v + b.v;
+        return r;
+    case '-':
+        r.v = a.v - b.v;
+        return r;
+    case '*':
+        r.v = a.v * b.v;
+        return r;
+    }
+    // '/' or '%'
+    if (b.v == 0) {
+        if (live)
+            pp_expr_error(e, "division by zero");
+        return pp_int(0);
+    }
+    if (u) {
+        r.v = c == '/' ? a.v / b.v : a.v % b.v;
+    } else if (y == -1) {
+        // Avoids the overflow of INTMAX_MIN / -1
+        r.v = c == '/' ? 0 - a.v : 0;
+    } else {
+        r.v = (unsigned long long)(c == '/' ? x / y : x % y);
+    }
+    return r;
+}
+
+// Binary operators binding at least as tightly as min_prec
+static PPValue pp_binary(PPExpr* e, int min_prec, bool live) {
+    PPValue lhs = pp_unary(e, live);
+    int prec = pp_binary_prec(e->tok);
+    while (prec != 0 && prec >= min_prec) {
+        PPToken* op = e->tok;
+        e->tok = op->next;
+        // The right operand of && and || is only evaluated when it decides
+        // the result
+        bool rhs_live = live;
+        if (prec == 1)
+            rhs_live = live && !pp_is_true(lhs);
+        else if (prec == 2)
+            rhs_live = live && pp_is_true(lhs);
+        PPValue rhs = pp_binary(e, prec + 1, rhs_live);
+        lhs = pp_apply(e, op, lhs, rhs, live);
+        prec = pp_binary_prec(e->tok);
+    }
+    return lhs;
+}
+
+static PPValue pp_cond_expr(PPExpr* e, bool live) {
+    PPValue cond = pp_binary(e, 1, live);
+    if (!is_punct(e->tok, "?"))
+        return cond;
+    e->tok = e->tok->next;
+    bool take = pp_is_true(cond);
+    PPValue a = pp_cond_expr(e, live && take);
+    if (!is_punct(e->tok, ":"))
+        pp_expr_error(e, "missing ':'");
+    e->tok = e->tok->next;
+    PPValue b = pp_cond_expr(e, live && !take);
+    bool u = a.is_unsigned || b.is_unsigned;
+    if (!take)
+        a = b;
+    a.is_unsigned = u;
+    return a;
+}
+
+/**
+ * Evaluate the controlling expression of #if or #elif
+ *
+ * `defined` operators are resolved first, then macros are expanded and the
+ * result is evaluated as an integer constant expression.
+ *
+ * @param[in] p Start of the expression
+ * @param[in] line_end End of the directive line
+ * @param[in] file File name for diagnostics
+ * @return Whether the expression is nonzero
+ */
+static bool eval_if_expr(PreprocessContext* ctx, const char* p,
+                         const char* line_end, const char* file) {
+    PPExpr e;
+    e.ctx = ctx;
+    e.file = file;
+    bool in_comment = false;
+    PPToken* list = pp_tokenize(ctx, p, line_end, &in_comment, NULL);
+
+    // defined's operand is not expanded
+    PPToken** link = &list;
+    while ((*link)->kind != PP_EOL) {
+        PPToken* d = pp_defined(&e, *link);
+        if (d)
+            *link = d;
+        link = &(*link)->next;
+    }
+
+    e.tok = expand_tokens(ctx, list);
+    if (e.tok->kind == PP_EOL)
+        pp_expr_error(&e, "missing expression");
+    bool result = pp_is_true(pp_cond_expr(&e, true));
+    if (e.tok->kind != PP_EOL)
+        pp_expr_error(&e, "missing binary operator");
+    // Within a macro invocation spanning lines, the tokens of the line
+    // being expanded are still in use
+    if (!ctx->joining)
+        end_expansion(ctx);
+    return result;
+}
+
+/**
+ * Skip the rest of an inactive conditional group
+ *
+ * Only the keywords of conditional directives are read, to follow nesting;
+ * nothing is expanded or evaluated and other lines are not visited.
+ *
+ * @param[in] p Start of a line inside the group
+ * @param[in] end End of the input
+ * @return Start of the #elif, #else or #endif line that continues or closes
+ *         the group, or end
+ */
+static const char* skip_inactive_group(PreprocessContext* ctx, const char* p,
+                                       const char* end) {
+    int depth = 0;
+    while (p < end) {
+        p = scan_next_directive(p, end, &ctx->current_line);
+        if (p == end)
+            return end;
+
+        const char* line_end = scan_line_end(p, end);
+        // Step over the '#'
+        const char* kw = skip_spaces(p, line_end);
+        kw = skip_spaces(kw + 1, line_end);
+        const char* d = kw;
+        while (d < line_end && isalpha((unsigned char)*d))
+            d++;
+        size_t kw_len = (size_t)(d - kw);
+        if (kw_len >= 2 && kw[0] == 'i' && kw[1] == 'f' &&
+            (kw_len == 2 || (kw_len == 5 && strncmp(kw, "ifdef", 5) == 0) ||
+             (kw_len == 6 && strncmp(kw, "ifndef", 6) == 0))) {
+            depth++;
+        } else if (kw_len == 5 && strncmp(kw, "endif", 5) == 0) {
+            if (depth == 0)
+                return p;
+            depth--;
+        } else if (depth == 0 && kw_len == 4 &&
+                   (strncmp(kw, "elif", 4) == 0 ||
+                    strncmp(kw, "else", 4) == 0)) {
+            return p;
+        }
+
+        if (line_end == end)
+            return end;
+        p = line_end + 1;
+        ctx->current_line++;
+    }
+    return end;
+}
 
+/**
+ * Start reading a file
+ *
+ * With ctx->line_markers set, the caller emits the marker for line 1.
+ *
+ * @param[in] input Contents of the file
+ * @param[in] filename Name used to resolve quoted includes
+ * @param[in] display Name of this file in line markers
+ * @param[in] file Header entry when input is an included header, else NULL;
+ *            receives the include guard and #pragma once state
+ */
+static void enter_file(PreprocessContext* ctx, const char* input,
+                       const char* filename, const char* display,
+                       IncludeFile* file) {
+    PPFile* f = calloc(1, sizeof(PPFile));
+    if (!f) {
+        perror("calloc");
+        exit(1);
+    }
+    f->p = input;
+    f->end = input + strlen(input);
+    f->filename = filename;
+    f->display = display;
+    f->file = file;
+    f->out_line = 1;
+    f->parent_line = ctx->current_line;
+    f->guard_state = file ? GUARD_BEFORE : GUARD_INVALID;
+    f->parent = ctx->file;
+    ctx->file = f;
     ctx->current_line = 1;
+}
 
-    CondStack* cond_stack = NULL;
-    bool in_block_comment = false;
+// Close the innermost file and go back to the line that included it
+static void leave_file(PreprocessContext* ctx) {
+    PPFile* f = ctx->file;
+    while (f->cond_stack) {
+        CondStack* next = f->cond_stack->next;
+        free(f->cond_stack);
+        f->cond_stack = next;
+    }
 
-    const char* p = input;
-    while (*p) {
-        const char* line_start = p;
-        const char* line_end = strchr(p, '\n');
-        if (!line_end)
-            line_end = p + strlen(p);
+    if (f->guard_state == GUARD_AFTER) {
+        f->file->guard = dup_range(f->guard_name, f->guard_len);
+        f->file->guard_len = f->guard_len;
+        f->file->guard_hash = hash_name(f->guard_name, (int)f->guard_len);
+    }
 
-        const char* scan = line_start;
-        while (scan < line_end && (*scan == ' ' || *scan == '\t'))
-            scan++;
+    ctx->file = f->parent;
+    ctx->current_line = f->parent_line;
+    if (f->parent && ctx->line_markers) {
+        pp_line_marker(ctx->out, f->parent_line + 1, f->parent->display, 2);
+        f->parent->out_line = f->parent_line + 1;
+    }
+    free(f);
+}
 
-        bool is_directive = false;
-        if (scan < line_end && *scan == '#') {
-            const char* d = scan + 1;
+/**
+ * Carry out the directive on a line, if it starts with one
+ *
+ * Also follows the line through include guard detection.
+ *
+ * @param[in,out] f File the line belongs to
+ * @param[in] line_start Start of the line
+ * @param[in] line_end End of the line
+ * @return Whether the line is a directive and so is not output
+ */
+static bool run_directive(PreprocessContext* ctx, PPFile* f,
+                          const char* line_start, const char* line_end) {
+    const char* scan = line_start;
+    while (scan < line_end && (*scan == ' ' || *scan == '\t'))
+        scan++;
+
+    bool is_directive = false;
+    if (scan < line_end && *scan == '#') {
+        const char* d = scan + 1;
+        while (d < line_end && (*d == ' ' || *d == '\t'))
+            d++;
+
+        const char* kw_start = d;
+        while (d < line_end && isalpha((unsigned char)*d))
+            d++;
+        size_t kw_len = (size_t)(d - kw_start);
+
+        if (f->guard_state == GUARD_BEFORE) {
+            f->guard_name =
+                guard_condition(kw_start, kw_len, d, line_end, &f->guard_len);
+            f->guard_state = (f->guard_name && !f->in_guard_comment)
+                                 ? GUARD_INSIDE
+                                 : GUARD_INVALID;
+        } else if (f->guard_state == GUARD_AFTER) {
+            f->guard_state = GUARD_INVALID;
+        } else if (f->guard_state == GUARD_INSIDE && f->cond_stack &&
+                   !f->cond_stack->next &&
+                   ((kw_len == 4 && strncmp(kw_start, "elif", 4) == 0) ||
+                    (kw_len == 4 && strncmp(kw_start, "else", 4) == 0))) {
+            f->guard_state = GUARD_INVALID;
+        }
+
+        bool parent_active = (!f->cond_stack || f->cond_stack->active);
+
+        if (kw_len == 5 && strncmp(kw_start, "ifdef", 5) == 0) {
+            is_directive = true;
             while (d < line_end && (*d == ' ' || *d == '\t'))
                 d++;
-
-            const char* kw_start = d;
-            while (d < line_end && isalpha((unsigned char)*d))
+            const char* name_start = d;
+            unsigned int name_hash;
+            d = scan_ident(d, line_end, &name_hash);
+            size_t name_len = (size_t)(d - name_start);
+            bool found =
+                find_macro(ctx, name_start, name_len, name_hash) != NULL;
+
+            CondStack* cs = calloc(1, sizeof(CondStack));
+            cs->active = parent_active && found;
+            cs->matched = found || !parent_active;
+            cs->next = f->cond_stack;
+            f->cond_stack = cs;
+        } else if (kw_len == 6 && strncmp(kw_start, "ifndef", 6) == 0) {
+            is_directive = true;
+            while (d < line_end && (*d == ' ' || *d == '\t'))
                 d++;
-            size_t kw_len = (size_t)(d - kw_start);
-
-            bool parent_active = (!cond_stack || cond_stack->active);
-
-            const char* expr_begin = skip_spaces(d, line_end);
-            int expr_val = 0;
-            if (expr_begin < line_end) {
-                const char* e = expr_begin;
-                bool negate = false;
-                if (*e == '!') {
-                    negate = true;
-                    e++;
-                    e = skip_spaces(e, line_end);
-                }
-                if ((line_end - e) >= 7 && strncmp(e, "defined", 7) == 0) {
-                    e += 7;
-                    e = skip_spaces(e, line_end);
-                    if (e < line_end && *e == '(')
-                        e++;
-                    e = skip_spaces(e, line_end);
-                    const char* name_start = e;
-                    while (e < line_end && is_ident_char(*e))
-                        e++;
-                    size_t name_len = (size_t)(e - name_start);
-                    expr_val = find_macro(ctx, name_start, name_len) ? 1 : 0;
-                } else if (is_ident_start(*e)) {
-                    const char* name_start = e;
-                    while (e < line_end && is_ident_char(*e))
-                        e++;
-                    size_t name_len = (size_t)(e - name_start);
-                    if (name_len == 8 &&
-                        strncmp(name_start, "__LINE__", 8) == 0) {
-                        expr_val = ctx->current_line;
-                    } else {
-                        Macro* m = find_macro(ctx, name_start, name_len);
-                        if (m)
-                            expr_val = (int)strtol(m->value, NULL, 10);
-                        else
-                            expr_val = 0;
-                    }
-                } else {
-                    expr_val = (int)strtol(e, NULL, 10);
-                }
-                if (negate)
-                    expr_val = !expr_val;
+            const char* name_start = d;
+            unsigned int name_hash;
+            d = scan_ident(d, line_end, &name_hash);
+            size_t name_len = (size_t)(d - name_start);
+            bool found =
+                find_macro(ctx, name_start, name_len, name_hash) != NULL;
+
+            CondStack* cs = calloc(1, sizeof(CondStack));
+            cs->active = parent_active && !found;
+            cs->matched = !found || !parent_active;
+            cs->next = f->cond_stack;
+            f->cond_stack = cs;
+        } else if (kw_len == 2 && strncmp(kw_start, "if", 2) == 0) {
+            is_directive = true;
+            // Inside an inactive group no branch can be taken, so the
+            // expression is not even evaluated
+            bool take = parent_active &&
+                        eval_if_expr(ctx, d, line_end, f->display);
+            CondStack* cs = calloc(1, sizeof(CondStack));
+            cs->active = take;
+            cs->matched = take || !parent_active;
+            cs->next = f->cond_stack;
+            f->cond_stack = cs;
+        } else if (kw_len == 4 && strncmp(kw_start, "elif", 4) == 0) {
+            is_directive = true;
+            if (f->cond_stack) {
+                bool take = !f->cond_stack->matched &&
+                            eval_if_expr(ctx, d, line_end, f->display);
+                f->cond_stack->active = take;
+                if (take)
+                    f->cond_stack->matched = true;
             }
+        } else if (kw_len == 4 && strncmp(kw_start, "else", 4) == 0) {
+            is_directive = true;
+            if (f->cond_stack) {
+                bool grand_active =
+                    (!f->cond_stack->next || f->cond_stack->next->active);
+                f->cond_stack->active = grand_active && !f->cond_stack->matched;
+                f->cond_stack->matched = true;
+            }
+        } else if (kw_len == 5 && strncmp(kw_start, "endif", 5) == 0) {
+            is_directive = true;
+            if (f->cond_stack) {
+                CondStack* tmp = f->cond_stack;
+                f->cond_stack = f->cond_stack->next;
+                free(tmp);
+            }
+        } else if (!parent_active) {
+            is_directive = true;
+        } else if (kw_len == 7 && strncmp(kw_start, "include", 7) == 0) {
+            is_directive = true;
+            if (ctx->joining) {
+                fprintf(stderr, "Error: %s:%d: #include in macro arguments\n",
+                        f->display, ctx->current_line);
+                exit(1);
+            }
+            while (d < line_end && (*d == ' ' || *d == '\t'))
+                d++;
 
-            if (kw_len == 5 && strncmp(kw_start, "ifdef", 5) == 0) {
-                is_directive = true;
-                while (d < line_end && (*d == ' ' || *d == '\t'))
-                    d++;
-                const char* name_start = d;
-                while (d < line_end && is_ident_char(*d))
-                    d++;
-                size_t name_len = (size_t)(d - name_start);
-                bool found = find_macro(ctx, name_start, name_len) != NULL;
-
-                CondStack* cs = calloc(1, sizeof(CondStack));
-                cs->active = parent_active && found;
-                cs->matched = found;
-                cs->next = cond_stack;
-                cond_stack = cs;
-            } else if (kw_len == 6 && strncmp(kw_start, "ifndef", 6) == 0) {
-                is_directive = true;
-                while (d < line_end && (*d == ' ' || *d == '\t'))
-                    d++;
-                const char* name_start = d;
-                while (d < line_end && is_ident_char(*d))
-                    d++;
-                size_t name_len = (size_t)(d - name_start);
-                bool found = find_macro(ctx, name_start, name_len) != NULL;
-
-                CondStack* cs = calloc(1, sizeof(CondStack));
-                cs->active = parent_active && !found;
-                cs->matched = !found;
-                cs->next = cond_stack;
-                cond_stack = cs;
-            } else if (kw_len == 2 && strncmp(kw_start, "if", 2) == 0) {
-                is_directive = true;
-                CondStack* cs = calloc(1, sizeof(CondStack));
-                cs->active = parent_active && (expr_val != 0);
-                cs->matched = (expr_val != 0);
-                cs->next = cond_stack;
-                cond_stack = cs;
-            } else if (kw_len == 4 && strncmp(kw_start, "elif", 4) == 0) {
-                is_directive = true;
-                if (cond_stack) {
-                    bool grand_active =
-                        (!cond_stack->next || cond_stack->next->active);
-                    bool take = (!cond_stack->matched) && (expr_val != 0);
-                    cond_stack->active = grand_active && take;
-                    if (take)
-                        cond_stack->matched = true;
-                }
-            } else if (kw_len == 4 && strncmp(kw_start, "else", 4) == 0) {
-                is_directive = true;
-                if (cond_stack) {
-                    bool grand_active =
-                        (!cond_stack->next || cond_stack->next->active);
-                    cond_stack->active = grand_active && !cond_stack->matched;
-                    cond_stack->matched = true;
-                }
-            } else if (kw_len == 5 && strncmp(kw_start, "endif", 5) == 0) {
-                is_directive = true;
-                if (cond_stack) {
-                    CondStack* tmp = cond_stack;
-                    cond_stack = cond_stack->next;
-                    free(tmp);
-                }
-            } else if (!parent_active) {
-                is_directive = true;
-            } else if (kw_len == 7 && strncmp(kw_start, "include", 7) == 0) {
-                is_directive = true;
-                while (d < line_end && (*d == ' ' || *d == '\t'))
-                    d++;
-
-                if (d < line_end && (*d == '"' || *d == '<')) {
-                    char closing = (*d == '"') ? '"' : '>';
+            if (d < line_end && (*d == '"' || *d == '<')) {
+                char closing = (*d == '"') ? '"' : '>';
+                d++;
+                const char* inc_start = d;
+                while (d < line_end && *d != closing)
                     d++;
-                    const char* inc_start = d;
-                    while (d < line_end && *d != closing)
-                        d++;
-                    if (d < line_end && *d == closing) {
-                        size_t inc_len = 0;
-                        const char* t = inc_start;
-                        while (t < d) {
-                            inc_len++;
-                            t++;
-                        }
-                        char* inc_name = dup_range(inc_start, inc_len);
-                        char* inc_content = NULL;
+                if (d < line_end && *d == closing) {
+                    size_t inc_len = 0;
+                    const char* t = inc_start;
+                    while (t < d) {
+                        inc_len++;
+                        t++;
+                    }
+                    char* inc_name = dup_range(inc_start, inc_len);
+                    const char* path =
+                        find_include(f->filename, inc_name, closing == '"');
+                    if (!path) {
+                        fprintf(stderr,
+                                "Error: could not read include file %s\n",
+                                inc_name);
+                        free(inc_name);
+                        exit(1);
+                    }
 
-                        if (closing == '"') {
-                            char* dir = get_dirname(filename);
-                            inc_content = try_read_include(dir, inc_name);
-                            free(dir);
-                        }
-                        if (!inc_content) {
-                            inc_content =
-                                try_read_include("selfhost/include", inc_name);
-                        }
-                        if (!inc_content) {
-                            inc_content = try_read_include(".", inc_name);
-                        }
-                        if (!inc_content) {
+                    // A guarded header whose guard is defined, or one
+                    // marked #pragma once, is not opened again
+                    IncludeFile* inc = include_file(ctx, path);
+                    // Skipped headers are still dependencies: editing
+                    // one can remove its guard
+                    if (ctx->record_deps)
+                        add_dep(ctx, inc);
+                    if (!include_is_redundant(ctx, inc)) {
+                        const FileView* inc_view = cached_file_view(inc->path);
+                        if (!inc_view) {
                             fprintf(stderr,
                                     "Error: could not read include file %s\n",
                                     inc_name);
                             free(inc_name);
                             exit(1);
                         }
-
-                        char* expanded =
-                            preprocess_internal(inc_content, filename, ctx);
-                        sb_append_n(&out, expanded, strlen(expanded));
-                        free(expanded);
-                        free(inc_content);
-                        free(inc_name);
+                        if (ctx->line_markers)
+                            pp_line_marker(ctx->out, 1, path, 1);
+                        enter_file(ctx, inc_view->data, f->filename,
+                                   inc->path, inc);
                     }
+                    free(inc_name);
                 }
-            } else if (kw_len == 6 && strncmp(kw_start, "define", 6) == 0) {
-                is_directive = true;
-                while (d < line_end && (*d == ' ' || *d == '\t'))
+            }
+        } else if (kw_len == 6 && strncmp(kw_start, "define", 6) == 0) {
+            is_directive = true;
+            while (d < line_end && (*d == ' ' || *d == '\t'))
+                d++;
+            const char* name_start = d;
+            if (d < line_end && is_ident_start(*d)) {
+                while (d < line_end && is_ident_char(*d))
                     d++;
-                const char* name_start = d;
-                if (d < line_end && is_ident_start(*d)) {
-                    while (d < line_end && is_ident_char(*d))
-                        d++;
-                    char* name =
-                        dup_range(name_start, (size_t)(d - name_start));
-                    bool is_function = false;
-                    bool is_variadic = false;
-                    char** params = NULL;
-                    int param_count = 0;
-
-                    // Function-like macro: no whitespace between name and '('
-                    if (d < line_end && *d == '(') {
-                        is_function = true;
-                        d++;
-                        int pcap = 4;
-                        params = malloc(sizeof(char*) * pcap);
-                        if (!params) {
-                            perror("malloc");
-                            exit(1);
+                char* name = dup_range(name_start, (size_t)(d - name_start));
+                bool is_function = false;
+                bool is_variadic = false;
+                char** params = NULL;
+                int param_count = 0;
+
+                // Function-like macro: no whitespace between name and '('
+                if (d < line_end && *d == '(') {
+                    is_function = true;
+                    d++;
+                    int pcap = 4;
+                    params = malloc(sizeof(char*) * pcap);
+                    if (!params) {
+                        perror("malloc");
+                        exit(1);
+                    }
+                    while (1) {
+                        d = skip_spaces(d, line_end);
+                        if (d < line_end && *d == ')') {
+                            d++;
+                            break;
                         }
-                        while (1) {
-                            d = skip_spaces(d, line_end);
-                            if (d < line_end && *d == ')') {
-                                d++;
-                                break;
-                            }
-                            // Check for ... (variadic)
-                            if ((line_end - d) >= 3 && d[0] == '.' &&
-                                d[1] == '.' && d[2] == '.') {
-                                is_variadic = true;
-                                d += 3;
-                                d = skip_spaces(d, line_end);
-                                if (d < line_end && *d == ',') {
-                                    d++;
-                                    continue;
-                                }
-                                if (d < line_end && *d == ')') {
-                                    d++;
-                                    break;
-                                }
-                                fprintf(stderr,
-                                        "variadic macro ... must be last\n");
-                                exit(1);
-                            }
-                            const char* pstart = d;
-                            if (!(d < line_end && is_ident_start(*d))) {
-                                fprintf(stderr, "invalid macro parameter\n");
-                                exit(1);
-                            }
-                            while (d < line_end && is_ident_char(*d))
-                                d++;
-                            if (param_count == pcap) {
-                                pcap *= 2;
-                                char** np =
-                                    realloc(params, sizeof(char*) * pcap);
-                                if (!np) {
-                                    perror("realloc");
-                                    exit(1);
-                                }
-                                params = np;
-                            }
-                            params[param_count++] =
-                                dup_range(pstart, (size_t)(d - pstart));
+                        // Check for ... (variadic)
+                        if ((line_end - d) >= 3 && d[0] == '.' &&
+                            d[1] == '.' && d[2] == '.') {
+                            is_variadic = true;
+                            d += 3;
                             d = skip_spaces(d, line_end);
                             if (d < line_end && *d == ',') {
                                 d++;
@@ -764,192 +2181,679 @@ static char* preprocess_internal(const char* input, const char* filename,
                                 d++;
                                 break;
                             }
-                            fprintf(stderr, "invalid macro parameter list\n");
+                            fprintf(stderr,
+                                    "variadic macro ... must be last\n");
                             exit(1);
                         }
-                    } else {
-                        while (d < line_end && (*d == ' ' || *d == '\t'))
+                        const char* pstart = d;
+                        if (!(d < line_end && is_ident_start(*d))) {
+                            fprintf(stderr, "invalid macro parameter\n");
+                            exit(1);
+                        }
+                        while (d < line_end && is_ident_char(*d))
+                            d++;
+                        if (param_count == pcap) {
+                            pcap *= 2;
+                            char** np = realloc(params, sizeof(char*) * pcap);
+                            if (!np) {
+                                perror("realloc");
+                                exit(1);
+                            }
+                            params = np;
+                        }
+                        params[param_count++] =
+                            dup_range(pstart, (size_t)(d - pstart));
+                        d = skip_spaces(d, line_end);
+                        if (d < line_end && *d == ',') {
+                            d++;
+                            continue;
+                        }
+                        if (d < line_end && *d == ')') {
                             d++;
+                            break;
+                        }
+                        fprintf(stderr, "invalid macro parameter list\n");
+                        exit(1);
                     }
-
-                    char* value = trim_copy(d, (size_t)(line_end - d));
-                    add_or_replace_macro(ctx, name, value, is_function,
-                                         is_variadic, params, param_count);
-                    free(name);
-                    free(value);
+                } else {
+                    while (d < line_end && (*d == ' ' || *d == '\t'))
+                        d++;
                 }
-            } else if (kw_len == 5 && strncmp(kw_start, "undef", 5) == 0) {
-                is_directive = true;
-                while (d < line_end && (*d == ' ' || *d == '\t'))
-                    d++;
-                const char* name_start = d;
-                while (d < line_end && is_ident_char(*d))
-                    d++;
-                if (d > name_start)
-                    undef_macro(ctx, name_start, (size_t)(d - name_start));
-            } else if (kw_len == 6 && strncmp(kw_start, "pragma", 6) == 0) {
-                // Ignore pragmas for now.
-                is_directive = true;
-            } else if (kw_len == 5 && strncmp(kw_start, "error", 5) == 0) {
-                is_directive = true;
-                const char* msg = skip_spaces(d, line_end);
-                fprintf(stderr, "#error: %.*s\n", (int)(line_end - msg), msg);
-                exit(1);
+
+                char* value = trim_copy(d, (size_t)(line_end - d));
+                add_or_replace_macro(ctx, name, value, is_function,
+                                     is_variadic, params, param_count);
+                free(name);
+                free(value);
+            }
+        } else if (kw_len == 5 && strncmp(kw_start, "undef", 5) == 0) {
+            is_directive = true;
+            while (d < line_end && (*d == ' ' || *d == '\t'))
+                d++;
+            const char* name_start = d;
+            unsigned int name_hash;
+            d = scan_ident(d, line_end, &name_hash);
+            if (d > name_start)
+                undef_macro(ctx, name_start, (size_t)(d - name_start),
+                            name_hash);
+        } else if (kw_len == 6 && strncmp(kw_start, "pragma", 6) == 0) {
+            // Only #pragma once has an effect
+            is_directive = true;
+            const char* arg = skip_spaces(d, line_end);
+            if (f->file && line_end - arg >= 4 &&
+                strncmp(arg, "once", 4) == 0 &&
+                (arg + 4 == line_end || !is_ident_char(arg[4]))) {
+                f->file->pragma_once = true;
+            }
+        } else if (kw_len == 5 && strncmp(kw_start, "error", 5) == 0) {
+            is_directive = true;
+            const char* msg = skip_spaces(d, line_end);
+            fprintf(stderr, "#error: %.*s\n", (int)(line_end - msg), msg);
+            exit(1);
+        }
+
+        if (f->guard_state == GUARD_INSIDE && !f->cond_stack) {
+            f->guard_state = GUARD_AFTER;
+        }
+    } else if ((f->guard_state == GUARD_BEFORE ||
+                f->guard_state == GUARD_AFTER) &&
+               !is_blank_line(line_start, line_end, &f->in_guard_comment)) {
+        f->guard_state = GUARD_INVALID;
+    }
+    return is_directive;
+}
+
+/**
+ * Move to the next line of text, carrying out the directives on the way
+ *
+ * The line handed out before is stepped over first. Included files are
+ * entered and left as their lines are reached; while ctx->joining, the
+ * current file is not left.
+ *
+ * @param[out] start Start of the line
+ * @param[out] end End of the line: its newline, or the end of the file
+ * @return false at the end of the input
+ */
+static bool pp_read_line(PreprocessContext* ctx, const char** start,
+                         const char** end) {
+    for (;;) {
+        PPFile* f = ctx->file;
+        if (!f)
+            return false;
+        if (f->pending) {
+            f->p = f->line_end;
+            if (*f->p == '\n') {
+                f->p++;
+                ctx->current_line++;
             }
+            f->pending = false;
+        }
+        if (*f->p && f->cond_stack && !f->cond_stack->active)
+            f->p = skip_inactive_group(ctx, f->p, f->end);
+        if (!*f->p) {
+            if (ctx->joining)
+                return false;
+            leave_file(ctx);
+            continue;
         }
 
-        if (!is_directive && (!cond_stack || cond_stack->active)) {
-            const char* s = line_start;
+        const char* line_end = scan_line_end(f->p, f->end);
+        f->line_end = line_end;
+        f->pending = true;
+        if (run_directive(ctx, f, f->p, line_end))
+            continue;
+        if (f->cond_stack && !f->cond_stack->active)
+            continue;
+        *start = f->p;
+        *end = line_end;
+        return true;
+    }
+}
+
+// Copy a line of text to ctx->out, expanding the macros in it
+static void emit_line(PreprocessContext* ctx, const char* line_start,
+                      const char* line_end) {
+    PPFile* f = ctx->file;
+    StrBuf* out = ctx->out;
+    if (ctx->line_markers && f->out_line != ctx->current_line) {
+        // Short gaps are cheaper as blank lines than as a marker
+        int gap = ctx->current_line - f->out_line;
+        if (gap > 0 && gap <= 8) {
+            for (int i = 0; i < gap; i++)
+                sb_append_c(out, '\n');
+        } else {
+            pp_line_marker(out, ctx->current_line, f->display, 0);
+        }
+        f->out_line = ctx->current_line;
+    }
+    const char* s = line_start;
+    while (s < line_end) {
+        if (f->in_block_comment) {
+            const char* close = scan_comment_end(s, line_end);
+            if (close) {
+                sb_append_n(out, s, (size_t)(close + 2 - s));
+                s = close + 2;
+                f->in_block_comment = false;
+            } else {
+                sb_append_n(out, s, (size_t)(line_end - s));
+                s = line_end;
+            }
+            continue;
+        }
+
+        if (*s == '/' && (s + 1) < line_end && s[1] == '*') {
+            sb_append_c(out, '/');
+            sb_append_c(out, '*');
+            s += 2;
+            f->in_block_comment = true;
+            continue;
+        }
+        if (*s == '/' && (s + 1) < line_end && s[1] == '/') {
+            sb_append_n(out, s, (size_t)(line_end - s));
+            s = line_end;
+            continue;
+        }
+        if (*s == '"' || *s == '\'') {
+            char quote = *s;
+            sb_append_c(out, *s++);
             while (s < line_end) {
-                if (in_block_comment) {
-                    sb_append_c(&out, *s);
-                    if (*s == '*' && (s + 1) < line_end && s[1] == '/') {
-                        sb_append_c(&out, '/');
-                        s += 2;
-                        in_block_comment = false;
-                    } else {
-                        s++;
-                    }
-                    continue;
-                }
+                // Stops at a quote, backslash or line_end
+                const char* stop = scan_string_stop(s, quote);
+                sb_append_n(out, s, (size_t)(stop - s));
+                s = stop;
+                if (s >= line_end)
+                    break;
+                sb_append_c(out, *s);
+                if (*s++ == quote)
+                    break;
+                if (s < line_end)
+                    sb_append_c(out, *s++);
+            }
+            continue;
+        }
 
-                if (*s == '/' && (s + 1) < line_end && s[1] == '*') {
-                    sb_append_c(&out, '/');
-                    sb_append_c(&out, '*');
-                    s += 2;
-                    in_block_comment = true;
-                    continue;
-                }
-                if (*s == '/' && (s + 1) < line_end && s[1] == '/') {
-                    sb_append_n(&out, s, (size_t)(line_end - s));
-                    s = line_end;
-                    continue;
-                }
-                if (*s == '"' || *s == '\'') {
-                    char quote = *s;
-                    sb_append_c(&out, *s++);
-                    bool escaped = false;
-                    while (s < line_end) {
-                        sb_append_c(&out, *s);
-                        if (escaped) {
-                            escaped = false;
-                        } else if (*s == '\\') {
-                            escaped = true;
-                        } else if (*s == quote) {
-                            s++;
-                            break;
-                        }
-                        s++;
-                    }
-                    continue;
-                }
+        if (isdigit((unsigned char)*s) ||
+            (*s == '.' && s + 1 < line_end && isdigit((unsigned char)s[1]))) {
+            // A suffix such as the "x1F" of 0x1F is not a name
+            const char* num_end = pp_skip_number(s, line_end);
+            sb_append_n(out, s, (size_t)(num_end - s));
+            s = num_end;
+            continue;
+        }
 
-                if (is_ident_start(*s)) {
-                    const char* id_start = s;
-                    while (s < line_end && is_ident_char(*s))
-                        s++;
-                    size_t id_len = (size_t)(s - id_start);
-                    if (id_len == 8 && strncmp(id_start, "__LINE__", 8) == 0) {
-                        char line_buf[32];
-                        snprintf(line_buf, sizeof(line_buf), "%d",
-                                 ctx->current_line);
-                        sb_append_n(&out, line_buf, strlen(line_buf));
-                        continue;
-                    }
-                    Macro* m = find_macro(ctx, id_start, id_len);
-                    if (m) {
-                        if (m->is_function) {
-                            const char* call = s;
-                            call = skip_spaces(call, line_end);
-                            if (call < line_end && *call == '(') {
-                                int argc = 0;
-                                char** args =
-                                    parse_macro_args(&call, line_end, &argc);
-                                // For variadic macros, accept argc >=
-                                // param_count For non-variadic, require argc ==
-                                // param_count
-                                bool arg_count_ok =
-                                    m->is_variadic ? (argc >= m->param_count)
-                                                   : (argc == m->param_count);
-                                if (arg_count_ok) {
-                                    char* ex =
-                                        expand_function_macro(m, args, argc);
-                                    char* re =
-                                        expand_macros_in_text(ctx, ex, 0);
-                                    sb_append_n(&out, re, strlen(re));
-                                    free(re);
-                                    free(ex);
-                                    s = call;
-                                } else {
-                                    sb_append_n(&out, id_start, id_len);
-                                }
-                                for (int i = 0; i < argc; i++)
-                                    free(args[i]);
-                                free(args);
-                            } else {
-                                sb_append_n(&out, id_start, id_len);
-                            }
-                        } else {
-                            char* ex = expand_macros_in_text(ctx, m->value, 0);
-                            sb_append_n(&out, ex, strlen(ex));
-                            free(ex);
-                        }
-                    } else {
-                        sb_append_n(&out, id_start, id_len);
-                    }
-                    continue;
-                }
+        if (is_ident_start(*s)) {
+            const char* id_start = s;
+            unsigned int id_hash;
+            s = scan_ident(s, line_end, &id_hash);
+            size_t id_len = (size_t)(s - id_start);
+            if ((id_len == 8 && strncmp(id_start, "__LINE__", 8) == 0) ||
+                find_macro(ctx, id_start, id_len, id_hash)) {
+                expand_line(ctx, id_start, line_end);
+                s = line_end;
+            } else {
+                sb_append_n(out, id_start, id_len);
+            }
+            continue;
+        }
+
+        sb_append_c(out, *s);
+        s++;
+    }
+
+    // An invocation spanning lines ends the output line where it ends
+    if (*f->line_end == '\n') {
+        sb_append_c(out, '\n');
+        f->out_line++;
+    }
+}
+
+// Precompiled header support (see pch.c)
+static PchBuf* pch_save = NULL; // Receives the state preprocess() ends with
+static PchReader pch_state;     // State preprocess() starts from
+static bool pch_state_set = false;
+static char* pch_state_path = NULL; // File pch_state was loaded from
+
+/**
+ * Record the state of the next preprocess() calls for a precompiled header
+ *
+ * Written are the headers read with their sizes and hashes, the macros,
+ * and the include guards and #pragma once flags.
+ *
+ * @param[out] out Buffer the state is appended to, or NULL to stop
+ */
+void preprocess_save_pch(PchBuf* out) { pch_save = out; }
+
+// Whether a header recorded in a precompiled header is unchanged
+static bool pch_input_current(const char* path, unsigned long long size,
+                              unsigned int hash) {
+    const FileView* v = cached_file_view(path);
+    return v && v->len == size && hash_name(v->data, (int)v->len) == hash;
+}
+
+/**
+ * Read the preprocessor state of a precompiled header
+ *
+ * @param[in,out] r Reader at the state; moved past it
+ * @param[in,out] ctx Receives the macros and include state, or NULL to
+ *                check the recorded headers instead
+ * @return false if the state is corrupt or a header has changed
+ */
+static bool read_pch_state(PchReader* r, PreprocessContext* ctx) {
+    int len;
+    unsigned int count = pch_get_u32(r);
+    for (unsigned int i = 0; i < count && !r->error; i++) {
+        const char* path = pch_get_str(r, &len);
+        unsigned long long size = pch_get_u64(r);
+        unsigned int hash = pch_get_u32(r);
+        if (!ctx && (!path || !pch_input_current(path, size, hash)))
+            return false;
+        // Editing a header the precompiled one was built from also
+        // invalidates what was compiled with it
+        if (ctx && ctx->record_deps && path)
+            add_dep(ctx, include_file(ctx, path));
+    }
 
-                sb_append_c(&out, *s);
-                s++;
+    count = pch_get_u32(r);
+    for (unsigned int i = 0; i < count && !r->error; i++) {
+        const char* name = pch_get_str(r, &len);
+        const char* value = pch_get_str(r, &len);
+        unsigned int flags = pch_get_u32(r);
+        int param_count = (int)pch_get_u32(r);
+        if (param_count < 0 || param_count > r->end - r->p) {
+            r->error = true;
+            break;
+        }
+        char** params = NULL;
+        if (ctx && param_count > 0) {
+            params = malloc(sizeof(char*) * (size_t)param_count);
+            if (!params) {
+                perror("malloc");
+                exit(1);
             }
         }
+        for (int j = 0; j < param_count; j++) {
+            const char* param = pch_get_str(r, &len);
+            if (params)
+                params[j] = dup_range(param ? param : "", (size_t)len);
+        }
+        if (ctx && name && value) {
+            add_or_replace_macro(ctx, name, value, (flags & 1u) != 0,
+                                 (flags & 2u) != 0, params, param_count);
+        }
+    }
 
-        if (*line_end == '\n') {
-            if (!is_directive && (!cond_stack || cond_stack->active))
-                sb_append_c(&out, '\n');
-            p = line_end + 1;
-            ctx->current_line++;
-        } else {
-            p = line_end;
+    count = pch_get_u32(r);
+    for (unsigned int i = 0; i < count && !r->error; i++) {
+        const char* path = pch_get_str(r, &len);
+        const char* guard = pch_get_str(r, &len);
+        bool pragma_once = pch_get_u32(r) != 0;
+        if (ctx && path) {
+            IncludeFile* f = include_file(ctx, path);
+            if (guard && !f->guard) {
+                f->guard = dup_range(guard, (size_t)len);
+                f->guard_len = (size_t)len;
+                f->guard_hash = hash_name(guard, len);
+            }
+            f->pragma_once = f->pragma_once || pragma_once;
         }
     }
+    return !r->error;
+}
 
-    while (cond_stack) {
-        CondStack* next = cond_stack->next;
-        free(cond_stack);
-        cond_stack = next;
+/**
+ * Start the next preprocess() calls from the state of a precompiled header
+ *
+ * @param[in,out] r Reader at the state written by preprocess_save_pch();
+ *                moved past it. NULL drops a loaded state.
+ * @param[in] path File the state was read from, listed by -MD along with
+ *            the headers it was built from
+ * @return false if the state is corrupt or a header it was built from has
+ *         changed
+ */
+bool preprocess_load_pch(PchReader* r, const char* path) {
+    pch_state_set = false;
+    free(pch_state_path);
+    pch_state_path = NULL;
+    if (!r)
+        return true;
+    // Headers may have changed since an earlier translation unit
+    file_cache_revalidate();
+    PchReader start = *r;
+    if (!read_pch_state(r, NULL))
+        return false;
+    pch_state = start;
+    pch_state_set = true;
+    pch_state_path = strdup(path);
+    if (!pch_state_path) {
+        perror("strdup");
+        exit(1);
     }
+    return true;
+}
 
-    return out.data;
+static void write_pch_state(PreprocessContext* ctx, PchBuf* out) {
+    IncludeTable* includes = &ctx->includes;
+    pch_put_u32(out, (unsigned int)includes->count);
+    for (int i = 0; i < includes->cap; i++) {
+        IncludeFile* f = includes->slots[i];
+        if (!f)
+            continue;
+        const FileView* v = cached_file_view(f->path);
+        pch_put_str(out, f->path, (int)strlen(f->path));
+        pch_put_u64(out, v ? (unsigned long long)v->len : 0);
+        pch_put_u32(out, v ? hash_name(v->data, (int)v->len) : 0);
+    }
+
+    MacroTable* macros = &ctx->macros;
+    pch_put_u32(out, (unsigned int)macros->count);
+    for (int i = 0; i < macros->cap; i++) {
+        Macro* m = macros->slots[i];
+        if (!m)
+            continue;
+        pch_put_str(out, m->name, (int)m->name_len);
+        pch_put_str(out, m->value, (int)strlen(m->value));
+        pch_put_u32(out,
+                    (m->is_function ? 1u : 0u) | (m->is_variadic ? 2u : 0u));
+        pch_put_u32(out, (unsigned int)m->param_count);
+        for (int j = 0; j < m->param_count; j++)
+            pch_put_str(out, m->params[j], (int)strlen(m->params[j]));
+    }
+
+    pch_put_u32(out, (unsigned int)includes->count);
+    for (int i = 0; i < includes->cap; i++) {
+        IncludeFile* f = includes->slots[i];
+        if (!f)
+            continue;
+        pch_put_str(out, f->path, (int)strlen(f->path));
+        pch_put_str(out, f->guard, (int)f->guard_len);
+        pch_put_u32(out, f->pragma_once ? 1u : 0u);
+    }
 }
 
-char* preprocess(const char* input, const char* filename) {
-    PreprocessContext ctx = {0};
-    add_or_replace_macro(&ctx, "__clang__", "1", false, false, NULL, 0);
+// Make dependency file support (-MD)
+static const char* deps_path = NULL;   // File the rule is written to
+static const char* deps_target = NULL; // Target of the rule
+
+/**
+ * Write a Make dependency rule for the next preprocess() calls
+ *
+ * The rule makes target depend on the source file and every header it
+ * includes, as found by the preprocessor itself, so no separate pass is
+ * needed. A precompiled header in use is listed too, with the headers it
+ * was built from. Each header also gets an empty rule, so that make does
+ * not fail once a header is deleted.
+ *
+ * @param[in] path File to write the rule to, or NULL to stop
+ * @param[in] target Target of the rule, e.g. the output file
+ */
+void preprocess_save_deps(const char* path, const char* target) {
+    deps_path = path;
+    deps_target = target;
+}
+
+// Append a file name with the characters make treats specially escaped
+static void sb_append_make_name(StrBuf* sb, const char* name) {
+    for (const char* s = name; *s; s++) {
+        if (*s == ' ' || *s == '\t' || *s == '#')
+            sb_append_c(sb, '\\');
+        else if (*s == '$')
+            sb_append_c(sb, '$');
+        sb_append_c(sb, *s);
+    }
+}
+
+static void write_deps(PreprocessContext* ctx) {
+    FILE* fp = fopen(ctx->deps_path, "w");
+    if (!fp) {
+        perror(ctx->deps_path);
+        exit(1);
+    }
+    StrBuf rule;
+    sb_init(&rule);
+    rule.fp = fp;
+    sb_append_make_name(&rule, ctx->deps_target);
+    sb_append_c(&rule, ':');
+    // Source read from stdin has no file to depend on
+    if (strcmp(ctx->filename, "-") != 0) {
+        sb_append_c(&rule, ' ');
+        sb_append_make_name(&rule, ctx->filename);
+    }
+    if (ctx->pch_path) {
+        sb_append_n(&rule, " \\\n  ", 5);
+        sb_append_make_name(&rule, ctx->pch_path);
+    }
+    for (int i = 0; i < ctx->dep_count; i++) {
+        sb_append_n(&rule, " \\\n  ", 5);
+        sb_append_make_name(&rule, ctx->deps[i]->path);
+    }
+    sb_append_c(&rule, '\n');
+    for (int i = 0; i < ctx->dep_count; i++) {
+        sb_append_c(&rule, '\n');
+        sb_append_make_name(&rule, ctx->deps[i]->path);
+        sb_append_n(&rule, ":\n", 2);
+    }
+    sb_flush(&rule);
+    free(rule.data);
+    if (fclose(fp) != 0) {
+        perror(ctx->deps_path);
+        exit(1);
+    }
+}
+
+/**
+ * Set up the preprocessing of a translation unit
+ *
+ * Picks up the precompiled header, dependency and precompiled output
+ * settings in effect.
+ *
+ * @param[out] ctx Preprocessor state
+ * @param[in] input Source text; must outlive ctx
+ * @param[in] filename Name of the source file
+ * @param[in] out Receives the text, or NULL when tokens are pulled
+ */
+static void begin_preprocess(PreprocessContext* ctx, const char* input,
+                             const char* filename, StrBuf* out) {
+    // Headers cached by an earlier translation unit may have changed
+    file_cache_revalidate();
+
+    memset(ctx, 0, sizeof(PreprocessContext));
+    ctx->out = out;
+    ctx->filename = filename;
+    ctx->line_markers = out && out->fp;
+    ctx->record_deps = deps_path != NULL;
+    ctx->deps_path = deps_path;
+    ctx->deps_target = deps_target;
+    ctx->pch_out = pch_save;
+    if (pch_state_set) {
+        PchReader r = pch_state;
+        read_pch_state(&r, ctx);
+        ctx->pch_path = strdup(pch_state_path);
+        if (!ctx->pch_path) {
+            perror("strdup");
+            exit(1);
+        }
+    }
+    add_or_replace_macro(ctx, "__clang__", "1", false, false, NULL, 0);
 #ifdef __APPLE__
-    add_or_replace_macro(&ctx, "__APPLE__", "1", false, false, NULL, 0);
+    add_or_replace_macro(ctx, "__APPLE__", "1", false, false, NULL, 0);
 #endif
-    add_or_replace_macro(&ctx, "__STDC_VERSION__", "199901L", false, false,
+    add_or_replace_macro(ctx, "__STDC_VERSION__", "199901L", false, false,
                          NULL, 0);
 
     StrBuf file_val;
     sb_init(&file_val);
     sb_append_escaped_quoted(&file_val, filename);
-    add_or_replace_macro(&ctx, "__FILE__", file_val.data, false, false, NULL,
-                         0);
+    add_or_replace_macro(ctx, "__FILE__", file_val.data, false, false, NULL, 0);
     free(file_val.data);
 
     time_t now = time(NULL);
     struct tm* tm_info = localtime(&now);
     char date_buf[32];
     strftime(date_buf, sizeof(date_buf), "\"%b %d %Y\"", tm_info);
-    add_or_replace_macro(&ctx, "__DATE__", date_buf, false, false, NULL, 0);
+    add_or_replace_macro(ctx, "__DATE__", date_buf, false, false, NULL, 0);
     char time_buf[32];
     strftime(time_buf, sizeof(time_buf), "\"%H:%M:%S\"", tm_info);
-    add_or_replace_macro(&ctx, "__TIME__", time_buf, false, false, NULL, 0);
+    add_or_replace_macro(ctx, "__TIME__", time_buf, false, false, NULL, 0);
+
+    // A header being precompiled records its own guard as well
+    IncludeFile* top = NULL;
+    if (ctx->pch_out) {
+        const char* real = cached_realpath(filename);
+        if (real)
+            top = include_file(ctx, real);
+    }
 
-    char* out = preprocess_internal(input, filename, &ctx);
-    free_macros(ctx.macros);
-    return out;
+    if (ctx->line_markers)
+        pp_line_marker(out, 1, filename, 0);
+    enter_file(ctx, input, filename, filename, top);
+}
+
+// Write what the whole translation unit yields besides its text
+static void finish_preprocess(PreprocessContext* ctx) {
+    if (ctx->pch_out)
+        write_pch_state(ctx, ctx->pch_out);
+    if (ctx->record_deps)
+        write_deps(ctx);
+}
+
+static void free_preprocess(PreprocessContext* ctx) {
+    while (ctx->file) {
+        PPFile* parent = ctx->file->parent;
+        while (ctx->file->cond_stack) {
+            CondStack* next = ctx->file->cond_stack->next;
+            free(ctx->file->cond_stack);
+            ctx->file->cond_stack = next;
+        }
+        free(ctx->file);
+        ctx->file = parent;
+    }
+    for (int i = 0; i < ctx->retired_count; i++)
+        free(ctx->retired[i]);
+    free(ctx->retired);
+    free(ctx->pch_path);
+    free(ctx->deps);
+    free_macros(&ctx->macros);
+    free_includes(&ctx->includes);
+    arena_free(&ctx->expand_arena);
+    arena_free(&ctx->text_arena);
+}
+
+static void run_preprocess(const char* input, const char* filename,
+                           StrBuf* out) {
+    PreprocessContext ctx;
+    begin_preprocess(&ctx, input, filename, out);
+    const char* start;
+    const char* end;
+    while (pp_read_line(&ctx, &start, &end))
+        emit_line(&ctx, start, end);
+    finish_preprocess(&ctx);
+    free_preprocess(&ctx);
+}
+
+/**
+ * Preprocess a translation unit
+ *
+ * @param[in] input Source text
+ * @param[in] filename Name of the source file
+ * @return Preprocessed text (caller frees)
+ */
+char* preprocess(const char* input, const char* filename) {
+    StrBuf out;
+    sb_init(&out);
+    run_preprocess(input, filename, &out);
+    return out.data;
+}
+
+/**
+ * Preprocess a translation unit, writing the text to fp as it is produced
+ *
+ * The output carries "# line "file"" markers so that it maps back to the
+ * sources, as with -E in other compilers.
+ *
+ * @param[in] input Source text
+ * @param[in] filename Name of the source file
+ * @param[in] fp Output stream
+ */
+void preprocess_to_file(const char* input, const char* filename, FILE* fp) {
+    StrBuf out;
+    sb_init(&out);
+    out.fp = fp;
+    run_preprocess(input, filename, &out);
+    sb_flush(&out);
+    free(out.data);
+}
+
+// Token stream of a translation unit (see preprocessor_new())
+struct Preprocessor {
+    PreprocessContext ctx;
+    PPToken* tok; // Next token of the line being read, or NULL
+    bool done;    // The end of the input has been reached
+};
+
+/**
+ * Start preprocessing a translation unit into a stream of tokens
+ *
+ * Nothing is read until the first preprocessor_next(); lines are read and
+ * expanded one at a time as their tokens are asked for, so no preprocessed
+ * text is built.
+ *
+ * @param[in] input Source text; must outlive the preprocessor
+ * @param[in] filename Name of the source file
+ * @return New preprocessor
+ */
+Preprocessor* preprocessor_new(const char* input, const char* filename) {
+    Preprocessor* pp = calloc(1, sizeof(Preprocessor));
+    if (!pp) {
+        perror("calloc");
+        exit(1);
+    }
+    begin_preprocess(&pp->ctx, input, filename, NULL);
+    return pp;
+}
+
+/**
+ * Get the next token of the preprocessed translation unit
+ *
+ * When the end is reached, the dependency rule and precompiled header
+ * state are written as preprocess() would.
+ *
+ * @param[in,out] pp Preprocessor
+ * @param[out] tok Spelling and source position of the token; the spelling
+ *             stays valid until preprocessor_free()
+ * @return false at the end of the input
+ */
+bool preprocessor_next(Preprocessor* pp, PPSpelling* tok) {
+    PreprocessContext* ctx = &pp->ctx;
+    while (!pp->tok || pp->tok->kind == PP_EOL) {
+        if (pp->done)
+            return false;
+        end_expansion(ctx);
+        const char* start;
+        const char* end;
+        if (!pp_read_line(ctx, &start, &end)) {
+            finish_preprocess(ctx);
+            pp->tok = NULL;
+            pp->done = true;
+            return false;
+        }
+        PPToken* list = pp_tokenize(ctx, start, end,
+                                    &ctx->file->in_block_comment,
+                                    &ctx->line_eol);
+        pp->tok = expand_tokens(ctx, list);
+        ctx->line_eol = NULL;
+    }
+    PPToken* t = pp->tok;
+    pp->tok = t->next;
+    tok->str = t->str;
+    tok->len = t->len;
+    tok->line = t->line;
+    tok->col = t->col;
+    return true;
+}
+
+void preprocessor_free(Preprocessor* pp) {
+    if (!pp)
+        return;
+    free_preprocess(&pp->ctx);
+    free(pp);
 }
@@ -1,6 +1,30 @@
 #ifndef __PREPROCESS_H__
 #define __PREPROCESS_H__
 
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "pch.h"
+
+// Token of a preprocessed translation unit
+typedef struct {
+    const char* str; // Spelling, as the lexer reads it
+    int len;
+    int line; // Line in the file the token comes from
+    int col;
+} PPSpelling;
+
+typedef struct Preprocessor Preprocessor;
+
 char* preprocess(const char* input, const char* filename);
+void preprocess_to_file(const char* input, const char* filename, FILE* fp);
+void add_include_dir(const char* dir, bool is_system);
+void clear_include_dirs(void);
+void preprocess_save_pch(PchBuf* out);
+bool preprocess_load_pch(PchReader* r, const char* path);
+void preprocess_save_deps(const char* path, const char* target);
+Preprocessor* preprocessor_new(const char* input, const char* filename);
+bool preprocessor_next(Preprocessor* pp, PPSpelling* tok);
+void preprocessor_free(Preprocessor* pp);
 
 #endif
@@ -0,0 +1,117 @@
+#include "scan.h"
+
+#include <string.h>
+
+// Byte scanners shared by the lexer and the preprocessor. They are built on
+// memchr/strspn/strcspn, which the C library implements with vector
+// instructions where available, so long runs of whitespace, comment text and
+// string bodies are skipped many bytes at a time.
+
+/**
+ * Skip whitespace (space, tab, newline, vertical tab, form feed, CR)
+ *
+ * @param[in] p NUL-terminated text
+ * @return First non-whitespace character (possibly the terminator)
+ */
+const char* scan_skip_space(const char* p) {
+    return p + strspn(p, " \t\n\v\f\r");
+}
+
+/**
+ * Find the end of the current line
+ *
+ * @param[in] p Start of the scan
+ * @param[in] end End of the buffer
+ * @return Pointer to the next '\n', or end if there is none
+ */
+const char* scan_line_end(const char* p, const char* end) {
+    const char* q = memchr(p, '\n', (size_t)(end - p));
+    return q ? q : end;
+}
+
+/**
+ * Find the closing "*" "/" of a block comment
+ *
+ * @param[in] p First character inside the comment
+ * @param[in] end End of the searchable range
+ * @return Pointer to the '*' of the terminator, or NULL if it is not in range
+ */
+const char* scan_comment_end(const char* p, const char* end) {
+    while (p < end) {
+        const char* q = memchr(p, '*', (size_t)(end - p));
+        if (!q || q + 1 >= end) {
+            return NULL;
+        }
+        if (q[1] == '/') {
+            return q;
+        }
+        p = q + 1;
+    }
+    return NULL;
+}
+
+// Bytes scan_next_directive() searches at a time
+#define SCAN_WINDOW 4096
+
+static int count_newlines(const char* p, const char* end) {
+    int n = 0;
+    const char* q = memchr(p, '\n', (size_t)(end - p));
+    while (q) {
+        n++;
+        q++;
+        q = memchr(q, '\n', (size_t)(end - q));
+    }
+    return n;
+}
+
+/**
+ * Find the next line whose first non-blank character is '#'
+ *
+ * Instead of examining every line, the scan jumps from one '#' to the next
+ * with memchr and only counts the newlines in between, so code without
+ * directives is crossed at memchr speed.
+ *
+ * @param[in] p Start of a line
+ * @param[in] end End of the buffer
+ * @param[in,out] lines Incremented by the number of newlines passed
+ * @return Start of the directive's line, or end if there is none
+ */
+const char* scan_next_directive(const char* p, const char* end, int* lines) {
+    const char* start = p;
+    while (p < end) {
+        // One cache-sized window at a time, so that counting newlines reads
+        // bytes the '#' search has just loaded
+        const char* limit = end;
+        if (end - p > SCAN_WINDOW)
+            limit = p + SCAN_WINDOW;
+        const char* hash = memchr(p, '#', (size_t)(limit - p));
+        if (!hash) {
+            *lines += count_newlines(p, limit);
+            p = limit;
+            continue;
+        }
+        *lines += count_newlines(p, hash);
+        // A directive if only blanks precede the '#' on its line
+        const char* s = hash;
+        while (s > start && (s[-1] == ' ' || s[-1] == '\t'))
+            s--;
+        if (s == start || s[-1] == '\n')
+            return s;
+        p = hash + 1;
+    }
+    return end;
+}
+
+/**
+ * Skip ordinary characters inside a string or character literal
+ *
+ * @param[in] p NUL-terminated text inside the literal
+ * @param[in] quote The literal's delimiter ('"' or '\'')
+ * @return First quote, backslash, newline or terminator at or after p
+ */
+const char* scan_string_stop(const char* p, char quote) {
+    if (quote == '"') {
+        return p + strcspn(p, "\"\\\n");
+    }
+    return p + strcspn(p, "'\\\n");
+}
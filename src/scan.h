@@ -0,0 +1,13 @@
+#ifndef __SCAN_H__
+#define __SCAN_H__
+
+#include <stddef.h>
+
+extern const char* scan_skip_space(const char* p);
+extern const char* scan_line_end(const char* p, const char* end);
+extern const char* scan_comment_end(const char* p, const char* end);
+extern const char* scan_next_directive(const char* p, const char* end,
+                                       int* lines);
+extern const char* scan_string_stop(const char* p, char quote);
+
+#endif
@@ -0,0 +1,269 @@
+#include "type.h"
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Builtin types are created once and shared by every compilation, and so is
+// every pointer or array type built on one of them: they live in this arena
+// for the rest of the process. A type derived from a struct lives in the
+// compilation's arena, like the struct itself.
+static Arena* type_arena = NULL;
+// Builtin types by kind (INT to BOOL), signedness and volatility
+#define BUILTIN_SLOTS 48
+static Type* builtins[BUILTIN_SLOTS];
+
+static Type* alloc_type(bool permanent) {
+    if (!permanent)
+        return ast_alloc(sizeof(Type));
+    if (!type_arena) {
+        type_arena = calloc(1, sizeof(Arena));
+        if (!type_arena) {
+            perror("calloc");
+            exit(1);
+        }
+    }
+    Type* t = arena_alloc(type_arena, sizeof(Type));
+    t->is_permanent = true;
+    return t;
+}
+
+/**
+ * Get the canonical instance of a builtin type
+ *
+ * The returned type is shared and must not be modified; use
+ * qualify_type() to get a qualified variant.
+ *
+ * @param[in] kind Any kind except PTR, STRUCT and UNION
+ * @param[in] is_unsigned Unsigned variant
+ * @param[in] is_volatile Volatile variant
+ * @return Canonical type
+ */
+Type* builtin_type(int kind, bool is_unsigned, bool is_volatile) {
+    int i = kind * 4;
+    if (is_unsigned)
+        i += 1;
+    if (is_volatile)
+        i += 2;
+    if (!builtins[i]) {
+        Type* t = alloc_type(true);
+        t->ty = kind;
+        t->is_unsigned = is_unsigned;
+        t->is_volatile = is_volatile;
+        builtins[i] = t;
+    }
+    return builtins[i];
+}
+
+Type* new_type_void(void) { return builtin_type(VOID, false, false); }
+
+Type* new_type_int(void) { return builtin_type(INT, false, false); }
+
+Type* new_type_bool(void) { return builtin_type(BOOL, false, false); }
+
+Type* new_type_char(void) { return builtin_type(CHAR, false, false); }
+
+Type* new_type_short(void) { return builtin_type(SHORT, false, false); }
+
+Type* new_type_long(void) { return builtin_type(LONG, false, false); }
+
+Type* new_type_double(void) { return builtin_type(DOUBLE, false, false); }
+
+Type* new_type_float(void) { return builtin_type(FLOAT, false, false); }
+
+/**
+ * Get the pointer type to base
+ *
+ * @param[in] base Pointed-to type, or NULL for an untyped pointer
+ * @return Canonical pointer type; must not be modified
+ */
+Type* new_type_ptr(Type* base) {
+    if (base && base->pointer_type)
+        return base->pointer_type;
+    Type* t = alloc_type(base && base->is_permanent);
+    t->ty = PTR;
+    t->ptr_to = base;
+    if (base)
+        base->pointer_type = t;
+    return t;
+}
+
+/**
+ * Get an array type
+ *
+ * An array of unknown size gets a type of its own, so that an initializer
+ * can fill in array_size afterwards.
+ *
+ * @param[in] base Element type
+ * @param[in] size Number of elements, or 0 if unknown
+ * @return Array type; canonical and unmodifiable if size is not 0
+ */
+Type* new_type_array(Type* base, size_t size) {
+    if (size == 0) {
+        Type* open = ast_alloc(sizeof(Type));
+        open->ty = PTR;
+        open->ptr_to = base;
+        return open;
+    }
+    for (Type* t = base->array_types; t; t = t->next_array) {
+        if (t->array_size == size)
+            return t;
+    }
+    Type* t = alloc_type(base->is_permanent);
+    t->ty = PTR;
+    t->ptr_to = base;
+    t->array_size = size;
+    t->next_array = base->array_types;
+    base->array_types = t;
+    return t;
+}
+
+/**
+ * Add qualifiers to a type
+ *
+ * A struct or union is qualified in place, since its tag names a single
+ * type. restrict only applies to pointers.
+ *
+ * @param[in] ty Type to qualify
+ * @param[in] is_unsigned Make the type unsigned
+ * @param[in] is_restrict Make the pointer restrict-qualified
+ * @param[in] is_volatile Make the type volatile
+ * @return ty itself if it already has the qualifiers, else the qualified
+ *         type
+ */
+Type* qualify_type(Type* ty, bool is_unsigned, bool is_restrict,
+                   bool is_volatile) {
+    bool u = ty->is_unsigned || is_unsigned;
+    bool r = ty->is_restrict || (is_restrict && ty->ty == PTR);
+    bool v = ty->is_volatile || is_volatile;
+    if (u == ty->is_unsigned && r == ty->is_restrict && v == ty->is_volatile)
+        return ty;
+    if (ty->ty == STRUCT || ty->ty == UNION) {
+        ty->is_unsigned = u;
+        ty->is_volatile = v;
+        return ty;
+    }
+    if (ty->ty != PTR)
+        return builtin_type(ty->ty, u, v);
+
+    // Qualified pointers are rare enough to get a copy each time
+    Type* t = ast_alloc(sizeof(Type));
+    *t = *ty;
+    t->is_unsigned = u;
+    t->is_restrict = r;
+    t->is_volatile = v;
+    t->is_permanent = false;
+    t->pointer_type = NULL;
+    t->array_types = NULL;
+    t->next_array = NULL;
+    return t;
+}
+
+/**
+ * Set the members of a struct or union
+ *
+ * The layout is computed again on the next type_size() or type_align().
+ *
+ * @param[in,out] ty STRUCT or UNION type
+ * @param[in] members Member list in declaration order
+ */
+void set_members(Type* ty, Member* members) {
+    ty->members = members;
+    ty->has_layout = false;
+}
+
+// Size, alignment and member offsets of a struct or union. Members are laid
+// out like LLVM lays out the struct type they become, bitfields included.
+static void layout_members(Type* ty) {
+    int size = 0;
+    int align = 1;
+    for (Member* m = ty->members; m; m = m->next) {
+        int s = type_size(m->type);
+        int a = type_align(m->type);
+        if (a > align)
+            align = a;
+        if (ty->ty == UNION) {
+            m->offset = 0;
+            if (s > size)
+                size = s;
+        } else {
+            size = (size + a - 1) / a * a;
+            m->offset = size;
+            size += s;
+        }
+    }
+    ty->size = (size + align - 1) / align * align;
+    ty->align = align;
+    // An incomplete type is laid out again once its members are known
+    ty->has_layout = ty->members != NULL;
+}
+
+/**
+ * Get the size of a type in bytes
+ *
+ * @param[in] ty Type, or NULL for int
+ * @return Size; the layout of a struct or union is computed only once
+ */
+int type_size(Type* ty) {
+    if (ty == NULL)
+        return 4;
+    if (ty->array_size > 0)
+        return type_size(ty->ptr_to) * (int)ty->array_size;
+    switch (ty->ty) {
+    case CHAR:
+    case BOOL:
+        return 1;
+    case SHORT:
+        return 2;
+    case INT:
+    case FLOAT:
+        return 4;
+    case LONG:
+    case LONGLONG:
+    case DOUBLE:
+    case PTR:
+        return 8;
+    case STRUCT:
+    case UNION:
+        if (!ty->has_layout)
+            layout_members(ty);
+        return ty->size;
+    default:
+        return 4;
+    }
+}
+
+/**
+ * Get the alignment of a type in bytes
+ *
+ * @param[in] ty Type, or NULL for int
+ * @return Alignment; an array is aligned like its elements
+ */
+int type_align(Type* ty) {
+    if (ty == NULL)
+        return 4;
+    if (ty->array_size > 0)
+        return type_align(ty->ptr_to);
+    switch (ty->ty) {
+    case CHAR:
+    case BOOL:
+        return 1;
+    case SHORT:
+        return 2;
+    case INT:
+    case FLOAT:
+        return 4;
+    case LONG:
+    case LONGLONG:
+    case DOUBLE:
+    case PTR:
+        return 8;
+    case STRUCT:
+    case UNION:
+        if (!ty->has_layout)
+            layout_members(ty);
+        return ty->align;
+    default:
+        return 4;
+    }
+}
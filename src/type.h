@@ -0,0 +1,23 @@
+#ifndef __TYPE_H__
+#define __TYPE_H__
+
+#include "common.h"
+
+extern Type* builtin_type(int kind, bool is_unsigned, bool is_volatile);
+extern Type* new_type_void(void);
+extern Type* new_type_int(void);
+extern Type* new_type_bool(void);
+extern Type* new_type_char(void);
+extern Type* new_type_short(void);
+extern Type* new_type_long(void);
+extern Type* new_type_double(void);
+extern Type* new_type_float(void);
+extern Type* new_type_ptr(Type* base);
+extern Type* new_type_array(Type* base, size_t size);
+extern Type* qualify_type(Type* ty, bool is_unsigned, bool is_restrict,
+                          bool is_volatile);
+extern void set_members(Type* ty, Member* members);
+extern int type_size(Type* ty);
+extern int type_align(Type* ty);
+
+#endif
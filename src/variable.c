@@ -1,68 +1,229 @@
 #include "variable.h"
+#include "arena.h"
+#include "intern.h"
 #include <memory.h>
 #include <stdlib.h>
 
-typedef struct ScopedLVar ScopedLVar;
-struct ScopedLVar {
-    LVar base;
-    int scope_depth;
-};
+// Tables live in the compilation's arena; a grown table leaves its old
+// slots behind, which at most doubles what the table occupies
+static void grow_sym_table(SymTable* table, int initial_cap) {
+    int old_cap = table->cap;
+    SymSlot* old_slots = table->slots;
+    table->cap = old_cap ? old_cap * 2 : initial_cap;
+    table->slots = ast_alloc(sizeof(SymSlot) * (size_t)table->cap);
+    for (int i = 0; i < old_cap; i++) {
+        SymSlot* old = &old_slots[i];
+        if (old->sym == 0)
+            continue;
+        int j = (int)(sym_hash(old->sym) & (unsigned int)(table->cap - 1));
+        while (table->slots[j].sym != 0)
+            j = (j + 1) & (table->cap - 1);
+        table->slots[j] = *old;
+    }
+}
 
-LVar* find_lvar(Context* ctx, Token* tok) {
-    for (LVar* var = ctx->locals; var != NULL; var = var->next) {
-        ScopedLVar* scoped = (ScopedLVar*)var;
-        if (scoped->scope_depth <= ctx->scope_depth && var->len == tok->len &&
-            memcmp(var->name, tok->str, tok->len) == 0) {
-            return var;
-        }
+// Slot holding sym, or NULL if it was never inserted
+static SymSlot* find_sym(SymTable* table, int sym) {
+    if (table->cap == 0)
+        return NULL;
+    int i = (int)(sym_hash(sym) & (unsigned int)(table->cap - 1));
+    while (table->slots[i].sym != 0) {
+        if (table->slots[i].sym == sym)
+            return &table->slots[i];
+        i = (i + 1) & (table->cap - 1);
     }
     return NULL;
 }
 
-LVar* find_gvar(Context* ctx, Token* tok) {
-    for (LVar* var = ctx->globals; var != NULL; var = var->next) {
-        if (var->len == tok->len &&
-            memcmp(var->name, tok->str, tok->len) == 0) {
-            return var;
-        }
+// Slot holding sym, inserted with a NULL value if missing; valid until the
+// next insertion
+static SymSlot* insert_sym(SymTable* table, int sym, int initial_cap) {
+    if ((table->count + 1) * 2 > table->cap)
+        grow_sym_table(table, initial_cap);
+    int i = (int)(sym_hash(sym) & (unsigned int)(table->cap - 1));
+    while (table->slots[i].sym != 0 && table->slots[i].sym != sym)
+        i = (i + 1) & (table->cap - 1);
+    SymSlot* slot = &table->slots[i];
+    if (slot->sym == 0) {
+        slot->sym = sym;
+        table->count++;
     }
-    return NULL;
+    return slot;
+}
+
+// Make var the visible binding of its name; the previous one is kept in
+// var->shadowed
+static void bind_var(SymTable* table, LVar* var) {
+    SymSlot* slot = insert_sym(table, var->sym, 16);
+    LVar* prev = slot->value;
+    var->shadowed = prev;
+    slot->value = var;
 }
 
+static LVar* lookup_var(SymTable* table, int sym) {
+    SymSlot* slot = find_sym(table, sym);
+    if (!slot)
+        return NULL;
+    LVar* var = slot->value;
+    return var;
+}
+
+LVar* find_lvar(Context* ctx, Token* tok) {
+    return lookup_var(&ctx->local_table, tok_sym(tok));
+}
+
+LVar* find_gvar(Context* ctx, Token* tok) {
+    return lookup_var(&ctx->global_table, tok_sym(tok));
+}
+
+/**
+ * Declare a local variable in the innermost open scope
+ *
+ * @param[in,out] ctx Parser context
+ * @param[in] tok Name of the variable
+ * @param[in] type Type of the variable
+ * @return New variable; its offset is the next free slot of the function
+ */
 LVar* add_lvar(Context* ctx, Token* tok, Type* type) {
-    ScopedLVar* scoped = calloc(1, sizeof(ScopedLVar));
-    LVar* new_var = &scoped->base;
+    LVar* new_var = ast_alloc(sizeof(LVar));
     new_var->name = tok->str;
     new_var->len = tok->len;
+    new_var->sym = tok_sym(tok);
     new_var->type = type;
-    scoped->scope_depth = ctx->scope_depth;
 
     // Assign unique slot id for codegen local_allocas[] indexing.
-    int next_offset = 0;
-    for (LVar* var = ctx->locals; var != NULL; var = var->next) {
-        if (var->offset >= next_offset) {
-            next_offset = var->offset + 1;
-        }
-    }
-    if (next_offset >= MAX_LOCALS) {
-        fprintf(stderr, "Too many local variables (max %d)\n", MAX_LOCALS);
-        exit(1);
-    }
-    new_var->offset = next_offset;
+    new_var->offset = ctx->local_count;
+    ctx->local_count++;
 
-    // Push front so name lookup finds the most recent declaration first.
+    // Every local of the function stays on ctx->locals for codegen; the
+    // table only holds the ones in scope
     new_var->next = ctx->locals;
     ctx->locals = new_var;
+    bind_var(&ctx->local_table, new_var);
 
     return new_var;
 }
 
-void reset_scope(Context* ctx) { ctx->scope_depth = 0; }
+/**
+ * Declare a global variable
+ *
+ * A later declaration of the same name hides an earlier one.
+ *
+ * @param[in,out] ctx Parser context
+ * @param[in] tok Name of the variable
+ * @param[in] type Type of the variable
+ * @return New variable
+ */
+LVar* add_gvar(Context* ctx, Token* tok, Type* type) {
+    LVar* var = ast_alloc(sizeof(LVar));
+    var->name = tok->str;
+    var->len = tok->len;
+    var->sym = tok_sym(tok);
+    var->type = type;
+    var->next = ctx->globals;
+    ctx->globals = var;
+    bind_var(&ctx->global_table, var);
+    return var;
+}
 
-void enter_scope(Context* ctx) { ctx->scope_depth++; }
+/**
+ * Make the variables on ctx->globals visible to find_gvar()
+ *
+ * For a list filled in directly, newest declaration first, as when a
+ * precompiled header is restored.
+ *
+ * @param[in,out] ctx Parser context
+ */
+void index_gvars(Context* ctx) {
+    for (LVar* var = ctx->globals; var; var = var->next) {
+        if (!lookup_var(&ctx->global_table, var->sym))
+            bind_var(&ctx->global_table, var);
+    }
+}
 
+/**
+ * Start a new function: no locals are visible, slots count from 0 and no
+ * VLA sizes are recorded
+ *
+ * @param[in,out] ctx Parser context
+ */
+void reset_scope(Context* ctx) {
+    memset(&ctx->local_table, 0, sizeof(SymTable));
+    ctx->scope_depth = 0;
+    ctx->local_count = 0;
+    ctx->vla_size_exprs = NULL;
+    ctx->vla_cap = 0;
+}
+
+void enter_scope(Context* ctx) {
+    if (ctx->scope_depth == ctx->scope_cap) {
+        int cap = ctx->scope_cap ? ctx->scope_cap * 2 : 16;
+        LVar** starts = ast_alloc(sizeof(LVar*) * (size_t)cap);
+        if (ctx->scope_depth > 0) {
+            memcpy(starts, ctx->scope_starts,
+                   sizeof(LVar*) * (size_t)ctx->scope_depth);
+        }
+        ctx->scope_starts = starts;
+        ctx->scope_cap = cap;
+    }
+    ctx->scope_starts[ctx->scope_depth] = ctx->locals;
+    ctx->scope_depth++;
+}
+
+/**
+ * Close the innermost scope, uncovering the bindings its locals shadowed
+ *
+ * @param[in,out] ctx Parser context
+ */
 void leave_scope(Context* ctx) {
-    if (ctx->scope_depth > 0) {
-        ctx->scope_depth--;
+    if (ctx->scope_depth == 0)
+        return;
+    ctx->scope_depth--;
+    LVar* start = ctx->scope_starts[ctx->scope_depth];
+    for (LVar* var = ctx->locals; var != start; var = var->next) {
+        SymSlot* slot = find_sym(&ctx->local_table, var->sym);
+        slot->value = var->shadowed;
     }
 }
+
+/**
+ * Look up a function by name
+ *
+ * @param[in] ctx Compilation context
+ * @param[in] sym Interned symbol id of the name
+ * @return Entry of the function, or NULL if it was never declared or called
+ */
+FuncEntry* find_function(Context* ctx, int sym) {
+    SymSlot* slot = find_sym(&ctx->functions, sym);
+    if (!slot)
+        return NULL;
+    FuncEntry* fn = slot->value;
+    return fn;
+}
+
+/**
+ * Get the entry of a function, creating an empty one on first use
+ *
+ * @param[in,out] ctx Compilation context
+ * @param[in] sym Interned symbol id of the name
+ * @return Entry of the function
+ */
+FuncEntry* add_function(Context* ctx, int sym) {
+    SymSlot* slot = insert_sym(&ctx->functions, sym, 64);
+    if (!slot->value)
+        slot->value = ast_alloc(sizeof(FuncEntry));
+    FuncEntry* fn = slot->value;
+    return fn;
+}
+
+/**
+ * Record a function prototype or definition; the first one is kept
+ *
+ * @param[in,out] ctx Compilation context
+ * @param[in] fn ND_FUNCTION node
+ */
+void declare_function(Context* ctx, Node* fn) {
+    FuncEntry* entry = add_function(ctx, tok_sym(fn->tok));
+    if (!entry->decl)
+        entry->decl = fn;
+}
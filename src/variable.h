@@ -8,8 +8,13 @@
 extern LVar* find_lvar(Context* ctx, Token* tok);
 extern LVar* find_gvar(Context* ctx, Token* tok);
 extern LVar* add_lvar(Context* ctx, Token* tok, Type* type);
+extern LVar* add_gvar(Context* ctx, Token* tok, Type* type);
+extern void index_gvars(Context* ctx);
 extern void reset_scope(Context* ctx);
 extern void enter_scope(Context* ctx);
 extern void leave_scope(Context* ctx);
+extern FuncEntry* find_function(Context* ctx, int sym);
+extern FuncEntry* add_function(Context* ctx, int sym);
+extern void declare_function(Context* ctx, Node* fn);
 
 #endif
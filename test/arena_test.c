@@ -0,0 +1,57 @@
+#include "arena_test.h"
+#include "../src/arena.h"
+#include "../src/lex.h"
+#include "../src/parse.h"
+#include "test_common.h"
+#include <stdint.h>
+#include <string.h>
+
+char* test_arena_alloc_zeroed_aligned() {
+    Arena arena;
+    memset(&arena, 0, sizeof(arena));
+
+    char* a = arena_alloc(&arena, 3);
+    char* b = arena_alloc(&arena, 16);
+    mu_assert("allocations should be 8-byte aligned",
+              ((uintptr_t)a % 8) == 0 && ((uintptr_t)b % 8) == 0);
+    mu_assert("allocations should not overlap", b >= a + 3);
+    for (int i = 0; i < 16; i++) {
+        mu_assert("allocation should be zeroed", b[i] == 0);
+    }
+
+    arena_free(&arena);
+    mu_assert("arena should be empty after free", arena.chunks == NULL);
+    return NULL;
+}
+
+char* test_arena_large_alloc() {
+    Arena arena;
+    memset(&arena, 0, sizeof(arena));
+
+    char* small = arena_alloc(&arena, 8);
+    char* big = arena_alloc(&arena, 1 << 20);
+    char* after = arena_alloc(&arena, 8);
+    big[(1 << 20) - 1] = 'x';
+    mu_assert("large allocation should succeed", big != NULL);
+    mu_assert("small allocations should keep using the current chunk",
+              after == small + 8);
+
+    arena_free(&arena);
+    return NULL;
+}
+
+char* test_arena_owns_parse_objects() {
+    Context ctx = {0};
+    arena_use(&ctx.arena);
+
+    Token* tok = tokenize("int main() { char* s = \"hi\"; return 1 + 2; }");
+    ctx.current_token = tok;
+    parse_program(&ctx);
+    mu_assert("should parse one function", ctx.node_count == 1);
+    mu_assert("arena should hold the AST", ctx.arena.chunks != NULL);
+
+    free_tokens(tok);
+    arena_use(NULL);
+    arena_free(&ctx.arena);
+    return NULL;
+}
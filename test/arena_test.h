@@ -0,0 +1,8 @@
+#ifndef __ARENA_TEST_H__
+#define __ARENA_TEST_H__
+
+char* test_arena_alloc_zeroed_aligned();
+char* test_arena_large_alloc();
+char* test_arena_owns_parse_objects();
+
+#endif
@@ -96,9 +96,7 @@ static char* run_generate_test(Node* ast, int expected) {
 
     // Setup Context with single function
     Context parse_ctx = {0};
-    parse_ctx.code[0] = func;
-    parse_ctx.code[1] = NULL;
-    parse_ctx.node_count = 1;
+    add_code(&parse_ctx, func);
 
     LLVMModuleRef module = generate_module(&parse_ctx);
 
@@ -115,7 +113,6 @@ static char* run_generate_test(Node* ast, int expected) {
     static char msg[64];
     snprintf(msg, sizeof(msg), "Expected %d, got %d", expected, result);
     mu_assert(msg, result == expected);
-    free_ast(func);
     return NULL;
 }
 
@@ -136,9 +133,7 @@ static char* run_generate_double_test(Node* ast, double expected) {
 
     // Setup Context with single function
     Context parse_ctx = {0};
-    parse_ctx.code[0] = func;
-    parse_ctx.code[1] = NULL;
-    parse_ctx.node_count = 1;
+    add_code(&parse_ctx, func);
 
     LLVMModuleRef module = generate_module(&parse_ctx);
     if (!module) {
@@ -196,9 +191,7 @@ static char* run_generate_float_test(Node* ast, float expected) {
 
     // Setup Context with single function
     Context parse_ctx = {0};
-    parse_ctx.code[0] = func;
-    parse_ctx.code[1] = NULL;
-    parse_ctx.node_count = 1;
+    add_code(&parse_ctx, func);
 
     LLVMModuleRef module = generate_module(&parse_ctx);
     if (!module) {
@@ -279,8 +272,6 @@ char* test_generate_float_to_double() {
     double result = main_func();
     LLVMDisposeExecutionEngine(engine);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
 
     if (result != 1.5)
@@ -307,8 +298,6 @@ char* test_generate_double_to_float() {
     float result = main_func();
     LLVMDisposeExecutionEngine(engine);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
 
     if (result != 1.5f)
@@ -1181,9 +1170,6 @@ char* test_generate_proto_and_init() {
     }
     int result = execute_module(&llvm_ctx, "main");
 
-    for (int i = 0; i < ctx.node_count; i++) {
-        free_ast(ctx.code[i]);
-    }
     cleanup_llvm_context(&llvm_ctx);
     free_tokens(head);
     mu_assert("Expected 15", result == 15);
@@ -1254,8 +1240,6 @@ char* test_generate_double_from_int() {
     double result = main_func();
     LLVMDisposeExecutionEngine(engine);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
 
     if (result != 42.0)
@@ -1281,8 +1265,6 @@ char* test_generate_int_from_double() {
     int result = main_func();
     LLVMDisposeExecutionEngine(engine);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
 
     if (result != 42)
@@ -1312,8 +1294,6 @@ char* test_generate_do_while() {
         int result = main_func();
         LLVMDisposeExecutionEngine(engine);
 
-        for (int i = 0; i < ctx.node_count; i++)
-            free_ast(ctx.code[i]);
         free_tokens(head);
 
         if (result != 10)
@@ -1341,8 +1321,6 @@ char* test_generate_do_while() {
         int result = main_func();
         LLVMDisposeExecutionEngine(engine);
 
-        for (int i = 0; i < ctx.node_count; i++)
-            free_ast(ctx.code[i]);
         free_tokens(head);
 
         if (result != 1)
@@ -1372,8 +1350,6 @@ char* test_generate_ternary_float() {
     float result = main_func();
     LLVMDisposeExecutionEngine(engine);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
 
     if (result != 1.5f)
@@ -1400,8 +1376,6 @@ char* test_generate_ternary_mixed() {
     double result = main_func();
     LLVMDisposeExecutionEngine(engine);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
 
     if (result != 2.5)
@@ -1428,8 +1402,6 @@ char* test_generate_ternary_int_double_common_type() {
     double result = main_func();
     LLVMDisposeExecutionEngine(engine);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
 
     if (result != 2.5)
@@ -1459,8 +1431,6 @@ char* test_generate_unsigned() {
         unsigned int result = main_func();
         LLVMDisposeExecutionEngine(engine);
 
-        for (int i = 0; i < ctx.node_count; i++)
-            free_ast(ctx.code[i]);
         free_tokens(head);
 
         if (result != 2147483647u)
@@ -1487,8 +1457,6 @@ char* test_generate_unsigned() {
         int result = main_func();
         LLVMDisposeExecutionEngine(engine);
 
-        for (int i = 0; i < ctx.node_count; i++)
-            free_ast(ctx.code[i]);
         free_tokens(head);
 
         if (result != 0)
@@ -1522,8 +1490,6 @@ char* test_generate_bitwise() {
         int result = main_func();
         LLVMDisposeExecutionEngine(engine);
 
-        for (int i = 0; i < ctx.node_count; i++)
-            free_ast(ctx.code[i]);
         free_tokens(head);
 
         if (result != 3)
@@ -1550,8 +1516,6 @@ char* test_generate_bitwise() {
         int result = main_func();
         LLVMDisposeExecutionEngine(engine);
 
-        for (int i = 0; i < ctx.node_count; i++)
-            free_ast(ctx.code[i]);
         free_tokens(head);
 
         if (result != -1)
@@ -1578,8 +1542,6 @@ char* test_generate_bitwise() {
         int result = main_func();
         LLVMDisposeExecutionEngine(engine);
 
-        for (int i = 0; i < ctx.node_count; i++)
-            free_ast(ctx.code[i]);
         free_tokens(head);
 
         if (result != 32)
@@ -1610,8 +1572,6 @@ char* test_generate_compound_bitwise() {
         int result = main_func();
         LLVMDisposeExecutionEngine(engine);
 
-        for (int i = 0; i < ctx.node_count; i++)
-            free_ast(ctx.code[i]);
         free_tokens(head);
 
         if (result != 1)
@@ -1638,8 +1598,6 @@ char* test_generate_compound_bitwise() {
         int result = main_func();
         LLVMDisposeExecutionEngine(engine);
 
-        for (int i = 0; i < ctx.node_count; i++)
-            free_ast(ctx.code[i]);
         free_tokens(head);
 
         if (result != 4)
@@ -1668,8 +1626,6 @@ char* test_generate_union_overlap() {
     int result = main_func();
     LLVMDisposeExecutionEngine(engine);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
 
     if (result != 1)
@@ -1697,8 +1653,6 @@ char* test_generate_bitfield_access() {
     int result = main_func();
     LLVMDisposeExecutionEngine(engine);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
 
     if (result != 22)
@@ -1725,8 +1679,6 @@ char* test_generate_goto_label() {
     int result = main_func();
     LLVMDisposeExecutionEngine(engine);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
 
     if (result != 0)
@@ -1753,8 +1705,6 @@ char* test_generate_designated_initializer_array() {
     int result = main_func();
     LLVMDisposeExecutionEngine(engine);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
 
     if (result != 4)
@@ -1781,8 +1731,6 @@ char* test_generate_designated_initializer_struct() {
     int result = main_func();
     LLVMDisposeExecutionEngine(engine);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
 
     if (result != 7)
@@ -1809,8 +1757,6 @@ char* test_generate_long_double() {
     int result = main_func();
     LLVMDisposeExecutionEngine(engine);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
 
     if (result != 3)
@@ -1836,8 +1782,6 @@ char* test_generate_scalar_compound_literal() {
     int result = main_func();
     LLVMDisposeExecutionEngine(engine);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
 
     if (result != 7)
@@ -1864,8 +1808,6 @@ char* test_generate_complex_basic() {
     int result = main_func();
     LLVMDisposeExecutionEngine(engine);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
 
     if (result != 3)
@@ -1892,8 +1834,6 @@ char* test_generate_vla_basic() {
     int result = main_func();
     LLVMDisposeExecutionEngine(engine);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
 
     if (result != 12)
@@ -1920,8 +1860,6 @@ char* test_generate_adjacent_string_literals() {
     int result = main_func();
     LLVMDisposeExecutionEngine(engine);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
 
     if (result != ('f' + 'r'))
@@ -1948,8 +1886,6 @@ char* test_generate_struct_compound_literal_member() {
     int result = main_func();
     LLVMDisposeExecutionEngine(engine);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
 
     if (result != 2)
@@ -1975,8 +1911,6 @@ char* test_generate_array_compound_literal_subscript() {
     int result = main_func();
     LLVMDisposeExecutionEngine(engine);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
 
     if (result != 4)
@@ -2003,8 +1937,6 @@ char* test_generate_union_compound_literal_designator() {
     int result = main_func();
     LLVMDisposeExecutionEngine(engine);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
 
     if (result != 5)
@@ -2031,8 +1963,6 @@ char* test_generate_sizeof_vla_expr_runtime() {
     int result = main_func();
     LLVMDisposeExecutionEngine(engine);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
 
     if (result != 12)
@@ -2060,8 +1990,6 @@ char* test_generate_function_pointer_basic() {
     int result = main_func();
     LLVMDisposeExecutionEngine(engine);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
 
     if (result != 6)
@@ -2169,8 +2097,6 @@ char* test_generate_static_inline() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 7 for static inline add(3,4)", result == 7);
     return NULL;
@@ -2200,8 +2126,6 @@ char* test_generate_restrict_param() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 7 for restrict foo(3,4)", result == 7);
     return NULL;
@@ -2228,8 +2152,6 @@ char* test_generate_volatile_local() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 20 for volatile local", result == 20);
     return NULL;
@@ -2256,8 +2178,6 @@ char* test_generate_volatile_global() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 42 for volatile global", result == 42);
     return NULL;
@@ -2285,8 +2205,6 @@ char* test_generate_volatile_ptr() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 99 for volatile ptr", result == 99);
     return NULL;
@@ -2307,8 +2225,6 @@ char* test_generate_short_basic() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 42 for short", result == 42);
     return NULL;
@@ -2330,8 +2246,6 @@ char* test_generate_short_arithmetic() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 15 for short arithmetic", result == 15);
     return NULL;
@@ -2352,8 +2266,6 @@ char* test_generate_const_local() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 42 for const local", result == 42);
     return NULL;
@@ -2375,8 +2287,6 @@ char* test_generate_const_param() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 42 for const param", result == 42);
     return NULL;
@@ -2398,8 +2308,6 @@ char* test_generate_enum_values() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 7 for enum values (1+2+4)", result == 7);
     return NULL;
@@ -2421,8 +2329,6 @@ char* test_generate_flexible_array_member() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 42 for flexible array member struct", result == 42);
     return NULL;
@@ -2444,8 +2350,6 @@ char* test_generate_funcstr() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 1 for __func__ string comparison", result == 1);
     return NULL;
@@ -2470,8 +2374,6 @@ char* test_generate_continue() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 9 for continue (sum odds 1..5)", result == 9);
     return NULL;
@@ -2493,8 +2395,6 @@ char* test_generate_variadic_call() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 0 for variadic call", result == 0);
     return NULL;
@@ -2518,8 +2418,6 @@ char* test_generate_variadic_definition() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 7 for variadic definition", result == 7);
     return NULL;
@@ -2540,8 +2438,6 @@ char* test_generate_array_init() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 60 for array init {10,20,30}", result == 60);
     return NULL;
@@ -2562,8 +2458,6 @@ char* test_generate_struct_init() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 7 for struct init {3,4}", result == 7);
     return NULL;
@@ -2584,8 +2478,6 @@ char* test_generate_void_function() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 99 for void function call", result == 99);
     return NULL;
@@ -2605,8 +2497,6 @@ char* test_generate_ternary_int() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 10 for ternary int (true)", result == 10);
     return NULL;
@@ -2626,8 +2516,6 @@ char* test_generate_ternary_int_false() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 20 for ternary int (false)", result == 20);
     return NULL;
@@ -2647,8 +2535,6 @@ char* test_generate_modulo() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 2 for 17 %% 5", result == 2);
     return NULL;
@@ -2671,8 +2557,6 @@ char* test_generate_nested_struct() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 6 for nested struct", result == 6);
     return NULL;
@@ -2694,8 +2578,6 @@ char* test_generate_escape_sequences() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     // \a=7, \b=8, \f=12, \v=11, \r=13 -> 7+8+12+11+13 = 51
     mu_assert("Expected 51 for escape sequences", result == 51);
@@ -2717,8 +2599,6 @@ char* test_generate_char_init() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 131 for char array init", result == 131);
     return NULL;
@@ -2738,8 +2618,6 @@ char* test_generate_negative_div() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected -3 for -10 / 3", result == -3);
     return NULL;
@@ -2759,8 +2637,6 @@ char* test_generate_negative_mod() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected -1 for -10 %% 3", result == -1);
     return NULL;
@@ -2782,8 +2658,6 @@ char* test_generate_global_struct() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 30 for global struct", result == 30);
     return NULL;
@@ -2805,8 +2679,6 @@ char* test_generate_multiple_returns() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 10 for multiple returns", result == 10);
     return NULL;
@@ -2826,8 +2698,6 @@ char* test_generate_long_basic() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 2 for long basic (100%7)", result == 2);
     return NULL;
@@ -2848,8 +2718,6 @@ char* test_generate_unsigned_char() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 200 for unsigned char", result == 200);
     return NULL;
@@ -2873,8 +2741,6 @@ char* test_generate_unsigned_global_cast() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 0 for unsigned global zero-extend", result == 0);
     return NULL;
@@ -2897,8 +2763,6 @@ char* test_generate_for_break() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 6 for for-break (1+2+3)", result == 6);
     return NULL;
@@ -2921,8 +2785,6 @@ char* test_generate_while_continue() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 9 for while-continue", result == 9);
     return NULL;
@@ -2943,8 +2805,6 @@ char* test_generate_pointer_deref_assign() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 30 for pointer deref assign", result == 30);
     return NULL;
@@ -2965,8 +2825,6 @@ char* test_generate_cast_int_ptr() {
     }
     int result = execute_module(&llvm_ctx, "main");
     cleanup_llvm_context(&llvm_ctx);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     mu_assert("Expected 65 for cast int to char ptr", result == 65);
     return NULL;
@@ -38,3 +38,164 @@ char* test_read_file_not_found() {
     mu_assert("read_file should return NULL for missing file", src == NULL);
     return NULL;
 }
+
+static char* write_temp_file(char* path, const char* content, size_t len) {
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp error");
+        return "mkstemp failed";
+    }
+    if (write(fd, content, len) != (ssize_t)len) {
+        close(fd);
+        unlink(path);
+        return "write failed";
+    }
+    close(fd);
+    return NULL;
+}
+
+char* test_open_file_view_mapped() {
+    char path[] = "test_file_XXXXXX";
+    char* err = write_temp_file(path, "int main() { return 0; }\n", 25);
+    if (err)
+        return err;
+
+    FileView view;
+    bool ok = open_file_view(path, &view);
+    unlink(path);
+
+    mu_assert("open_file_view should succeed", ok);
+    mu_assert("small regular file should be mapped", view.mapped);
+    mu_assert("length should match", view.len == 25);
+    mu_assert("content should match",
+              strcmp(view.data, "int main() { return 0; }\n") == 0);
+
+    close_file_view(&view);
+    mu_assert("data should be cleared after close", view.data == NULL);
+    return NULL;
+}
+
+char* test_open_file_view_page_multiple() {
+    // A file filling whole pages has no guaranteed terminator in the mapping,
+    // so it must be read into a buffer instead
+    size_t len = (size_t)getpagesize();
+    char* content = malloc(len);
+    memset(content, 'a', len);
+    char path[] = "test_file_XXXXXX";
+    char* err = write_temp_file(path, content, len);
+    free(content);
+    if (err)
+        return err;
+
+    FileView view;
+    bool ok = open_file_view(path, &view);
+    unlink(path);
+
+    mu_assert("open_file_view should succeed", ok);
+    mu_assert("page-sized file should not be mapped", !view.mapped);
+    mu_assert("length should match", view.len == len);
+    mu_assert("content should be NUL-terminated", view.data[len] == '\0');
+
+    close_file_view(&view);
+    return NULL;
+}
+
+char* test_open_file_view_not_found() {
+    FileView view;
+    bool ok =
+        open_file_view("/tmp/llvm7_this_file_should_not_exist_12345.txt", &view);
+    mu_assert("open_file_view should fail for missing file", !ok);
+    return NULL;
+}
+
+// Replace a file the way editors do: write a new file, then rename it over
+// the old one. Cached views may map the old file, which stays unchanged.
+static bool rewrite_file(const char* path, const char* content) {
+    char tmp[] = "test_file_XXXXXX";
+    if (write_temp_file(tmp, content, strlen(content)))
+        return false;
+    return rename(tmp, path) == 0;
+}
+
+char* test_cached_file_view_reuses_contents() {
+    char path[] = "test_file_XXXXXX";
+    char* err = write_temp_file(path, "int x;\n", 7);
+    if (err)
+        return err;
+
+    const char* resolved = cached_realpath(path);
+    mu_assert("cached_realpath should find the file", resolved != NULL);
+    const FileView* first = cached_file_view(resolved);
+    const FileView* second = cached_file_view(resolved);
+    unlink(path);
+
+    mu_assert("cached_file_view should succeed", first != NULL);
+    mu_assert("second lookup should return the cached view", first == second);
+    mu_assert("content should match", strcmp(first->data, "int x;\n") == 0);
+    mu_assert("resolution should be cached",
+              cached_realpath(path) == resolved);
+    return NULL;
+}
+
+char* test_cached_file_view_revalidates() {
+    char path[] = "test_file_XXXXXX";
+    char* err = write_temp_file(path, "int x;\n", 7);
+    if (err)
+        return err;
+
+    const char* resolved = cached_realpath(path);
+    const FileView* view = cached_file_view(resolved);
+    mu_assert("cached_file_view should succeed", view != NULL);
+    if (!rewrite_file(path, "int longer_name;\n")) {
+        unlink(path);
+        return "rewrite failed";
+    }
+
+    view = cached_file_view(resolved);
+    bool kept = strcmp(view->data, "int x;\n") == 0;
+    file_cache_revalidate();
+    view = cached_file_view(resolved);
+    unlink(path);
+    mu_assert("same epoch should keep the cached contents", kept);
+    mu_assert("new epoch should see the new contents",
+              strcmp(view->data, "int longer_name;\n") == 0);
+    return NULL;
+}
+
+char* test_cached_realpath_negative() {
+    const char* path = "test_file_cache_missing.h";
+    unlink(path);
+    mu_assert("missing file should not resolve",
+              cached_realpath(path) == NULL);
+    if (!rewrite_file(path, "int y;\n"))
+        return "write failed";
+
+    bool kept = cached_realpath(path) == NULL;
+    file_cache_revalidate();
+    const char* resolved = cached_realpath(path);
+    unlink(path);
+    mu_assert("same epoch should keep the negative entry", kept);
+    mu_assert("new epoch should find the created file", resolved != NULL);
+    return NULL;
+}
+
+char* test_cached_dir_has() {
+    mu_assert("existing entry should be found", cached_dir_has(".", "main.c"));
+    mu_assert("missing entry should not be found",
+              !cached_dir_has(".", "no_such_file.h"));
+    mu_assert("entry in a subdirectory should be found",
+              cached_dir_has("incdir", "sub/nested.h"));
+    mu_assert("missing directory should list as empty",
+              !cached_dir_has("no_such_dir", "main.c"));
+
+    const char* path = "test_file_cache_listed.h";
+    unlink(path);
+    mu_assert("file should not be listed yet", !cached_dir_has(".", path));
+    if (!rewrite_file(path, "int z;\n"))
+        return "write failed";
+    file_cache_revalidate();
+    bool found = cached_dir_has(".", path);
+    unlink(path);
+    mu_assert("new epoch should list the created file", found);
+    return NULL;
+}
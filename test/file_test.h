@@ -3,5 +3,12 @@
 
 char* test_read_file_success();
 char* test_read_file_not_found();
+char* test_open_file_view_mapped();
+char* test_open_file_view_page_multiple();
+char* test_open_file_view_not_found();
+char* test_cached_file_view_reuses_contents();
+char* test_cached_file_view_revalidates();
+char* test_cached_realpath_negative();
+char* test_cached_dir_has();
 
 #endif
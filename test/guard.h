@@ -0,0 +1,5 @@
+/* Header wrapped in an include guard */
+#ifndef GUARD_H
+#define GUARD_H
+int guarded_val = 1;
+#endif // GUARD_H
@@ -0,0 +1 @@
+int sub_val = 3;
@@ -0,0 +1 @@
+int which_val = 1;
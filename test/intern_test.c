@@ -0,0 +1,50 @@
+#include "intern_test.h"
+#include "../src/intern.h"
+#include "../src/lex.h"
+#include "test_common.h"
+#include <stdio.h>
+#include <string.h>
+
+char* test_intern_same_name() {
+    const char* s = "foo foo";
+    int a = intern(s, 3);
+    int b = intern(s + 4, 3);
+    mu_assert("same spelling should share id", a == b);
+    mu_assert("id should be positive", a > 0);
+    mu_assert("name should be copied", sym_name(a) != s);
+    mu_assert("name should match", strcmp(sym_name(a), "foo") == 0);
+    mu_assert("len should match", sym_len(a) == 3);
+    mu_assert("hash should match", sym_hash(a) == hash_name("foo", 3));
+    return NULL;
+}
+
+char* test_intern_distinct_names() {
+    int ids[2000];
+    char buf[16];
+    // Enough names to force the table to grow several times
+    for (int i = 0; i < 2000; i++) {
+        snprintf(buf, sizeof(buf), "n%d", i);
+        ids[i] = intern(buf, (int)strlen(buf));
+    }
+    for (int i = 0; i < 2000; i++) {
+        snprintf(buf, sizeof(buf), "n%d", i);
+        mu_assert("id should be stable",
+                  intern(buf, (int)strlen(buf)) == ids[i]);
+        mu_assert("name should round-trip",
+                  strcmp(sym_name(ids[i]), buf) == 0);
+    }
+    mu_assert("prefix should be distinct", intern("n1", 2) != intern("n", 1));
+    return NULL;
+}
+
+char* test_intern_lexer_sets_sym() {
+    Token* tok = tokenize("abc int abc abd");
+    mu_assert("ident should be interned", tok[0].sym == intern("abc", 3));
+    mu_assert("keyword should not be interned", tok[1].sym == 0);
+    mu_assert("repeated ident should share id", tok[2].sym == tok[0].sym);
+    mu_assert("different ident should differ", tok[3].sym != tok[0].sym);
+    mu_assert("tok_sym should resolve keyword",
+              tok_sym(&tok[1]) == intern("int", 3));
+    free_tokens(tok);
+    return NULL;
+}
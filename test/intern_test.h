@@ -0,0 +1,8 @@
+#ifndef __INTERN_TEST_H__
+#define __INTERN_TEST_H__
+
+char* test_intern_same_name();
+char* test_intern_distinct_names();
+char* test_intern_lexer_sets_sym();
+
+#endif
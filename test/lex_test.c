@@ -1,8 +1,12 @@
 #include "lex_test.h"
+#include "../src/file.h"
 #include "../src/lex.h"
 #include "../src/parse.h"
+#include "../src/preprocess.h"
 #include "test_common.h"
+#include <dirent.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 
@@ -14,38 +18,41 @@ char* test_lex_tokenize() {
     mu_assert("First token should be TK_NUM",
               curr_token != NULL && curr_token->kind == TK_NUM);
     mu_assert("First token value should be 1",
-              curr_token != NULL && curr_token->val == 1);
+              curr_token != NULL && (int)curr_token->num->uval == 1);
 
-    curr_token = curr_token->next;
+    curr_token = next_token(curr_token);
     mu_assert("Second token should be TK_RESERVED",
               curr_token != NULL && curr_token->kind == TK_RESERVED);
     mu_assert("Second token should be +",
               curr_token != NULL &&
                   strncmp(curr_token->str, "+", curr_token->len) == 0);
 
-    curr_token = curr_token->next;
+    curr_token = next_token(curr_token);
     mu_assert("Third token should be TK_NUM",
               curr_token != NULL && curr_token->kind == TK_NUM);
     mu_assert("Third token value should be 2",
-              curr_token != NULL && curr_token->val == 2);
+              curr_token != NULL && (int)curr_token->num->uval == 2);
 
-    curr_token = curr_token->next;
+    curr_token = next_token(curr_token);
     mu_assert("Fourth token should be TK_RESERVED",
               curr_token != NULL && curr_token->kind == TK_RESERVED);
     mu_assert("Fourth token should be -",
               curr_token != NULL &&
                   strncmp(curr_token->str, "-", curr_token->len) == 0);
 
-    curr_token = curr_token->next;
+    curr_token = next_token(curr_token);
     mu_assert("Fifth token should be TK_NUM",
               curr_token != NULL && curr_token->kind == TK_NUM);
     mu_assert("Fifth token value should be 3",
-              curr_token != NULL && curr_token->val == 3);
+              curr_token != NULL && (int)curr_token->num->uval == 3);
 
-    curr_token = curr_token->next;
+    curr_token = next_token(curr_token);
     mu_assert("Last token should be TK_EOF", curr_token->kind == TK_EOF);
+    mu_assert("TK_EOF should have no numeric payload",
+              curr_token->num == NULL);
 
-    free_tokens(head);
+    // Any token of the array releases the whole allocation
+    free_tokens(next_token(head));
     return NULL;
 }
 
@@ -102,14 +109,14 @@ char* test_lex_comments() {
     Token* curr = head;
 
     mu_assert("First token should be 1",
-              curr->kind == TK_NUM && curr->val == 1);
-    curr = curr->next;
+              curr->kind == TK_NUM && (int)curr->num->uval == 1);
+    curr = next_token(curr);
     mu_assert("Second token should be +",
               curr->kind == TK_RESERVED && curr->str[0] == '+');
-    curr = curr->next;
+    curr = next_token(curr);
     mu_assert("Third token should be 2",
-              curr->kind == TK_NUM && curr->val == 2);
-    curr = curr->next;
+              curr->kind == TK_NUM && (int)curr->num->uval == 2);
+    curr = next_token(curr);
     mu_assert("Last token should be EOF", curr->kind == TK_EOF);
 
     free_tokens(head);
@@ -139,9 +146,9 @@ char* test_lex_token_positions() {
 
     mu_assert("first token line/col should be 1:1",
               t->line == 1 && t->col == 1);
-    t = t->next;
+    t = next_token(t);
     mu_assert("plus token line/col should be 2:3", t->line == 2 && t->col == 3);
-    t = t->next;
+    t = next_token(t);
     mu_assert("number token line/col should be 2:5",
               t->line == 2 && t->col == 5);
 
@@ -157,20 +164,20 @@ char* test_lex_double() {
               curr->kind == TK_RESERVED &&
                   strncmp(curr->str, "double", curr->len) == 0);
 
-    curr = curr->next;
+    curr = next_token(curr);
     mu_assert("Second token should be x",
               curr->kind == TK_IDENT &&
                   strncmp(curr->str, "x", curr->len) == 0);
 
-    curr = curr->next;
+    curr = next_token(curr);
     mu_assert("Third token should be =",
               curr->kind == TK_RESERVED && curr->str[0] == '=');
 
-    curr = curr->next;
+    curr = next_token(curr);
     mu_assert("Fourth token should be TK_NUM", curr->kind == TK_NUM);
-    mu_assert("Fourth token fval should be 1.23", curr->fval == 1.23);
+    mu_assert("Fourth token fval should be 1.23", curr->num->fval == 1.23);
 
-    curr = curr->next;
+    curr = next_token(curr);
     mu_assert("Fifth token should be ;",
               curr->kind == TK_RESERVED && curr->str[0] == ';');
 
@@ -186,21 +193,23 @@ char* test_lex_float() {
               curr->kind == TK_RESERVED &&
                   strncmp(curr->str, "float", curr->len) == 0);
 
-    curr = curr->next;
+    curr = next_token(curr);
     mu_assert("Second token should be y",
               curr->kind == TK_IDENT &&
                   strncmp(curr->str, "y", curr->len) == 0);
 
-    curr = curr->next;
+    curr = next_token(curr);
     mu_assert("Third token should be =",
               curr->kind == TK_RESERVED && curr->str[0] == '=');
 
-    curr = curr->next;
+    curr = next_token(curr);
     mu_assert("Fourth token should be TK_NUM", curr->kind == TK_NUM);
-    mu_assert("Fourth token should be float", curr->is_float);
-    mu_assert("Fourth token fval should be 1.23", curr->fval == 1.23);
+    mu_assert("Fourth token should be float", curr->num->type == NUM_FLOAT);
+    // Rounded directly to float, not through double
+    mu_assert("Fourth token fval should be 1.23f",
+              curr->num->fval == (double)1.23f);
 
-    curr = curr->next;
+    curr = next_token(curr);
     mu_assert("Fifth token should be ;",
               curr->kind == TK_RESERVED && curr->str[0] == ';');
 
@@ -214,37 +223,37 @@ char* test_lex_bitwise() {
 
     mu_assert("token should be &",
               curr->kind == TK_RESERVED && strncmp(curr->str, "&", 1) == 0);
-    curr = curr->next;
+    curr = next_token(curr);
     mu_assert("token should be |",
               curr->kind == TK_RESERVED && strncmp(curr->str, "|", 1) == 0);
-    curr = curr->next;
+    curr = next_token(curr);
     mu_assert("token should be ^",
               curr->kind == TK_RESERVED && strncmp(curr->str, "^", 1) == 0);
-    curr = curr->next;
+    curr = next_token(curr);
     mu_assert("token should be ~",
               curr->kind == TK_RESERVED && strncmp(curr->str, "~", 1) == 0);
-    curr = curr->next;
+    curr = next_token(curr);
     mu_assert("token should be <<",
               curr->kind == TK_RESERVED && strncmp(curr->str, "<<", 2) == 0);
-    curr = curr->next;
+    curr = next_token(curr);
     mu_assert("token should be >>",
               curr->kind == TK_RESERVED && strncmp(curr->str, ">>", 2) == 0);
-    curr = curr->next;
+    curr = next_token(curr);
     mu_assert("token should be &=",
               curr->kind == TK_RESERVED && strncmp(curr->str, "&=", 2) == 0);
-    curr = curr->next;
+    curr = next_token(curr);
     mu_assert("token should be |=",
               curr->kind == TK_RESERVED && strncmp(curr->str, "|=", 2) == 0);
-    curr = curr->next;
+    curr = next_token(curr);
     mu_assert("token should be ^=",
               curr->kind == TK_RESERVED && strncmp(curr->str, "^=", 2) == 0);
-    curr = curr->next;
+    curr = next_token(curr);
     mu_assert("token should be <<=",
               curr->kind == TK_RESERVED && strncmp(curr->str, "<<=", 3) == 0);
-    curr = curr->next;
+    curr = next_token(curr);
     mu_assert("token should be >>=",
               curr->kind == TK_RESERVED && strncmp(curr->str, ">>=", 3) == 0);
-    curr = curr->next;
+    curr = next_token(curr);
 
     free_tokens(head);
     return NULL;
@@ -255,9 +264,9 @@ char* test_lex_no_unsigned_suffix_on_float() {
     Token* curr = head;
 
     mu_assert("first token should be float TK_NUM", curr->kind == TK_NUM);
-    mu_assert("first token should be float", curr->is_float);
-    mu_assert("float token should not be marked unsigned", !curr->is_unsigned);
-    curr = curr->next;
+    mu_assert("first token should be float", curr->num->type == NUM_DOUBLE);
+    mu_assert("float token should not be marked unsigned", curr->num->type != NUM_UINT);
+    curr = next_token(curr);
     mu_assert("second token should be identifier 'u'",
               curr->kind == TK_IDENT && curr->len == 1 && curr->str[0] == 'u');
 
@@ -270,9 +279,9 @@ char* test_lex_large_unsigned_literal() {
     Token* curr = head;
 
     mu_assert("first token should be TK_NUM", curr->kind == TK_NUM);
-    mu_assert("first token should be unsigned", curr->is_unsigned);
+    mu_assert("first token should be unsigned", curr->num->type == NUM_UINT);
     mu_assert("uval should keep full unsigned literal",
-              curr->uval == 4294967295ULL);
+              curr->num->uval == 4294967295ULL);
 
     free_tokens(head);
     return NULL;
@@ -284,8 +293,8 @@ char* test_lex_hex_float() {
     Token* curr = head;
 
     mu_assert("first token should be TK_NUM", curr->kind == TK_NUM);
-    mu_assert("first token should be float", curr->is_float);
-    mu_assert("0x1p3 should equal 8.0", curr->fval == 8.0);
+    mu_assert("first token should be float", curr->num->type == NUM_DOUBLE);
+    mu_assert("0x1p3 should equal 8.0", curr->num->fval == 8.0);
 
     free_tokens(head);
     return NULL;
@@ -297,8 +306,8 @@ char* test_lex_hex_float_with_fraction() {
     Token* curr = head;
 
     mu_assert("first token should be TK_NUM", curr->kind == TK_NUM);
-    mu_assert("first token should be float", curr->is_float);
-    mu_assert("0x1.8p1 should equal 3.0", curr->fval == 3.0);
+    mu_assert("first token should be float", curr->num->type == NUM_DOUBLE);
+    mu_assert("0x1.8p1 should equal 3.0", curr->num->fval == 3.0);
 
     free_tokens(head);
     return NULL;
@@ -310,8 +319,8 @@ char* test_lex_hex_float_negative_exp() {
     Token* curr = head;
 
     mu_assert("first token should be TK_NUM", curr->kind == TK_NUM);
-    mu_assert("first token should be float", curr->is_float);
-    mu_assert("0xAp-2 should equal 2.5", curr->fval == 2.5);
+    mu_assert("first token should be float", curr->num->type == NUM_DOUBLE);
+    mu_assert("0xAp-2 should equal 2.5", curr->num->fval == 2.5);
 
     free_tokens(head);
     return NULL;
@@ -323,8 +332,8 @@ char* test_lex_hex_float_uppercase() {
     Token* curr = head;
 
     mu_assert("first token should be TK_NUM", curr->kind == TK_NUM);
-    mu_assert("first token should be float", curr->is_float);
-    mu_assert("0X1P3 should equal 8.0", curr->fval == 8.0);
+    mu_assert("first token should be float", curr->num->type == NUM_DOUBLE);
+    mu_assert("0X1P3 should equal 8.0", curr->num->fval == 8.0);
 
     free_tokens(head);
     return NULL;
@@ -335,7 +344,7 @@ char* test_lex_hex_escape() {
     Token* head = tokenize("'\\x41'");
     Token* curr = head;
     mu_assert("should be TK_NUM", curr->kind == TK_NUM);
-    mu_assert("'\\x41' should be 65", curr->val == 65);
+    mu_assert("'\\x41' should be 65", (int)curr->num->uval == 65);
     free_tokens(head);
     return NULL;
 }
@@ -347,9 +356,9 @@ char* test_lex_hex_escape_two_digit() {
     mu_assert("should be TK_NUM", curr->kind == TK_NUM);
     // Check if char is signed (CHAR_MAX == 127) or unsigned (CHAR_MAX == 255)
     if (CHAR_MAX == 127) {
-        mu_assert("'\\xff' signed char should be -1", curr->val == -1);
+        mu_assert("'\\xff' signed char should be -1", (int)curr->num->uval == -1);
     } else {
-        mu_assert("'\\xff' unsigned char should be 255", curr->val == 255);
+        mu_assert("'\\xff' unsigned char should be 255", (int)curr->num->uval == 255);
     }
     free_tokens(head);
     return NULL;
@@ -361,7 +370,7 @@ char* test_lex_octal_escape() {
     Token* head = tokenize("'\\101'");
     Token* curr = head;
     mu_assert("should be TK_NUM", curr->kind == TK_NUM);
-    mu_assert("'\\101' should be 65", curr->val == 65);
+    mu_assert("'\\101' should be 65", (int)curr->num->uval == 65);
     free_tokens(head);
     return NULL;
 }
@@ -371,7 +380,7 @@ char* test_lex_octal_escape_zero() {
     Token* head = tokenize("'\\0'");
     Token* curr = head;
     mu_assert("should be TK_NUM", curr->kind == TK_NUM);
-    mu_assert("'\\0' should be 0", curr->val == 0);
+    mu_assert("'\\0' should be 0", (int)curr->num->uval == 0);
     free_tokens(head);
     return NULL;
 }
@@ -382,9 +391,236 @@ char* test_lex_hex_int() {
     Token* curr = head;
 
     mu_assert("first token should be TK_NUM", curr->kind == TK_NUM);
-    mu_assert("first token should not be float", !curr->is_float);
-    mu_assert("0x123 should equal 291", curr->uval == 291);
+    mu_assert("first token should not be float", curr->num->type != NUM_DOUBLE);
+    mu_assert("0x123 should equal 291", curr->num->uval == 291);
+
+    free_tokens(head);
+    return NULL;
+}
+
+char* test_lex_positions_match_rescan() {
+    // Positions tracked while lexing must match a full rescan of the source,
+    // including after multi-line comments and string literals.
+    const char* src = "int a; /* one\ntwo\n */ char* s = \"x\\ny\";\n"
+                      "// line\n  b = 'c' +\n\t0x1f;\n";
+    Token* head = tokenize(src);
+    int count = 0;
+    for (Token* t = head; t; t = next_token(t)) {
+        const char* pos = t->str;
+        if (t->kind == TK_STR) {
+            // String tokens point to decoded storage; locate the closing quote
+            pos = strstr(src, "\";");
+        }
+        if (t->kind == TK_NUM && t->len == 0) {
+            // Character literals are positioned at the character itself
+            pos = strchr(src, '\'') + 1;
+        }
+        int line = 0;
+        int col = 0;
+        lex_get_line_col(src, pos, &line, &col);
+        mu_assert("token line should match rescan", t->line == line);
+        mu_assert("token col should match rescan", t->col == col);
+        count++;
+    }
+    mu_assert("should lex all tokens", count == 16);
+
+    free_tokens(head);
+    return NULL;
+}
 
+char* test_lexer_matches_tokenize() {
+    // The pull-mode lexer must produce the same tokens as tokenize(), also
+    // after its window has wrapped around several times
+    char src[4096];
+    int off = 0;
+    for (int i = 0; i < 100; i++) {
+        off += snprintf(src + off, sizeof(src) - off, "x%d = %d + 'a';\n", i,
+                        i);
+    }
+    Token* head = tokenize(src);
+    Lexer* lx = lexer_new(src);
+    Token* t = lexer_peek(lx, 0);
+    int count = 0;
+    for (Token* want = head; want; want = next_token(want)) {
+        mu_assert("kind should match", t->kind == want->kind);
+        mu_assert("text should match",
+                  t->str == want->str && t->len == want->len);
+        mu_assert("line should match", t->line == want->line);
+        if (want->kind == TK_NUM) {
+            mu_assert("value should match", t->num->uval == want->num->uval);
+        }
+        t = lexer_advance(lx);
+        count++;
+    }
+    mu_assert("should lex all tokens", count == 601);
+    mu_assert("EOF should repeat", t->kind == TK_EOF);
+
+    lexer_free(lx);
     free_tokens(head);
     return NULL;
 }
+
+char* test_lexer_preprocessed() {
+    // Tokens pulled from the preprocessor must match those of its text, and
+    // keep the source line they were expanded on
+    const char* src = "#define ADD(a, b) ((a) + (b))\n"
+                      "#define CAT(a, b) a##b\n"
+                      "int CAT(x, 1) = ADD(1,\n"
+                      "                    2.5);\n"
+                      "char* s = \"str\";\n";
+    char* text = preprocess(src, "pp.c");
+    Token* head = tokenize(text);
+    Preprocessor* pp = preprocessor_new(src, "pp.c");
+    Lexer* lx = lexer_new_preprocessed(pp);
+    Token* t = lexer_peek(lx, 0);
+    int count = 0;
+    for (Token* want = head; want; want = next_token(want)) {
+        mu_assert("kind should match", t->kind == want->kind);
+        mu_assert("text should match",
+                  t->len == want->len &&
+                      strncmp(t->str, want->str, (size_t)t->len) == 0);
+        if (want->kind == TK_NUM) {
+            mu_assert("value should match", t->num->uval == want->num->uval);
+        }
+        t = lexer_advance(lx);
+        count++;
+    }
+    mu_assert("should lex all tokens", count == 20);
+    mu_assert("EOF should repeat", t->kind == TK_EOF);
+
+    lexer_free(lx);
+    preprocessor_free(pp);
+    pp = preprocessor_new(src, "pp.c");
+    lx = lexer_new_preprocessed(pp);
+    mu_assert("pasted name should be one token",
+              lexer_peek(lx, 1)->len == 2 &&
+                  strncmp(lexer_peek(lx, 1)->str, "x1", 2) == 0);
+    mu_assert("expansion should take the line of the macro name",
+              lexer_peek(lx, 4)->line == 3);
+    lexer_free(lx);
+    preprocessor_free(pp);
+    free_tokens(head);
+    free(text);
+    return NULL;
+}
+
+char* test_lexer_keep_token() {
+    // Identifiers returned by consume_ident() must survive the window
+    char src[2048];
+    int off = snprintf(src, sizeof(src), "name");
+    for (int i = 0; i < 200; i++) {
+        off += snprintf(src + off, sizeof(src) - off, " ;");
+    }
+    Context ctx = {0};
+    ctx.lexer = lexer_new(src);
+    ctx.current_token = lexer_peek(ctx.lexer, 0);
+
+    Token* name = consume_ident(&ctx);
+    mu_assert("should consume identifier", name != NULL);
+    while (consume(&ctx, ";")) {
+    }
+    mu_assert("should reach EOF", at_eof(&ctx));
+    mu_assert("kept token should be intact",
+              name->kind == TK_IDENT && name->len == 4 &&
+                  strncmp(name->str, "name", 4) == 0);
+    mu_assert("peek past EOF should be NULL", peek_token(&ctx, 1) == NULL);
+
+    lexer_free(ctx.lexer);
+    return NULL;
+}
+
+// Compare a parallel tokenization of src token by token with a serial one
+static char* check_parallel_matches_serial(const char* src, int nthreads) {
+    Token* serial = tokenize_parallel(src, 1);
+    Token* par = tokenize_parallel(src, nthreads);
+    mu_assert("both should lex", serial != NULL && par != NULL);
+    Token* a = serial;
+    Token* b = par;
+    for (; a && b; a = next_token(a), b = next_token(b)) {
+        mu_assert("kind should match", a->kind == b->kind);
+        mu_assert("text should match", a->len == b->len &&
+                                           memcmp(a->str, b->str, a->len) == 0);
+        mu_assert("position should match",
+                  a->line == b->line && a->col == b->col);
+        mu_assert("sym should match", a->sym == b->sym);
+        if (a->kind == TK_NUM) {
+            mu_assert("value should match", a->num->uval == b->num->uval &&
+                                                a->num->fval == b->num->fval);
+        }
+    }
+    mu_assert("token counts should match", a == NULL && b == NULL);
+
+    free_tokens(serial);
+    free_tokens(par);
+    return NULL;
+}
+
+char* test_lex_parallel_matches_serial() {
+    // Split points must avoid comments and literals that span lines
+    static const char* piece =
+        "int v = 'x' + '\\'' + '\"' + '\\101';\n"
+        "/* a\n \"not a string\n*/ char* s = \"line\n// still string\";\n"
+        "// comment with ' and \"\n"
+        "double d = 1.5e3 + 0x1p4;\n";
+    size_t plen = strlen(piece);
+    int reps = 300;
+    char* src = malloc(plen * reps + 1);
+    for (int i = 0; i < reps; i++) {
+        memcpy(src + plen * i, piece, plen);
+    }
+    src[plen * reps] = '\0';
+
+    char* message = check_parallel_matches_serial(src, 7);
+    free(src);
+    return message;
+}
+
+char* test_lex_parallel_matches_serial_corpus() {
+    // Every demo and compiler source, preprocessed as for a compile
+    static const char* dirs[] = {"../demo", "../src"};
+    // The built-in header directory is relative to the repository root
+    add_include_dir("../selfhost/include", true);
+    int files = 0;
+    for (int d = 0; d < 2; d++) {
+        DIR* dir = opendir(dirs[d]);
+        mu_assert("corpus directory should open", dir != NULL);
+        struct dirent* ent;
+        while ((ent = readdir(dir)) != NULL) {
+            size_t len = strlen(ent->d_name);
+            if (len < 3 || strcmp(ent->d_name + len - 2, ".c") != 0) {
+                continue;
+            }
+            char path[512];
+            snprintf(path, sizeof(path), "%s/%s", dirs[d], ent->d_name);
+            char* source = read_file(path);
+            mu_assert("corpus file should be readable", source != NULL);
+            char* text = preprocess(source, path);
+            char* message = check_parallel_matches_serial(text, 7);
+            free(text);
+            free(source);
+            if (message) {
+                fprintf(stderr, "parallel lexing differs on %s\n", path);
+                closedir(dir);
+                clear_include_dirs();
+                return message;
+            }
+            files++;
+        }
+        closedir(dir);
+    }
+    clear_include_dirs();
+    mu_assert("corpus should not be empty", files > 10);
+    return NULL;
+}
+
+char* test_lex_parallel_error() {
+    // An error in a later chunk is reported like the serial lexer does
+    char src[4096];
+    int off = 0;
+    for (int i = 0; i < 200; i++) {
+        off += snprintf(src + off, sizeof(src) - off, "x = %d;\n", i);
+    }
+    snprintf(src + off, sizeof(src) - off, "@\n");
+    mu_assert("should fail", tokenize_parallel(src, 4) == NULL);
+    return NULL;
+}
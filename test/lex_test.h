@@ -11,6 +11,7 @@ char* test_expect_number();
 char* test_lex_comments();
 char* test_lex_get_line_col();
 char* test_lex_token_positions();
+char* test_lex_positions_match_rescan();
 char* test_lex_double();
 char* test_lex_float();
 char* test_lex_bitwise();
@@ -25,5 +26,11 @@ char* test_lex_hex_escape();
 char* test_lex_hex_escape_two_digit();
 char* test_lex_octal_escape();
 char* test_lex_octal_escape_zero();
+char* test_lexer_matches_tokenize();
+char* test_lexer_preprocessed();
+char* test_lexer_keep_token();
+char* test_lex_parallel_matches_serial();
+char* test_lex_parallel_matches_serial_corpus();
+char* test_lex_parallel_error();
 
 #endif
@@ -0,0 +1,111 @@
+#include "literal_test.h"
+#include "../src/literal.h"
+#include "test_common.h"
+#include <stdlib.h>
+#include <string.h>
+
+static NumType type_of(const char* s) {
+    TokenNum num;
+    const char* err = NULL;
+    read_number(s, &num, &err);
+    return num.type;
+}
+
+static unsigned long long value_of(const char* s) {
+    TokenNum num;
+    const char* err = NULL;
+    read_number(s, &num, &err);
+    return num.uval;
+}
+
+char* test_literal_int_types() {
+    mu_assert("42 should be int", type_of("42") == NUM_INT);
+    mu_assert("2147483648 should be long", type_of("2147483648") == NUM_LONG);
+    mu_assert("0xFFFFFFFF should be unsigned int",
+              type_of("0xFFFFFFFF") == NUM_UINT);
+    mu_assert("4294967295u should be unsigned int",
+              type_of("4294967295u") == NUM_UINT);
+    mu_assert("4294967296u should be unsigned long",
+              type_of("4294967296u") == NUM_ULONG);
+    mu_assert("1L should be long", type_of("1L") == NUM_LONG);
+    mu_assert("1lu should be unsigned long", type_of("1lu") == NUM_ULONG);
+    mu_assert("1ULL should be unsigned long long",
+              type_of("1ULL") == NUM_ULLONG);
+    mu_assert("1ll should be long long", type_of("1ll") == NUM_LLONG);
+    mu_assert("0x8000000000000000 should be unsigned long",
+              type_of("0x8000000000000000") == NUM_ULONG);
+    mu_assert("1.5 should be double", type_of("1.5") == NUM_DOUBLE);
+    mu_assert("1.5f should be float", type_of("1.5f") == NUM_FLOAT);
+    mu_assert("1.5L should be double", type_of("1.5L") == NUM_DOUBLE);
+    return NULL;
+}
+
+char* test_literal_bases() {
+    mu_assert("0777 should be octal 511", value_of("0777") == 511);
+    mu_assert("0 should be 0", value_of("0") == 0);
+    mu_assert("0b1011 should be 11", value_of("0b1011") == 11);
+    mu_assert("0x1F should be 31", value_of("0x1F") == 31);
+    mu_assert("1234 should be 1234", value_of("1234") == 1234);
+
+    // Suffix letters belong to the literal, the rest does not
+    TokenNum num;
+    const char* err = NULL;
+    const char* s = "10ul)";
+    mu_assert("should stop after suffix", read_number(s, &num, &err) == s + 4);
+    s = "0x1.";
+    mu_assert("hex without exponent should stop at dot",
+              read_number(s, &num, &err) == s + 3 && num.type == NUM_INT);
+    return NULL;
+}
+
+char* test_literal_64bit() {
+    // FNV-1a 64-bit offset basis and prime
+    mu_assert("hex offset basis should be exact",
+              value_of("0xcbf29ce484222325") == 14695981039346656037ULL);
+    mu_assert("decimal offset basis should be exact",
+              value_of("14695981039346656037") == 0xcbf29ce484222325ULL);
+    mu_assert("oversized decimal should be unsigned long long-like",
+              type_of("14695981039346656037") == NUM_ULONG);
+    mu_assert("prime should be exact",
+              value_of("1099511628211ULL") == 0x100000001b3ULL);
+    mu_assert("max value should be exact",
+              value_of("18446744073709551615u") == 18446744073709551615ULL);
+    return NULL;
+}
+
+char* test_literal_errors() {
+    TokenNum num;
+    const char* err = NULL;
+    mu_assert("2^64 should overflow",
+              read_number("18446744073709551616", &num, &err) == NULL);
+    mu_assert("overflow should be reported",
+              strcmp(err, "integer constant is too large") == 0);
+    mu_assert("08 should be rejected", read_number("08", &num, &err) == NULL);
+    mu_assert("0x without digits should be rejected",
+              read_number("0x", &num, &err) == NULL);
+    mu_assert("1e+ should be rejected", read_number("1e+", &num, &err) == NULL);
+    return NULL;
+}
+
+char* test_literal_float_rounding() {
+    // Fast path and fallback must both match strtod()/strtof()
+    const char* doubles[] = {"0.1",   "1e22",     "1e23",   "3.14159",
+                             "1e-22", "2.5e-300", "0x1p-3", "123456789012345678901.5",
+                             ".5",    "9007199254740993.0"};
+    for (int i = 0; i < 10; i++) {
+        TokenNum num;
+        const char* err = NULL;
+        read_number(doubles[i], &num, &err);
+        mu_assert("double should be correctly rounded",
+                  num.fval == strtod(doubles[i], NULL));
+    }
+    const char* floats[] = {"0.1f", "16777217f", "3.4e38f", "1e-10f"};
+    for (int i = 0; i < 4; i++) {
+        TokenNum num;
+        const char* err = NULL;
+        read_number(floats[i], &num, &err);
+        mu_assert("float should be correctly rounded",
+                  num.fval == (double)strtof(floats[i], NULL));
+    }
+    return NULL;
+}
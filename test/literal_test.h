@@ -0,0 +1,10 @@
+#ifndef __LITERAL_TEST_H__
+#define __LITERAL_TEST_H__
+
+char* test_literal_int_types();
+char* test_literal_bases();
+char* test_literal_64bit();
+char* test_literal_errors();
+char* test_literal_float_rounding();
+
+#endif
@@ -1,12 +1,21 @@
+#include "arena_test.h"
 #include "codegen_test.h"
 #include "file_test.h"
+#include "intern_test.h"
 #include "lex_test.h"
+#include "literal_test.h"
 #include "parse_test.h"
+#include "pch_test.h"
 #include "preprocess_test.h"
+#include "scan_test.h"
 #include "test_common.h"
+#include "type_test.h"
 #include <stdio.h>
 
 static char* run_all_tests() {
+    mu_run_test(test_arena_alloc_zeroed_aligned, "arena: alloc zeroed aligned");
+    mu_run_test(test_arena_large_alloc, "arena: large alloc");
+    mu_run_test(test_arena_owns_parse_objects, "arena: owns parse objects");
     mu_run_test(test_generate_return_42, "codegen: return 42");
     mu_run_test(test_generate_return_negative, "codegen: return -1");
     mu_run_test(test_generate_return_max_int, "codegen: return INT_MAX");
@@ -154,6 +163,16 @@ static char* run_all_tests() {
     mu_run_test(test_generate_cast_int_ptr, "codegen: cast int to char ptr");
     mu_run_test(test_read_file_success, "file: read_file success");
     mu_run_test(test_read_file_not_found, "file: read_file not found");
+    mu_run_test(test_open_file_view_mapped, "file: open view mapped");
+    mu_run_test(test_open_file_view_page_multiple,
+                "file: open view page multiple");
+    mu_run_test(test_open_file_view_not_found, "file: open view not found");
+    mu_run_test(test_cached_file_view_reuses_contents,
+                "file: cached view reuses contents");
+    mu_run_test(test_cached_file_view_revalidates,
+                "file: cached view revalidates");
+    mu_run_test(test_cached_realpath_negative, "file: cached realpath negative");
+    mu_run_test(test_cached_dir_has, "file: cached dir has");
     mu_run_test(test_lex_tokenize, "lex: tokenize");
 
     mu_run_test(test_consume_operator, "lex: consume operator");
@@ -162,6 +181,8 @@ static char* run_all_tests() {
     mu_run_test(test_lex_comments, "lex: comments");
     mu_run_test(test_lex_get_line_col, "lex: get line col");
     mu_run_test(test_lex_token_positions, "lex: token positions");
+    mu_run_test(test_lex_positions_match_rescan,
+                "lex: positions match rescan");
     mu_run_test(test_lex_double, "lex: double and floats");
     mu_run_test(test_lex_float, "lex: float with suffix");
     mu_run_test(test_lex_bitwise, "lex: bitwise operators");
@@ -179,6 +200,14 @@ static char* run_all_tests() {
     mu_run_test(test_lex_hex_escape_two_digit, "lex: hex escape two digit");
     mu_run_test(test_lex_octal_escape, "lex: octal escape");
     mu_run_test(test_lex_octal_escape_zero, "lex: octal escape \\0");
+    mu_run_test(test_lexer_matches_tokenize, "lex: lexer matches tokenize");
+    mu_run_test(test_lexer_preprocessed, "lex: lexer from preprocessor");
+    mu_run_test(test_lexer_keep_token, "lex: lexer keep token");
+    mu_run_test(test_lex_parallel_matches_serial,
+                "lex: parallel matches serial");
+    mu_run_test(test_lex_parallel_matches_serial_corpus,
+                "lex: parallel matches serial on demo and src");
+    mu_run_test(test_lex_parallel_error, "lex: parallel error");
     mu_run_test(test_new_node_num, "parse: new_node_num");
     mu_run_test(test_new_node, "parse: new_node");
     mu_run_test(test_unary_num, "parse: unary num");
@@ -248,6 +277,7 @@ static char* run_all_tests() {
                 "parse: global ptr init not array");
     mu_run_test(test_scope_depth_is_context_local,
                 "parse: scope depth is context local");
+    mu_run_test(test_scope_shadowing, "parse: scope shadowing");
     mu_run_test(test_parse_double, "parse: double declarations");
     mu_run_test(test_parse_float, "parse: float declarations");
     mu_run_test(test_parse_do_while, "parse: do-while");
@@ -285,6 +315,12 @@ static char* run_all_tests() {
     mu_run_test(test_parse_long_long_promotion, "parse: long long promotion");
     mu_run_test(test_parse_function_pointer_basic,
                 "parse: function pointer basic");
+    mu_run_test(test_parse_function_table, "parse: function table");
+    mu_run_test(test_parse_beyond_fixed_limits,
+                "parse: beyond fixed limits");
+    mu_run_test(test_parse_vla_size_per_function,
+                "parse: VLA size per function");
+    mu_run_test(test_parse_switch_case_list, "parse: switch case list");
     mu_run_test(test_parse_static_inline, "parse: static inline");
     mu_run_test(test_parse_inline_function, "parse: inline function");
     mu_run_test(test_parse_short_decl, "parse: short decl");
@@ -295,6 +331,19 @@ static char* run_all_tests() {
     mu_run_test(test_parse_flexible_array_member,
                 "parse: flexible array member");
     mu_run_test(test_parse_funcstr, "parse: __func__");
+    mu_run_test(test_intern_same_name, "intern: same name");
+    mu_run_test(test_intern_distinct_names, "intern: distinct names");
+    mu_run_test(test_intern_lexer_sets_sym, "intern: lexer sets sym");
+    mu_run_test(test_literal_int_types, "literal: int types");
+    mu_run_test(test_literal_bases, "literal: bases");
+    mu_run_test(test_literal_64bit, "literal: 64-bit values");
+    mu_run_test(test_literal_errors, "literal: errors");
+    mu_run_test(test_literal_float_rounding, "literal: float rounding");
+    mu_run_test(test_scan_skip_space, "scan: skip space");
+    mu_run_test(test_scan_line_end, "scan: line end");
+    mu_run_test(test_scan_comment_end, "scan: comment end");
+    mu_run_test(test_scan_next_directive, "scan: next directive");
+    mu_run_test(test_scan_string_stop, "scan: string stop");
     mu_run_test(test_preprocess_noop, "preprocess: no-op");
     mu_run_test(test_preprocess_include, "preprocess: include");
     mu_run_test(test_preprocess_define, "preprocess: define");
@@ -306,6 +355,12 @@ static char* run_all_tests() {
     mu_run_test(test_preprocess_long_define_value,
                 "preprocess: long define value");
     mu_run_test(test_preprocess_if_elif_expr, "preprocess: if/elif expression");
+    mu_run_test(test_preprocess_if_full_expressions,
+                "preprocess: #if full expressions");
+    mu_run_test(test_preprocess_if_short_circuit,
+                "preprocess: #if short circuit");
+    mu_run_test(test_preprocess_skip_inactive_groups,
+                "preprocess: skip inactive groups");
     mu_run_test(test_preprocess_function_macro_and_undef,
                 "preprocess: function macro and undef");
     mu_run_test(test_preprocess_pragma_ignored, "preprocess: pragma ignored");
@@ -313,6 +368,14 @@ static char* run_all_tests() {
     mu_run_test(test_preprocess_token_pasting, "preprocess: token pasting");
     mu_run_test(test_preprocess_recursive_macro_expansion,
                 "preprocess: recursive macro expansion");
+    mu_run_test(test_preprocess_nested_function_macros,
+                "preprocess: nested function macros");
+    mu_run_test(test_preprocess_self_reference,
+                "preprocess: self-referential macros");
+    mu_run_test(test_preprocess_paste_and_stringize_operands,
+                "preprocess: ## and # operands");
+    mu_run_test(test_preprocess_expansion_spacing,
+                "preprocess: expansion spacing");
     mu_run_test(test_preprocess_variadic_macro_basic,
                 "preprocess: variadic macro basic");
     mu_run_test(test_preprocess_variadic_macro_single_arg,
@@ -325,17 +388,35 @@ static char* run_all_tests() {
                 "preprocess: variadic macro stringify __VA_ARGS__");
     mu_run_test(test_preprocess_variadic_macro_gnu_comma_suppression,
                 "preprocess: variadic macro gnu comma suppression");
+    mu_run_test(test_preprocess_invocation_across_lines,
+                "preprocess: invocation across lines");
     mu_run_test(test_preprocess_stdc_version, "preprocess: __STDC_VERSION__");
     mu_run_test(test_preprocess_file_macro, "preprocess: __FILE__");
     mu_run_test(test_preprocess_date_macro, "preprocess: __DATE__");
     mu_run_test(test_preprocess_time_macro, "preprocess: __TIME__");
     mu_run_test(test_preprocess_line_macro, "preprocess: __LINE__");
+    mu_run_test(test_preprocess_line_after_include,
+                "preprocess: __LINE__ after include");
     mu_run_test(test_preprocess_line_in_if_directive,
                 "preprocess: __LINE__ in #if");
     mu_run_test(test_preprocess_line_via_define,
                 "preprocess: __LINE__ via #define");
     mu_run_test(test_preprocess_file_not_expand_in_string,
                 "preprocess: __FILE__ not expand in string");
+    mu_run_test(test_preprocess_many_macros, "preprocess: many macros");
+    mu_run_test(test_preprocess_include_guard, "preprocess: include guard");
+    mu_run_test(test_preprocess_pragma_once, "preprocess: #pragma once");
+    mu_run_test(test_preprocess_include_dirs, "preprocess: include dirs");
+    mu_run_test(test_preprocess_to_file_line_markers,
+                "preprocess: streamed output with line markers");
+    mu_run_test(test_preprocess_dependency_file,
+                "preprocess: make dependency file");
+    mu_run_test(test_pch_round_trip, "pch: round trip");
+    mu_run_test(test_type_builtins_shared, "type: builtins shared");
+    mu_run_test(test_type_derived_shared, "type: derived types shared");
+    mu_run_test(test_type_qualifiers_not_shared,
+                "type: qualifiers not shared");
+    mu_run_test(test_type_struct_layout, "type: struct layout");
     return NULL;
 }
 
@@ -1,8 +1,10 @@
 #include "parse_test.h"
+#include "../src/intern.h"
 #include "../src/lex.h"
 #include "../src/variable.h"
 #include "test_common.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 char* test_new_node_num() {
@@ -13,7 +15,6 @@ char* test_new_node_num() {
     mu_assert("Node lhs should be NULL", node->lhs == NULL);
     mu_assert("Node rhs should be NULL", node->rhs == NULL);
 
-    free_ast(node);
     return NULL;
 }
 
@@ -28,7 +29,6 @@ char* test_new_node() {
     mu_assert("Node lhs value should be 5", node->lhs->val == 5);
     mu_assert("Node rhs value should be 3", node->rhs->val == 3);
 
-    free_ast(node);
     return NULL;
 }
 
@@ -40,7 +40,6 @@ char* test_unary_num() {
 
     mu_assert("Node kind should be ND_NUM", node->kind == ND_NUM);
     mu_assert("Node value should be 42", node->val == 42);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -53,7 +52,6 @@ char* test_unary_plus() {
 
     mu_assert("Node kind should be ND_NUM", node->kind == ND_NUM);
     mu_assert("Node value should be 42", node->val == 42);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -67,7 +65,6 @@ char* test_unary_minus() {
     mu_assert("Node kind should be ND_SUB", node->kind == ND_SUB);
     mu_assert("Left value should be 0", node->lhs->val == 0);
     mu_assert("Right value should be 5", node->rhs->val == 5);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -81,7 +78,6 @@ char* test_unary_plus_num() {
     mu_assert("Node kind should be ND_ADD", node->kind == ND_ADD);
     mu_assert("Left value should be 5", node->lhs->val == 5);
     mu_assert("Right value should be 3", node->rhs->val == 3);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -97,7 +93,6 @@ char* test_unary_minus_mul() {
     mu_assert("Left node kind should be ND_SUB", node->lhs->kind == ND_SUB);
     mu_assert("Left-left value should be 0", node->lhs->lhs->val == 0);
     mu_assert("Left-right value should be 3", node->lhs->rhs->val == 3);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -111,7 +106,6 @@ char* test_primary_num() {
     mu_assert("Node kind should be ND_NUM", node->kind == ND_NUM);
     mu_assert("Node value should be 42", node->val == 42);
     mu_assert("Token should be EOF", ctx.current_token->kind == TK_EOF);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -125,7 +119,6 @@ char* test_primary_paren() {
     mu_assert("Node kind should be ND_NUM", node->kind == ND_NUM);
     mu_assert("Node value should be 42", node->val == 42);
     mu_assert("Token should be EOF", ctx.current_token->kind == TK_EOF);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -138,7 +131,6 @@ char* test_mul_single_num() {
 
     mu_assert("Node kind should be ND_NUM", node->kind == ND_NUM);
     mu_assert("Node value should be 5", node->val == 5);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -152,7 +144,6 @@ char* test_mul_multiply() {
     mu_assert("Node kind should be ND_MUL", node->kind == ND_MUL);
     mu_assert("Left value should be 2", node->lhs->val == 2);
     mu_assert("Right value should be 3", node->rhs->val == 3);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -166,7 +157,6 @@ char* test_mul_divide() {
     mu_assert("Node kind should be ND_DIV", node->kind == ND_DIV);
     mu_assert("Left value should be 6", node->lhs->val == 6);
     mu_assert("Right value should be 2", node->rhs->val == 2);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -182,7 +172,6 @@ char* test_mul_chain() {
     mu_assert("Left node kind should be ND_MUL", node->lhs->kind == ND_MUL);
     mu_assert("Left-left value should be 2", node->lhs->lhs->val == 2);
     mu_assert("Left-right value should be 3", node->lhs->rhs->val == 3);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -195,7 +184,6 @@ char* test_expr_single_num() {
 
     mu_assert("Node kind should be ND_NUM", node->kind == ND_NUM);
     mu_assert("Node value should be 42", node->val == 42);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -209,7 +197,6 @@ char* test_expr_add() {
     mu_assert("Node kind should be ND_ADD", node->kind == ND_ADD);
     mu_assert("Left value should be 1", node->lhs->val == 1);
     mu_assert("Right value should be 2", node->rhs->val == 2);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -223,7 +210,6 @@ char* test_expr_subtract() {
     mu_assert("Node kind should be ND_SUB", node->kind == ND_SUB);
     mu_assert("Left value should be 5", node->lhs->val == 5);
     mu_assert("Right value should be 3", node->rhs->val == 3);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -239,7 +225,6 @@ char* test_expr_add_sub_chain() {
     mu_assert("Left node kind should be ND_SUB", node->lhs->kind == ND_SUB);
     mu_assert("Left-left value should be 1", node->lhs->lhs->val == 1);
     mu_assert("Left-right value should be 2", node->lhs->rhs->val == 2);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -255,7 +240,6 @@ char* test_expr_precedence() {
     mu_assert("Right node kind should be ND_MUL", node->rhs->kind == ND_MUL);
     mu_assert("Right-left value should be 2", node->rhs->lhs->val == 2);
     mu_assert("Right-right value should be 3", node->rhs->rhs->val == 3);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -276,7 +260,6 @@ char* test_expr_complex_precedence() {
               node->lhs->rhs->lhs->val == 2);
     mu_assert("Left-right-right value should be 3",
               node->lhs->rhs->rhs->val == 3);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -290,7 +273,6 @@ char* test_relational_lt() {
     mu_assert("Node kind should be ND_LT", node->kind == ND_LT);
     mu_assert("Left value should be 1", node->lhs->val == 1);
     mu_assert("Right value should be 2", node->rhs->val == 2);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -304,7 +286,6 @@ char* test_relational_le() {
     mu_assert("Node kind should be ND_LE", node->kind == ND_LE);
     mu_assert("Left value should be 1", node->lhs->val == 1);
     mu_assert("Right value should be 2", node->rhs->val == 2);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -318,7 +299,6 @@ char* test_relational_gt() {
     mu_assert("Node kind should be ND_GT", node->kind == ND_GT);
     mu_assert("Left value should be 1", node->lhs->val == 1);
     mu_assert("Right value should be 2", node->rhs->val == 2);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -332,7 +312,6 @@ char* test_relational_ge() {
     mu_assert("Node kind should be ND_GE", node->kind == ND_GE);
     mu_assert("Left value should be 1", node->lhs->val == 1);
     mu_assert("Right value should be 2", node->rhs->val == 2);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -346,7 +325,6 @@ char* test_equality_eq() {
     mu_assert("Node kind should be ND_EQ", node->kind == ND_EQ);
     mu_assert("Left value should be 1", node->lhs->val == 1);
     mu_assert("Right value should be 2", node->rhs->val == 2);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -360,7 +338,6 @@ char* test_equality_ne() {
     mu_assert("Node kind should be ND_NE", node->kind == ND_NE);
     mu_assert("Left value should be 1", node->lhs->val == 1);
     mu_assert("Right value should be 2", node->rhs->val == 2);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -376,18 +353,16 @@ char* test_expr_combined_precedence() {
     mu_assert("Left-left value should be 1", node->lhs->lhs->val == 1);
     mu_assert("Left-right value should be 2", node->lhs->rhs->val == 2);
     mu_assert("Right value should be 3", node->rhs->val == 3);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
 
 char* test_new_node_ident() {
     Context ctx = {0};
-    Token head;
-    head.next = NULL;
+    Token* head = tokenize("a");
 
     // First declare the variable
-    Token* tok = new_token(TK_IDENT, &head, "a", 1);
+    Token* tok = head;
     add_lvar(&ctx, tok, new_type_int());
 
     // Then use it
@@ -398,22 +373,20 @@ char* test_new_node_ident() {
     mu_assert("Node lhs should be NULL", node->lhs == NULL);
     mu_assert("Node rhs should be NULL", node->rhs == NULL);
 
-    free_ast(node);
-    free_tokens(head.next);
+    free_tokens(head);
     return NULL;
 }
 
 char* test_new_node_ident_abc() {
     Context ctx = {0};
-    Token head;
-    head.next = NULL;
+    Token* head = tokenize("a1 a2 a3");
 
     // First declare variables
-    Token* tok = new_token(TK_IDENT, &head, "a1", 2);
+    Token* tok = head;
     add_lvar(&ctx, tok, new_type_int());
-    Token* tok2 = new_token(TK_IDENT, tok, "a2", 2);
+    Token* tok2 = tok + 1;
     add_lvar(&ctx, tok2, new_type_int());
-    Token* tok3 = new_token(TK_IDENT, tok2, "a3", 2);
+    Token* tok3 = tok + 2;
     add_lvar(&ctx, tok3, new_type_int());
 
     // Then use them
@@ -429,10 +402,7 @@ char* test_new_node_ident_abc() {
     mu_assert("Node2 lhs should be NULL", node2->lhs == NULL);
     mu_assert("Node2 rhs should be NULL", node2->rhs == NULL);
 
-    free_ast(node);
-    free_ast(node2);
-    free_ast(node3);
-    free_tokens(head.next);
+    free_tokens(head);
     return NULL;
 }
 
@@ -448,7 +418,6 @@ char* test_primary_ident() {
     mu_assert("Node kind should be ND_LVAR", node->kind == ND_LVAR);
     mu_assert("Node val should be 0", node->val == 0);
     mu_assert("Token should be EOF", ctx.current_token->kind == TK_EOF);
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -468,7 +437,6 @@ char* test_assign() {
     mu_assert("Left val should be 0", node->lhs->val == 0);
     mu_assert("Right node kind should be ND_NUM", node->rhs->kind == ND_NUM);
     mu_assert("Right value should be 42", node->rhs->val == 42);
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -478,7 +446,7 @@ char* test_assign_chain() {
     // First declare variables 'a' and 'b'
     Token* tok = tokenize("a=b=5");
     Token* tok_a = tok;             // 'a' token
-    Token* tok_b = tok->next->next; // 'b' token (skip '=')
+    Token* tok_b = tok + 2; // 'b' token (skip '=')
     add_lvar(&ctx, tok_a, new_type_int());
     add_lvar(&ctx, tok_b, new_type_int());
     ctx.current_token = tok;
@@ -492,7 +460,6 @@ char* test_assign_chain() {
               node->rhs->kind == ND_ASSIGN);
     mu_assert("Right-left val should be 1", node->rhs->lhs->val == 1);
     mu_assert("Right-right value should be 5", node->rhs->rhs->val == 5);
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -506,7 +473,6 @@ char* test_stmt() {
     mu_assert("Node kind should be ND_NUM", node->kind == ND_NUM);
     mu_assert("Node value should be 42", node->val == 42);
     mu_assert("Token should be EOF", ctx.current_token->kind == TK_EOF);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -524,7 +490,6 @@ char* test_stmt_assign() {
     mu_assert("Node kind should be ND_ASSIGN", node->kind == ND_ASSIGN);
     mu_assert("Left node kind should be ND_LVAR", node->lhs->kind == ND_LVAR);
     mu_assert("Right node kind should be ND_NUM", node->rhs->kind == ND_NUM);
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -539,7 +504,6 @@ char* test_stmt_return_num() {
     mu_assert("Left node kind should be ND_NUM", node->lhs->kind == ND_NUM);
     mu_assert("Left node value should be 42", node->lhs->val == 42);
     mu_assert("Right node should be NULL", node->rhs == NULL);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -548,7 +512,7 @@ char* test_stmt_return_ident() {
     Context ctx = {0};
     // First declare variable 'a'
     Token* tok = tokenize("return a;");
-    Token* tok_a = tok->next; // 'a' token
+    Token* tok_a = tok + 1; // 'a' token
     add_lvar(&ctx, tok_a, new_type_int());
     ctx.current_token = tok;
 
@@ -557,7 +521,6 @@ char* test_stmt_return_ident() {
     mu_assert("Node kind should be ND_RETURN", node->kind == ND_RETURN);
     mu_assert("Left node kind should be ND_LVAR", node->lhs->kind == ND_LVAR);
     mu_assert("Right node should be NULL", node->rhs == NULL);
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -566,9 +529,8 @@ char* test_stmt_return_expr() {
     Context ctx = {0};
     // First declare variables 'a' and 'b'
     Token* tok = tokenize("return a + b;");
-    Token* tok_a = tok->next; // 'a' token (after 'return')
-    Token* tok_b =
-        tok->next->next->next; // 'b' token (after 'return', 'a', '+')
+    Token* tok_a = tok + 1; // 'a' token (after 'return')
+    Token* tok_b = tok + 3; // 'b' token (after 'return', 'a', '+')
     add_lvar(&ctx, tok_a, new_type_int());
     add_lvar(&ctx, tok_b, new_type_int());
     ctx.current_token = tok;
@@ -582,7 +544,6 @@ char* test_stmt_return_expr() {
     mu_assert("Left-right node kind should be ND_LVAR",
               node->lhs->rhs->kind == ND_LVAR);
     mu_assert("Right node should be NULL", node->rhs == NULL);
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -591,10 +552,8 @@ char* test_stmt_if() {
     Context ctx = {0};
     // First declare variables 'a' and 'b'
     Token* tok = tokenize("if (a) return b;");
-    Token* tok_a = tok->next->next; // 'a' token (after 'if', '(')
-    Token* tok_b =
-        tok->next->next->next->next
-            ->next; // 'b' token (after 'if', '(', 'a', ')', 'return')
+    Token* tok_a = tok + 2; // 'a' token (after 'if', '(')
+    Token* tok_b = tok + 5; // 'b' token (after 'if', '(', 'a', ')', 'return')
     add_lvar(&ctx, tok_a, new_type_int());
     add_lvar(&ctx, tok_b, new_type_int());
     ctx.current_token = tok;
@@ -607,7 +566,6 @@ char* test_stmt_if() {
     mu_assert("Then lhs kind should be ND_LVAR",
               node->lhs->lhs->kind == ND_LVAR);
     mu_assert("Else should be NULL", node->rhs == NULL);
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -617,10 +575,9 @@ char* test_stmt_if_else() {
     Token* tok = tokenize("if (a) return b; else return c;");
     // Declare variables 'a', 'b', 'c'
     // Tokens: if, (, a, ), return, b, ;, else, return, c, ;
-    Token* tok_a = tok->next->next;                   // 'a'
-    Token* tok_b = tok->next->next->next->next->next; // 'b'
-    Token* tok_c =
-        tok->next->next->next->next->next->next->next->next->next; // 'c'
+    Token* tok_a = tok + 2; // 'a'
+    Token* tok_b = tok + 5; // 'b'
+    Token* tok_c = tok + 9; // 'c'
     add_lvar(&ctx, tok_a, new_type_int());
     add_lvar(&ctx, tok_b, new_type_int());
     add_lvar(&ctx, tok_c, new_type_int());
@@ -632,7 +589,6 @@ char* test_stmt_if_else() {
     mu_assert("Condition kind should be ND_LVAR", node->cond->kind == ND_LVAR);
     mu_assert("Then kind should be ND_RETURN", node->lhs->kind == ND_RETURN);
     mu_assert("Else kind should be ND_RETURN", node->rhs->kind == ND_RETURN);
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -640,8 +596,8 @@ char* test_stmt_if_else() {
 char* test_stmt_if_with_block() {
     Context ctx = {0};
     Token* tok = tokenize("if (a) { return b; }");
-    Token* tok_a = tok->next->next;                         // 'a'
-    Token* tok_b = tok->next->next->next->next->next->next; // 'b'
+    Token* tok_a = tok + 2; // 'a'
+    Token* tok_b = tok + 6; // 'b'
     add_lvar(&ctx, tok_a, new_type_int());
     add_lvar(&ctx, tok_b, new_type_int());
     ctx.current_token = tok;
@@ -654,7 +610,6 @@ char* test_stmt_if_with_block() {
     mu_assert("Then first stmt kind should be ND_RETURN",
               node->lhs->lhs->kind == ND_RETURN);
     mu_assert("Else should be NULL", node->rhs == NULL);
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -662,9 +617,9 @@ char* test_stmt_if_with_block() {
 char* test_stmt_if_complex_cond() {
     Context ctx = {0};
     Token* tok = tokenize("if (a == b) return c;");
-    Token* tok_a = tok->next->next;                               // 'a'
-    Token* tok_b = tok->next->next->next->next;                   // 'b'
-    Token* tok_c = tok->next->next->next->next->next->next->next; // 'c'
+    Token* tok_a = tok + 2; // 'a'
+    Token* tok_b = tok + 4; // 'b'
+    Token* tok_c = tok + 7; // 'c'
     add_lvar(&ctx, tok_a, new_type_int());
     add_lvar(&ctx, tok_b, new_type_int());
     add_lvar(&ctx, tok_c, new_type_int());
@@ -675,7 +630,6 @@ char* test_stmt_if_complex_cond() {
     mu_assert("Node kind should be ND_IF", node->kind == ND_IF);
     mu_assert("Condition kind should be ND_EQ", node->cond->kind == ND_EQ);
     mu_assert("Then kind should be ND_RETURN", node->lhs->kind == ND_RETURN);
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -683,8 +637,8 @@ char* test_stmt_if_complex_cond() {
 char* test_stmt_while() {
     Context ctx = {0};
     Token* tok = tokenize("while (a) return b;");
-    Token* tok_a = tok->next->next;                   // 'a'
-    Token* tok_b = tok->next->next->next->next->next; // 'b'
+    Token* tok_a = tok + 2; // 'a'
+    Token* tok_b = tok + 5; // 'b'
     add_lvar(&ctx, tok_a, new_type_int());
     add_lvar(&ctx, tok_b, new_type_int());
     ctx.current_token = tok;
@@ -696,7 +650,6 @@ char* test_stmt_while() {
     mu_assert("Body kind should be ND_RETURN", node->lhs->kind == ND_RETURN);
     mu_assert("Body lhs kind should be ND_LVAR",
               node->lhs->lhs->kind == ND_LVAR);
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -704,8 +657,8 @@ char* test_stmt_while() {
 char* test_stmt_while_complex_cond() {
     Context ctx = {0};
     Token* tok = tokenize("while (a < b) a = a + 1;");
-    Token* tok_a = tok->next->next;             // 'a'
-    Token* tok_b = tok->next->next->next->next; // 'b'
+    Token* tok_a = tok + 2; // 'a'
+    Token* tok_b = tok + 4; // 'b'
     add_lvar(&ctx, tok_a, new_type_int());
     add_lvar(&ctx, tok_b, new_type_int());
     ctx.current_token = tok;
@@ -715,7 +668,6 @@ char* test_stmt_while_complex_cond() {
     mu_assert("Node kind should be ND_WHILE", node->kind == ND_WHILE);
     mu_assert("Condition kind should be ND_LT", node->cond->kind == ND_LT);
     mu_assert("Body kind should be ND_ASSIGN", node->lhs->kind == ND_ASSIGN);
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -723,7 +675,7 @@ char* test_stmt_while_complex_cond() {
 char* test_stmt_for() {
     Context ctx = {0};
     Token* tok = tokenize("for (a = 0; a < 10; a = a + 1) return 42;");
-    Token* tok_a = tok->next->next; // 'a'
+    Token* tok_a = tok + 2; // 'a'
     add_lvar(&ctx, tok_a, new_type_int());
     ctx.current_token = tok;
 
@@ -734,7 +686,6 @@ char* test_stmt_for() {
     mu_assert("Condition kind should be ND_LT", node->cond->kind == ND_LT);
     mu_assert("Inc kind should be ND_ASSIGN", node->rhs->kind == ND_ASSIGN);
     mu_assert("Body kind should be ND_RETURN", node->lhs->kind == ND_RETURN);
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -743,9 +694,8 @@ char* test_stmt_for_no_init() {
     Context ctx = {0};
     Token* tok = tokenize("for (; a < 10;) return b;");
     // Tokens: for, (, ;, a, <, 10, ;, ), return, b, ;
-    Token* tok_a = tok->next->next->next; // 'a' (after 'for', '(', ';')
-    Token* tok_b =
-        tok->next->next->next->next->next->next->next->next->next; // 'b'
+    Token* tok_a = tok + 3; // 'a' (after 'for', '(', ';')
+    Token* tok_b = tok + 9; // 'b'
     add_lvar(&ctx, tok_a, new_type_int());
     add_lvar(&ctx, tok_b, new_type_int());
     ctx.current_token = tok;
@@ -756,7 +706,6 @@ char* test_stmt_for_no_init() {
     mu_assert("Init should be NULL", node->init == NULL);
     mu_assert("Condition kind should be ND_LT", node->cond->kind == ND_LT);
     mu_assert("Inc should be NULL", node->rhs == NULL);
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -774,7 +723,6 @@ char* test_program_single_stmt() {
               ctx.code[0]->tok->len == 4 &&
                   strncmp(ctx.code[0]->tok->str, "main", 4) == 0);
     mu_assert("ctx.code[1] should be NULL", ctx.code[1] == NULL);
-    free_ast(ctx.code[0]);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -795,7 +743,6 @@ char* test_program_multiple_stmts() {
     mu_assert("ctx.code[0] body third stmt value should be 3",
               ctx.code[0]->lhs->next->next->val == 3);
     mu_assert("ctx.code[1] should be NULL", ctx.code[1] == NULL);
-    free_ast(ctx.code[0]);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -818,7 +765,6 @@ char* test_program_assign_stmts() {
     mu_assert("ctx.code[0] body fourth stmt kind should be ND_ASSIGN",
               ctx.code[0]->lhs->next->next->next->kind == ND_ASSIGN);
     mu_assert("ctx.code[1] should be NULL", ctx.code[1] == NULL);
-    free_ast(ctx.code[0]);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -832,7 +778,6 @@ char* test_stmt_call() {
     mu_assert("Node kind should be ND_CALL", node->kind == ND_CALL);
     mu_assert("tok should not be NULL", node->tok != NULL);
     mu_assert("LHS (args) should be NULL", node->lhs == NULL);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -851,7 +796,6 @@ char* test_stmt_call_with_args() {
     mu_assert("Second arg should exist", node->lhs->next != NULL);
     mu_assert("Second arg should be ND_NUM", node->lhs->next->kind == ND_NUM);
     mu_assert("Second arg value should be 2", node->lhs->next->val == 2);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -870,7 +814,6 @@ char* test_function_simple() {
               node->lhs->kind == ND_RETURN);
     mu_assert("First stmt lhs value should be 42", node->lhs->lhs->val == 42);
     mu_assert("Token should be EOF", ctx.current_token->kind == TK_EOF);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -890,7 +833,6 @@ char* test_function_multiple_stmts() {
     mu_assert("Third stmt should exist", node->lhs->next->next != NULL);
     mu_assert("Third stmt kind should be ND_RETURN",
               node->lhs->next->next->kind == ND_RETURN);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -908,7 +850,6 @@ char* test_program_single_function() {
               ctx.code[0]->tok->len == 4 &&
                   strncmp(ctx.code[0]->tok->str, "main", 4) == 0);
     mu_assert("ctx.code[1] should be NULL", ctx.code[1] == NULL);
-    free_ast(ctx.code[0]);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -932,8 +873,6 @@ char* test_program_multiple_functions() {
     mu_assert("ctx.code[1] name should be 'main'",
               ctx.code[1]->tok->len == 4 &&
                   strncmp(ctx.code[1]->tok->str, "main", 4) == 0);
-    free_ast(ctx.code[0]);
-    free_ast(ctx.code[1]);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -949,7 +888,6 @@ char* test_function_with_block() {
     mu_assert("First stmt kind should be ND_IF", node->lhs->kind == ND_IF);
     mu_assert("If body kind should be ND_BLOCK",
               node->lhs->lhs->kind == ND_BLOCK);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -971,7 +909,6 @@ char* test_function_with_params() {
               node->rhs->next->kind == ND_LVAR);
     mu_assert("Second param offset should be 1", node->rhs->next->val == 1);
     mu_assert("Body should not be NULL", node->lhs != NULL);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -989,7 +926,6 @@ char* test_function_with_single_param() {
     mu_assert("Param kind should be ND_LVAR", node->rhs->kind == ND_LVAR);
     mu_assert("Param offset should be 0", node->rhs->val == 0);
     mu_assert("No second param", node->rhs->next == NULL);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -997,7 +933,7 @@ char* test_function_with_single_param() {
 char* test_unary_deref() {
     Context ctx = {0};
     Token* tok = tokenize("*p");
-    Token* tok_p = tok->next; // 'p'
+    Token* tok_p = tok + 1; // 'p'
     // p is a pointer type (int*)
     add_lvar(&ctx, tok_p, new_type_ptr(new_type_int()));
     ctx.current_token = tok;
@@ -1006,7 +942,6 @@ char* test_unary_deref() {
 
     mu_assert("Node kind should be ND_DEREF", node->kind == ND_DEREF);
     mu_assert("Operand should be ND_LVAR", node->lhs->kind == ND_LVAR);
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -1014,7 +949,7 @@ char* test_unary_deref() {
 char* test_unary_addr() {
     Context ctx = {0};
     Token* tok = tokenize("&x");
-    Token* tok_x = tok->next; // 'x'
+    Token* tok_x = tok + 1; // 'x'
     add_lvar(&ctx, tok_x, new_type_int());
     ctx.current_token = tok;
 
@@ -1022,7 +957,6 @@ char* test_unary_addr() {
 
     mu_assert("Node kind should be ND_ADDR", node->kind == ND_ADDR);
     mu_assert("Operand should be ND_LVAR", node->lhs->kind == ND_LVAR);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -1030,7 +964,7 @@ char* test_unary_addr() {
 char* test_unary_deref_complex() {
     Context ctx = {0};
     Token* tok = tokenize("**p");
-    Token* tok_p = tok->next->next; // 'p' (after '*', '*')
+    Token* tok_p = tok + 2; // 'p' (after '*', '*')
     // p is a pointer to pointer (int**)
     Type* int_ptr = new_type_ptr(new_type_int());
     add_lvar(&ctx, tok_p, new_type_ptr(int_ptr));
@@ -1042,7 +976,6 @@ char* test_unary_deref_complex() {
     mu_assert("Operand should be ND_DEREF", node->lhs->kind == ND_DEREF);
     mu_assert("Inner operand should be ND_LVAR",
               node->lhs->lhs->kind == ND_LVAR);
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -1050,7 +983,7 @@ char* test_unary_deref_complex() {
 char* test_expr_with_deref() {
     Context ctx = {0};
     Token* tok = tokenize("*p + 1");
-    Token* tok_p = tok->next; // 'p'
+    Token* tok_p = tok + 1; // 'p'
     // p is a pointer type (int*)
     add_lvar(&ctx, tok_p, new_type_ptr(new_type_int()));
     ctx.current_token = tok;
@@ -1061,7 +994,6 @@ char* test_expr_with_deref() {
     mu_assert("Left should be ND_DEREF", node->lhs->kind == ND_DEREF);
     mu_assert("Right should be ND_NUM", node->rhs->kind == ND_NUM);
     mu_assert("Right value should be 1", node->rhs->val == 1);
-    free_ast(node);
     free_tokens(ctx.current_token);
     return NULL;
 }
@@ -1079,7 +1011,6 @@ char* test_parse_add_assign_does_not_share_lhs_node() {
     mu_assert("assignment rhs should be add", node->rhs->kind == ND_ADD);
     mu_assert("compound assign should not share lhs node pointer",
               node->lhs != node->rhs->lhs);
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -1100,8 +1031,6 @@ char* test_global_ptr_init_not_treated_as_array() {
     mu_assert("gpx initializer should be address-of",
               ctx.code[1]->init && ctx.code[1]->init->kind == ND_ADDR);
 
-    free_ast(ctx.code[0]);
-    free_ast(ctx.code[1]);
     free_tokens(tok);
     return NULL;
 }
@@ -1127,6 +1056,41 @@ char* test_scope_depth_is_context_local() {
     return NULL;
 }
 
+char* test_scope_shadowing() {
+    Context ctx = {0};
+    Token* tok = tokenize("x y");
+    Token* x = tok;
+    Token* y = tok + 1;
+
+    reset_scope(&ctx);
+    LVar* outer = add_lvar(&ctx, x, new_type_int());
+    enter_scope(&ctx);
+    LVar* inner = add_lvar(&ctx, x, new_type_char());
+    mu_assert("Inner declaration should shadow the outer one",
+              find_lvar(&ctx, x) == inner);
+    leave_scope(&ctx);
+    mu_assert("Closing the scope should uncover the outer declaration",
+              find_lvar(&ctx, x) == outer);
+
+    enter_scope(&ctx);
+    LVar* sibling = add_lvar(&ctx, y, new_type_int());
+    leave_scope(&ctx);
+    enter_scope(&ctx);
+    mu_assert("Locals of a closed sibling scope should not be visible",
+              find_lvar(&ctx, y) == NULL);
+    leave_scope(&ctx);
+    mu_assert("Slots should never be reused within a function",
+              outer->offset == 0 && inner->offset == 1 &&
+                  sibling->offset == 2);
+
+    reset_scope(&ctx);
+    mu_assert("A new function should start without locals",
+              find_lvar(&ctx, x) == NULL &&
+                  add_lvar(&ctx, y, new_type_int())->offset == 0);
+    free_tokens(tok);
+    return NULL;
+}
+
 char* test_parse_double() {
     Context ctx = {0};
     Token* tok = tokenize("double x = 1.23;");
@@ -1139,9 +1103,9 @@ char* test_parse_double() {
     mu_assert("Node initializer should exist", node->init != NULL);
     mu_assert("Node initializer kind should be ND_FNUM",
               node->init->kind == ND_FNUM);
-    mu_assert("Node initializer fval should be 1.23", node->init->fval == 1.23);
+    mu_assert("Node initializer fval should be 1.23",
+              node->init->u.fval == 1.23);
 
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -1158,9 +1122,9 @@ char* test_parse_float() {
     mu_assert("Node initializer should exist", node->init != NULL);
     mu_assert("Node initializer kind should be ND_FNUM",
               node->init->kind == ND_FNUM);
-    mu_assert("Node initializer fval should be 1.23", node->init->fval == 1.23);
+    mu_assert("Node initializer fval should be 1.23f",
+              node->init->u.fval == (double)1.23f);
 
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -1169,7 +1133,7 @@ char* test_parse_do_while() {
     Context ctx = {0};
     Token* tok = tokenize("do { a = a + 1; } while (a < 10);");
     // Declare 'a'
-    add_lvar(&ctx, tok->next->next, new_type_int());
+    add_lvar(&ctx, tok + 2, new_type_int());
     ctx.current_token = tok;
 
     Node* node = parse_stmt(&ctx);
@@ -1182,7 +1146,6 @@ char* test_parse_do_while() {
     // it from while in codegen. In C, do-while always executes at least once.
     // I'll add a flag to Node.
 
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -1313,7 +1276,6 @@ char* test_parse_union_decl() {
     mu_assert("decl type should be UNION", node->type->ty == UNION);
     mu_assert("union should have members", node->type->members != NULL);
 
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -1336,7 +1298,6 @@ char* test_parse_bitfield_decl() {
     mu_assert("second width should be 5",
               node->type->members->next->bit_width == 5);
 
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -1358,8 +1319,6 @@ char* test_parse_goto_label() {
     mu_assert("label stmt should wrap return",
               n2->lhs && n2->lhs->kind == ND_RETURN);
 
-    free_ast(n1);
-    free_ast(n2);
     free_tokens(tok);
     return NULL;
 }
@@ -1384,7 +1343,6 @@ char* test_parse_designated_initializer_array() {
                   node->init->lhs->next->next->kind == ND_NUM &&
                   node->init->lhs->next->next->val == 3);
 
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -1405,7 +1363,6 @@ char* test_parse_designated_initializer_struct() {
                                         node->init->lhs->next->kind == ND_NUM &&
                                         node->init->lhs->next->val == 5);
 
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -1422,7 +1379,6 @@ char* test_parse_long_double_decl() {
     mu_assert("initializer should be float literal",
               node->init && node->init->kind == ND_FNUM);
 
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -1440,7 +1396,6 @@ char* test_parse_scalar_compound_literal() {
               node->init->lhs && node->init->lhs->kind == ND_NUM &&
                   node->init->lhs->val == 3);
 
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -1457,7 +1412,6 @@ char* test_parse_complex_decl() {
     mu_assert("initializer should be float literal",
               node->init && node->init->kind == ND_FNUM);
 
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -1477,8 +1431,6 @@ char* test_parse_vla_decl() {
     mu_assert("a type should be pointer for runtime VLA",
               a_decl->type && a_decl->type->ty == PTR);
 
-    free_ast(n_decl);
-    free_ast(a_decl);
     free_tokens(tok);
     return NULL;
 }
@@ -1497,7 +1449,6 @@ char* test_parse_adjacent_string_literals() {
     mu_assert("concatenated content should be foobar",
               strncmp(ctx.strings[0], "foobar", 6) == 0);
 
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -1516,7 +1467,6 @@ char* test_parse_struct_compound_literal_member() {
     mu_assert("compound init should exist",
               node->init->lhs->init && node->init->lhs->init->kind == ND_INIT);
 
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -1537,7 +1487,6 @@ char* test_parse_array_compound_literal_subscript() {
                   node->init->lhs->lhs->lhs &&
                   node->init->lhs->lhs->lhs->kind == ND_COMPOUND);
 
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -1556,7 +1505,6 @@ char* test_parse_union_compound_literal_designator() {
     mu_assert("compound init should exist",
               node->init->lhs->init && node->init->lhs->init->kind == ND_INIT);
 
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -1566,7 +1514,7 @@ char* test_parse_sizeof_vla_expr_runtime() {
     Token* tok = tokenize("int n = 3; int a[n]; int x = sizeof(a);");
     ctx.current_token = tok;
 
-    Node* n_decl = parse_stmt(&ctx);
+    parse_stmt(&ctx); // int n = 3;
     Node* a_decl = parse_stmt(&ctx);
     Node* x_decl = parse_stmt(&ctx);
 
@@ -1576,9 +1524,6 @@ char* test_parse_sizeof_vla_expr_runtime() {
     mu_assert("sizeof(vla) should become runtime mul expr",
               x_decl->init->kind == ND_MUL);
 
-    free_ast(n_decl);
-    free_ast(a_decl);
-    free_ast(x_decl);
     free_tokens(tok);
     return NULL;
 }
@@ -1593,7 +1538,6 @@ char* test_parse_long_long_decl() {
     mu_assert("long long type should be LONGLONG", node->type->ty == LONGLONG);
     mu_assert("long long should not be unsigned", !node->type->is_unsigned);
 
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -1609,7 +1553,6 @@ char* test_parse_unsigned_long_long_decl() {
               node->type->ty == LONGLONG);
     mu_assert("unsigned long long should be unsigned", node->type->is_unsigned);
 
-    free_ast(node);
     free_tokens(tok);
     return NULL;
 }
@@ -1628,8 +1571,6 @@ char* test_parse_long_vs_long_long_distinct() {
     mu_assert("long long should be LONGLONG type",
               decl_ll->type->ty == LONGLONG);
 
-    free_ast(decl_long);
-    free_ast(decl_ll);
     free_tokens(tok_long);
     free_tokens(tok_ll);
     return NULL;
@@ -1639,11 +1580,11 @@ char* test_parse_long_long_promotion() {
     Context ctx = {0};
     Token* tok_l = tokenize("long a;");
     ctx.current_token = tok_l;
-    Node* decl_l = parse_stmt(&ctx);
+    parse_stmt(&ctx);
 
     Token* tok_ll = tokenize("long long b;");
     ctx.current_token = tok_ll;
-    Node* decl_ll = parse_stmt(&ctx);
+    parse_stmt(&ctx);
 
     Token* tok_add = tokenize("a + b;");
     ctx.current_token = tok_add;
@@ -1653,9 +1594,6 @@ char* test_parse_long_long_promotion() {
               node_add->type->ty == LONGLONG);
     mu_assert("result should be signed", !node_add->type->is_unsigned);
 
-    free_ast(decl_l);
-    free_ast(decl_ll);
-    free_ast(node_add);
     free_tokens(tok_l);
     free_tokens(tok_ll);
     free_tokens(tok_add);
@@ -1693,8 +1631,93 @@ char* test_parse_function_pointer_basic() {
     mu_assert("call should be indirect through expr",
               ret->lhs->rhs && ret->lhs->rhs->kind == ND_LVAR);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
+    free_tokens(head);
+    return NULL;
+}
+
+char* test_parse_function_table() {
+    Context ctx = {0};
+    Token* head = tokenize("int f(int x); int f(int x) { return x; } "
+                           "int g() { return f(1); }");
+    ctx.current_token = head;
+    parse_program(&ctx);
+
+    FuncEntry* f = find_function(&ctx, tok_sym(&head[1]));
+    mu_assert("Prototype should be the recorded declaration",
+              f && f->decl == ctx.code[0]);
+    FuncEntry* g = find_function(&ctx, tok_sym(ctx.code[2]->tok));
+    mu_assert("Definition should be recorded",
+              g && g->decl == ctx.code[2] && g->llvm_func == NULL);
+    mu_assert("Unknown names should not be found",
+              find_function(&ctx, intern("h", 1)) == NULL);
+
+    free_tokens(head);
+    return NULL;
+}
+
+char* test_parse_beyond_fixed_limits() {
+    // More declarations, strings and locals than the old fixed arrays held
+    int n = 1500;
+    char* src = malloc((size_t)n * 64 + 64);
+    mu_assert("malloc failed", src != NULL);
+    char* p = src;
+    for (int i = 0; i < n; i++)
+        p += sprintf(p, "int g%d;", i);
+    p += sprintf(p, "char* f() { char* s; ");
+    for (int i = 0; i < n; i++)
+        p += sprintf(p, "int v%d; s = \"%d\";", i, i);
+    sprintf(p, "return s; }");
+
+    Context ctx = {0};
+    Token* head = tokenize(src);
+    ctx.current_token = head;
+    parse_program(&ctx);
+    mu_assert("Every declaration should be kept",
+              ctx.node_count == n + 1 && ctx.code[n + 1] == NULL);
+    mu_assert("Every string literal should be kept",
+              ctx.string_count == n &&
+                  strncmp(ctx.strings[n - 1], "1499", 4) == 0);
+    mu_assert("Every local should get its own slot",
+              ctx.code[n]->u.locals->offset == n);
+
+    free_tokens(head);
+    free(src);
+    return NULL;
+}
+
+char* test_parse_vla_size_per_function() {
+    Context ctx = {0};
+    Token* head = tokenize("int f(int n) { int a[n]; return sizeof(a); } "
+                           "int g(int n) { int* p; return sizeof(p); }");
+    ctx.current_token = head;
+    parse_program(&ctx);
+
+    Node* ret = ctx.code[1]->lhs->next;
+    mu_assert("A VLA in an earlier function should not affect sizeof",
+              ret && ret->kind == ND_RETURN && ret->lhs->kind == ND_NUM &&
+                  ret->lhs->val == 8);
+    free_tokens(head);
+    return NULL;
+}
+
+char* test_parse_switch_case_list() {
+    Context ctx = {0};
+    Token* head = tokenize("int f(int x) { switch (x) { case 3: return 1; "
+                           "default: return 2; case 7: return 3; } }");
+    ctx.current_token = head;
+    parse_program(&ctx);
+
+    Node* sw = ctx.code[0]->lhs;
+    mu_assert("should be switch", sw && sw->kind == ND_SWITCH);
+    // Labels are listed last one first
+    Node* c = sw->u.cases;
+    mu_assert("case 7 should be listed first",
+              c && c->kind == ND_CASE && c->val == 7 && !c->is_default);
+    c = c->u.next_case;
+    mu_assert("default should be listed second", c && c->is_default);
+    c = c->u.next_case;
+    mu_assert("case 3 should be listed last",
+              c && c->val == 3 && !c->is_default && !c->u.next_case);
     free_tokens(head);
     return NULL;
 }
@@ -1711,8 +1734,6 @@ char* test_parse_static_inline() {
     mu_assert("should be function", fn->kind == ND_FUNCTION);
     mu_assert("should be inline", fn->is_inline);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     return NULL;
 }
@@ -1728,8 +1749,6 @@ char* test_parse_inline_function() {
     mu_assert("should be function", fn->kind == ND_FUNCTION);
     mu_assert("should be inline", fn->is_inline);
 
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     free_tokens(head);
     return NULL;
 }
@@ -1751,8 +1770,6 @@ char* test_parse_short_decl() {
     mu_assert("should not be unsigned", !node->type->is_unsigned);
 
     free_tokens(tok);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     return NULL;
 }
 
@@ -1772,8 +1789,6 @@ char* test_parse_const_qualifier() {
     mu_assert("type should be INT", node->type->ty == INT);
 
     free_tokens(tok);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     return NULL;
 }
 
@@ -1793,8 +1808,6 @@ char* test_parse_register_qualifier() {
     mu_assert("type should be INT", node->type->ty == INT);
 
     free_tokens(tok);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     return NULL;
 }
 
@@ -1815,8 +1828,6 @@ char* test_parse_signed_qualifier() {
     mu_assert("should not be unsigned", !node->type->is_unsigned);
 
     free_tokens(tok);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     return NULL;
 }
 
@@ -1831,8 +1842,6 @@ char* test_parse_enum_values() {
     mu_assert("should parse enum values", ctx.node_count == 0);
 
     free_tokens(tok);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     return NULL;
 }
 
@@ -1847,8 +1856,6 @@ char* test_parse_flexible_array_member() {
     mu_assert("should parse flexible array member", ctx.node_count == 0);
 
     free_tokens(tok);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     return NULL;
 }
 
@@ -1863,7 +1870,5 @@ char* test_parse_funcstr() {
     mu_assert("should have one function", ctx.node_count == 1);
 
     free_tokens(tok);
-    for (int i = 0; i < ctx.node_count; i++)
-        free_ast(ctx.code[i]);
     return NULL;
 }
@@ -67,6 +67,7 @@ char* test_expr_with_deref();
 char* test_parse_add_assign_does_not_share_lhs_node();
 char* test_global_ptr_init_not_treated_as_array();
 char* test_scope_depth_is_context_local();
+char* test_scope_shadowing();
 char* test_parse_double();
 char* test_parse_float();
 char* test_parse_do_while();
@@ -95,6 +96,10 @@ char* test_parse_long_long_promotion();
 char* test_parse_static_inline();
 char* test_parse_inline_function();
 char* test_parse_function_pointer_basic();
+char* test_parse_function_table();
+char* test_parse_beyond_fixed_limits();
+char* test_parse_vla_size_per_function();
+char* test_parse_switch_case_list();
 char* test_parse_short_decl();
 char* test_parse_const_qualifier();
 char* test_parse_register_qualifier();
@@ -0,0 +1,150 @@
+#include "pch_test.h"
+#include "../src/arena.h"
+#include "../src/lex.h"
+#include "../src/parse.h"
+#include "../src/pch.h"
+#include "../src/preprocess.h"
+#include "test_common.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static bool write_text(const char* path, const char* text) {
+    FILE* fp = fopen(path, "w");
+    if (!fp)
+        return false;
+    fputs(text, fp);
+    fclose(fp);
+    return true;
+}
+
+// Preprocess and parse src into ctx, starting from the loaded header if any
+static char* parse_source(Context* ctx, const char* src, const char* name) {
+    memset(ctx, 0, sizeof(Context));
+    arena_use(&ctx->arena);
+    char* preprocessed = preprocess(src, name);
+    restore_pch(ctx);
+    Token* tok = tokenize(preprocessed);
+    ctx->current_token = tok;
+    parse_program(ctx);
+    free_tokens(tok);
+    return preprocessed;
+}
+
+static void free_context(Context* ctx, char* preprocessed) {
+    arena_use(NULL);
+    arena_free(&ctx->arena);
+    free(preprocessed);
+}
+
+char* test_pch_round_trip() {
+    char header[] = "test_pch_h_XXXXXX";
+    int fd = mkstemp(header);
+    if (fd < 0) {
+        perror("mkstemp error");
+        return "mkstemp failed";
+    }
+    close(fd);
+    char pch[] = "test_pch_XXXXXX";
+    fd = mkstemp(pch);
+    if (fd < 0) {
+        unlink(header);
+        perror("mkstemp error");
+        return "mkstemp failed";
+    }
+    close(fd);
+
+    const char* text = "#ifndef PCH_TEST_H\n#define PCH_TEST_H\n"
+                       "#define SQUARE(x) ((x) * (x))\n"
+                       "#define LIMIT 7\n"
+                       "typedef struct Point { int x; char* name; } Point;\n"
+                       "enum Color { RED, GREEN = 5, BLUE };\n"
+                       "extern int counter;\n"
+                       "int area(Point* p, ...);\n"
+                       "#endif\n";
+    if (!write_text(header, text)) {
+        unlink(header);
+        unlink(pch);
+        return "could not write header";
+    }
+
+    // Precompile the header
+    PchBuf state;
+    memset(&state, 0, sizeof(state));
+    preprocess_save_pch(&state);
+    Context ctx;
+    char* out = parse_source(&ctx, text, header);
+    preprocess_save_pch(NULL);
+    write_pch(&ctx, &state, pch);
+    free_context(&ctx, out);
+    free(state.data);
+
+    mu_assert("Precompiled header should load", load_pch(pch));
+
+    // Macros and the include guard come back through the preprocessor
+    char deps[] = "test_pch_d_XXXXXX";
+    fd = mkstemp(deps);
+    mu_assert("mkstemp failed", fd >= 0);
+    close(fd);
+    char src[128];
+    snprintf(src, sizeof(src),
+             "#include \"%s\"\nint f() { return SQUARE(LIMIT); }\n", header);
+    preprocess_save_deps(deps, "main.ll");
+    out = parse_source(&ctx, src, "main.c");
+    preprocess_save_deps(NULL, NULL);
+    close_pch();
+
+    char rule[4096];
+    FILE* fp = fopen(deps, "r");
+    mu_assert("Dependency file should be written", fp != NULL);
+    size_t len = fread(rule, 1, sizeof(rule) - 1, fp);
+    rule[len] = '\0';
+    fclose(fp);
+    unlink(deps);
+    char pch_dep[64];
+    snprintf(pch_dep, sizeof(pch_dep), "main.ll: main.c \\\n  %s \\\n", pch);
+    mu_assert("Rule should list the precompiled header after the source",
+              strncmp(rule, pch_dep, strlen(pch_dep)) == 0);
+    mu_assert("Rule should list the headers it was built from",
+              strstr(rule + strlen(pch_dep), header) != NULL);
+    mu_assert("Saved macros should expand",
+              strstr(out, "((7) * (7))") != NULL);
+    mu_assert("Saved include guard should skip the header",
+              strstr(out, "typedef") == NULL);
+
+    Typedef* td = ctx.typedefs;
+    mu_assert("Typedef should be restored",
+              td && td->len == 5 && memcmp(td->name, "Point", 5) == 0);
+    Member* m = td->type->members;
+    mu_assert("Struct members should be restored",
+              td->type->ty == STRUCT && m && m->len == 1 &&
+                  m->type->ty == INT && m->next && m->next->type->ty == PTR &&
+                  m->next->type->ptr_to->ty == CHAR && !m->next->next);
+    mu_assert("Struct tag should share the typedef's type",
+              ctx.struct_tags && ctx.struct_tags->type == td->type);
+    int green = -1;
+    for (EnumConst* ec = ctx.enum_consts; ec; ec = ec->next) {
+        if (ec->len == 5 && memcmp(ec->name, "GREEN", 5) == 0)
+            green = ec->val;
+    }
+    mu_assert("Enum constants should be restored", green == 5);
+    mu_assert("Declarations should precede the translation unit",
+              ctx.node_count == 3 && ctx.code[0]->kind == ND_GVAR &&
+                  ctx.code[0]->is_extern && ctx.code[1]->is_vararg &&
+                  ctx.code[2]->lhs != NULL);
+    Node* param = ctx.code[1]->rhs;
+    mu_assert("Prototype parameters should be restored",
+              param && param->type->ty == PTR &&
+                  param->type->ptr_to == td->type && !param->next);
+    free_context(&ctx, out);
+
+    // Any change to an input header invalidates the precompiled one
+    write_text(header, "#define LIMIT 8\n");
+    mu_assert("Stale precompiled header should be rejected", !load_pch(pch));
+    mu_assert("Invalid precompiled header should be rejected",
+              !load_pch(header));
+
+    unlink(header);
+    unlink(pch);
+    return NULL;
+}
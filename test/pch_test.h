@@ -0,0 +1,7 @@
+#ifndef __PCH_TEST_H__
+#define __PCH_TEST_H__
+
+// Test functions
+char* test_pch_round_trip();
+
+#endif
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 char* test_preprocess_noop() {
     const char* input = "int main() { return 0; }";
@@ -131,6 +132,74 @@ char* test_preprocess_if_elif_expr() {
     return NULL;
 }
 
+char* test_preprocess_if_full_expressions() {
+    const char* input = "#define A 4\n#define B 0\n#define C\n"
+                        "#define SQ(x) ((x) * (x))\n"
+                        "#if A >= 3 && (B || defined C)\nint a = 1;\n#endif\n"
+                        "#if SQ(A) == 16 && 'a' == 97\nint b = 1;\n#endif\n"
+                        "#if -1 < 0u\nint c = 0;\n#else\nint c = 1;\n#endif\n"
+                        "#if (2 + 3) * 4 == 20 && -7 / 2 == -3\nint d = 1;\n"
+                        "#endif\n"
+                        "#if UNDEFINED || 0 ? 0 : (1 << 4 == 16)\nint e = 1;\n"
+                        "#endif\n"
+                        "#if A > 5 || defined(UNDEFINED)\nint f = 0;\n"
+                        "#elif A == 4\nint f = 1;\n#endif\n";
+    char* output = preprocess(input, "expr.c");
+    mu_assert("&&, || and defined should combine",
+              strstr(output, "int a = 1;") != NULL);
+    mu_assert("Function-like macros and character constants should evaluate",
+              strstr(output, "int b = 1;") != NULL);
+    mu_assert("-1 should convert to unsigned against 0u",
+              strstr(output, "int c = 1;") != NULL);
+    mu_assert("Arithmetic should follow C precedence",
+              strstr(output, "int d = 1;") != NULL);
+    mu_assert("Undefined identifiers should be 0",
+              strstr(output, "int e = 1;") != NULL);
+    mu_assert("#elif should evaluate full expressions",
+              strstr(output, "int f = 1;") != NULL &&
+                  strstr(output, "int f = 0;") == NULL);
+    free(output);
+    return NULL;
+}
+
+char* test_preprocess_if_short_circuit() {
+    // Division by zero is only an error where the value is used, and the
+    // conditions of groups that cannot be taken are not evaluated at all
+    const char* input = "#if 0 && 1 / 0\n#elif 1 || 1 / 0\nint a = 1;\n"
+                        "#elif 1 / 0\n#endif\n"
+                        "#if 0\n#if 1 / 0\n#elif 1 / 0\n#endif\n"
+                        "#ifdef X\n#elif 1\nint b = 0;\n#endif\n#endif\n";
+    char* output = preprocess(input, "short.c");
+    mu_assert("Short-circuited operands should not be evaluated",
+              strstr(output, "int a = 1;") != NULL);
+    mu_assert("Nothing inside an inactive group should be taken",
+              strstr(output, "int b = 0;") == NULL);
+    free(output);
+    return NULL;
+}
+
+char* test_preprocess_skip_inactive_groups() {
+    const char* input = "#if 0\n"
+                        "a # b\n"
+                        "  #  if 1\n#elif 1\n#else\n  #endif\n"
+                        "#ifdef X\n#endif\n"
+                        "#elif 1\n"
+                        "int a = __LINE__;\n"
+                        "#else\n"
+                        "#if 1\nint b = 0;\n#endif\n"
+                        "#endif\n"
+                        "int c = __LINE__;\n";
+    char* output = preprocess(input, "skip.c");
+    mu_assert("Nested groups should not end the skipped group",
+              strstr(output, "int a = 10;") != NULL);
+    mu_assert("Groups after the taken branch should be skipped",
+              strstr(output, "int b") == NULL);
+    mu_assert("Line numbers should count skipped lines",
+              strstr(output, "int c = 16;") != NULL);
+    free(output);
+    return NULL;
+}
+
 char* test_preprocess_function_macro_and_undef() {
     const char* input = "#define ADD(x,y) ((x)+(y))\n"
                         "int z = ADD(2, 3);\n"
@@ -188,14 +257,69 @@ char* test_preprocess_recursive_macro_expansion() {
     return NULL;
 }
 
+char* test_preprocess_nested_function_macros() {
+    const char* input = "#define ONE 1\n"
+                        "#define G(a) [a]\n"
+                        "#define F(a) G(a) + G(ONE)\n"
+                        "int x = F(F(ONE));\n";
+    char* output = preprocess(input, "nested.c");
+    mu_assert("function macros in a replacement should be rescanned",
+              strstr(output, "int x = [[1] + [1]] + [1];") != NULL);
+    free(output);
+    return NULL;
+}
+
+char* test_preprocess_self_reference() {
+    const char* input = "#define f(x) x + f(x)\n"
+                        "#define g f\n"
+                        "int y = f(2); int z = g(g(1));\n";
+    char* output = preprocess(input, "self.c");
+    mu_assert("a macro should not expand inside its own expansion",
+              strstr(output, "int y = 2 + f(2);") != NULL);
+    mu_assert("argument expanded before substitution",
+              strstr(output, "int z = 1 + f(1) + f(1 + f(1));") != NULL);
+    free(output);
+    return NULL;
+}
+
+char* test_preprocess_paste_and_stringize_operands() {
+    const char* input = "#define ONE 1\n"
+                        "#define CAT(a, b) a##b\n"
+                        "#define XCAT(a, b) CAT(a, b)\n"
+                        "#define STR(x) #x\n"
+                        "#define XSTR(x) STR(x)\n"
+                        "CAT(ONE, 2) XCAT(ONE, 2) CAT(, z) STR(ONE) XSTR(ONE)\n";
+    char* output = preprocess(input, "paste.c");
+    mu_assert("operands of ## and # should not be expanded",
+              strstr(output, "ONE2 12 z \"ONE\" \"1\"") != NULL);
+    free(output);
+    return NULL;
+}
+
+char* test_preprocess_expansion_spacing() {
+    const char* input = "#define V /* note */ 7\n"
+                        "#define NEG -1\n"
+                        "#define E\n"
+                        "#define x1F oops\n"
+                        "int v = V; int n = -NEG; int e = 0x1F+E 1;\n";
+    char* output = preprocess(input, "space.c");
+    mu_assert("comments in a macro value should not be copied",
+              strstr(output, "int v = 7;") != NULL);
+    mu_assert("tokens from an expansion should not merge with neighbours",
+              strstr(output, "int n = - -1;") != NULL);
+    mu_assert("a number suffix is not a name; empty expansion leaves the rest",
+              strstr(output, "int e = 0x1F+ 1;") != NULL);
+    free(output);
+    return NULL;
+}
+
 char* test_preprocess_variadic_macro_basic() {
     const char* input = "#define DEBUG(fmt, ...) fmt, __VA_ARGS__\n"
                         "int x = DEBUG(1, 2, 3);\n";
     char* output = preprocess(input, "var.c");
-    // Note: variadic args preserve original spacing from parse_macro_args
-    // which trims spaces, so "2, 3" becomes "2,3"
+    // The variadic arguments keep their spacing
     mu_assert("variadic macro should expand __VA_ARGS__",
-              strstr(output, "int x = 1, 2,3;") != NULL);
+              strstr(output, "int x = 1, 2, 3;") != NULL);
     free(output);
     return NULL;
 }
@@ -216,10 +340,8 @@ char* test_preprocess_variadic_macro_in_stringify() {
     const char* input = "#define PRINT(fmt, ...) printf(fmt, __VA_ARGS__)\n"
                         "PRINT(\"%d %d\", a, b);\n";
     char* output = preprocess(input, "var3.c");
-    // Note: variadic args preserve original spacing from parse_macro_args
-    // which trims spaces, so "a, b" becomes "a,b"
     mu_assert("variadic macro with printf-style call should expand",
-              strstr(output, "printf(\"%d %d\", a,b);") != NULL);
+              strstr(output, "printf(\"%d %d\", a, b);") != NULL);
     free(output);
     return NULL;
 }
@@ -230,7 +352,7 @@ char* test_preprocess_variadic_macro_zero_fixed_params() {
                         "int x = VA_ONLY(a, b, c);\n";
     char* output = preprocess(input, "var4.c");
     mu_assert("variadic-only macro should expand all args",
-              strstr(output, "int x = a,b,c;") != NULL);
+              strstr(output, "int x = a, b, c;") != NULL);
     free(output);
     return NULL;
 }
@@ -241,7 +363,7 @@ char* test_preprocess_variadic_macro_stringify_va_args() {
                         "const char* s = TOSTR(fmt, 1, 2);\n";
     char* output = preprocess(input, "var5.c");
     mu_assert("stringify of __VA_ARGS__ should produce quoted string",
-              strstr(output, "const char* s = \"1,2\";") != NULL);
+              strstr(output, "const char* s = \"1, 2\";") != NULL);
     free(output);
     return NULL;
 }
@@ -260,6 +382,28 @@ char* test_preprocess_variadic_macro_gnu_comma_suppression() {
     return NULL;
 }
 
+char* test_preprocess_invocation_across_lines() {
+    const char* input = "#define ADD(a, b) ((a) + (b))\n"
+                        "#define TWICE(x) (x * 2)\n"
+                        "int x = ADD(1,\n"
+                        "            2);\n"
+                        "int y = TWICE\n"
+                        "    (3);\n"
+                        "int TWICE;\n"
+                        "int z = __LINE__;\n";
+    char* output = preprocess(input, "lines.c");
+    mu_assert("arguments should be read past the end of the line",
+              strstr(output, "int x = ((1) + (2));\n") != NULL);
+    mu_assert("'(' on the next line should start the arguments",
+              strstr(output, "int y = (3 * 2);\n") != NULL);
+    mu_assert("a name not followed by '(' should be left alone",
+              strstr(output, "int TWICE;\n") != NULL);
+    mu_assert("joined lines should keep the line count",
+              strstr(output, "int z = 8;\n") != NULL);
+    free(output);
+    return NULL;
+}
+
 char* test_preprocess_stdc_version() {
     const char* input = "long v = __STDC_VERSION__;\n";
     char* output = preprocess(input, "test.c");
@@ -310,6 +454,15 @@ char* test_preprocess_line_macro() {
     return NULL;
 }
 
+char* test_preprocess_line_after_include() {
+    const char* input = "#include \"guard.h\"\nint a = __LINE__;\n";
+    char* output = preprocess(input, "main.c");
+    mu_assert("__LINE__ should resume counting after an include",
+              strstr(output, "int a = 2;") != NULL);
+    free(output);
+    return NULL;
+}
+
 char* test_preprocess_line_in_if_directive() {
     const char* input = "#if __LINE__ == 1\nint x = 1;\n#endif\n";
     char* output = preprocess(input, "test.c");
@@ -339,3 +492,151 @@ char* test_preprocess_file_not_expand_in_string() {
     free(output);
     return NULL;
 }
+
+char* test_preprocess_many_macros() {
+    // Enough macros to grow the table several times, then undefine every
+    // other one so lookups have to probe past the deleted slots.
+    size_t cap = 1 << 20;
+    char* input = malloc(cap);
+    size_t len = 0;
+    for (int i = 0; i < 10000; i++)
+        len += (size_t)snprintf(input + len, cap - len, "#define M%d %d\n", i,
+                                i);
+    for (int i = 0; i < 10000; i += 2)
+        len += (size_t)snprintf(input + len, cap - len, "#undef M%d\n", i);
+    len += (size_t)snprintf(input + len, cap - len,
+                            "#define M9998 redefined\n"
+                            "int a = M0; int b = M1; int c = M9997;\n"
+                            "int d = M9998; int e = M5000; int f = M4999;\n");
+    char* output = preprocess(input, "test.c");
+    mu_assert("Undefined macro should stay unexpanded",
+              strstr(output, "int a = M0;") != NULL);
+    mu_assert("M1 should expand", strstr(output, "int b = 1;") != NULL);
+    mu_assert("M9997 should expand", strstr(output, "int c = 9997;") != NULL);
+    mu_assert("Redefined macro should expand to new value",
+              strstr(output, "int d = redefined;") != NULL);
+    mu_assert("M5000 should stay unexpanded",
+              strstr(output, "int e = M5000;") != NULL);
+    mu_assert("M4999 should expand", strstr(output, "int f = 4999;") != NULL);
+    free(output);
+    free(input);
+    return NULL;
+}
+
+static int count_occurrences(const char* haystack, const char* needle) {
+    int n = 0;
+    for (const char* p = strstr(haystack, needle); p;
+         p = strstr(p + 1, needle))
+        n++;
+    return n;
+}
+
+char* test_preprocess_include_guard() {
+    const char* input = "#include \"guard.h\"\n#include \"guard.h\"\n"
+                        "#include \"../test/guard.h\"\n"
+                        "#undef GUARD_H\n#include \"guard.h\"\n";
+    char* output = preprocess(input, "main.c");
+    mu_assert("Guarded header should be expanded again only after #undef",
+              count_occurrences(output, "int guarded_val = 1;") == 2);
+    free(output);
+
+    input = "#include \"unguarded.h\"\n#include \"unguarded.h\"\n";
+    output = preprocess(input, "main.c");
+    mu_assert("Text after the #endif should be included every time",
+              count_occurrences(output, "int unguarded_val = 3;") == 2);
+    free(output);
+    return NULL;
+}
+
+char* test_preprocess_pragma_once() {
+    const char* input = "#include \"once.h\"\n#include \"once.h\"\n"
+                        "#include \"./once.h\"\n";
+    char* output = preprocess(input, "main.c");
+    mu_assert("#pragma once header should be included once",
+              count_occurrences(output, "int once_val = 2;") == 1);
+    free(output);
+    return NULL;
+}
+
+char* test_preprocess_include_dirs() {
+    // Added out of order: -I directories are still searched first
+    add_include_dir("sysdir/", true);
+    add_include_dir("incdir", false);
+    const char* input = "#include <which.h>\n#include <sub/nested.h>\n"
+                        "#include \"sys_only.h\"\n#include <sub>\n";
+    char* output = preprocess(input, "main.c");
+    clear_include_dirs();
+
+    mu_assert("-I directory should win over -isystem",
+              strstr(output, "int which_val = 1;") != NULL &&
+                  strstr(output, "int which_val = 2;") == NULL);
+    mu_assert("Subdirectory include should resolve",
+              strstr(output, "int sub_val = 3;") != NULL);
+    mu_assert("Quoted include should fall back to the search path",
+              strstr(output, "int sys_only_val = 4;") != NULL);
+    mu_assert("A directory of the same name should not stop the search",
+              strstr(output, "int sub_file_val = 5;") != NULL);
+    free(output);
+    return NULL;
+}
+
+char* test_preprocess_to_file_line_markers() {
+    FILE* fp = tmpfile();
+    mu_assert("tmpfile failed", fp != NULL);
+    const char* input = "#include \"guard.h\"\n#define N 4\n"
+                        "#if 0\nskipped\n#endif\nint a = N;\n"
+                        "#if 0\n1\n2\n3\n4\n5\n6\n7\n8\n9\n10\n#endif\n"
+                        "int b = __LINE__;\n";
+    preprocess_to_file(input, "main.c", fp);
+
+    char output[1024];
+    rewind(fp);
+    size_t len = fread(output, 1, sizeof(output) - 1, fp);
+    output[len] = '\0';
+    fclose(fp);
+
+    mu_assert("Output should start with a marker for the main file",
+              strncmp(output, "# 1 \"main.c\"\n", 13) == 0);
+    mu_assert("Entering a header should be marked",
+              strstr(output, "guard.h\" 1\n") != NULL);
+    mu_assert("Returning from a header should be marked",
+              strstr(output, "int guarded_val = 1;\n# 2 \"main.c\" 2\n") !=
+                  NULL);
+    mu_assert("Short gaps should be padded with blank lines",
+              strstr(output, "2\n\n\n\n\nint a = 4;\n") != NULL);
+    mu_assert("Long gaps should get a marker",
+              strstr(output, "# 19 \"main.c\"\nint b = 19;\n") != NULL);
+    return NULL;
+}
+
+char* test_preprocess_dependency_file() {
+    char path[] = "test_deps_XXXXXX";
+    int fd = mkstemp(path);
+    mu_assert("mkstemp failed", fd >= 0);
+    close(fd);
+    const char* input = "#include \"guard.h\"\n#include \"once.h\"\n"
+                        "#include \"guard.h\"\n";
+    preprocess_save_deps(path, "out dir/main.ll");
+    char* output = preprocess(input, "main.c");
+    preprocess_save_deps(NULL, NULL);
+    free(output);
+
+    char rule[4096];
+    FILE* fp = fopen(path, "r");
+    mu_assert("Dependency file should be written", fp != NULL);
+    size_t len = fread(rule, 1, sizeof(rule) - 1, fp);
+    rule[len] = '\0';
+    fclose(fp);
+    unlink(path);
+
+    mu_assert("Rule should name the escaped target and the source",
+              strncmp(rule, "out\\ dir/main.ll: main.c \\\n", 27) == 0);
+    const char* guard = strstr(rule, "/guard.h \\\n");
+    const char* once = strstr(rule, "/once.h\n");
+    mu_assert("Headers should be listed once, in inclusion order",
+              guard && once && guard < once &&
+                  count_occurrences(rule, "/guard.h") == 2);
+    mu_assert("Every header should get an empty rule",
+              strstr(rule, "/guard.h:\n") && strstr(rule, "/once.h:\n"));
+    return NULL;
+}
@@ -10,24 +10,39 @@ char* test_preprocess_no_expand_in_literals_or_comments();
 char* test_preprocess_macro_scope_is_per_call();
 char* test_preprocess_long_define_value();
 char* test_preprocess_if_elif_expr();
+char* test_preprocess_if_full_expressions();
+char* test_preprocess_if_short_circuit();
+char* test_preprocess_skip_inactive_groups();
 char* test_preprocess_function_macro_and_undef();
 char* test_preprocess_pragma_ignored();
 char* test_preprocess_stringification();
 char* test_preprocess_token_pasting();
 char* test_preprocess_recursive_macro_expansion();
+char* test_preprocess_nested_function_macros();
+char* test_preprocess_self_reference();
+char* test_preprocess_paste_and_stringize_operands();
+char* test_preprocess_expansion_spacing();
 char* test_preprocess_variadic_macro_basic();
 char* test_preprocess_variadic_macro_single_arg();
 char* test_preprocess_variadic_macro_in_stringify();
 char* test_preprocess_variadic_macro_zero_fixed_params();
 char* test_preprocess_variadic_macro_stringify_va_args();
 char* test_preprocess_variadic_macro_gnu_comma_suppression();
+char* test_preprocess_invocation_across_lines();
 char* test_preprocess_stdc_version();
 char* test_preprocess_file_macro();
 char* test_preprocess_date_macro();
 char* test_preprocess_time_macro();
 char* test_preprocess_line_macro();
+char* test_preprocess_line_after_include();
 char* test_preprocess_line_in_if_directive();
 char* test_preprocess_line_via_define();
 char* test_preprocess_file_not_expand_in_string();
+char* test_preprocess_many_macros();
+char* test_preprocess_include_guard();
+char* test_preprocess_pragma_once();
+char* test_preprocess_include_dirs();
+char* test_preprocess_to_file_line_markers();
+char* test_preprocess_dependency_file();
 
 #endif
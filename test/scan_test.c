@@ -0,0 +1,70 @@
+#include "scan_test.h"
+#include "../src/scan.h"
+#include "test_common.h"
+#include <string.h>
+
+char* test_scan_skip_space() {
+    const char* s = " \t\r\n\v\fx ";
+    mu_assert("should stop at first non-space", *scan_skip_space(s) == 'x');
+    mu_assert("should stop at terminator", *scan_skip_space("   ") == '\0');
+    return NULL;
+}
+
+char* test_scan_line_end() {
+    const char* s = "abc\ndef";
+    const char* end = s + strlen(s);
+    mu_assert("should find newline", scan_line_end(s, end) == s + 3);
+    mu_assert("should return end without newline",
+              scan_line_end(s + 4, end) == end);
+    mu_assert("should respect range", scan_line_end(s, s + 2) == s + 2);
+    return NULL;
+}
+
+char* test_scan_comment_end() {
+    const char* s = "a * b ** / c */ d";
+    const char* end = s + strlen(s);
+    mu_assert("should find comment terminator",
+              scan_comment_end(s, end) == strstr(s, "*/"));
+    mu_assert("should not find terminator outside range",
+              scan_comment_end(s, s + 13) == NULL);
+    const char* t = "abc*";
+    mu_assert("should handle trailing star", scan_comment_end(t, t + 4) == NULL);
+    return NULL;
+}
+
+char* test_scan_next_directive() {
+    const char* s = "int a; // #x\nb # c\n  \t# if X\n#endif\n";
+    const char* end = s + strlen(s);
+    int lines = 0;
+    const char* d = scan_next_directive(s, end, &lines);
+    mu_assert("should skip '#' after other text", d == strstr(s, "  \t#"));
+    mu_assert("should count the lines passed", lines == 2);
+    d = scan_next_directive(strchr(d, '\n') + 1, end, &lines);
+    mu_assert("should match at the start of the range",
+              d == strstr(s, "#endif") && lines == 2);
+
+    // Longer than one search window
+    char big[10000];
+    memset(big, '\n', sizeof(big));
+    memcpy(big + sizeof(big) - 3, "#x\n", 3);
+    lines = 0;
+    d = scan_next_directive(big, big + sizeof(big), &lines);
+    mu_assert("should find a directive past the first window",
+              d == big + sizeof(big) - 3 && lines == (int)sizeof(big) - 3);
+    lines = 0;
+    mu_assert("should return end without a directive",
+              scan_next_directive(big, big + 100, &lines) == big + 100 &&
+                  lines == 100);
+    return NULL;
+}
+
+char* test_scan_string_stop() {
+    const char* s = "abc\\\"def\"";
+    mu_assert("should stop at backslash", scan_string_stop(s, '"') == s + 3);
+    mu_assert("should stop at quote", scan_string_stop(s + 5, '"') == s + 8);
+    mu_assert("should ignore other quote kind",
+              *scan_string_stop("a'b\"", '"') == '"');
+    mu_assert("should stop at newline",
+              *scan_string_stop("ab\ncd'", '\'') == '\n');
+    return NULL;
+}
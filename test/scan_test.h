@@ -0,0 +1,10 @@
+#ifndef __SCAN_TEST_H__
+#define __SCAN_TEST_H__
+
+char* test_scan_skip_space();
+char* test_scan_line_end();
+char* test_scan_comment_end();
+char* test_scan_next_directive();
+char* test_scan_string_stop();
+
+#endif
@@ -0,0 +1 @@
+int sys_only_val = 4;
@@ -0,0 +1,94 @@
+#include "type_test.h"
+#include "../src/lex.h"
+#include "../src/parse.h"
+#include "../src/type.h"
+#include "test_common.h"
+#include <string.h>
+
+char* test_type_builtins_shared() {
+    mu_assert("int should be a single type", new_type_int() == new_type_int());
+    mu_assert("char should be a single type",
+              new_type_char() == new_type_char());
+    Type* u = qualify_type(new_type_int(), true, false, false);
+    mu_assert("unsigned int should be a variant of its own",
+              u != new_type_int() && u->ty == INT && u->is_unsigned);
+    mu_assert("unsigned int should be shared",
+              u == builtin_type(INT, true, false));
+    mu_assert("int should stay signed", !new_type_int()->is_unsigned);
+    return NULL;
+}
+
+char* test_type_derived_shared() {
+    Type* p = new_type_ptr(new_type_char());
+    mu_assert("char* should be shared", p == new_type_ptr(new_type_char()));
+    mu_assert("char** should be shared",
+              new_type_ptr(p) == new_type_ptr(new_type_ptr(new_type_char())));
+    Type* a = new_type_array(new_type_int(), 4);
+    mu_assert("int[4] should be shared",
+              a == new_type_array(new_type_int(), 4));
+    mu_assert("int[5] should differ from int[4]",
+              new_type_array(new_type_int(), 5) != a);
+    mu_assert("int[] should not be shared",
+              new_type_array(new_type_int(), 0) !=
+                  new_type_array(new_type_int(), 0));
+    Type* r = qualify_type(p, false, true, false);
+    mu_assert("restrict char* should not change char*",
+              r != p && r->is_restrict && !p->is_restrict);
+    return NULL;
+}
+
+char* test_type_qualifiers_not_shared() {
+    Context ctx = {0};
+    Token* head = tokenize("typedef unsigned int u32; volatile u32 a; u32 b; "
+                           "int c[] = {1, 2, 3}; int* d = {0}; int e[3];");
+    ctx.current_token = head;
+    parse_program(&ctx);
+
+    mu_assert("should have five globals", ctx.node_count == 5);
+    Type* a = ctx.code[0]->type;
+    Type* b = ctx.code[1]->type;
+    mu_assert("volatile should apply to a", a->is_volatile && a->is_unsigned);
+    mu_assert("volatile should not leak into the typedef",
+              !b->is_volatile && b->is_unsigned);
+    mu_assert("int[] should be sized by its initializer",
+              ctx.code[2]->type->array_size == 3);
+    mu_assert("a braced scalar should not turn int* into an array",
+              ctx.code[3]->type->array_size == 0 &&
+                  new_type_ptr(new_type_int())->array_size == 0);
+    mu_assert("int[3] should not be affected by int[]",
+              ctx.code[4]->type->array_size == 3);
+    free_tokens(head);
+    return NULL;
+}
+
+char* test_type_struct_layout() {
+    Context ctx = {0};
+    Token* head = tokenize(
+        "struct S { char c; int a[3]; short s; double d; }; "
+        "union U { char c[5]; int i; }; "
+        "int f() { return sizeof(struct S) + sizeof(union U) * 100; }");
+    ctx.current_token = head;
+    parse_program(&ctx);
+
+    Type* s = NULL;
+    for (StructTag* tag = ctx.struct_tags; tag; tag = tag->next) {
+        if (tag->len == 1 && tag->name[0] == 'S')
+            s = tag->type;
+    }
+    mu_assert("struct S should be declared", s != NULL);
+    Member* m = s->members;
+    mu_assert("members should be at their aligned offsets",
+              m->offset == 0 && m->next->offset == 4 &&
+                  m->next->next->offset == 16 &&
+                  m->next->next->next->offset == 24);
+    mu_assert("struct S should be 32 bytes aligned to 8",
+              type_size(s) == 32 && type_align(s) == 8 && s->has_layout);
+
+    Node* ret = ctx.code[ctx.node_count - 1]->lhs;
+    mu_assert("sizeof should use the layout",
+              ret && ret->kind == ND_RETURN && ret->lhs->kind == ND_ADD &&
+                  ret->lhs->lhs->val == 32 &&
+                  ret->lhs->rhs->lhs->val == 8);
+    free_tokens(head);
+    return NULL;
+}
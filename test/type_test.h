@@ -0,0 +1,9 @@
+#ifndef __TYPE_TEST_H__
+#define __TYPE_TEST_H__
+
+char* test_type_builtins_shared();
+char* test_type_derived_shared();
+char* test_type_qualifiers_not_shared();
+char* test_type_struct_layout();
+
+#endif